@@ -126,6 +126,7 @@ typedef NS_ENUM(NSInteger, SNTEventLogType) {
   SNTEventLogTypeProtobuf,
   SNTEventLogTypeJSON,
   SNTEventLogTypeNull,
+  SNTEventLogTypeSocket,
 };
 
 // The return status of a sync.
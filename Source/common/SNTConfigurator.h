@@ -188,6 +188,8 @@
 ///      format. Use spoolDirectory to specify a path. Use spoolDirectoryFileSizeThresholdKB,
 ///      spoolDirectorySizeThresholdMB and spoolDirectoryEventMaxFlushTimeSec to configure
 ///      additional settings.
+///    SNTEventLogTypeSocket "socket": (BETA) Streamed as length-delimited protobuf records to a
+///      local consumer listening on the Unix domain socket at eventLogSocketPath.
 ///    Defaults to SNTEventLogTypeFilelog.
 ///    For mobileconfigs use EventLogType as the key and syslog or filelog strings as the value.
 ///
@@ -202,6 +204,16 @@
 ///
 @property(readonly, nonatomic) NSString *eventLogTypeRaw;
 
+///
+///  Event log types, as for eventLogType, that events are written to as well as eventLogType. Each
+///  is written independently, so one falling behind doesn't hold up the others. Types that would
+///  write to the same place as an earlier one, such as filelog and json, are ignored.
+///  Defaults to none.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) NSArray<NSNumber *> *eventLogAdditionalTypes;
+
 ///
 ///  If eventLogType is set to Filelog, eventLogPath will provide the path to save logs.
 ///  Defaults to /var/db/santa/santa.log.
@@ -246,6 +258,77 @@
 ///
 @property(readonly, nonatomic) float spoolDirectoryEventMaxFlushTimeSec;
 
+///
+///  If eventLogType is set to protobuf and spoolDirectoryUseSegments is set, event batches are
+///  appended to rolling segment files in spoolDirectory rather than each being written to its own
+///  file. Defaults to NO.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) BOOL spoolDirectoryUseSegments;
+
+///
+///  If eventLogType is set to protobuf and spoolDirectoryCompressBatches is set, event batches are
+///  compressed before being written to spoolDirectory. `santactl printlog` reads both compressed
+///  and uncompressed batches. Defaults to NO.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) BOOL spoolDirectoryCompressBatches;
+
+///
+///  If eventLogType is set to protobuf and spoolDirectoryChecksumRecords is set, each event in a
+///  batch is written with a checksum, so that readers can skip damaged events rather than losing
+///  the whole batch. Takes precedence over spoolDirectoryCompressBatches. Defaults to NO.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) BOOL spoolDirectoryChecksumRecords;
+
+///
+///  If eventLogType is set to filelog, json or protobuf and eventLogUseWriterThread is set, events
+///  are handed to the log writer in batches by a dedicated thread, instead of one at a time.
+///  Defaults to NO.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) BOOL eventLogUseWriterThread;
+
+///
+///  If eventLogType is set to filelog or json and eventLogRotationSizeMB is set, santad rotates
+///  the file at eventLogPath once it reaches this size, instead of relying on newsyslog. Rotated
+///  files are compressed. Defaults to 0, which disables rotation by size.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) NSUInteger eventLogRotationSizeMB;
+
+///
+///  If eventLogType is set to filelog or json and eventLogRotationIntervalSec is set, santad
+///  rotates the file at eventLogPath once it is this old. Defaults to 0, which disables rotation by
+///  age.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) NSUInteger eventLogRotationIntervalSec;
+
+///
+///  The number of files rotated by santad to keep next to eventLogPath. Older ones are deleted.
+///  0 keeps them all. Defaults to 10.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) NSUInteger eventLogRotationRetainCount;
+
+///
+///  If eventLogType is set to socket, the path of the SOCK_STREAM Unix domain socket that events
+///  are streamed to. Events the consumer can't keep up with go to spoolDirectory. Defaults to
+///  /var/db/santa/events.sock.
+///
+///  @note: This property is KVO compliant, but should only be read once at santad startup.
+///
+@property(readonly, nonatomic) NSString *eventLogSocketPath;
+
 ///
 ///  If set, contains the filesystem access policy configuration.
 ///
@@ -672,6 +755,21 @@
 ///
 @property(readonly, nonatomic) NSArray<NSString *> *enabledProcessAnnotations;
 
+///
+/// Number of executables covered by the "lineage" process annotation, counting
+/// the process itself. Returns 0 when unset, in which case the annotator's own
+/// default applies.
+/// This property is not KVO compliant.
+///
+@property(readonly, nonatomic) NSUInteger processAnnotationLineageDepth;
+
+///
+/// Maximum number of processes tracked by the process tree. Returns 0 when
+/// unset, in which case the tree's own default applies.
+/// This property is not KVO compliant.
+///
+@property(readonly, nonatomic) NSUInteger processTreeMaxProcesses;
+
 ///
 ///  Retrieve an initialized singleton configurator object using the default file path.
 ///
@@ -115,11 +115,20 @@ static NSString *const kFileChangesRegexKey = @"FileChangesRegex";
 static NSString *const kFileChangesPrefixFiltersKey = @"FileChangesPrefixFilters";
 
 static NSString *const kEventLogType = @"EventLogType";
+static NSString *const kEventLogAdditionalTypes = @"EventLogAdditionalTypes";
 static NSString *const kEventLogPath = @"EventLogPath";
 static NSString *const kSpoolDirectory = @"SpoolDirectory";
 static NSString *const kSpoolDirectoryFileSizeThresholdKB = @"SpoolDirectoryFileSizeThresholdKB";
 static NSString *const kSpoolDirectorySizeThresholdMB = @"SpoolDirectorySizeThresholdMB";
 static NSString *const kSpoolDirectoryEventMaxFlushTimeSec = @"SpoolDirectoryEventMaxFlushTimeSec";
+static NSString *const kSpoolDirectoryUseSegments = @"SpoolDirectoryUseSegments";
+static NSString *const kSpoolDirectoryCompressBatches = @"SpoolDirectoryCompressBatches";
+static NSString *const kSpoolDirectoryChecksumRecords = @"SpoolDirectoryChecksumRecords";
+static NSString *const kEventLogUseWriterThread = @"EventLogUseWriterThread";
+static NSString *const kEventLogRotationSizeMB = @"EventLogRotationSizeMB";
+static NSString *const kEventLogRotationIntervalSec = @"EventLogRotationIntervalSec";
+static NSString *const kEventLogRotationRetainCount = @"EventLogRotationRetainCount";
+static NSString *const kEventLogSocketPath = @"EventLogSocketPath";
 
 static NSString *const kFileAccessPolicy = @"FileAccessPolicy";
 static NSString *const kFileAccessPolicyPlist = @"FileAccessPolicyPlist";
@@ -150,6 +159,8 @@ static NSString *const kMetricExportTimeout = @"MetricExportTimeout";
 static NSString *const kMetricExtraLabels = @"MetricExtraLabels";
 
 static NSString *const kEnabledProcessAnnotations = @"EnabledProcessAnnotations";
+static NSString *const kProcessAnnotationLineageDepth = @"ProcessAnnotationLineageDepth";
+static NSString *const kProcessTreeMaxProcesses = @"ProcessTreeMaxProcesses";
 
 // The keys managed by a sync server or mobileconfig.
 static NSString *const kClientModeKey = @"ClientMode";
@@ -255,11 +266,20 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
       kMachineIDPlistFileKey : string,
       kMachineIDPlistKeyKey : string,
       kEventLogType : string,
+      kEventLogAdditionalTypes : array,
       kEventLogPath : string,
       kSpoolDirectory : string,
       kSpoolDirectoryFileSizeThresholdKB : number,
       kSpoolDirectorySizeThresholdMB : number,
       kSpoolDirectoryEventMaxFlushTimeSec : number,
+      kSpoolDirectoryUseSegments : number,
+      kSpoolDirectoryCompressBatches : number,
+      kSpoolDirectoryChecksumRecords : number,
+      kEventLogUseWriterThread : number,
+      kEventLogRotationSizeMB : number,
+      kEventLogRotationIntervalSec : number,
+      kEventLogRotationRetainCount : number,
+      kEventLogSocketPath : string,
       kFileAccessPolicy : dictionary,
       kFileAccessPolicyPlist : string,
       kFileAccessBlockMessage : string,
@@ -282,6 +302,8 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
       kEntitlementsPrefixFilterKey : array,
       kEntitlementsTeamIDFilterKey : array,
       kEnabledProcessAnnotations : array,
+      kProcessAnnotationLineageDepth : number,
+      kProcessTreeMaxProcesses : number,
     };
 
     _syncStateFilePath = syncStateFilePath;
@@ -484,6 +506,10 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
   return [self configStateSet];
 }
 
++ (NSSet *)keyPathsForValuesAffectingEventLogAdditionalTypes {
+  return [self configStateSet];
+}
+
 + (NSSet *)keyPathsForValuesAffectingEventLogPath {
   return [self configStateSet];
 }
@@ -504,6 +530,38 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
   return [self configStateSet];
 }
 
++ (NSSet *)keyPathsForValuesAffectingSpoolDirectoryUseSegments {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingSpoolDirectoryCompressBatches {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingSpoolDirectoryChecksumRecords {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingEventLogUseWriterThread {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingEventLogRotationSizeMB {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingEventLogRotationIntervalSec {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingEventLogRotationRetainCount {
+  return [self configStateSet];
+}
+
++ (NSSet *)keyPathsForValuesAffectingEventLogSocketPath {
+  return [self configStateSet];
+}
+
 + (NSSet *)keyPathsForValuesAffectingFileAccessPolicy {
   return [self configStateSet];
 }
@@ -912,8 +970,8 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
   return machineId.length ? machineId : [SNTSystemInfo hardwareUUID];
 }
 
-- (SNTEventLogType)eventLogType {
-  NSString *logType = [self.configState[kEventLogType] lowercaseString];
+static SNTEventLogType EventLogTypeFromString(NSString *rawLogType) {
+  NSString *logType = [rawLogType lowercaseString];
   if ([logType isEqualToString:@"protobuf"]) {
     return SNTEventLogTypeProtobuf;
   } else if ([logType isEqualToString:@"syslog"]) {
@@ -924,11 +982,27 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
     return SNTEventLogTypeJSON;
   } else if ([logType isEqualToString:@"file"]) {
     return SNTEventLogTypeFilelog;
+  } else if ([logType isEqualToString:@"socket"]) {
+    return SNTEventLogTypeSocket;
   } else {
     return SNTEventLogTypeFilelog;
   }
 }
 
+- (SNTEventLogType)eventLogType {
+  return EventLogTypeFromString(self.configState[kEventLogType]);
+}
+
+- (NSArray<NSNumber *> *)eventLogAdditionalTypes {
+  NSMutableArray<NSNumber *> *logTypes = [NSMutableArray array];
+  for (id logType in self.configState[kEventLogAdditionalTypes]) {
+    if ([logType isKindOfClass:[NSString class]]) {
+      [logTypes addObject:@(EventLogTypeFromString(logType))];
+    }
+  }
+  return logTypes;
+}
+
 - (NSString *)eventLogTypeRaw {
   return self.configState[kEventLogType] ?: @"file";
 }
@@ -959,6 +1033,40 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
            : 15.0;
 }
 
+- (BOOL)spoolDirectoryUseSegments {
+  return [self.configState[kSpoolDirectoryUseSegments] boolValue];
+}
+
+- (BOOL)spoolDirectoryCompressBatches {
+  return [self.configState[kSpoolDirectoryCompressBatches] boolValue];
+}
+
+- (BOOL)spoolDirectoryChecksumRecords {
+  return [self.configState[kSpoolDirectoryChecksumRecords] boolValue];
+}
+
+- (BOOL)eventLogUseWriterThread {
+  return [self.configState[kEventLogUseWriterThread] boolValue];
+}
+
+- (NSUInteger)eventLogRotationSizeMB {
+  return [self.configState[kEventLogRotationSizeMB] unsignedIntegerValue];
+}
+
+- (NSUInteger)eventLogRotationIntervalSec {
+  return [self.configState[kEventLogRotationIntervalSec] unsignedIntegerValue];
+}
+
+- (NSUInteger)eventLogRotationRetainCount {
+  return self.configState[kEventLogRotationRetainCount]
+           ? [self.configState[kEventLogRotationRetainCount] unsignedIntegerValue]
+           : 10;
+}
+
+- (NSString *)eventLogSocketPath {
+  return self.configState[kEventLogSocketPath] ?: @"/var/db/santa/events.sock";
+}
+
 - (NSDictionary *)fileAccessPolicy {
   return self.configState[kFileAccessPolicy];
 }
@@ -1145,6 +1253,16 @@ static NSString *const kSyncTypeRequired = @"SyncTypeRequired";
   return annotations;
 }
 
+// Returns 0 when unset, leaving the default to LineageAnnotator.
+- (NSUInteger)processAnnotationLineageDepth {
+  return [self.configState[kProcessAnnotationLineageDepth] unsignedIntegerValue];
+}
+
+// Returns 0 when unset, leaving the default to ProcessTree.
+- (NSUInteger)processTreeMaxProcesses {
+  return [self.configState[kProcessTreeMaxProcesses] unsignedIntegerValue];
+}
+
 #pragma mark Private
 
 ///
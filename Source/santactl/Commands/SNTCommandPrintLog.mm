@@ -16,14 +16,22 @@
 #include <google/protobuf/json/json.h>
 #include <stdlib.h>
 
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "Source/common/SNTLogging.h"
 #include "Source/common/santa_proto_include_wrapper.h"
 #import "Source/santactl/SNTCommand.h"
 #import "Source/santactl/SNTCommandController.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/binaryproto_proto_include_wrapper.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_codec.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "google/protobuf/any.pb.h"
 
 using JsonPrintOptions = google::protobuf::json::PrintOptions;
@@ -31,6 +39,39 @@ using google::protobuf::json::MessageToJsonString;
 using santa::fsspool::binaryproto::LogBatch;
 namespace pbv1 = ::santa::pb::v1;
 
+// Decodes a spooled LogBatch read from path and appends its messages to santaMsgs. Returns false
+// if the batch couldn't be decoded at all.
+static bool AppendBatch(const std::string &contents, NSString *path,
+                        std::vector<::pbv1::SantaMessage> *santaMsgs) {
+  // Batches may have been compressed or framed by the spool writer. Damaged records of framed
+  // batches are skipped, and the rest printed.
+  size_t damagedRecords = 0;
+  absl::StatusOr<std::string> batch = ::fsspool::DecodeBatch(contents, &damagedRecords);
+  if (!batch.ok()) {
+    LOGE(@"Failed to decode '%@': %s", path, batch.status().ToString().c_str());
+    return false;
+  }
+  if (damagedRecords > 0) {
+    LOGW(@"Skipped %zu damaged record(s) in '%@'", damagedRecords, path);
+  }
+
+  LogBatch logBatch;
+  if (!logBatch.ParseFromString(*batch)) {
+    LOGE(@"Failed to parse '%@'", path);
+    return false;
+  }
+
+  for (const google::protobuf::Any &any : logBatch.records()) {
+    ::pbv1::SantaMessage santaMsg;
+    if (!any.UnpackTo(&santaMsg)) {
+      LOGE(@"Failed to unpack Any proto to SantaMessage in file '%@'", path);
+      break;
+    }
+    santaMsgs->push_back(std::move(santaMsg));
+  }
+  return true;
+}
+
 @interface SNTCommandPrintLog : SNTCommand <SNTCommandProtocol>
 @end
 
@@ -52,7 +93,8 @@ REGISTER_COMMAND_NAME(@"printlog")
 
 + (NSString *)longHelpText {
   return @"Prints the contents of serialized Santa protobuf logs as JSON.\n"
-         @"Multiple paths can be provided. The output is a list of all the \n"
+         @"Multiple paths can be provided. A directory is read as a spool written with\n"
+         @"SpoolDirectoryUseSegments. The output is a list of all the \n"
          @"SantaMessage entries per-file. E.g.: \n"
          @"  [\n"
          @"    [\n"
@@ -73,19 +115,39 @@ REGISTER_COMMAND_NAME(@"printlog")
 
   for (int argIdx = 0; argIdx < [arguments count]; argIdx++) {
     NSString *path = arguments[argIdx];
-    int fd = open([path UTF8String], O_RDONLY);
-    if (fd == -1) {
-      LOGE(@"Failed to open '%@': errno: %d: %s", path, errno, strerror(errno));
-      continue;
-    }
-
-    LogBatch logBatch;
-    bool ret = logBatch.ParseFromFileDescriptor(fd);
-    close(fd);
-
-    if (!ret) {
-      LOGE(@"Failed to parse '%@'", path);
-      continue;
+    std::vector<::pbv1::SantaMessage> santaMsgs;
+
+    BOOL isDir = NO;
+    if ([[NSFileManager defaultManager] fileExistsAtPath:path isDirectory:&isDir] && isDir) {
+      // A spool directory written with SpoolDirectoryUseSegments. Records are read from the
+      // consumer's last checkpoint, and nothing is checkpointed, so printing consumes none of them.
+      ::fsspool::FsSpoolSegmentReader reader([path UTF8String]);
+      while (true) {
+        absl::StatusOr<std::string> contents = reader.NextMessage();
+        if (contents.ok()) {
+          AppendBatch(*contents, path, &santaMsgs);
+        } else if (absl::IsDataLoss(contents.status())) {
+          LOGW(@"Skipped damaged segment record in '%@': %s", path,
+               contents.status().ToString().c_str());
+        } else {
+          if (!absl::IsNotFound(contents.status())) {
+            LOGE(@"Failed to read segments in '%@': %s", path,
+                 contents.status().ToString().c_str());
+          }
+          break;
+        }
+      }
+    } else {
+      std::ifstream in([path UTF8String], std::ios::binary);
+      if (!in) {
+        LOGE(@"Failed to open '%@': errno: %d: %s", path, errno, strerror(errno));
+        continue;
+      }
+      std::string contents((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+      if (!AppendBatch(contents, path, &santaMsgs)) {
+        continue;
+      }
     }
 
     if (argIdx != 0) {
@@ -96,22 +158,13 @@ REGISTER_COMMAND_NAME(@"printlog")
     }
     std::cout << "\n[\n";
 
-    int numRecords = logBatch.records_size();
-
-    for (int i = 0; i < numRecords; i++) {
-      const google::protobuf::Any &any = logBatch.records(i);
-      ::pbv1::SantaMessage santaMsg;
-      if (!any.UnpackTo(&santaMsg)) {
-        LOGE(@"Failed to unpack Any proto to SantaMessage in file '%@'", path);
-        break;
-      }
-
+    for (size_t i = 0; i < santaMsgs.size(); i++) {
       if (i != 0) {
         std::cout << ",\n";
       }
 
       std::string json;
-      if (!MessageToJsonString(santaMsg, &json, options).ok()) {
+      if (!MessageToJsonString(santaMsgs[i], &json, options).ok()) {
         LOGE(@"Unable to convert message to JSON in file: '%@'", path);
       }
       std::cout << json;
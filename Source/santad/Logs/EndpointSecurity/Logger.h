@@ -17,6 +17,7 @@
 
 #include <memory>
 #include <string_view>
+#include <vector>
 
 #import <Foundation/Foundation.h>
 
@@ -38,15 +39,37 @@ namespace santa {
 
 class Logger {
  public:
+  // Events are written to each of additional_log_types as well as log_type. Types which would
+  // write to the same destination as an earlier one are ignored.
   static std::unique_ptr<Logger> Create(std::shared_ptr<santa::EndpointSecurityAPI> esapi,
                                         SNTEventLogType log_type, SNTDecisionCache *decision_cache,
                                         NSString *event_log_path, NSString *spool_log_path,
                                         size_t spool_dir_size_threshold,
                                         size_t spool_file_size_threshold,
-                                        uint64_t spool_flush_timeout_ms);
+                                        uint64_t spool_flush_timeout_ms,
+                                        bool spool_use_segments = false,
+                                        bool spool_compress_batches = false,
+                                        bool spool_checksum_records = false,
+                                        bool use_writer_thread = false,
+                                        size_t event_log_rotate_size_bytes = 0,
+                                        uint64_t event_log_rotate_age_sec = 0,
+                                        size_t event_log_retain_count = 0,
+                                        const std::vector<SNTEventLogType> &additional_log_types =
+                                          {},
+                                        NSString *event_log_socket_path = nil);
+
+  // A serializer and the writer its output is handed to.
+  struct Sink {
+    std::shared_ptr<santa::Serializer> serializer;
+    std::shared_ptr<santa::Writer> writer;
+  };
 
   Logger(std::shared_ptr<santa::Serializer> serializer, std::shared_ptr<santa::Writer> writer);
 
+  // With more than one sink, each writer is fed from its own queue so that a slow writer can't
+  // hold up the others, and sinks sharing a serializer share its output. See santa::FanOut.
+  explicit Logger(std::vector<Sink> sinks);
+
   virtual ~Logger() = default;
 
   virtual void Log(std::unique_ptr<santa::EnrichedMessage> msg);
@@ -68,8 +91,7 @@ class Logger {
   friend class santa::LoggerPeer;
 
  private:
-  std::shared_ptr<santa::Serializer> serializer_;
-  std::shared_ptr<santa::Writer> writer_;
+  std::vector<Sink> sinks_;
 };
 
 }  // namespace santa
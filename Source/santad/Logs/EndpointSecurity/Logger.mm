@@ -14,6 +14,8 @@
 
 #include "Source/santad/Logs/EndpointSecurity/Logger.h"
 
+#include <algorithm>
+
 #import "Source/common/SNTCommonEnums.h"
 #include "Source/common/SNTLogging.h"
 #include "Source/common/SNTStoredEvent.h"
@@ -21,10 +23,12 @@
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Empty.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Protobuf.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Serializer.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FanOut.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/File.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Null.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Spool.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Syslog.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/UnixSocket.h"
 #include "Source/santad/SNTDecisionCache.h"
 
 using santa::BasicString;
@@ -32,12 +36,15 @@ using santa::Empty;
 using santa::EndpointSecurityAPI;
 using santa::EnrichedMessage;
 using santa::EnrichedProcess;
+using santa::EnrichedType;
+using santa::FanOut;
 using santa::File;
 using santa::Message;
 using santa::Null;
 using santa::Protobuf;
 using santa::Spool;
 using santa::Syslog;
+using santa::UnixSocket;
 
 namespace santa {
 
@@ -47,75 +54,214 @@ static const uint64_t kFlushBufferTimeoutMS = 10000;
 static const size_t kBufferBatchSizeBytes = (1024 * 128);
 // Reserve an extra 4kb of buffer space to account for event overflow
 static const size_t kMaxExpectedWriteSizeBytes = 4096;
+// Retry connecting to the event log socket every second
+static const uint64_t kSocketReconnectIntervalMS = 1000;
+// Buffer up to 4mb for the event log socket before spilling
+static const size_t kSocketMaxBufferedBytes = (1024 * 1024 * 4);
+
+// Executions and file access decisions are what matter most when events must be
+// dropped. File closes, forks and exits are the most frequent events, and the
+// least costly to lose.
+static Writer::Priority PriorityOfMessage(const EnrichedType &msg) {
+  if (std::holds_alternative<EnrichedExec>(msg)) {
+    return Writer::Priority::kHigh;
+  }
+  if (std::holds_alternative<EnrichedClose>(msg) || std::holds_alternative<EnrichedFork>(msg) ||
+      std::holds_alternative<EnrichedExit>(msg)) {
+    return Writer::Priority::kLow;
+  }
+  return Writer::Priority::kNormal;
+}
 
-// Translate configured log type to appropriate Serializer/Writer pairs
+// Where events of the given type are written, or nil if they aren't.
+static NSString *LogDestination(SNTEventLogType log_type) {
+  switch (log_type) {
+    case SNTEventLogTypeFilelog:
+    case SNTEventLogTypeJSON: return @"file";
+    case SNTEventLogTypeSyslog: return @"syslog";
+    case SNTEventLogTypeProtobuf: return @"spool";
+    case SNTEventLogTypeSocket: return @"socket";
+    default: return nil;
+  }
+}
+
+// Translate configured log types to appropriate Serializer/Writer pairs
 std::unique_ptr<Logger> Logger::Create(std::shared_ptr<EndpointSecurityAPI> esapi,
                                        SNTEventLogType log_type, SNTDecisionCache *decision_cache,
                                        NSString *event_log_path, NSString *spool_log_path,
                                        size_t spool_dir_size_threshold,
                                        size_t spool_file_size_threshold,
-                                       uint64_t spool_flush_timeout_ms) {
-  switch (log_type) {
-    case SNTEventLogTypeFilelog:
-      return std::make_unique<Logger>(
-        BasicString::Create(esapi, std::move(decision_cache)),
-        File::Create(event_log_path, kFlushBufferTimeoutMS, kBufferBatchSizeBytes,
-                     kMaxExpectedWriteSizeBytes));
-    case SNTEventLogTypeSyslog:
-      return std::make_unique<Logger>(BasicString::Create(esapi, std::move(decision_cache), false),
-                                      Syslog::Create());
-    case SNTEventLogTypeNull: return std::make_unique<Logger>(Empty::Create(), Null::Create());
-    case SNTEventLogTypeProtobuf:
-      LOGW(@"The EventLogType value protobuf is currently in beta. The protobuf schema is subject "
-           @"to change.");
-      return std::make_unique<Logger>(
-        Protobuf::Create(esapi, std::move(decision_cache)),
-        Spool::Create([spool_log_path UTF8String], spool_dir_size_threshold,
-                      spool_file_size_threshold, spool_flush_timeout_ms));
-    case SNTEventLogTypeJSON:
-      return std::make_unique<Logger>(
-        Protobuf::Create(esapi, std::move(decision_cache), true),
-        File::Create(event_log_path, kFlushBufferTimeoutMS, kBufferBatchSizeBytes,
-                     kMaxExpectedWriteSizeBytes));
-    default: LOGE(@"Invalid log type: %ld", log_type); return nullptr;
+                                       uint64_t spool_flush_timeout_ms,
+                                       bool spool_use_segments, bool spool_compress_batches,
+                                       bool spool_checksum_records, bool use_writer_thread,
+                                       size_t event_log_rotate_size_bytes,
+                                       uint64_t event_log_rotate_age_sec,
+                                       size_t event_log_retain_count,
+                                       const std::vector<SNTEventLogType> &additional_log_types,
+                                       NSString *event_log_socket_path) {
+  std::vector<SNTEventLogType> log_types = {log_type};
+  log_types.insert(log_types.end(), additional_log_types.begin(), additional_log_types.end());
+  bool logs_to_spool = std::find(log_types.begin(), log_types.end(), SNTEventLogTypeProtobuf) !=
+                       log_types.end();
+
+  // The spool and the socket carry the same records, so they share a serializer. Each event is
+  // then only serialized once for both.
+  std::shared_ptr<santa::Serializer> protobuf_serializer;
+  auto get_protobuf_serializer = [&]() {
+    if (!protobuf_serializer) {
+      protobuf_serializer = Protobuf::Create(esapi, decision_cache);
+    }
+    return protobuf_serializer;
+  };
+
+  std::vector<Sink> sinks;
+  NSMutableSet<NSString *> *destinations = [NSMutableSet set];
+  for (SNTEventLogType type : log_types) {
+    NSString *destination = LogDestination(type);
+    if (destination && [destinations containsObject:destination]) {
+      LOGW(@"Ignoring event log type %ld, which writes to the same place as another", type);
+      continue;
+    }
+
+    switch (type) {
+      case SNTEventLogTypeFilelog:
+        sinks.push_back({BasicString::Create(esapi, decision_cache),
+                         File::Create(event_log_path, kFlushBufferTimeoutMS, kBufferBatchSizeBytes,
+                                      kMaxExpectedWriteSizeBytes, use_writer_thread,
+                                      event_log_rotate_size_bytes, event_log_rotate_age_sec,
+                                      event_log_retain_count)});
+        break;
+      case SNTEventLogTypeSyslog:
+        sinks.push_back({BasicString::Create(esapi, decision_cache, false), Syslog::Create()});
+        break;
+      case SNTEventLogTypeNull:
+        // Only log nothing if nothing else is logged.
+        break;
+      case SNTEventLogTypeProtobuf:
+        LOGW(@"The EventLogType value protobuf is currently in beta. The protobuf schema is "
+             @"subject to change.");
+        sinks.push_back(
+          {get_protobuf_serializer(),
+           Spool::Create([spool_log_path UTF8String], spool_dir_size_threshold,
+                         spool_file_size_threshold, spool_flush_timeout_ms, spool_use_segments,
+                         spool_compress_batches, spool_checksum_records, use_writer_thread)});
+        break;
+      case SNTEventLogTypeSocket: {
+        LOGW(@"The EventLogType value socket is currently in beta. The protobuf schema is "
+             @"subject to change.");
+        // Records the consumer can't keep up with are spooled, unless the spool is already
+        // getting every record.
+        std::shared_ptr<santa::Writer> spill_writer;
+        if (!logs_to_spool) {
+          spill_writer =
+            Spool::Create([spool_log_path UTF8String], spool_dir_size_threshold,
+                          spool_file_size_threshold, spool_flush_timeout_ms, spool_use_segments,
+                          spool_compress_batches, spool_checksum_records, use_writer_thread);
+        }
+        sinks.push_back({get_protobuf_serializer(),
+                         UnixSocket::Create(event_log_socket_path, kSocketReconnectIntervalMS,
+                                            kSocketMaxBufferedBytes, std::move(spill_writer))});
+        break;
+      }
+      case SNTEventLogTypeJSON:
+        sinks.push_back({Protobuf::Create(esapi, decision_cache, true),
+                         File::Create(event_log_path, kFlushBufferTimeoutMS, kBufferBatchSizeBytes,
+                                      kMaxExpectedWriteSizeBytes, use_writer_thread,
+                                      event_log_rotate_size_bytes, event_log_rotate_age_sec,
+                                      event_log_retain_count)});
+        break;
+      default: LOGE(@"Invalid log type: %ld", type); return nullptr;
+    }
+
+    if (destination) {
+      [destinations addObject:destination];
+    }
+  }
+
+  if (sinks.empty()) {
+    return std::make_unique<Logger>(Empty::Create(), Null::Create());
   }
+  return std::make_unique<Logger>(std::move(sinks));
 }
 
 Logger::Logger(std::shared_ptr<santa::Serializer> serializer, std::shared_ptr<santa::Writer> writer)
-    : serializer_(std::move(serializer)), writer_(std::move(writer)) {}
+    : sinks_({{std::move(serializer), std::move(writer)}}) {}
+
+Logger::Logger(std::vector<Sink> sinks) {
+  if (sinks.size() == 1) {
+    sinks_ = std::move(sinks);
+    return;
+  }
+
+  // Group the writers of each serializer behind a FanOut, which gives each writer its own queue.
+  for (Sink &sink : sinks) {
+    auto it = std::find_if(sinks_.begin(), sinks_.end(), [&sink](const Sink &s) {
+      return s.serializer == sink.serializer;
+    });
+    if (it == sinks_.end()) {
+      sinks_.push_back({sink.serializer, nullptr});
+    }
+  }
+  for (Sink &grouped : sinks_) {
+    std::vector<std::shared_ptr<Writer>> writers;
+    for (Sink &sink : sinks) {
+      if (sink.serializer == grouped.serializer) {
+        writers.push_back(std::move(sink.writer));
+      }
+    }
+    grouped.writer = FanOut::Create(std::move(writers));
+  }
+}
 
 void Logger::Log(std::unique_ptr<EnrichedMessage> msg) {
-  writer_->Write(serializer_->SerializeMessage(std::move(msg)));
+  Writer::Priority priority = PriorityOfMessage(msg->GetEnrichedMessage());
+  for (const Sink &sink : sinks_) {
+    sink.writer->WritePrioritized(sink.serializer->SerializeMessage(*msg), priority);
+  }
 }
 
 void Logger::LogAllowlist(const Message &msg, const std::string_view hash) {
-  writer_->Write(serializer_->SerializeAllowlist(msg, hash));
+  for (const Sink &sink : sinks_) {
+    sink.writer->Write(sink.serializer->SerializeAllowlist(msg, hash));
+  }
 }
 
 void Logger::LogBundleHashingEvents(NSArray<SNTStoredEvent *> *events) {
   for (SNTStoredEvent *se in events) {
-    writer_->Write(serializer_->SerializeBundleHashingEvent(se));
+    for (const Sink &sink : sinks_) {
+      sink.writer->Write(sink.serializer->SerializeBundleHashingEvent(se));
+    }
   }
 }
 
 void Logger::LogDiskAppeared(NSDictionary *props) {
-  writer_->Write(serializer_->SerializeDiskAppeared(props));
+  for (const Sink &sink : sinks_) {
+    sink.writer->Write(sink.serializer->SerializeDiskAppeared(props));
+  }
 }
 
 void Logger::LogDiskDisappeared(NSDictionary *props) {
-  writer_->Write(serializer_->SerializeDiskDisappeared(props));
+  for (const Sink &sink : sinks_) {
+    sink.writer->Write(sink.serializer->SerializeDiskDisappeared(props));
+  }
 }
 
 void Logger::LogFileAccess(const std::string &policy_version, const std::string &policy_name,
                            const santa::Message &msg,
                            const santa::EnrichedProcess &enriched_process,
                            const std::string &target, FileAccessPolicyDecision decision) {
-  writer_->Write(serializer_->SerializeFileAccess(policy_version, policy_name, msg,
-                                                  enriched_process, target, decision));
+  for (const Sink &sink : sinks_) {
+    sink.writer->WritePrioritized(
+      sink.serializer->SerializeFileAccess(policy_version, policy_name, msg, enriched_process,
+                                           target, decision),
+      Writer::Priority::kHigh);
+  }
 }
 
 void Logger::Flush() {
-  writer_->Flush();
+  for (const Sink &sink : sinks_) {
+    sink.writer->Flush();
+  }
 }
 
 }  // namespace santa
@@ -33,10 +33,12 @@
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Empty.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Protobuf.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Serializer.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FanOut.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/File.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Null.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Spool.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Syslog.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/UnixSocket.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
 
 using santa::BasicString;
@@ -45,6 +47,7 @@ using santa::EnrichedClose;
 using santa::EnrichedFile;
 using santa::EnrichedMessage;
 using santa::EnrichedProcess;
+using santa::FanOut;
 using santa::File;
 using santa::Logger;
 using santa::Message;
@@ -52,6 +55,7 @@ using santa::Null;
 using santa::Protobuf;
 using santa::Spool;
 using santa::Syslog;
+using santa::UnixSocket;
 
 namespace santa {
 
@@ -60,11 +64,13 @@ class LoggerPeer : public Logger {
   // Make base class constructors visible
   using Logger::Logger;
 
-  LoggerPeer(std::unique_ptr<Logger> l) : Logger(l->serializer_, l->writer_) {}
+  LoggerPeer(std::unique_ptr<Logger> l) : Logger(std::vector<Sink>{}) { sinks_ = l->sinks_; }
 
-  std::shared_ptr<santa::Serializer> Serializer() { return serializer_; }
+  std::shared_ptr<santa::Serializer> Serializer() { return sinks_[0].serializer; }
 
-  std::shared_ptr<santa::Writer> Writer() { return writer_; }
+  std::shared_ptr<santa::Writer> Writer() { return sinks_[0].writer; }
+
+  const std::vector<Sink> &Sinks() { return sinks_; }
 };
 
 }  // namespace santa
@@ -128,6 +134,67 @@ class MockWriter : public Null {
     Logger::Create(mockESApi, SNTEventLogTypeJSON, nil, @"/tmp/temppy", @"/tmp/spool", 1, 1, 1));
   XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<Protobuf>(logger.Serializer()));
   XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<File>(logger.Writer()));
+
+  // Additional log types each get their own sink, unless they'd write to the same place as another
+  logger = LoggerPeer(Logger::Create(mockESApi, SNTEventLogTypeProtobuf, nil, @"/tmp/temppy",
+                                     @"/tmp/spool", 1, 1, 1, false, false, false, false, 0, 0, 0,
+                                     {SNTEventLogTypeJSON, SNTEventLogTypeFilelog}));
+  XCTAssertEqual(logger.Sinks().size(), 2);
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<Protobuf>(logger.Sinks()[0].serializer));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<Protobuf>(logger.Sinks()[1].serializer));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<FanOut>(logger.Sinks()[0].writer));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<FanOut>(logger.Sinks()[1].writer));
+
+  logger = LoggerPeer(Logger::Create(mockESApi, SNTEventLogTypeSocket, nil, @"/tmp/temppy",
+                                     @"/tmp/spool", 1, 1, 1, false, false, false, false, 0, 0, 0,
+                                     {}, @"/tmp/events.sock"));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<Protobuf>(logger.Serializer()));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<UnixSocket>(logger.Writer()));
+
+  // The spool and the socket share a serializer, so events are only serialized once for both
+  logger = LoggerPeer(Logger::Create(mockESApi, SNTEventLogTypeProtobuf, nil, @"/tmp/temppy",
+                                     @"/tmp/spool", 1, 1, 1, false, false, false, false, 0, 0, 0,
+                                     {SNTEventLogTypeSocket}, @"/tmp/events.sock"));
+  XCTAssertEqual(logger.Sinks().size(), 1);
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<Protobuf>(logger.Serializer()));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<FanOut>(logger.Writer()));
+}
+
+- (void)testLogToSinks {
+  auto sharedSerializer = std::make_shared<MockSerializer>();
+  auto otherSerializer = std::make_shared<MockSerializer>();
+  auto firstWriter = std::make_shared<MockWriter>();
+  auto secondWriter = std::make_shared<MockWriter>();
+  auto otherWriter = std::make_shared<MockWriter>();
+
+  LoggerPeer logger(std::vector<Logger::Sink>{
+    {sharedSerializer, firstWriter},
+    {otherSerializer, otherWriter},
+    {sharedSerializer, secondWriter},
+  });
+
+  // Writers sharing a serializer are grouped behind a single FanOut
+  XCTAssertEqual(logger.Sinks().size(), 2);
+  XCTAssertEqual(logger.Sinks()[0].serializer, sharedSerializer);
+  XCTAssertEqual(logger.Sinks()[1].serializer, otherSerializer);
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<FanOut>(logger.Sinks()[0].writer));
+  XCTAssertNotEqual(nullptr, std::dynamic_pointer_cast<FanOut>(logger.Sinks()[1].writer));
+
+  // Each serializer is only used once per event, and every writer gets its output
+  EXPECT_CALL(*sharedSerializer, SerializeDiskAppeared).Times(1);
+  EXPECT_CALL(*otherSerializer, SerializeDiskAppeared).Times(1);
+  EXPECT_CALL(*firstWriter, Write).Times(1);
+  EXPECT_CALL(*secondWriter, Write).Times(1);
+  EXPECT_CALL(*otherWriter, Write).Times(1);
+
+  logger.LogDiskAppeared(@{@"key" : @"value"});
+  logger.Flush();
+
+  XCTBubbleMockVerifyAndClearExpectations(sharedSerializer.get());
+  XCTBubbleMockVerifyAndClearExpectations(otherSerializer.get());
+  XCTBubbleMockVerifyAndClearExpectations(firstWriter.get());
+  XCTBubbleMockVerifyAndClearExpectations(secondWriter.get());
+  XCTBubbleMockVerifyAndClearExpectations(otherWriter.get());
 }
 
 - (void)testLog {
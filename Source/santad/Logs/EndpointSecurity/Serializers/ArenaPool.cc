@@ -0,0 +1,91 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ArenaPool.h"
+
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using google::protobuf::Arena;
+using google::protobuf::ArenaOptions;
+
+namespace santa {
+
+struct ArenaPool::PooledArena {
+  static ArenaOptions Options(char *initial_block, size_t initial_block_size) {
+    ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = initial_block_size;
+    return options;
+  }
+
+  explicit PooledArena(size_t size)
+      : initial_block_size(size),
+        initial_block(new char[size]),
+        arena(Options(initial_block.get(), size)) {}
+
+  const size_t initial_block_size;
+  // The arena doesn't own the initial block, so it must be destroyed first.
+  const std::unique_ptr<char[]> initial_block;
+  Arena arena;
+};
+
+// Arenas that the current thread's leases have returned.
+static thread_local std::vector<std::unique_ptr<ArenaPool::PooledArena>>
+    idle_arenas;
+
+ArenaPool::ArenaPool(size_t initial_block_size)
+    : initial_block_size_(initial_block_size) {}
+
+ArenaPool::Lease ArenaPool::Acquire() const {
+  for (auto it = idle_arenas.rbegin(); it != idle_arenas.rend(); ++it) {
+    if ((*it)->initial_block_size == initial_block_size_) {
+      std::unique_ptr<PooledArena> arena = std::move(*it);
+      idle_arenas.erase(std::next(it).base());
+      return Lease(std::move(arena));
+    }
+  }
+
+  return Lease(std::make_unique<PooledArena>(initial_block_size_));
+}
+
+size_t ArenaPool::IdleArenasForTesting() { return idle_arenas.size(); }
+
+ArenaPool::Lease::Lease(std::unique_ptr<PooledArena> arena)
+    : arena_(std::move(arena)) {}
+
+ArenaPool::Lease::Lease(Lease &&other) = default;
+
+ArenaPool::Lease::~Lease() {
+  // Moved from
+  if (!arena_) {
+    return;
+  }
+
+  // Frees any blocks the message needed beyond the initial one, which is kept.
+  arena_->arena.Reset();
+
+  // Make room by dropping the least recently used arena, which may have been
+  // sized for a pool that is no longer in use.
+  if (idle_arenas.size() >= kMaxArenasPerThread) {
+    idle_arenas.erase(idle_arenas.begin());
+  }
+  idle_arenas.push_back(std::move(arena_));
+}
+
+Arena *ArenaPool::Lease::get() const { return &arena_->arena; }
+
+}  // namespace santa
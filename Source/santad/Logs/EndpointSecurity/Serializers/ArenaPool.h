@@ -0,0 +1,72 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_SERIALIZERS_ARENAPOOL_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_SERIALIZERS_ARENAPOOL_H
+
+#include <google/protobuf/arena.h>
+
+#include <cstddef>
+#include <memory>
+
+namespace santa {
+
+// Lends out protobuf arenas that are kept by the calling thread and Reset()
+// after each message instead of being destroyed. Every arena is given an
+// initial block that Reset() retains, so a message that fits in it costs no
+// heap allocations for the arena itself.
+class ArenaPool {
+ public:
+  // Arenas that a thread keeps for reuse. Returning another destroys the one
+  // that has been idle the longest.
+  static constexpr size_t kMaxArenasPerThread = 4;
+
+  struct PooledArena;
+
+  // An arena borrowed from the pool, reset and returned when destroyed.
+  class Lease {
+   public:
+    Lease(Lease &&other);
+    Lease &operator=(Lease &&other) = delete;
+    Lease(const Lease &other) = delete;
+    Lease &operator=(const Lease &other) = delete;
+    ~Lease();
+
+    google::protobuf::Arena *get() const;
+
+   private:
+    friend class ArenaPool;
+    explicit Lease(std::unique_ptr<PooledArena> arena);
+
+    std::unique_ptr<PooledArena> arena_;
+  };
+
+  explicit ArenaPool(size_t initial_block_size);
+
+  // Borrow an arena whose initial block is `initial_block_size` bytes. Leases
+  // may be nested, each gets its own arena.
+  Lease Acquire() const;
+
+  // Arenas kept by the calling thread that are not currently lent out.
+  static size_t IdleArenasForTesting();
+
+  size_t initial_block_size() const { return initial_block_size_; }
+
+ private:
+  size_t initial_block_size_;
+};
+
+}  // namespace santa
+
+#endif
@@ -0,0 +1,210 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+// Compares building and serializing events on a new arena per event, as the
+// Protobuf serializer used to, against arenas lent out by an ArenaPool.
+//
+// Usage: arena_pool_benchmark [corpus_dir] [iterations]
+//
+// Loads the recorded JSON events in corpus_dir (default
+// Source/santad/testdata/protobuf/v6), then copies each into an arena message
+// and serializes it, iterations (default 20000) times over the corpus. Reports
+// the arena space each event needs, then the heap allocations per event
+// and throughput for each arena strategy.
+#include <google/protobuf/arena.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "Source/common/santa_proto_include_wrapper.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ArenaPool.h"
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "google/protobuf/json/json.h"
+
+namespace {
+
+namespace pbv1 = ::santa::pb::v1;
+
+using Clock = std::chrono::steady_clock;
+using google::protobuf::Arena;
+
+size_t allocations = 0;
+
+// Corpus file name prefixes, and the SantaMessage event they hold.
+constexpr std::pair<const char *, const char *> kEventFields[] = {
+    {"allowlist", "allowlist"},
+    {"close", "close"},
+    {"cs_invalidated", "codesigning_invalidated"},
+    {"exchangedata", "exchangedata"},
+    {"exec", "execution"},
+    {"exit", "exit"},
+    {"file_access", "file_access"},
+    {"fork", "fork"},
+    {"link", "link"},
+    {"login_", "login_logout"},
+    {"lw_session_", "login_window_session"},
+    {"openssh_", "open_ssh"},
+    {"rename", "rename"},
+    {"screensharing_", "screen_sharing"},
+    {"unlink", "unlink"},
+};
+
+bool LoadEvent(const std::filesystem::path &path, pbv1::SantaMessage *msg) {
+  std::string name = path.filename().string();
+  const char *field_name = nullptr;
+  for (const auto &[prefix, field] : kEventFields) {
+    if (absl::StartsWith(name, prefix)) {
+      field_name = field;
+      break;
+    }
+  }
+  if (!field_name) {
+    fprintf(stderr, "Skipping %s: unknown event\n", name.c_str());
+    return false;
+  }
+
+  std::ifstream in(path);
+  std::string json((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+
+  const google::protobuf::FieldDescriptor *field =
+      msg->GetDescriptor()->FindFieldByName(field_name);
+  google::protobuf::Message *event =
+      msg->GetReflection()->MutableMessage(msg, field);
+  absl::Status status =
+      google::protobuf::json::JsonStringToMessage(json, event);
+  if (!status.ok()) {
+    fprintf(stderr, "Skipping %s: %s\n", name.c_str(),
+            status.ToString().c_str());
+    return false;
+  }
+
+  msg->set_machine_id("C02XXXXXXXXX");
+  msg->mutable_event_time()->set_seconds(1714000100);
+  msg->mutable_processed_time()->set_seconds(1714000100);
+  return true;
+}
+
+// Stands in for the serializer, which fills in a message field by field.
+std::vector<uint8_t> Serialize(Arena *arena, const pbv1::SantaMessage &event) {
+  pbv1::SantaMessage *msg = Arena::Create<pbv1::SantaMessage>(arena);
+  msg->CopyFrom(event);
+  std::vector<uint8_t> vec(msg->ByteSizeLong());
+  msg->SerializeWithCachedSizesToArray(vec.data());
+  return vec;
+}
+
+template <typename Serializer>
+void Run(const char *name, const std::vector<pbv1::SantaMessage> &corpus,
+         size_t iterations, Serializer serialize) {
+  size_t events = 0;
+  size_t bytes = 0;
+  size_t start_allocations = allocations;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    for (const pbv1::SantaMessage &event : corpus) {
+      bytes += serialize(event).size();
+      events++;
+    }
+  }
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("%-18s %5.2f allocs/event %6.0f ns/event %8.1f MiB/sec\n", name,
+         double(allocations - start_allocations) / events, secs * 1e9 / events,
+         bytes / secs / (1024 * 1024));
+}
+
+}  // namespace
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+int main(int argc, char *argv[]) {
+  std::filesystem::path corpus_dir = "Source/santad/testdata/protobuf/v6";
+  size_t iterations = 20000;
+  if (argc > 1) {
+    corpus_dir = argv[1];
+  }
+  if (argc > 2 && !absl::SimpleAtoi(argv[2], &iterations)) {
+    fprintf(stderr, "Usage: %s [corpus_dir] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::filesystem::path> paths;
+  std::error_code ec;
+  for (const auto &entry :
+       std::filesystem::directory_iterator(corpus_dir, ec)) {
+    if (entry.path().extension() == ".json") {
+      paths.push_back(entry.path());
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+
+  std::vector<pbv1::SantaMessage> corpus;
+  std::vector<size_t> space_used;
+  for (const std::filesystem::path &path : paths) {
+    pbv1::SantaMessage msg;
+    if (LoadEvent(path, &msg)) {
+      Arena arena;
+      Serialize(&arena, msg);
+      space_used.push_back(arena.SpaceUsed());
+      corpus.push_back(std::move(msg));
+    }
+  }
+  if (corpus.empty()) {
+    fprintf(stderr, "No events found in %s\n", corpus_dir.c_str());
+    return 1;
+  }
+
+  std::sort(space_used.begin(), space_used.end());
+  printf("%zu events, arena space used: median %zu, max %zu bytes\n",
+         corpus.size(), space_used[space_used.size() / 2], space_used.back());
+
+  Run("new arena", corpus, iterations, [](const pbv1::SantaMessage &event) {
+    Arena arena;
+    return Serialize(&arena, event);
+  });
+
+  for (size_t block_size : {1024, 2048, 4096, 8192, 16384}) {
+    santa::ArenaPool pool(block_size);
+    char name[32];
+    snprintf(name, sizeof(name), "pool, %zu block", block_size);
+    Run(name, corpus, iterations, [&pool](const pbv1::SantaMessage &event) {
+      santa::ArenaPool::Lease arena = pool.Acquire();
+      return Serialize(arena.get(), event);
+    });
+  }
+  return 0;
+}
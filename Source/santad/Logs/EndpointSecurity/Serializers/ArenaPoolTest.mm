@@ -0,0 +1,106 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#import <XCTest/XCTest.h>
+#include <google/protobuf/arena.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Source/common/santa_proto_include_wrapper.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ArenaPool.h"
+
+using google::protobuf::Arena;
+using santa::ArenaPool;
+
+namespace pbv1 = ::santa::pb::v1;
+
+@interface ArenaPoolTest : XCTestCase
+@end
+
+@implementation ArenaPoolTest
+
+- (void)testArenaIsReusedAndReset {
+  ArenaPool pool(1024);
+  Arena *first;
+  uint64_t initial_space;
+
+  {
+    ArenaPool::Lease lease = pool.Acquire();
+    first = lease.get();
+    initial_space = first->SpaceAllocated();
+
+    // Outgrow the initial block so the arena has to allocate more.
+    pbv1::SantaMessage *msg = Arena::Create<pbv1::SantaMessage>(lease.get());
+    for (int i = 0; i < 64; i++) {
+      msg->mutable_execution()->add_args(std::string(64, 'A'));
+    }
+    XCTAssertGreaterThan(first->SpaceAllocated(), initial_space);
+  }
+
+  {
+    ArenaPool::Lease lease = pool.Acquire();
+    XCTAssertEqual(lease.get(), first);
+    // Blocks beyond the initial one were freed when the arena was returned
+    XCTAssertEqual(lease.get()->SpaceAllocated(), initial_space);
+  }
+}
+
+- (void)testNestedLeases {
+  ArenaPool pool(2048);
+
+  ArenaPool::Lease outer = pool.Acquire();
+  ArenaPool::Lease inner = pool.Acquire();
+  XCTAssertNotEqual(outer.get(), inner.get());
+
+  ArenaPool::Lease moved = std::move(inner);
+  XCTAssertNotEqual(outer.get(), moved.get());
+}
+
+- (void)testIdleArenasAreBounded {
+  ArenaPool pool(3072);
+
+  {
+    std::vector<ArenaPool::Lease> leases;
+    for (size_t i = 0; i < ArenaPool::kMaxArenasPerThread + 2; i++) {
+      leases.push_back(pool.Acquire());
+    }
+  }
+
+  XCTAssertEqual(ArenaPool::IdleArenasForTesting(), ArenaPool::kMaxArenasPerThread);
+}
+
+- (void)testPoolsOnlyReuseTheirBlockSize {
+  ArenaPool small_pool(4096);
+  ArenaPool large_pool(8192);
+  Arena *small_arena;
+
+  {
+    ArenaPool::Lease lease = small_pool.Acquire();
+    small_arena = lease.get();
+  }
+
+  {
+    ArenaPool::Lease lease = large_pool.Acquire();
+    XCTAssertNotEqual(lease.get(), small_arena);
+  }
+
+  {
+    ArenaPool::Lease lease = small_pool.Acquire();
+    XCTAssertEqual(lease.get(), small_arena);
+  }
+}
+
+@end
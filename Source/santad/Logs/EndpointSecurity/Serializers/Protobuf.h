@@ -25,6 +25,7 @@
 #import "Source/common/SNTCachedDecision.h"
 #include "Source/common/santa_proto_include_wrapper.h"
 #include "Source/santad/EventProviders/EndpointSecurity/EndpointSecurityAPI.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ArenaPool.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Serializer.h"
 #import "Source/santad/SNTDecisionCache.h"
 
@@ -32,11 +33,16 @@ namespace santa {
 
 class Protobuf : public Serializer {
  public:
-  static std::shared_ptr<Protobuf> Create(std::shared_ptr<santa::EndpointSecurityAPI> esapi,
-                                          SNTDecisionCache *decision_cache, bool json = false);
+  // Fits every event in the recorded test corpus, the largest being executions
+  // at under 5KB, with room for longer args and envs.
+  static constexpr size_t kDefaultArenaInitialBlockSize = 8192;
+
+  static std::shared_ptr<Protobuf> Create(
+      std::shared_ptr<santa::EndpointSecurityAPI> esapi, SNTDecisionCache *decision_cache,
+      bool json = false, size_t arena_initial_block_size = kDefaultArenaInitialBlockSize);
 
   Protobuf(std::shared_ptr<santa::EndpointSecurityAPI> esapi, SNTDecisionCache *decision_cache,
-           bool json = false);
+           bool json = false, size_t arena_initial_block_size = kDefaultArenaInitialBlockSize);
 
   std::vector<uint8_t> SerializeMessage(const santa::EnrichedClose &) override;
   std::vector<uint8_t> SerializeMessage(const santa::EnrichedExchange &) override;
@@ -90,6 +96,8 @@ class Protobuf : public Serializer {
   // Toggle for transforming protobuf output to its JSON form.
   // See https://protobuf.dev/programming-guides/proto3/#json
   bool json_;
+  // Messages are built on arenas that are reused rather than recreated per event.
+  santa::ArenaPool arena_pool_;
 };
 
 }  // namespace santa
@@ -28,11 +28,13 @@
 #include <optional>
 #include <string_view>
 
+#include "Source/common/BranchPrediction.h"
 #import "Source/common/SNTCachedDecision.h"
 #include "Source/common/SNTLogging.h"
 #import "Source/common/SNTStoredEvent.h"
 #import "Source/common/String.h"
 #include "Source/santad/EventProviders/EndpointSecurity/EndpointSecurityAPI.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ProtobufJson.h"
 #include "Source/santad/Logs/EndpointSecurity/Serializers/Utilities.h"
 #import "Source/santad/SNTDecisionCache.h"
 #include "absl/status/status.h"
@@ -84,15 +86,22 @@ namespace santa {
 
 static constexpr NSUInteger kMaxEncodeObjectEntries = 64;
 static constexpr NSUInteger kMaxEncodeObjectLevels = 5;
+// Most events fit, so JSON output rarely needs to grow its buffer
+static constexpr size_t kExpectedJsonSizeBytes = 4096;
 
 std::shared_ptr<Protobuf> Protobuf::Create(std::shared_ptr<EndpointSecurityAPI> esapi,
-                                           SNTDecisionCache *decision_cache, bool json) {
-  return std::make_shared<Protobuf>(esapi, std::move(decision_cache), json);
+                                           SNTDecisionCache *decision_cache, bool json,
+                                           size_t arena_initial_block_size) {
+  return std::make_shared<Protobuf>(esapi, std::move(decision_cache), json,
+                                    arena_initial_block_size);
 }
 
 Protobuf::Protobuf(std::shared_ptr<EndpointSecurityAPI> esapi, SNTDecisionCache *decision_cache,
-                   bool json)
-    : Serializer(std::move(decision_cache)), esapi_(esapi), json_(json) {}
+                   bool json, size_t arena_initial_block_size)
+    : Serializer(std::move(decision_cache)),
+      esapi_(esapi),
+      json_(json),
+      arena_pool_(arena_initial_block_size) {}
 
 static inline void EncodeTimestamp(Timestamp *timestamp, struct timespec ts) {
   timestamp->set_seconds(ts.tv_sec);
@@ -438,20 +447,27 @@ static inline void EncodeCertificateInfo(::pbv1::CertificateInfo *pb_cert_info,
 
 std::vector<uint8_t> Protobuf::FinalizeProto(::pbv1::SantaMessage *santa_msg) {
   if (this->json_) {
-    // TODO: Profile this. It's probably not the most efficient way to do this.
-    JsonPrintOptions options;
-    options.always_print_enums_as_ints = false;
-    options.always_print_fields_with_no_presence = true;
-    options.preserve_proto_field_names = true;
-    std::string json;
-
-    absl::Status status = MessageToJsonString(*santa_msg, &json, options);
+    std::vector<uint8_t> vec;
+    vec.reserve(kExpectedJsonSizeBytes);
+
+    // EncodeJson writes the same output as MessageToJsonString, but only handles what Santa
+    // itself logs. Anything else, such as paths that aren't valid UTF-8, takes the slow path.
+    if (unlikely(!EncodeJson(*santa_msg, &vec))) {
+      JsonPrintOptions options;
+      options.always_print_enums_as_ints = false;
+      options.always_print_fields_with_no_presence = true;
+      options.preserve_proto_field_names = true;
+      std::string json;
+
+      absl::Status status = MessageToJsonString(*santa_msg, &json, options);
+
+      if (!status.ok()) {
+        LOGE(@"Failed to convert protobuf to JSON: %s", status.ToString().c_str());
+      }
 
-    if (!status.ok()) {
-      LOGE(@"Failed to convert protobuf to JSON: %s", status.ToString().c_str());
+      vec.assign(json.begin(), json.end());
     }
 
-    std::vector<uint8_t> vec(json.begin(), json.end());
     // Add a newline to the end of the JSON row.
     vec.push_back('\n');
     return vec;
@@ -463,8 +479,8 @@ std::vector<uint8_t> Protobuf::FinalizeProto(::pbv1::SantaMessage *santa_msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedClose &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Close *pb_close = santa_msg->mutable_close();
 
@@ -476,8 +492,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedClose &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedExchange &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Exchangedata *pb_exchangedata = santa_msg->mutable_exchangedata();
 
@@ -607,8 +623,8 @@ void EncodeEntitlements(::pbv1::Execution *pb_exec, SNTCachedDecision *cd) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedExec &msg, SNTCachedDecision *cd) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   GetDecisionEnum(cd.decision);
 
@@ -687,8 +703,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedExec &msg, SNTCach
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedExit &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Exit *pb_exit = santa_msg->mutable_exit();
 
@@ -699,8 +715,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedExit &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedFork &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Fork *pb_fork = santa_msg->mutable_fork();
 
@@ -711,8 +727,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedFork &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLink &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Link *pb_link = santa_msg->mutable_link();
   EncodeProcessInfoLight(pb_link->mutable_instigator(), msg);
@@ -724,8 +740,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLink &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedRename &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Rename *pb_rename = santa_msg->mutable_rename();
   EncodeProcessInfoLight(pb_rename->mutable_instigator(), msg);
@@ -743,8 +759,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedRename &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedUnlink &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::Unlink *pb_unlink = santa_msg->mutable_unlink();
   EncodeProcessInfoLight(pb_unlink->mutable_instigator(), msg);
@@ -754,8 +770,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedUnlink &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedCSInvalidated &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::CodesigningInvalidated *pb_cs_invalidated = santa_msg->mutable_codesigning_invalidated();
   EncodeProcessInfoLight(pb_cs_invalidated->mutable_instigator(), msg);
@@ -804,8 +820,8 @@ static inline void EncodeUserInfo(std::function<::pbv1::UserInfo *()> lazy_f,
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSessionLogin &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::LoginWindowSessionLogin *pb_lw_login =
     santa_msg->mutable_login_window_session()->mutable_login();
 
@@ -820,8 +836,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSession
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSessionLogout &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::LoginWindowSessionLogout *pb_lw_logout =
     santa_msg->mutable_login_window_session()->mutable_logout();
 
@@ -836,8 +852,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSession
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSessionLock &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::LoginWindowSessionLock *pb_lw_lock =
     santa_msg->mutable_login_window_session()->mutable_lock();
 
@@ -851,8 +867,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSession
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSessionUnlock &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::LoginWindowSessionUnlock *pb_lw_unlock =
     santa_msg->mutable_login_window_session()->mutable_unlock();
 
@@ -867,8 +883,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginWindowSession
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedScreenSharingAttach &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::ScreenSharingAttach *pb_attach = santa_msg->mutable_screen_sharing()->mutable_attach();
 
   EncodeProcessInfoLight(pb_attach->mutable_instigator(), msg);
@@ -895,8 +911,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedScreenSharingAttac
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedScreenSharingDetach &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::ScreenSharingDetach *pb_detach = santa_msg->mutable_screen_sharing()->mutable_detach();
 
   EncodeProcessInfoLight(pb_detach->mutable_instigator(), msg);
@@ -913,8 +929,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedScreenSharingDetac
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedOpenSSHLogin &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::OpenSSHLogin *pb_ssh_login = santa_msg->mutable_open_ssh()->mutable_login();
 
   EncodeProcessInfoLight(pb_ssh_login->mutable_instigator(), msg);
@@ -934,8 +950,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedOpenSSHLogin &msg)
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedOpenSSHLogout &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::OpenSSHLogout *pb_ssh_logout = santa_msg->mutable_open_ssh()->mutable_logout();
 
   EncodeProcessInfoLight(pb_ssh_logout->mutable_instigator(), msg);
@@ -950,8 +966,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedOpenSSHLogout &msg
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginLogin &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::Login *pb_login = santa_msg->mutable_login_logout()->mutable_login();
 
   EncodeProcessInfoLight(pb_login->mutable_instigator(), msg);
@@ -969,8 +985,8 @@ std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginLogin &msg) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeMessage(const EnrichedLoginLogout &msg) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
   ::pbv1::Logout *pb_logout = santa_msg->mutable_login_logout()->mutable_logout();
 
   EncodeProcessInfoLight(pb_logout->mutable_instigator(), msg);
@@ -988,8 +1004,8 @@ std::vector<uint8_t> Protobuf::SerializeFileAccess(const std::string &policy_ver
                                                    const EnrichedProcess &enriched_process,
                                                    const std::string &target,
                                                    FileAccessPolicyDecision decision) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena, msg);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get(), msg);
 
   ::pbv1::FileAccess *file_access = santa_msg->mutable_file_access();
 
@@ -1006,8 +1022,8 @@ std::vector<uint8_t> Protobuf::SerializeFileAccess(const std::string &policy_ver
 }
 
 std::vector<uint8_t> Protobuf::SerializeAllowlist(const Message &msg, const std::string_view hash) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get());
 
   const es_file_t *es_file = santa::GetAllowListTargetFile(msg);
 
@@ -1024,8 +1040,8 @@ std::vector<uint8_t> Protobuf::SerializeAllowlist(const Message &msg, const std:
 }
 
 std::vector<uint8_t> Protobuf::SerializeBundleHashingEvent(SNTStoredEvent *event) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get());
 
   ::pbv1::Bundle *pb_bundle = santa_msg->mutable_bundle();
 
@@ -1086,8 +1102,8 @@ static void EncodeDisk(::pbv1::Disk *pb_disk, ::pbv1::Disk_Action action, NSDict
 }
 
 std::vector<uint8_t> Protobuf::SerializeDiskAppeared(NSDictionary *props) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get());
 
   EncodeDisk(santa_msg->mutable_disk(), ::pbv1::Disk::ACTION_APPEARED, props);
 
@@ -1095,8 +1111,8 @@ std::vector<uint8_t> Protobuf::SerializeDiskAppeared(NSDictionary *props) {
 }
 
 std::vector<uint8_t> Protobuf::SerializeDiskDisappeared(NSDictionary *props) {
-  Arena arena;
-  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(&arena);
+  ArenaPool::Lease arena = arena_pool_.Acquire();
+  ::pbv1::SantaMessage *santa_msg = CreateDefaultProto(arena.get());
 
   EncodeDisk(santa_msg->mutable_disk(), ::pbv1::Disk::ACTION_DISAPPEARED, props);
 
@@ -0,0 +1,985 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ProtobufJson.h"
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Source/common/santa_proto_include_wrapper.h"
+#include "absl/base/optimization.h"
+#include "google/protobuf/timestamp.pb.h"
+
+namespace santa {
+
+namespace {
+
+namespace pbv1 = ::santa::pb::v1;
+namespace pbtree = ::santa::pb::v1::process_tree;
+
+// google.protobuf.Timestamp only covers 0001-01-01T00:00:00Z through
+// 9999-12-31T23:59:59.999999999Z.
+constexpr int64_t kMinTimestampSeconds = -62135596800;
+constexpr int64_t kMaxTimestampSeconds = 253402300799;
+constexpr int32_t kMaxTimestampNanos = 999999999;
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+constexpr char kBase64Digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+bool NeedsAsciiEscape(uint8_t c) {
+  return c < 0x20 || c == '"' || c == '\\' || c == '<' || c == '>' ||
+         c == 0x7f;
+}
+
+// Besides the C1 controls, MessageToJsonString escapes the format and
+// separator characters that are invisible or that JavaScript treats as line
+// breaks.
+bool NeedsUnicodeEscape(uint32_t cp) {
+  return (cp >= 0x80 && cp <= 0x9f) || cp == 0xad ||
+         (cp >= 0x600 && cp <= 0x603) || cp == 0x6dd || cp == 0x70f ||
+         cp == 0x17b4 || cp == 0x17b5 || (cp >= 0x200b && cp <= 0x200f) ||
+         (cp >= 0x2028 && cp <= 0x202e) || (cp >= 0x2060 && cp <= 0x2064) ||
+         (cp >= 0x206a && cp <= 0x206f) || cp == 0xfeff ||
+         (cp >= 0xfff9 && cp <= 0xfffb) || (cp >= 0x1d173 && cp <= 0x1d17a) ||
+         cp == 0xe0001 || (cp >= 0xe0020 && cp <= 0xe007f);
+}
+
+// Decodes the multibyte UTF-8 sequence at the start of s. Returns its length,
+// or 0 if it is malformed, overlong, a surrogate or beyond U+10FFFF.
+size_t DecodeUtf8(std::string_view s, uint32_t *cp) {
+  uint8_t lead = s[0];
+  size_t len;
+  uint32_t min;
+  if ((lead & 0xe0) == 0xc0) {
+    len = 2;
+    min = 0x80;
+    *cp = lead & 0x1f;
+  } else if ((lead & 0xf0) == 0xe0) {
+    len = 3;
+    min = 0x800;
+    *cp = lead & 0x0f;
+  } else if ((lead & 0xf8) == 0xf0) {
+    len = 4;
+    min = 0x10000;
+    *cp = lead & 0x07;
+  } else {
+    return 0;
+  }
+  if (s.size() < len) {
+    return 0;
+  }
+  for (size_t i = 1; i < len; i++) {
+    uint8_t c = s[i];
+    if ((c & 0xc0) != 0x80) {
+      return 0;
+    }
+    *cp = (*cp << 6) | (c & 0x3f);
+  }
+  if (*cp < min || *cp > 0x10ffff || (*cp >= 0xd800 && *cp <= 0xdfff)) {
+    return 0;
+  }
+  return len;
+}
+
+// Writes JSON straight into the output buffer. Rather than failing midway,
+// it remembers whether anything couldn't be rendered and carries on.
+class JsonWriter {
+ public:
+  explicit JsonWriter(std::vector<uint8_t> *out) : out_(out) {}
+
+  bool ok() const { return ok_; }
+
+  void BeginObject() {
+    Put('{');
+    first_ = true;
+  }
+
+  void EndObject() {
+    Put('}');
+    first_ = false;
+  }
+
+  void BeginArray() {
+    Put('[');
+    first_ = true;
+  }
+
+  void EndArray() {
+    Put(']');
+    first_ = false;
+  }
+
+  // Starts an object member. Field names are plain ASCII.
+  JsonWriter &Key(std::string_view name) {
+    Separate();
+    Put('"');
+    Append(name);
+    Append("\":");
+    return *this;
+  }
+
+  // Starts an array element.
+  JsonWriter &Element() {
+    Separate();
+    return *this;
+  }
+
+  void Bool(bool value) { Append(value ? "true" : "false"); }
+
+  void Int32(int32_t value) { Number(value); }
+
+  void UInt32(uint32_t value) { Number(value); }
+
+  // 64 bit integers are quoted, since JavaScript numbers can't hold them.
+  void Int64(int64_t value) {
+    Put('"');
+    Number(value);
+    Put('"');
+  }
+
+  void UInt64(uint64_t value) {
+    Put('"');
+    Number(value);
+    Put('"');
+  }
+
+  // Known values are written by name, and unknown ones as numbers.
+  void Enum(int value, const std::string &name) {
+    if (name.empty()) {
+      Number(value);
+      return;
+    }
+    Put('"');
+    Append(name);
+    Put('"');
+  }
+
+  void String(std::string_view s) {
+    Put('"');
+    size_t run = 0;
+    size_t i = 0;
+    while (i < s.size()) {
+      uint8_t c = s[i];
+      if (ABSL_PREDICT_TRUE(c < 0x80)) {
+        if (ABSL_PREDICT_TRUE(!NeedsAsciiEscape(c))) {
+          i++;
+          continue;
+        }
+        Append(s.substr(run, i - run));
+        AsciiEscape(c);
+        run = ++i;
+        continue;
+      }
+
+      uint32_t cp;
+      size_t len = DecodeUtf8(s.substr(i), &cp);
+      if (ABSL_PREDICT_FALSE(len == 0)) {
+        ok_ = false;
+        break;
+      }
+      if (ABSL_PREDICT_FALSE(NeedsUnicodeEscape(cp))) {
+        Append(s.substr(run, i - run));
+        UnicodeEscape(cp);
+        run = i + len;
+      }
+      i += len;
+    }
+    Append(s.substr(run, i - run));
+    Put('"');
+  }
+
+  // Bytes are standard base64 with padding.
+  void Bytes(std::string_view s) {
+    Put('"');
+    size_t i = 0;
+    for (; i + 3 <= s.size(); i += 3) {
+      uint32_t n = (uint8_t(s[i]) << 16) | (uint8_t(s[i + 1]) << 8) |
+                   uint8_t(s[i + 2]);
+      Put(kBase64Digits[n >> 18]);
+      Put(kBase64Digits[(n >> 12) & 0x3f]);
+      Put(kBase64Digits[(n >> 6) & 0x3f]);
+      Put(kBase64Digits[n & 0x3f]);
+    }
+    if (i + 1 == s.size()) {
+      uint32_t n = uint8_t(s[i]) << 16;
+      Put(kBase64Digits[n >> 18]);
+      Put(kBase64Digits[(n >> 12) & 0x3f]);
+      Append("==");
+    } else if (i + 2 == s.size()) {
+      uint32_t n = (uint8_t(s[i]) << 16) | (uint8_t(s[i + 1]) << 8);
+      Put(kBase64Digits[n >> 18]);
+      Put(kBase64Digits[(n >> 12) & 0x3f]);
+      Put(kBase64Digits[(n >> 6) & 0x3f]);
+      Put('=');
+    }
+    Put('"');
+  }
+
+  // Timestamps are RFC 3339 in UTC, with 0, 3, 6 or 9 fractional digits.
+  void Timestamp(const ::google::protobuf::Timestamp &ts) {
+    int64_t seconds = ts.seconds();
+    int32_t nanos = ts.nanos();
+    if (ABSL_PREDICT_FALSE(seconds < kMinTimestampSeconds ||
+                 seconds > kMaxTimestampSeconds || nanos < 0 ||
+                 nanos > kMaxTimestampNanos)) {
+      ok_ = false;
+      Append("null");
+      return;
+    }
+
+    // Convert days since the epoch to a civil date, per
+    // https://howardhinnant.github.io/date_algorithms.html#civil_from_days
+    int64_t days = seconds / 86400;
+    int64_t secs_of_day = seconds % 86400;
+    if (secs_of_day < 0) {
+      days--;
+      secs_of_day += 86400;
+    }
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int64_t day = doy - (153 * mp + 2) / 5 + 1;
+    int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = yoe + era * 400 + (month <= 2);
+
+    Put('"');
+    Digits(year, 4);
+    Put('-');
+    Digits(month, 2);
+    Put('-');
+    Digits(day, 2);
+    Put('T');
+    Digits(secs_of_day / 3600, 2);
+    Put(':');
+    Digits(secs_of_day / 60 % 60, 2);
+    Put(':');
+    Digits(secs_of_day % 60, 2);
+    if (nanos != 0) {
+      Put('.');
+      if (nanos % 1000000 == 0) {
+        Digits(nanos / 1000000, 3);
+      } else if (nanos % 1000 == 0) {
+        Digits(nanos / 1000, 6);
+      } else {
+        Digits(nanos, 9);
+      }
+    }
+    Append("Z\"");
+  }
+
+ private:
+  void Put(char c) { out_->push_back(static_cast<uint8_t>(c)); }
+
+  void Append(std::string_view s) {
+    out_->insert(out_->end(), s.begin(), s.end());
+  }
+
+  void Separate() {
+    if (!first_) {
+      Put(',');
+    }
+    first_ = false;
+  }
+
+  template <typename T>
+  void Number(T value) {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    Append(std::string_view(buf, end - buf));
+  }
+
+  // Writes value zero padded to width digits.
+  void Digits(int64_t value, int width) {
+    char buf[16];
+    for (int i = width - 1; i >= 0; i--) {
+      buf[i] = '0' + value % 10;
+      value /= 10;
+    }
+    Append(std::string_view(buf, width));
+  }
+
+  void AsciiEscape(uint8_t c) {
+    switch (c) {
+      case '"': Append("\\\""); break;
+      case '\\': Append("\\\\"); break;
+      case '\b': Append("\\b"); break;
+      case '\f': Append("\\f"); break;
+      case '\n': Append("\\n"); break;
+      case '\r': Append("\\r"); break;
+      case '\t': Append("\\t"); break;
+      default: UEscape(c); break;
+    }
+  }
+
+  // Code points beyond the BMP are escaped as UTF-16 surrogate pairs.
+  void UnicodeEscape(uint32_t cp) {
+    if (cp < 0x10000) {
+      UEscape(cp);
+      return;
+    }
+    cp -= 0x10000;
+    UEscape(0xd800 + (cp >> 10));
+    UEscape(0xdc00 + (cp & 0x3ff));
+  }
+
+  void UEscape(uint32_t unit) {
+    char buf[6] = {'\\',
+                   'u',
+                   kHexDigits[(unit >> 12) & 0xf],
+                   kHexDigits[(unit >> 8) & 0xf],
+                   kHexDigits[(unit >> 4) & 0xf],
+                   kHexDigits[unit & 0xf]};
+    Append(std::string_view(buf, sizeof(buf)));
+  }
+
+  std::vector<uint8_t> *out_;
+  bool first_ = true;
+  bool ok_ = true;
+};
+
+void Encode(JsonWriter &w, const pbv1::UserInfo &m);
+void Encode(JsonWriter &w, const pbv1::GroupInfo &m);
+void Encode(JsonWriter &w, const pbv1::ProcessID &m);
+void Encode(JsonWriter &w, const pbv1::CodeSignature &m);
+void Encode(JsonWriter &w, const pbv1::Stat &m);
+void Encode(JsonWriter &w, const pbv1::Hash &m);
+void Encode(JsonWriter &w, const pbv1::FileInfo &m);
+void Encode(JsonWriter &w, const pbv1::FileInfoLight &m);
+void Encode(JsonWriter &w, const pbv1::FileDescriptor &m);
+void Encode(JsonWriter &w, const pbtree::Annotations &m);
+void Encode(JsonWriter &w, const pbv1::ProcessInfo &m);
+void Encode(JsonWriter &w, const pbv1::ProcessInfoLight &m);
+void Encode(JsonWriter &w, const pbv1::CertificateInfo &m);
+void Encode(JsonWriter &w, const pbv1::Entitlement &m);
+void Encode(JsonWriter &w, const pbv1::EntitlementInfo &m);
+void Encode(JsonWriter &w, const pbv1::Execution &m);
+void Encode(JsonWriter &w, const pbv1::Fork &m);
+void Encode(JsonWriter &w, const pbv1::Exit::Exited &m);
+void Encode(JsonWriter &w, const pbv1::Exit::Signaled &m);
+void Encode(JsonWriter &w, const pbv1::Exit &m);
+void Encode(JsonWriter &w, const pbv1::Close &m);
+void Encode(JsonWriter &w, const pbv1::Exchangedata &m);
+void Encode(JsonWriter &w, const pbv1::Rename &m);
+void Encode(JsonWriter &w, const pbv1::Unlink &m);
+void Encode(JsonWriter &w, const pbv1::CodesigningInvalidated &m);
+void Encode(JsonWriter &w, const pbv1::Link &m);
+void Encode(JsonWriter &w, const pbv1::Disk &m);
+void Encode(JsonWriter &w, const pbv1::Bundle &m);
+void Encode(JsonWriter &w, const pbv1::Allowlist &m);
+void Encode(JsonWriter &w, const pbv1::FileAccess &m);
+void Encode(JsonWriter &w, const pbv1::GraphicalSession &m);
+void Encode(JsonWriter &w, const pbv1::SocketAddress &m);
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLogin &m);
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLogout &m);
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLock &m);
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionUnlock &m);
+void Encode(JsonWriter &w, const pbv1::LoginWindowSession &m);
+void Encode(JsonWriter &w, const pbv1::Login &m);
+void Encode(JsonWriter &w, const pbv1::Logout &m);
+void Encode(JsonWriter &w, const pbv1::LoginLogout &m);
+void Encode(JsonWriter &w, const pbv1::ScreenSharingAttach &m);
+void Encode(JsonWriter &w, const pbv1::ScreenSharingDetach &m);
+void Encode(JsonWriter &w, const pbv1::ScreenSharing &m);
+void Encode(JsonWriter &w, const pbv1::OpenSSHLogin &m);
+void Encode(JsonWriter &w, const pbv1::OpenSSHLogout &m);
+void Encode(JsonWriter &w, const pbv1::OpenSSH &m);
+
+template <typename T>
+void Field(JsonWriter &w, std::string_view name, const T &m) {
+  w.Key(name);
+  Encode(w, m);
+}
+
+// Every field of the messages below has explicit presence, and is written in
+// field number order only if it is set. Repeated fields are always written.
+
+void Encode(JsonWriter &w, const pbv1::UserInfo &m) {
+  w.BeginObject();
+  if (m.has_uid()) w.Key("uid").Int32(m.uid());
+  if (m.has_name()) w.Key("name").String(m.name());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::GroupInfo &m) {
+  w.BeginObject();
+  if (m.has_gid()) w.Key("gid").Int32(m.gid());
+  if (m.has_name()) w.Key("name").String(m.name());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ProcessID &m) {
+  w.BeginObject();
+  if (m.has_pid()) w.Key("pid").Int32(m.pid());
+  if (m.has_pidversion()) w.Key("pidversion").Int32(m.pidversion());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::CodeSignature &m) {
+  w.BeginObject();
+  if (m.has_cdhash()) w.Key("cdhash").Bytes(m.cdhash());
+  if (m.has_signing_id()) w.Key("signing_id").String(m.signing_id());
+  if (m.has_team_id()) w.Key("team_id").String(m.team_id());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Stat &m) {
+  w.BeginObject();
+  if (m.has_dev()) w.Key("dev").Int32(m.dev());
+  if (m.has_mode()) w.Key("mode").UInt32(m.mode());
+  if (m.has_nlink()) w.Key("nlink").UInt32(m.nlink());
+  if (m.has_ino()) w.Key("ino").UInt64(m.ino());
+  if (m.has_user()) Field(w, "user", m.user());
+  if (m.has_group()) Field(w, "group", m.group());
+  if (m.has_rdev()) w.Key("rdev").Int32(m.rdev());
+  if (m.has_access_time()) w.Key("access_time").Timestamp(m.access_time());
+  if (m.has_modification_time()) {
+    w.Key("modification_time").Timestamp(m.modification_time());
+  }
+  if (m.has_change_time()) w.Key("change_time").Timestamp(m.change_time());
+  if (m.has_birth_time()) w.Key("birth_time").Timestamp(m.birth_time());
+  if (m.has_size()) w.Key("size").Int64(m.size());
+  if (m.has_blocks()) w.Key("blocks").Int64(m.blocks());
+  if (m.has_blksize()) w.Key("blksize").Int32(m.blksize());
+  if (m.has_flags()) w.Key("flags").UInt32(m.flags());
+  if (m.has_gen()) w.Key("gen").Int32(m.gen());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Hash &m) {
+  w.BeginObject();
+  if (m.has_type()) {
+    w.Key("type").Enum(m.type(), pbv1::Hash::HashAlgo_Name(m.type()));
+  }
+  if (m.has_hash()) w.Key("hash").String(m.hash());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::FileInfo &m) {
+  w.BeginObject();
+  if (m.has_path()) w.Key("path").String(m.path());
+  if (m.has_truncated()) w.Key("truncated").Bool(m.truncated());
+  if (m.has_stat()) Field(w, "stat", m.stat());
+  if (m.has_hash()) Field(w, "hash", m.hash());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::FileInfoLight &m) {
+  w.BeginObject();
+  if (m.has_path()) w.Key("path").String(m.path());
+  if (m.has_truncated()) w.Key("truncated").Bool(m.truncated());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::FileDescriptor &m) {
+  w.BeginObject();
+  if (m.has_fd()) w.Key("fd").Int32(m.fd());
+  if (m.has_fd_type()) {
+    w.Key("fd_type").Enum(m.fd_type(),
+                          pbv1::FileDescriptor::FDType_Name(m.fd_type()));
+  }
+  if (m.has_pipe_id()) w.Key("pipe_id").UInt64(m.pipe_id());
+  w.EndObject();
+}
+
+// Annotations' fields have no presence, so they're always written.
+void Encode(JsonWriter &w, const pbtree::Annotations &m) {
+  w.BeginObject();
+  w.Key("originator")
+      .Enum(m.originator(),
+            pbtree::Annotations::Originator_Name(m.originator()));
+  w.Key("lineage_fingerprint").UInt64(m.lineage_fingerprint());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ProcessInfo &m) {
+  w.BeginObject();
+  if (m.has_id()) Field(w, "id", m.id());
+  if (m.has_parent_id()) Field(w, "parent_id", m.parent_id());
+  if (m.has_responsible_id()) Field(w, "responsible_id", m.responsible_id());
+  if (m.has_original_parent_pid()) {
+    w.Key("original_parent_pid").Int32(m.original_parent_pid());
+  }
+  if (m.has_group_id()) w.Key("group_id").Int32(m.group_id());
+  if (m.has_session_id()) w.Key("session_id").Int32(m.session_id());
+  if (m.has_effective_user()) Field(w, "effective_user", m.effective_user());
+  if (m.has_effective_group()) Field(w, "effective_group", m.effective_group());
+  if (m.has_real_user()) Field(w, "real_user", m.real_user());
+  if (m.has_real_group()) Field(w, "real_group", m.real_group());
+  if (m.has_is_platform_binary()) {
+    w.Key("is_platform_binary").Bool(m.is_platform_binary());
+  }
+  if (m.has_is_es_client()) w.Key("is_es_client").Bool(m.is_es_client());
+  if (m.has_code_signature()) Field(w, "code_signature", m.code_signature());
+  if (m.has_cs_flags()) w.Key("cs_flags").UInt32(m.cs_flags());
+  if (m.has_executable()) Field(w, "executable", m.executable());
+  if (m.has_tty()) Field(w, "tty", m.tty());
+  if (m.has_start_time()) w.Key("start_time").Timestamp(m.start_time());
+  if (m.has_annotations()) Field(w, "annotations", m.annotations());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ProcessInfoLight &m) {
+  w.BeginObject();
+  if (m.has_id()) Field(w, "id", m.id());
+  if (m.has_parent_id()) Field(w, "parent_id", m.parent_id());
+  if (m.has_original_parent_pid()) {
+    w.Key("original_parent_pid").Int32(m.original_parent_pid());
+  }
+  if (m.has_group_id()) w.Key("group_id").Int32(m.group_id());
+  if (m.has_session_id()) w.Key("session_id").Int32(m.session_id());
+  if (m.has_effective_user()) Field(w, "effective_user", m.effective_user());
+  if (m.has_effective_group()) Field(w, "effective_group", m.effective_group());
+  if (m.has_real_user()) Field(w, "real_user", m.real_user());
+  if (m.has_real_group()) Field(w, "real_group", m.real_group());
+  if (m.has_executable()) Field(w, "executable", m.executable());
+  if (m.has_annotations()) Field(w, "annotations", m.annotations());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::CertificateInfo &m) {
+  w.BeginObject();
+  if (m.has_hash()) Field(w, "hash", m.hash());
+  if (m.has_common_name()) w.Key("common_name").String(m.common_name());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Entitlement &m) {
+  w.BeginObject();
+  if (m.has_key()) w.Key("key").String(m.key());
+  if (m.has_value()) w.Key("value").String(m.value());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::EntitlementInfo &m) {
+  w.BeginObject();
+  if (m.has_entitlements_filtered()) {
+    w.Key("entitlements_filtered").Bool(m.entitlements_filtered());
+  }
+  w.Key("entitlements").BeginArray();
+  for (const pbv1::Entitlement &entitlement : m.entitlements()) {
+    Encode(w.Element(), entitlement);
+  }
+  w.EndArray();
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Execution &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_target()) Field(w, "target", m.target());
+  if (m.has_script()) Field(w, "script", m.script());
+  if (m.has_working_directory()) {
+    Field(w, "working_directory", m.working_directory());
+  }
+  w.Key("args").BeginArray();
+  for (const std::string &arg : m.args()) {
+    w.Element().Bytes(arg);
+  }
+  w.EndArray();
+  w.Key("envs").BeginArray();
+  for (const std::string &env : m.envs()) {
+    w.Element().Bytes(env);
+  }
+  w.EndArray();
+  w.Key("fds").BeginArray();
+  for (const pbv1::FileDescriptor &fd : m.fds()) {
+    Encode(w.Element(), fd);
+  }
+  w.EndArray();
+  if (m.has_fd_list_truncated()) {
+    w.Key("fd_list_truncated").Bool(m.fd_list_truncated());
+  }
+  if (m.has_decision()) {
+    w.Key("decision").Enum(m.decision(),
+                           pbv1::Execution::Decision_Name(m.decision()));
+  }
+  if (m.has_reason()) {
+    w.Key("reason").Enum(m.reason(), pbv1::Execution::Reason_Name(m.reason()));
+  }
+  if (m.has_mode()) {
+    w.Key("mode").Enum(m.mode(), pbv1::Execution::Mode_Name(m.mode()));
+  }
+  if (m.has_certificate_info()) {
+    Field(w, "certificate_info", m.certificate_info());
+  }
+  if (m.has_explain()) w.Key("explain").String(m.explain());
+  if (m.has_quarantine_url()) {
+    w.Key("quarantine_url").String(m.quarantine_url());
+  }
+  if (m.has_original_path()) w.Key("original_path").String(m.original_path());
+  if (m.has_entitlement_info()) {
+    Field(w, "entitlement_info", m.entitlement_info());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Fork &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_child()) Field(w, "child", m.child());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Exit::Exited &m) {
+  w.BeginObject();
+  if (m.has_exit_status()) w.Key("exit_status").Int32(m.exit_status());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Exit::Signaled &m) {
+  w.BeginObject();
+  if (m.has_signal()) w.Key("signal").Int32(m.signal());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Exit &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_exited()) Field(w, "exited", m.exited());
+  if (m.has_signaled()) Field(w, "signaled", m.signaled());
+  if (m.has_stopped()) Field(w, "stopped", m.stopped());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Close &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_target()) Field(w, "target", m.target());
+  if (m.has_modified()) w.Key("modified").Bool(m.modified());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Exchangedata &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_file1()) Field(w, "file1", m.file1());
+  if (m.has_file2()) Field(w, "file2", m.file2());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Rename &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_target()) w.Key("target").String(m.target());
+  if (m.has_target_existed()) {
+    w.Key("target_existed").Bool(m.target_existed());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Unlink &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_target()) Field(w, "target", m.target());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::CodesigningInvalidated &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Link &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_target()) w.Key("target").String(m.target());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Disk &m) {
+  w.BeginObject();
+  if (m.has_action()) {
+    w.Key("action").Enum(m.action(), pbv1::Disk::Action_Name(m.action()));
+  }
+  if (m.has_mount()) w.Key("mount").String(m.mount());
+  if (m.has_volume()) w.Key("volume").String(m.volume());
+  if (m.has_bsd_name()) w.Key("bsd_name").String(m.bsd_name());
+  if (m.has_fs()) w.Key("fs").String(m.fs());
+  if (m.has_model()) w.Key("model").String(m.model());
+  if (m.has_serial()) w.Key("serial").String(m.serial());
+  if (m.has_bus()) w.Key("bus").String(m.bus());
+  if (m.has_dmg_path()) w.Key("dmg_path").String(m.dmg_path());
+  if (m.has_appearance()) w.Key("appearance").Timestamp(m.appearance());
+  if (m.has_mount_from()) w.Key("mount_from").String(m.mount_from());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Bundle &m) {
+  w.BeginObject();
+  if (m.has_file_hash()) Field(w, "file_hash", m.file_hash());
+  if (m.has_bundle_hash()) Field(w, "bundle_hash", m.bundle_hash());
+  if (m.has_bundle_name()) w.Key("bundle_name").String(m.bundle_name());
+  if (m.has_bundle_id()) w.Key("bundle_id").String(m.bundle_id());
+  if (m.has_bundle_path()) w.Key("bundle_path").String(m.bundle_path());
+  if (m.has_path()) w.Key("path").String(m.path());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Allowlist &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_target()) Field(w, "target", m.target());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::FileAccess &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_target()) Field(w, "target", m.target());
+  if (m.has_policy_version()) {
+    w.Key("policy_version").String(m.policy_version());
+  }
+  if (m.has_policy_name()) w.Key("policy_name").String(m.policy_name());
+  if (m.has_access_type()) {
+    w.Key("access_type")
+        .Enum(m.access_type(),
+              pbv1::FileAccess::AccessType_Name(m.access_type()));
+  }
+  if (m.has_policy_decision()) {
+    w.Key("policy_decision")
+        .Enum(m.policy_decision(),
+              pbv1::FileAccess::PolicyDecision_Name(m.policy_decision()));
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::GraphicalSession &m) {
+  w.BeginObject();
+  if (m.has_id()) w.Key("id").UInt32(m.id());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::SocketAddress &m) {
+  w.BeginObject();
+  if (m.has_address()) w.Key("address").Bytes(m.address());
+  if (m.has_type()) {
+    w.Key("type").Enum(m.type(), pbv1::SocketAddress::Type_Name(m.type()));
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLogin &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_user()) Field(w, "user", m.user());
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLogout &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_user()) Field(w, "user", m.user());
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionLock &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_user()) Field(w, "user", m.user());
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginWindowSessionUnlock &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_user()) Field(w, "user", m.user());
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginWindowSession &m) {
+  w.BeginObject();
+  if (m.has_login()) Field(w, "login", m.login());
+  if (m.has_logout()) Field(w, "logout", m.logout());
+  if (m.has_lock()) Field(w, "lock", m.lock());
+  if (m.has_unlock()) Field(w, "unlock", m.unlock());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Login &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_success()) w.Key("success").Bool(m.success());
+  if (m.has_failure_message()) {
+    w.Key("failure_message").Bytes(m.failure_message());
+  }
+  if (m.has_user()) Field(w, "user", m.user());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::Logout &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_user()) Field(w, "user", m.user());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::LoginLogout &m) {
+  w.BeginObject();
+  if (m.has_login()) Field(w, "login", m.login());
+  if (m.has_logout()) Field(w, "logout", m.logout());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ScreenSharingAttach &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_success()) w.Key("success").Bool(m.success());
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_viewer()) w.Key("viewer").Bytes(m.viewer());
+  if (m.has_authentication_type()) {
+    w.Key("authentication_type").Bytes(m.authentication_type());
+  }
+  if (m.has_authentication_user()) {
+    Field(w, "authentication_user", m.authentication_user());
+  }
+  if (m.has_session_user()) Field(w, "session_user", m.session_user());
+  if (m.has_existing_session()) {
+    w.Key("existing_session").Bool(m.existing_session());
+  }
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ScreenSharingDetach &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_viewer()) w.Key("viewer").Bytes(m.viewer());
+  if (m.has_graphical_session()) {
+    Field(w, "graphical_session", m.graphical_session());
+  }
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::ScreenSharing &m) {
+  w.BeginObject();
+  if (m.has_attach()) Field(w, "attach", m.attach());
+  if (m.has_detach()) Field(w, "detach", m.detach());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::OpenSSHLogin &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_result()) {
+    w.Key("result").Enum(m.result(),
+                         pbv1::OpenSSHLogin::Result_Name(m.result()));
+  }
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_user()) Field(w, "user", m.user());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::OpenSSHLogout &m) {
+  w.BeginObject();
+  if (m.has_instigator()) Field(w, "instigator", m.instigator());
+  if (m.has_source()) Field(w, "source", m.source());
+  if (m.has_user()) Field(w, "user", m.user());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::OpenSSH &m) {
+  w.BeginObject();
+  if (m.has_login()) Field(w, "login", m.login());
+  if (m.has_logout()) Field(w, "logout", m.logout());
+  w.EndObject();
+}
+
+void Encode(JsonWriter &w, const pbv1::SantaMessage &m) {
+  w.BeginObject();
+  if (m.has_machine_id()) w.Key("machine_id").String(m.machine_id());
+  if (m.has_event_time()) w.Key("event_time").Timestamp(m.event_time());
+  if (m.has_processed_time()) {
+    w.Key("processed_time").Timestamp(m.processed_time());
+  }
+  switch (m.event_case()) {
+    case pbv1::SantaMessage::kExecution:
+      Field(w, "execution", m.execution());
+      break;
+    case pbv1::SantaMessage::kFork: Field(w, "fork", m.fork()); break;
+    case pbv1::SantaMessage::kExit: Field(w, "exit", m.exit()); break;
+    case pbv1::SantaMessage::kClose: Field(w, "close", m.close()); break;
+    case pbv1::SantaMessage::kRename: Field(w, "rename", m.rename()); break;
+    case pbv1::SantaMessage::kUnlink: Field(w, "unlink", m.unlink()); break;
+    case pbv1::SantaMessage::kLink: Field(w, "link", m.link()); break;
+    case pbv1::SantaMessage::kExchangedata:
+      Field(w, "exchangedata", m.exchangedata());
+      break;
+    case pbv1::SantaMessage::kDisk: Field(w, "disk", m.disk()); break;
+    case pbv1::SantaMessage::kBundle: Field(w, "bundle", m.bundle()); break;
+    case pbv1::SantaMessage::kAllowlist:
+      Field(w, "allowlist", m.allowlist());
+      break;
+    case pbv1::SantaMessage::kFileAccess:
+      Field(w, "file_access", m.file_access());
+      break;
+    case pbv1::SantaMessage::kCodesigningInvalidated:
+      Field(w, "codesigning_invalidated", m.codesigning_invalidated());
+      break;
+    case pbv1::SantaMessage::kLoginWindowSession:
+      Field(w, "login_window_session", m.login_window_session());
+      break;
+    case pbv1::SantaMessage::kLoginLogout:
+      Field(w, "login_logout", m.login_logout());
+      break;
+    case pbv1::SantaMessage::kScreenSharing:
+      Field(w, "screen_sharing", m.screen_sharing());
+      break;
+    case pbv1::SantaMessage::kOpenSsh:
+      Field(w, "open_ssh", m.open_ssh());
+      break;
+    case pbv1::SantaMessage::EVENT_NOT_SET: break;
+  }
+  w.EndObject();
+}
+
+}  // namespace
+
+bool EncodeJson(const ::santa::pb::v1::SantaMessage &msg,
+                std::vector<uint8_t> *out) {
+  size_t start = out->size();
+  JsonWriter writer(out);
+  Encode(writer, msg);
+  if (!writer.ok()) {
+    out->resize(start);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace santa
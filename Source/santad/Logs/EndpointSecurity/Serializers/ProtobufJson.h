@@ -0,0 +1,37 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_SERIALIZERS_PROTOBUFJSON_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_SERIALIZERS_PROTOBUFJSON_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Source/common/santa_proto_include_wrapper.h"
+
+namespace santa {
+
+// Appends msg to out as JSON, without reflection. The output is byte for byte
+// what MessageToJsonString produces with preserve_proto_field_names and
+// always_print_fields_with_no_presence set.
+//
+// Returns false, leaving out as it was, if msg holds something only
+// MessageToJsonString knows how to render, such as a string that isn't valid
+// UTF-8 or a timestamp outside of years 1 through 9999.
+bool EncodeJson(const ::santa::pb::v1::SantaMessage &msg,
+                std::vector<uint8_t> *out);
+
+}  // namespace santa
+
+#endif
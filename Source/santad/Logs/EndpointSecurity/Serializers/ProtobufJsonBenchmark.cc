@@ -0,0 +1,215 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+// Compares EncodeJson against the reflection based MessageToJsonString that
+// the Protobuf serializer's JSON mode used before it, copying into a new
+// vector as FinalizeProto did.
+//
+// Usage: protobuf_json_benchmark [iterations]
+//
+// Encodes an execution event, the largest and most frequent one Santa logs,
+// iterations (default 200000) times with each, and reports the mean time per
+// event and throughput.
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Source/common/santa_proto_include_wrapper.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ProtobufJson.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "google/protobuf/json/json.h"
+
+namespace {
+
+namespace pbv1 = ::santa::pb::v1;
+
+using Clock = std::chrono::steady_clock;
+
+void SetProcessInfoLight(pbv1::ProcessInfoLight *proc) {
+  proc->mutable_id()->set_pid(12345);
+  proc->mutable_id()->set_pidversion(67890);
+  proc->mutable_parent_id()->set_pid(1);
+  proc->mutable_parent_id()->set_pidversion(1);
+  proc->set_original_parent_pid(1);
+  proc->set_group_id(12345);
+  proc->set_session_id(300);
+  proc->mutable_effective_user()->set_uid(501);
+  proc->mutable_effective_user()->set_name("nobody");
+  proc->mutable_effective_group()->set_gid(20);
+  proc->mutable_effective_group()->set_name("staff");
+  proc->mutable_real_user()->set_uid(501);
+  proc->mutable_real_user()->set_name("nobody");
+  proc->mutable_real_group()->set_gid(20);
+  proc->mutable_real_group()->set_name("staff");
+  proc->mutable_executable()->set_path("/bin/zsh");
+  proc->mutable_executable()->set_truncated(false);
+}
+
+void SetFileInfo(pbv1::FileInfo *file, const std::string &path) {
+  file->set_path(path);
+  file->set_truncated(false);
+  pbv1::Stat *stat = file->mutable_stat();
+  stat->set_dev(16777232);
+  stat->set_mode(0100755);
+  stat->set_nlink(1);
+  stat->set_ino(1152921500312524456);
+  stat->mutable_user()->set_uid(0);
+  stat->mutable_user()->set_name("root");
+  stat->mutable_group()->set_gid(0);
+  stat->mutable_group()->set_name("wheel");
+  stat->set_rdev(0);
+  stat->mutable_access_time()->set_seconds(1714000000);
+  stat->mutable_access_time()->set_nanos(123456789);
+  stat->mutable_modification_time()->set_seconds(1714000001);
+  stat->mutable_change_time()->set_seconds(1714000002);
+  stat->mutable_birth_time()->set_seconds(1714000003);
+  stat->set_size(1234567);
+  stat->set_blocks(2416);
+  stat->set_blksize(4096);
+  stat->set_flags(0x80000);
+  stat->set_gen(0);
+  file->mutable_hash()->set_type(pbv1::Hash::HASH_ALGO_SHA256);
+  file->mutable_hash()->set_hash(
+      "3a6eb0790f39ac87c94f3856b2dd2c5d110e6811602261a9a923d3bb23adc8b7");
+}
+
+pbv1::SantaMessage MakeExecution() {
+  pbv1::SantaMessage msg;
+  msg.set_machine_id("C02XXXXXXXXX");
+  msg.mutable_event_time()->set_seconds(1714000100);
+  msg.mutable_event_time()->set_nanos(500000000);
+  msg.mutable_processed_time()->set_seconds(1714000100);
+  msg.mutable_processed_time()->set_nanos(500123000);
+
+  pbv1::Execution *exec = msg.mutable_execution();
+  SetProcessInfoLight(exec->mutable_instigator());
+
+  pbv1::ProcessInfo *target = exec->mutable_target();
+  target->mutable_id()->set_pid(12346);
+  target->mutable_id()->set_pidversion(67891);
+  target->mutable_parent_id()->set_pid(12345);
+  target->mutable_parent_id()->set_pidversion(67890);
+  target->set_original_parent_pid(12345);
+  target->set_group_id(12346);
+  target->set_session_id(300);
+  target->mutable_effective_user()->set_uid(501);
+  target->mutable_effective_group()->set_gid(20);
+  target->mutable_real_user()->set_uid(501);
+  target->mutable_real_group()->set_gid(20);
+  target->set_is_platform_binary(true);
+  target->set_is_es_client(false);
+  target->mutable_code_signature()->set_cdhash(
+      std::string("\x4f\x5c\x02\xab\x19\x8e\x77\x10\x3d\x42\x00\xfe\x91\x2a"
+                  "\x66\x8b\xc0\x11\x5d\x73",
+                  20));
+  target->mutable_code_signature()->set_signing_id("com.apple.ls");
+  target->set_cs_flags(0x26000001);
+  SetFileInfo(target->mutable_executable(), "/bin/ls");
+  target->mutable_tty()->set_path("/dev/ttys001");
+  target->mutable_start_time()->set_seconds(1714000100);
+  target->mutable_start_time()->set_nanos(499000000);
+
+  SetFileInfo(exec->mutable_working_directory(), "/Users/nobody/src/project");
+  for (const char *arg : {"ls", "-la", "--color=auto", "/Users/nobody/src"}) {
+    exec->add_args(arg);
+  }
+  for (const char *env :
+       {"PATH=/usr/local/bin:/usr/bin:/bin:/usr/sbin:/sbin",
+        "HOME=/Users/nobody", "SHELL=/bin/zsh", "TERM=xterm-256color",
+        "LANG=en_US.UTF-8", "USER=nobody"}) {
+    exec->add_envs(env);
+  }
+  for (int fd = 0; fd < 3; fd++) {
+    pbv1::FileDescriptor *pb_fd = exec->add_fds();
+    pb_fd->set_fd(fd);
+    pb_fd->set_fd_type(pbv1::FileDescriptor::FD_TYPE_VNODE);
+  }
+  exec->set_fd_list_truncated(false);
+  exec->set_decision(pbv1::Execution::DECISION_ALLOW);
+  exec->set_reason(pbv1::Execution::REASON_SCOPE);
+  exec->set_mode(pbv1::Execution::MODE_LOCKDOWN);
+  exec->mutable_certificate_info()->mutable_hash()->set_type(
+      pbv1::Hash::HASH_ALGO_SHA256);
+  exec->mutable_certificate_info()->mutable_hash()->set_hash(
+      "d84db96af8c2e60ac4c851a21ec460f6f84e0235beb17d24a78712b9b021ed57");
+  exec->mutable_certificate_info()->set_common_name("Software Signing");
+  exec->set_explain("platform binary");
+  exec->set_original_path("/bin/ls");
+  return msg;
+}
+
+// The Protobuf serializer's JSON mode before EncodeJson.
+std::vector<uint8_t> ReflectionJson(const pbv1::SantaMessage &msg) {
+  google::protobuf::json::PrintOptions options;
+  options.always_print_enums_as_ints = false;
+  options.always_print_fields_with_no_presence = true;
+  options.preserve_proto_field_names = true;
+  std::string json;
+  absl::Status status =
+      google::protobuf::json::MessageToJsonString(msg, &json, options);
+  if (!status.ok()) {
+    fprintf(stderr, "MessageToJsonString: %s\n", status.ToString().c_str());
+  }
+  std::vector<uint8_t> vec(json.begin(), json.end());
+  vec.push_back('\n');
+  return vec;
+}
+
+std::vector<uint8_t> DirectJson(const pbv1::SantaMessage &msg) {
+  std::vector<uint8_t> vec;
+  vec.reserve(2048);
+  santa::EncodeJson(msg, &vec);
+  vec.push_back('\n');
+  return vec;
+}
+
+template <typename Encoder>
+void Run(const char *name, const pbv1::SantaMessage &msg, size_t iterations,
+         Encoder encode) {
+  size_t bytes = 0;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    bytes += encode(msg).size();
+  }
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("%-12s %8.0f ns/event %10.0f events/sec %8.1f MiB/sec\n", name,
+         secs * 1e9 / iterations, iterations / secs,
+         bytes / secs / (1024 * 1024));
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t iterations = 200000;
+  if (argc > 1 && !absl::SimpleAtoi(argv[1], &iterations)) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  pbv1::SantaMessage msg = MakeExecution();
+  std::vector<uint8_t> want = ReflectionJson(msg);
+  if (DirectJson(msg) != want) {
+    fprintf(stderr, "EncodeJson output differs from MessageToJsonString\n");
+    return 1;
+  }
+  printf("%zu byte execution event, %zu iterations\n", want.size(),
+         iterations);
+
+  Run("reflection", msg, iterations, ReflectionJson);
+  Run("EncodeJson", msg, iterations, DirectJson);
+  return 0;
+}
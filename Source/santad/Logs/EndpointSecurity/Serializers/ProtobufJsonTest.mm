@@ -0,0 +1,274 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#import <XCTest/XCTest.h>
+#include <google/protobuf/json/json.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Source/common/TestUtils.h"
+#include "Source/common/santa_proto_include_wrapper.h"
+#include "Source/santad/Logs/EndpointSecurity/Serializers/ProtobufJson.h"
+
+using JsonPrintOptions = google::protobuf::json::PrintOptions;
+using google::protobuf::Descriptor;
+using google::protobuf::FieldDescriptor;
+using google::protobuf::OneofDescriptor;
+using google::protobuf::Reflection;
+using google::protobuf::json::MessageToJsonString;
+using santa::EncodeJson;
+
+namespace pbv1 = ::santa::pb::v1;
+
+static std::string ReflectionJson(const pbv1::SantaMessage &msg) {
+  JsonPrintOptions options;
+  options.always_print_enums_as_ints = false;
+  options.always_print_fields_with_no_presence = true;
+  options.preserve_proto_field_names = true;
+
+  std::string json;
+  XCTAssertTrue(MessageToJsonString(msg, &json, options).ok());
+  return json;
+}
+
+static std::string DirectJson(const pbv1::SantaMessage &msg) {
+  std::vector<uint8_t> vec;
+  XCTAssertTrue(EncodeJson(msg, &vec));
+  return std::string(vec.begin(), vec.end());
+}
+
+// Sets every field of msg, and of the messages within it, to a value other than its default.
+// Repeated fields get two elements. Only one member of a oneof can be set, so the one at index
+// variant (modulo the number of members) is, and *num_variants is raised to the number of members
+// so that the caller can cover each of them. Message types already being filled further up are
+// left unset, so that recursive types terminate.
+static void FillAllFields(google::protobuf::Message *msg, int variant, int *num_variants,
+                          std::vector<const Descriptor *> *filling) {
+  const Descriptor *descriptor = msg->GetDescriptor();
+  const Reflection *reflection = msg->GetReflection();
+  if (descriptor->full_name() == "google.protobuf.Timestamp") {
+    reflection->SetInt64(msg, descriptor->FindFieldByName("seconds"), 1700000000 + variant);
+    reflection->SetInt32(msg, descriptor->FindFieldByName("nanos"), 123456000);
+    return;
+  }
+  if (std::find(filling->begin(), filling->end(), descriptor) != filling->end()) {
+    return;
+  }
+  filling->push_back(descriptor);
+
+  for (int i = 0; i < descriptor->field_count(); i++) {
+    const FieldDescriptor *field = descriptor->field(i);
+    if (const OneofDescriptor *oneof = field->real_containing_oneof()) {
+      *num_variants = std::max(*num_variants, oneof->field_count());
+      if (oneof->field(variant % oneof->field_count()) != field) {
+        continue;
+      }
+    }
+
+    const int count = field->is_repeated() ? 2 : 1;
+    for (int j = 0; j < count; j++) {
+      // Distinct values for each field and element.
+      const int n = field->number() * 10 + j + 1;
+      switch (field->cpp_type()) {
+        case FieldDescriptor::CPPTYPE_INT32:
+          field->is_repeated() ? reflection->AddInt32(msg, field, -n)
+                               : reflection->SetInt32(msg, field, -n);
+          break;
+        case FieldDescriptor::CPPTYPE_INT64:
+          field->is_repeated() ? reflection->AddInt64(msg, field, INT64_MIN + n)
+                               : reflection->SetInt64(msg, field, INT64_MIN + n);
+          break;
+        case FieldDescriptor::CPPTYPE_UINT32:
+          field->is_repeated() ? reflection->AddUInt32(msg, field, UINT32_MAX - n)
+                               : reflection->SetUInt32(msg, field, UINT32_MAX - n);
+          break;
+        case FieldDescriptor::CPPTYPE_UINT64:
+          field->is_repeated() ? reflection->AddUInt64(msg, field, UINT64_MAX - n)
+                               : reflection->SetUInt64(msg, field, UINT64_MAX - n);
+          break;
+        case FieldDescriptor::CPPTYPE_DOUBLE:
+          field->is_repeated() ? reflection->AddDouble(msg, field, n + 0.5)
+                               : reflection->SetDouble(msg, field, n + 0.5);
+          break;
+        case FieldDescriptor::CPPTYPE_FLOAT:
+          field->is_repeated() ? reflection->AddFloat(msg, field, n + 0.5f)
+                               : reflection->SetFloat(msg, field, n + 0.5f);
+          break;
+        case FieldDescriptor::CPPTYPE_BOOL:
+          field->is_repeated() ? reflection->AddBool(msg, field, true)
+                               : reflection->SetBool(msg, field, true);
+          break;
+        case FieldDescriptor::CPPTYPE_ENUM: {
+          // Counting back from the last value, which isn't the default.
+          const google::protobuf::EnumDescriptor *type = field->enum_type();
+          int value =
+            type->value(type->value_count() - 1 - (j + variant) % type->value_count())->number();
+          field->is_repeated() ? reflection->AddEnumValue(msg, field, value)
+                               : reflection->SetEnumValue(msg, field, value);
+          break;
+        }
+        case FieldDescriptor::CPPTYPE_STRING: {
+          std::string value = field->name() + std::to_string(n);
+          if (field->type() == FieldDescriptor::TYPE_BYTES) {
+            value.insert(0, std::string("\x00\xff", 2));
+          }
+          field->is_repeated() ? reflection->AddString(msg, field, value)
+                               : reflection->SetString(msg, field, value);
+          break;
+        }
+        case FieldDescriptor::CPPTYPE_MESSAGE:
+          FillAllFields(field->is_repeated() ? reflection->AddMessage(msg, field)
+                                             : reflection->MutableMessage(msg, field),
+                        variant, num_variants, filling);
+          break;
+      }
+    }
+  }
+  filling->pop_back();
+}
+
+@interface ProtobufJsonTest : XCTestCase
+@end
+
+@implementation ProtobufJsonTest
+
+- (void)testMatchesReflection {
+  pbv1::SantaMessage msg;
+  msg.set_machine_id("my_id");
+  msg.mutable_event_time()->set_seconds(1700000000);
+  msg.mutable_processed_time()->set_seconds(1700000000);
+  msg.mutable_processed_time()->set_nanos(123000000);
+
+  pbv1::Execution *exec = msg.mutable_execution();
+  exec->mutable_instigator()->mutable_id()->set_pid(12);
+  exec->mutable_instigator()->mutable_effective_user()->set_uid(-2);
+  exec->mutable_instigator()->mutable_annotations();
+  exec->mutable_target()->mutable_code_signature()->set_cdhash(std::string("\x00\xff\x10", 3));
+  exec->mutable_target()->set_cs_flags(0xffffffff);
+  exec->mutable_target()->mutable_start_time()->set_nanos(1000);
+  exec->mutable_target()->mutable_executable()->mutable_stat()->set_ino(UINT64_MAX);
+  exec->mutable_target()->mutable_executable()->mutable_stat()->set_size(INT64_MIN);
+  exec->mutable_target()->mutable_executable()->mutable_stat()->mutable_birth_time()->set_nanos(
+    1);
+  exec->add_args("ls");
+  exec->add_args("");
+  exec->add_args("ab");
+  exec->add_fds()->set_fd_type(pbv1::FileDescriptor::FD_TYPE_PIPE);
+  exec->set_decision(pbv1::Execution::DECISION_DENY);
+  // Enums hold values they don't know about, which are written as numbers.
+  exec->set_reason(static_cast<pbv1::Execution::Reason>(1234));
+  exec->set_explain("");
+  exec->mutable_entitlement_info()->set_entitlements_filtered(false);
+
+  XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+
+  // Unset fields with presence are skipped, but empty repeated fields are not.
+  msg.mutable_fork();
+  XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+  msg.mutable_exit()->mutable_signaled()->set_signal(9);
+  XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+}
+
+- (void)testMatchesReflectionForEveryField {
+  // Fields added to the schema, but not to EncodeJson, are missing from its output.
+  const google::protobuf::OneofDescriptor *events =
+    pbv1::SantaMessage::descriptor()->FindOneofByName("event");
+  XCTAssertNotEqual(events, nullptr);
+  for (int i = 0; i < events->field_count(); i++) {
+    int numVariants = 1;
+    for (int variant = 0; variant < numVariants; variant++) {
+      pbv1::SantaMessage msg;
+      std::vector<const Descriptor *> filling;
+      FillAllFields(&msg, variant, &numVariants, &filling);
+      // Replace whichever event the variant picked with this one.
+      FillAllFields(msg.GetReflection()->MutableMessage(&msg, events->field(i)), variant,
+                    &numVariants, &filling);
+      std::string got = DirectJson(msg);
+      std::string want = ReflectionJson(msg);
+      XCTAssertCStringEqual(got.c_str(), want.c_str(), @"%s, variant %d",
+                            events->field(i)->name().c_str(), variant);
+    }
+  }
+}
+
+- (void)testEscapesStrings {
+  std::vector<std::string> strings = {
+    "plain",
+    "quote\" backslash\\ slash/",
+    "\b\f\n\r\t\x01\x1f\x7f",
+    "<script>&'",
+    "caf\xc3\xa9 \xf0\x9f\x98\x80",
+    // Invisible format characters, line separators and C1 controls
+    "\xc2\x80\xc2\x9f\xc2\xad\xe2\x80\x8b\xe2\x80\xa8\xe2\x81\xa0\xef\xbb\xbf",
+    // Ones beyond the BMP are written as surrogate pairs
+    "\xf0\x9d\x85\xb3\xf3\xa0\x80\x81",
+  };
+
+  for (const std::string &s : strings) {
+    pbv1::SantaMessage msg;
+    msg.set_machine_id(s);
+    msg.mutable_disk()->set_mount(s);
+    XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+  }
+}
+
+- (void)testEncodesBytes {
+  for (size_t len = 0; len < 8; len++) {
+    pbv1::SantaMessage msg;
+    msg.mutable_execution()->add_envs(std::string(len, '\xfb'));
+    XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+  }
+}
+
+- (void)testEncodesTimestamps {
+  std::vector<std::pair<int64_t, int32_t>> times = {
+    {0, 0},
+    {-1, 999999999},
+    {951782400, 100000000},  // 2000-02-29
+    {-62135596800, 0},       // 0001-01-01
+    {253402300799, 999999000},
+    {1700000000, 123456},
+  };
+
+  for (const auto &[seconds, nanos] : times) {
+    pbv1::SantaMessage msg;
+    msg.mutable_event_time()->set_seconds(seconds);
+    msg.mutable_event_time()->set_nanos(nanos);
+    XCTAssertCppStringEqual(DirectJson(msg), ReflectionJson(msg));
+  }
+}
+
+- (void)testDefersToReflection {
+  std::vector<uint8_t> vec = {'x'};
+
+  pbv1::SantaMessage msg;
+  msg.set_machine_id("invalid \xff utf-8");
+  XCTAssertFalse(EncodeJson(msg, &vec));
+  XCTAssertEqual(vec.size(), 1);
+
+  msg.Clear();
+  msg.mutable_event_time()->set_seconds(253402300800);
+  XCTAssertFalse(EncodeJson(msg, &vec));
+  XCTAssertEqual(vec.size(), 1);
+
+  // Output is appended to what's already there.
+  msg.Clear();
+  XCTAssertTrue(EncodeJson(msg, &vec));
+  XCTAssertCppStringEqual(std::string(vec.begin(), vec.end()), "x{}");
+}
+
+@end
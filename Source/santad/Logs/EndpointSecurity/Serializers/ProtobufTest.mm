@@ -102,6 +102,18 @@ JsonPrintOptions DefaultJsonPrintOptions() {
   return options;
 }
 
+// What the serializer's JSON mode writes, as rendered by reflection.
+std::string FinalizedJsonString(const ::pbv1::SantaMessage &santaMsg) {
+  JsonPrintOptions options;
+  options.always_print_enums_as_ints = false;
+  options.always_print_fields_with_no_presence = true;
+  options.preserve_proto_field_names = true;
+
+  std::string json;
+  XCTAssertTrue(MessageToJsonString(santaMsg, &json, options).ok());
+  return json + "\n";
+}
+
 NSString *ConstructFilename(es_event_type_t eventType, NSString *variant = nil) {
   NSString *name;
   switch (eventType) {
@@ -282,6 +294,7 @@ void SerializeAndCheck(es_event_type_t eventType,
       options.ignore_unknown_fields = true;
       absl::Status status = JsonStringToMessage(protoStr, &santaMsg, options);
       XCTAssertTrue(status.ok());
+      XCTAssertCppStringEqual(protoStr, FinalizedJsonString(santaMsg));
       gotData = ConvertMessageToJsonString(santaMsg);
     } else {
       XCTAssertTrue(santaMsg.ParseFromString(protoStr));
@@ -36,8 +36,13 @@ class Serializer {
   virtual ~Serializer() = default;
 
   std::vector<uint8_t> SerializeMessage(std::unique_ptr<santa::EnrichedMessage> msg) {
+    return SerializeMessage(*msg);
+  }
+
+  // As above, for callers serializing the same message more than once.
+  std::vector<uint8_t> SerializeMessage(santa::EnrichedMessage &msg) {
     return std::visit([this](const auto &arg) { return this->SerializeMessageTemplate(arg); },
-                      msg->GetEnrichedMessage());
+                      msg.GetEnrichedMessage());
   }
 
   bool EnabledMachineID();
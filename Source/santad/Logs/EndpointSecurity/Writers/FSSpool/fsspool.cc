@@ -18,16 +18,25 @@
 #include <sys/stat.h>
 #include <time.h>
 
+
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <limits>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_platform_specific.h"
+#include "absl/crc/crc32c.h"
 #include "absl/random/random.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
 #include "absl/time/time.h"
@@ -47,6 +56,22 @@ namespace {
 
 constexpr absl::string_view kSpoolDirName = "new";
 constexpr absl::string_view kTmpDirName = "tmp";
+constexpr absl::string_view kSegmentDirName = "segments";
+constexpr absl::string_view kSegmentSuffix = ".seg";
+constexpr absl::string_view kCheckpointName = "checkpoint";
+constexpr absl::string_view kSizeCounterName = "size";
+constexpr absl::string_view kLowPrioritySuffix = ".low";
+constexpr absl::string_view kHighPrioritySuffix = ".high";
+
+// How often writers reconcile the shared size counter with the spool, and how
+// often they may do so early when the counter claims the spool is full.
+constexpr absl::Duration kSizeCounterReconcileInterval = absl::Minutes(5);
+constexpr absl::Duration kSizeCounterFullReconcileInterval = absl::Seconds(1);
+
+// Segment records are a 4-byte length and a 4-byte checksum, then the payload.
+constexpr size_t kRecordHeaderSize = 8;
+// Lengths past this are assumed to be corruption rather than a record.
+constexpr uint32_t kMaxRecordSize = 256 * 1024 * 1024;
 
 // Estimates the disk occupation of a file of the given size,
 // with the following heuristic: A typical disk cluster is 4KiB; files
@@ -157,25 +182,263 @@ std::string SpoolDirectory(absl::string_view base_dir) {
   return absl::StrCat(base_dir, PathSeparator(), kSpoolDirName);
 }
 
+// Spooled files of retention classes other than kNormal are marked by a
+// suffix. Files without one, such as those spooled before there were classes,
+// are kNormal.
+absl::string_view PrioritySuffix(Priority priority) {
+  switch (priority) {
+    case Priority::kLow: return kLowPrioritySuffix;
+    case Priority::kHigh: return kHighPrioritySuffix;
+    default: return "";
+  }
+}
+
+Priority PriorityOfFile(absl::string_view file_name) {
+  if (absl::EndsWith(file_name, kLowPrioritySuffix)) {
+    return Priority::kLow;
+  }
+  if (absl::EndsWith(file_name, kHighPrioritySuffix)) {
+    return Priority::kHigh;
+  }
+  return Priority::kNormal;
+}
+
+// Splits the name of a file spooled by FsSpoolWriter into the writer's ID and
+// the file's sequence number. Any other name is treated as the only file of a
+// writer of its own.
+std::pair<std::string, uint64_t> ParseSpooledFileName(
+    absl::string_view file_name) {
+  std::pair<absl::string_view, absl::string_view> parts =
+      absl::StrSplit(file_name, absl::MaxSplits('_', 1));
+  absl::string_view sequence = parts.second;
+  if (size_t dot = sequence.find('.'); dot != absl::string_view::npos) {
+    sequence = sequence.substr(0, dot);
+  }
+  uint64_t sequence_number;
+  if (parts.first.empty() || !absl::SimpleAtoi(sequence, &sequence_number)) {
+    return {std::string(file_name), 0};
+  }
+  return {std::string(parts.first), sequence_number};
+}
+
+struct SpooledFile {
+  std::string name;
+  Priority priority;
+  absl::Time mtime;
+  size_t occupation;
+};
+
+// Returns the regular files in the given spool directory.
+absl::StatusOr<std::vector<SpooledFile>> ListSpooledFiles(
+    const std::string& dir) {
+  std::vector<SpooledFile> files;
+  absl::Status status =
+      IterateDirectory(dir, [&dir, &files](const std::string& file_name) {
+        std::string file_path = absl::StrCat(dir, PathSeparator(), file_name);
+        struct stat stats;
+        if (stat(file_path.c_str(), &stats) < 0 ||
+            !StatIsReg(stats.st_mode)) {
+          return;
+        }
+        files.push_back({file_name, PriorityOfFile(file_name),
+                         absl::TimeFromTimespec(stats.st_mtimespec),
+                         EstimateDiskOccupation(stats.st_size)});
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  return files;
+}
+
+// Returns the disk occupation of each class in the given spool directory.
+absl::StatusOr<std::array<size_t, kNumPriorities>> EstimateClassSizes(
+    const std::string& dir) {
+  absl::StatusOr<std::vector<SpooledFile>> files = ListSpooledFiles(dir);
+  if (!files.ok()) {
+    return files.status();
+  }
+  std::array<size_t, kNumPriorities> class_sizes = {};
+  for (const SpooledFile& file : *files) {
+    class_sizes[static_cast<size_t>(file.priority)] += file.occupation;
+  }
+  return class_sizes;
+}
+
+void EncodeFixed32(char* buf, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+uint32_t DecodeFixed32(const char* buf) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(buf[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+uint32_t Checksum(absl::string_view data) {
+  return static_cast<uint32_t>(absl::ComputeCrc32c(data));
+}
+
+std::string SegmentDirectory(absl::string_view base_dir) {
+  return absl::StrCat(base_dir, PathSeparator(), kSegmentDirName);
+}
+
+std::string SegmentPath(const std::string& segment_dir, uint64_t segment) {
+  return absl::StrFormat("%s%s%020d%s", segment_dir, PathSeparator(), segment,
+                         kSegmentSuffix);
+}
+
+std::string CheckpointPath(absl::string_view base_dir) {
+  return absl::StrCat(base_dir, PathSeparator(), kCheckpointName);
+}
+
+// Returns the numbers of the segments in the given directory, in order.
+absl::StatusOr<std::vector<uint64_t>> ListSegments(
+    const std::string& segment_dir) {
+  std::vector<uint64_t> segments;
+  absl::Status status = IterateDirectory(
+      segment_dir, [&segments](const std::string& file_name) {
+        absl::string_view name = file_name;
+        uint64_t segment;
+        if (absl::ConsumeSuffix(&name, kSegmentSuffix) &&
+            absl::SimpleAtoi(name, &segment)) {
+          segments.push_back(segment);
+        }
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+
+// The checkpoint is a single line holding the reader's segment and offset.
+// A missing checkpoint is the start of the spool.
+absl::Status ReadCheckpoint(const std::string& path, uint64_t* segment,
+                            uint64_t* offset) {
+  *segment = 0;
+  *offset = 0;
+  const int fd = Open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return absl::OkStatus();
+    }
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to open ", path));
+  }
+  char buf[64];
+  const int n = PRead(fd, buf, sizeof(buf), 0);
+  Close(fd);
+  if (n < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to read ", path));
+  }
+  std::vector<absl::string_view> fields = absl::StrSplit(
+      absl::string_view(buf, n), absl::ByAnyChar(" \n"), absl::SkipEmpty());
+  if (fields.size() != 2 || !absl::SimpleAtoi(fields[0], segment) ||
+      !absl::SimpleAtoi(fields[1], offset)) {
+    return absl::DataLossError(absl::StrCat("malformed checkpoint ", path));
+  }
+  return absl::OkStatus();
+}
+
 bool operator==(struct timespec a, struct timespec b) {
   return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
 }
 
 bool operator!=(struct timespec a, struct timespec b) { return !(a == b); }
 
+// Acks of files spooled before the counter was last reconciled may take it
+// below zero.
+size_t LoadSize(const std::atomic<int64_t>& counter) {
+  int64_t size = counter.load(std::memory_order_relaxed);
+  return size < 0 ? 0 : static_cast<size_t>(size);
+}
+
 }  // namespace
 
-FsSpoolWriter::FsSpoolWriter(absl::string_view base_dir, size_t max_spool_size)
+static_assert(std::atomic<int64_t>::is_always_lock_free,
+              "The shared size counter must be usable across processes");
+
+SpoolSizeCounter::SpoolSizeCounter(absl::string_view base_dir)
+    : path_(absl::StrCat(base_dir, PathSeparator(), kSizeCounterName)) {}
+
+SpoolSizeCounter::~SpoolSizeCounter() {
+  if (counters_) {
+    Unmap(counters_, kNumCounters * sizeof(*counters_));
+  }
+}
+
+absl::Status SpoolSizeCounter::Open(bool create) {
+  const int fd =
+      fsspool::Open(path_.c_str(), create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return absl::NotFoundError(absl::StrCat(path_, " doesn't exist"));
+    }
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to open ", path_));
+  }
+  // A new counter file is empty. Extending it zero-fills it, and concurrent
+  // writers extending it to the same size is harmless.
+  const size_t size = kNumCounters * sizeof(*counters_);
+  struct stat stats;
+  if (fstat(fd, &stats) < 0 ||
+      (stats.st_size < static_cast<off_t>(size) && Truncate(fd, size) < 0)) {
+    absl::Status status =
+        absl::ErrnoToStatus(errno, absl::StrCat("failed to size ", path_));
+    Close(fd);
+    return status;
+  }
+  void* addr = MapShared(fd, size);
+  Close(fd);
+  if (addr == nullptr) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to map ", path_));
+  }
+  counters_ = static_cast<std::atomic<int64_t>*>(addr);
+  return absl::OkStatus();
+}
+
+size_t SpoolSizeCounter::Get() const { return LoadSize(counters_[0]); }
+
+size_t SpoolSizeCounter::Get(Priority priority) const {
+  return LoadSize(counters_[1 + static_cast<size_t>(priority)]);
+}
+
+void SpoolSizeCounter::Add(Priority priority, int64_t delta) {
+  counters_[0].fetch_add(delta, std::memory_order_relaxed);
+  counters_[1 + static_cast<size_t>(priority)].fetch_add(
+      delta, std::memory_order_relaxed);
+}
+
+void SpoolSizeCounter::Set(
+    const std::array<size_t, kNumPriorities>& class_sizes) {
+  size_t total = 0;
+  for (size_t i = 0; i < kNumPriorities; i++) {
+    counters_[1 + i].store(static_cast<int64_t>(class_sizes[i]),
+                           std::memory_order_relaxed);
+    total += class_sizes[i];
+  }
+  counters_[0].store(static_cast<int64_t>(total), std::memory_order_relaxed);
+}
+
+FsSpoolWriter::FsSpoolWriter(absl::string_view base_dir, size_t max_spool_size,
+                             std::array<size_t, kNumPriorities> class_budgets)
     : base_dir_(base_dir),
       spool_dir_(SpoolDirectory(base_dir)),
       tmp_dir_(absl::StrCat(base_dir, PathSeparator(), kTmpDirName)),
       max_spool_size_(max_spool_size),
+      class_budgets_(class_budgets),
       id_(absl::StrFormat("%016x", absl::Uniform<uint64_t>(
                                        absl::BitGen(), 0,
                                        std::numeric_limits<uint64_t>::max()))),
       // Guess that the spool is full during construction, so we will recompute
       // the actual spool size on the first write.
-      spool_size_estimate_(max_spool_size + 1) {}
+      spool_size_estimate_(max_spool_size + 1),
+      // Likewise, guess that every class is at its budget.
+      class_size_estimates_(class_budgets),
+      size_counter_(base_dir) {}
 
 absl::Status FsSpoolWriter::BuildDirectoryStructureIfNeeded() {
   if (!IsDirectory(spool_dir_)) {
@@ -198,8 +461,9 @@ absl::Status FsSpoolWriter::BuildDirectoryStructureIfNeeded() {
   return absl::OkStatus();
 }
 
-std::string FsSpoolWriter::UniqueFilename() {
-  std::string result = absl::StrFormat("%s_%020d", id_, sequence_number_);
+std::string FsSpoolWriter::UniqueFilename(Priority priority) {
+  std::string result = absl::StrFormat("%s_%020d%s", id_, sequence_number_,
+                                       PrioritySuffix(priority));
   sequence_number_++;
   return result;
 }
@@ -223,30 +487,207 @@ absl::StatusOr<size_t> FsSpoolWriter::EstimateSpoolDirSize() {
   }
 }
 
+bool FsSpoolWriter::OverClassBudget(Priority priority, size_t class_size,
+                                    size_t occupation) const {
+  const size_t budget = class_budgets_[static_cast<size_t>(priority)];
+  return budget > 0 && class_size + occupation > budget;
+}
+
+absl::StatusOr<size_t> FsSpoolWriter::SharedSpoolSize(Priority priority,
+                                                      size_t occupation) {
+  struct stat stats;
+  if (stat(spool_dir_.c_str(), &stats) < 0) {
+    return absl::ErrnoToStatus(errno, "failed to stat spool directory");
+  }
+  absl::Time now = absl::Now();
+  bool reconcile = now - size_counter_reconciled_ >=
+                   kSizeCounterReconcileInterval;
+  bool full = size_counter_.Get() > max_spool_size_ ||
+              OverClassBudget(priority, size_counter_.Get(priority),
+                              occupation);
+  if (!reconcile && full &&
+      now - size_counter_reconciled_ >= kSizeCounterFullReconcileInterval) {
+    // Consumers which remove files without an FsSpoolReader don't update the
+    // counter, so don't trust it to be full if the spool has changed since it
+    // was last reconciled.
+    reconcile = stats.st_mtimespec != spool_dir_last_mtime_;
+  }
+  if (reconcile) {
+    // Writes and acks racing with the scan may be missed or counted twice,
+    // which the next reconciliation corrects.
+    spool_dir_last_mtime_ = stats.st_mtimespec;
+    absl::StatusOr<std::array<size_t, kNumPriorities>> class_sizes =
+        EstimateClassSizes(spool_dir_);
+    if (!class_sizes.ok()) {
+      return class_sizes.status();
+    }
+    size_counter_.Set(*class_sizes);
+    size_counter_reconciled_ = now;
+  }
+  return size_counter_.Get();
+}
+
+absl::StatusOr<size_t> FsSpoolWriter::SpoolSize(Priority priority,
+                                                size_t occupation) {
+  if (size_counter_open_) {
+    return SharedSpoolSize(priority, occupation);
+  }
+  if (spool_size_estimate_ > max_spool_size_) {
+    // Recompute the spool size if we think we are
+    // over the limit.
+    absl::StatusOr<size_t> estimate = EstimateSpoolDirSize();
+    if (!estimate.ok()) {
+      return estimate.status();
+    }
+    spool_size_estimate_ = *estimate;
+  }
+  return spool_size_estimate_;
+}
+
+absl::StatusOr<size_t> FsSpoolWriter::ClassSize(Priority priority,
+                                                size_t occupation) {
+  if (size_counter_open_) {
+    // SpoolSize() has already reconciled the counter if need be.
+    return size_counter_.Get(priority);
+  }
+  const size_t klass = static_cast<size_t>(priority);
+  if (OverClassBudget(priority, class_size_estimates_[klass], occupation)) {
+    struct stat stats;
+    if (stat(spool_dir_.c_str(), &stats) < 0) {
+      return absl::ErrnoToStatus(errno, "failed to stat spool directory");
+    }
+    // If nothing was removed from the spool since the last scan, the class
+    // is still over its budget.
+    if (stats.st_mtimespec != class_sizes_last_mtime_) {
+      class_sizes_last_mtime_ = stats.st_mtimespec;
+      absl::StatusOr<std::array<size_t, kNumPriorities>> class_sizes =
+          EstimateClassSizes(spool_dir_);
+      if (!class_sizes.ok()) {
+        return class_sizes.status();
+      }
+      class_size_estimates_ = *class_sizes;
+    }
+  }
+  return class_size_estimates_[klass];
+}
+
+absl::Status FsSpoolWriter::EvictBelow(Priority priority, size_t needed) {
+  // Don't scan the spool when the lower classes can't make room anyway, such
+  // as for the lowest class. Without the shared counter, only the lowest
+  // class is known to have nothing below it.
+  size_t evictable_size = 0;
+  if (size_counter_open_) {
+    for (size_t i = 0; i < static_cast<size_t>(priority); i++) {
+      evictable_size += size_counter_.Get(static_cast<Priority>(i));
+    }
+  }
+  if (priority == Priority::kLow ||
+      (size_counter_open_ && evictable_size < needed)) {
+    return absl::UnavailableError(
+        "Spool size estimate greater than max allowed");
+  }
+
+  absl::StatusOr<std::vector<SpooledFile>> files = ListSpooledFiles(spool_dir_);
+  if (!files.ok()) {
+    return files.status();
+  }
+  std::vector<SpooledFile> evictable;
+  for (SpooledFile& file : *files) {
+    if (file.priority < priority) {
+      evictable.push_back(std::move(file));
+    }
+  }
+  std::sort(evictable.begin(), evictable.end(),
+            [](const SpooledFile& a, const SpooledFile& b) {
+              return std::tie(a.priority, a.mtime, a.name) <
+                     std::tie(b.priority, b.mtime, b.name);
+            });
+  size_t evicting = 0;
+  size_t n = 0;
+  while (n < evictable.size() && evicting < needed) {
+    evicting += evictable[n++].occupation;
+  }
+  if (evicting < needed) {
+    return absl::UnavailableError(
+        "Spool size estimate greater than max allowed");
+  }
+
+  // Files which were removed concurrently, e.g. acked by a reader, were
+  // already subtracted from the shared counter.
+  size_t freed = 0;
+  absl::Status status = absl::OkStatus();
+  std::array<size_t, kNumPriorities> class_freed = {};
+  for (size_t i = 0; i < n; i++) {
+    const SpooledFile& file = evictable[i];
+    std::string path = absl::StrCat(spool_dir_, PathSeparator(), file.name);
+    if (Unlink(path.c_str()) < 0) {
+      if (errno != ENOENT) {
+        status = absl::ErrnoToStatus(errno, absl::StrCat("failed to evict ",
+                                                         path));
+        break;
+      }
+      continue;
+    }
+    freed += file.occupation;
+    class_freed[static_cast<size_t>(file.priority)] += file.occupation;
+  }
+  for (size_t i = 0; i < kNumPriorities; i++) {
+    if (size_counter_open_ && class_freed[i] > 0) {
+      size_counter_.Add(static_cast<Priority>(i),
+                        -static_cast<int64_t>(class_freed[i]));
+    }
+    class_size_estimates_[i] -= std::min(class_size_estimates_[i],
+                                         class_freed[i]);
+  }
+  spool_size_estimate_ -= std::min(spool_size_estimate_, freed);
+  return status;
+}
+
 absl::Status FsSpoolWriter::WriteMessage(absl::string_view msg) {
+  return WritePrioritizedMessage(msg, Priority::kNormal);
+}
+
+absl::Status FsSpoolWriter::WritePrioritizedMessage(absl::string_view msg,
+                                                    Priority priority) {
   if (absl::Status status = BuildDirectoryStructureIfNeeded(); !status.ok()) {
     return status;  // << "can't create directory structure for writer";
   }
+  if (!size_counter_open_) {
+    // Fall back to estimating the spool size locally if the shared counter
+    // can't be used.
+    size_counter_open_ = size_counter_.Open(/*create=*/true).ok();
+  }
   // Flush messages to a file in the temporary directory.
-  const std::string fname = UniqueFilename();
+  const std::string fname = UniqueFilename(priority);
   const std::string tmp_file = absl::StrCat(tmp_dir_, PathSeparator(), fname);
   const std::string spool_file =
       absl::StrCat(spool_dir_, PathSeparator(), fname);
-  // Recompute the spool size if we think we are
-  // over the limit.
-  if (spool_size_estimate_ > max_spool_size_) {
-    absl::StatusOr<size_t> estimate = EstimateSpoolDirSize();
-    if (!estimate.ok()) {
-      return estimate.status();  // failed to recompute spool size
+  const size_t occupation = EstimateDiskOccupation(msg.size());
+  const size_t klass = static_cast<size_t>(priority);
+  absl::StatusOr<size_t> size = SpoolSize(priority, occupation);
+  if (!size.ok()) {
+    return size.status();  // failed to compute spool size
+  }
+  if (class_budgets_[klass] > 0) {
+    absl::StatusOr<size_t> class_size = ClassSize(priority, occupation);
+    if (!class_size.ok()) {
+      return class_size.status();  // failed to compute class size
     }
-    spool_size_estimate_ = *estimate;
-    if (spool_size_estimate_ > max_spool_size_) {
-      // Still over the limit: avoid writing.
+    if (OverClassBudget(priority, *class_size, occupation)) {
       return absl::UnavailableError(
-          "Spool size estimate greater than max allowed");
+          "Spool class size estimate greater than its budget");
+    }
+  }
+  if (*size > max_spool_size_) {
+    // Over the limit: only write if evicting lower classes brings the spool
+    // back within it.
+    if (absl::Status status = EvictBelow(priority, *size - max_spool_size_);
+        !status.ok()) {
+      return status;
     }
   }
-  spool_size_estimate_ += EstimateDiskOccupation(msg.size());
+  spool_size_estimate_ += occupation;
+  class_size_estimates_[klass] += occupation;
 
   if (absl::Status status = WriteTmpFile(tmp_file, msg); !status.ok()) {
     return status;  // writing to temporary file
@@ -256,24 +697,72 @@ absl::Status FsSpoolWriter::WriteMessage(absl::string_view msg) {
     return status;  // "moving tmp_file to the spooling area
   }
 
+  if (size_counter_open_) {
+    size_counter_.Add(priority, occupation);
+  }
   return absl::OkStatus();
 }
 
 FsSpoolReader::FsSpoolReader(absl::string_view base_directory)
-    : base_dir_(base_directory), spool_dir_(SpoolDirectory(base_directory)) {}
+    : base_dir_(base_directory),
+      spool_dir_(SpoolDirectory(base_directory)),
+      size_counter_(base_directory) {}
 
 int FsSpoolReader::NumberOfUnackedMessages() const {
   return unacked_messages_.size();
 }
 
 absl::Status FsSpoolReader::AckMessage(const std::string& message_path) {
-  int remove_status = remove(message_path.c_str());
-  if ((remove_status != 0) && (errno != ENOENT)) {
-    return absl::ErrnoToStatus(
-        errno,
-        absl::Substitute("Failed to remove $0: $1", message_path, errno));
+  return AckMessages(absl::MakeConstSpan(&message_path, 1));
+}
+
+absl::Status FsSpoolReader::AckMessages(
+    absl::Span<const std::string> message_paths) {
+  // Removing the messages changes the spool directory's mtime. If nothing else
+  // changed it since the last rescan, remember the new mtime so that draining
+  // the spool doesn't rescan the directory after every message. A file added
+  // concurrently may be missed until the next change, or until the index
+  // runs dry.
+  struct stat stats;
+  bool unchanged = stat(spool_dir_.c_str(), &stats) == 0 &&
+                   stats.st_mtimespec == spool_dir_last_mtime_;
+
+  if (!size_counter_open_) {
+    // Writers create the counter, so it is fine for it not to exist (yet).
+    size_counter_open_ = size_counter_.Open(/*create=*/false).ok();
+  }
+  std::array<int64_t, kNumPriorities> removed_sizes = {};
+  absl::Status status = absl::OkStatus();
+  for (const std::string& message_path : message_paths) {
+    struct stat message_stats;
+    bool have_size = size_counter_open_ &&
+                     stat(message_path.c_str(), &message_stats) == 0;
+
+    int remove_status = remove(message_path.c_str());
+    if ((remove_status != 0) && (errno != ENOENT)) {
+      status = absl::ErrnoToStatus(
+          errno,
+          absl::Substitute("Failed to remove $0: $1", message_path, errno));
+      break;
+    }
+    unacked_messages_.erase(message_path);
+    if (have_size && remove_status == 0) {
+      removed_sizes[static_cast<size_t>(PriorityOfFile(message_path))] +=
+          EstimateDiskOccupation(message_stats.st_size);
+    }
+  }
+  for (size_t i = 0; i < kNumPriorities; i++) {
+    if (removed_sizes[i] > 0) {
+      size_counter_.Add(static_cast<Priority>(i), -removed_sizes[i]);
+    }
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (unchanged && stat(spool_dir_.c_str(), &stats) == 0) {
+    spool_dir_last_mtime_ = stats.st_mtimespec;
   }
-  unacked_messages_.erase(message_path);
   return absl::OkStatus();
 }
 
@@ -286,43 +775,375 @@ absl::StatusOr<std::string> FsSpoolReader::NextMessagePath() {
   return file_path;
 }
 
+absl::StatusOr<std::vector<std::string>> FsSpoolReader::NextMessagePaths(
+    size_t max_messages) {
+  std::vector<std::string> file_paths;
+  while (file_paths.size() < max_messages) {
+    absl::StatusOr<std::string> file_path = OldestSpooledFile();
+    if (!file_path.ok()) {
+      if (absl::IsNotFound(file_path.status()) && !file_paths.empty()) {
+        break;
+      }
+      return file_path.status();
+    }
+    unacked_messages_.insert(*file_path);
+    file_paths.push_back(*std::move(file_path));
+  }
+  return file_paths;
+}
+
 absl::StatusOr<std::string> FsSpoolReader::OldestSpooledFile() {
-  if (!IsDirectory(spool_dir_)) {
+  struct stat stats;
+  if (stat(spool_dir_.c_str(), &stats) < 0 || !StatIsDir(stats.st_mode)) {
     return absl::NotFoundError(
         "Spool directory is not a directory or it doesn't exist.");
   }
-  absl::Time oldest_file_mtime;
-  std::string oldest_file_path;
-  absl::Status status = IterateDirectory(
-      spool_dir_, [this, &oldest_file_path,
-                   &oldest_file_mtime](const std::string& file_name) {
-        std::string file_path =
-            absl::StrCat(spool_dir_, PathSeparator(), file_name);
-        struct stat stats;
-        if (stat(file_path.c_str(), &stats) < 0) {
-          return;
-        }
-        if (!StatIsReg(stats.st_mode)) {
+  if (index_.empty() || stats.st_mtimespec != spool_dir_last_mtime_) {
+    // Record the mtime before scanning, so that changes made during the scan
+    // trigger another one.
+    spool_dir_last_mtime_ = stats.st_mtimespec;
+    if (absl::Status status = RescanSpoolDirectory(); !status.ok()) {
+      return status;
+    }
+  }
+
+  if (index_.empty()) {
+    return absl::NotFoundError("Empty FsSpool directory.");
+  }
+  auto oldest = index_.begin();
+  std::string oldest_file_path =
+      absl::StrCat(spool_dir_, PathSeparator(), oldest->second);
+  indexed_files_.erase(oldest->second);
+  index_.erase(oldest);
+  return oldest_file_path;
+}
+
+absl::Status FsSpoolReader::RescanSpoolDirectory() {
+  scan_++;
+  absl::Status status =
+      IterateDirectory(spool_dir_, [this](const std::string& file_name) {
+        // Only files new to the index need to be stat'd.
+        if (auto it = indexed_files_.find(file_name);
+            it != indexed_files_.end()) {
+          it->second.scan = scan_;
           return;
         }
+        std::string file_path =
+            absl::StrCat(spool_dir_, PathSeparator(), file_name);
         if (unacked_messages_.contains(file_path)) {
           return;
         }
-        absl::Time file_mtime = absl::FromTimeT(stats.st_mtime);
-        if (!oldest_file_path.empty() && oldest_file_mtime < file_mtime) {
-          return;
+        auto [writer_id, sequence_number] = ParseSpooledFileName(file_name);
+        // Only the first file seen of each writer needs to be stat'd, to rank
+        // the writer. The rest were written to the spool the same way.
+        auto writer = writer_ranks_.find(writer_id);
+        if (writer == writer_ranks_.end()) {
+          struct stat stats;
+          if (stat(file_path.c_str(), &stats) < 0 ||
+              !StatIsReg(stats.st_mode)) {
+            return;
+          }
+          writer = writer_ranks_
+                       .emplace(writer_id,
+                                absl::TimeFromTimespec(stats.st_mtimespec))
+                       .first;
         }
-        oldest_file_path = file_path;
-        oldest_file_mtime = file_mtime;
+        IndexKey key{writer->second, std::move(writer_id), sequence_number};
+        index_.emplace(key, file_name);
+        indexed_files_.emplace(file_name,
+                               IndexedFile{std::move(key), scan_});
       });
   if (!status.ok()) {
     return status;
   }
 
-  if (oldest_file_path.empty()) {
-    return absl::NotFoundError("Empty FsSpool directory.");
+  // Forget files which were removed by someone else, and writers which have
+  // no files left in the index.
+  absl::flat_hash_set<absl::string_view> indexed_writers;
+  for (auto it = indexed_files_.begin(); it != indexed_files_.end();) {
+    if (it->second.scan != scan_) {
+      index_.erase(it->second.key);
+      indexed_files_.erase(it++);
+    } else {
+      indexed_writers.insert(std::get<1>(it->second.key));
+      it++;
+    }
   }
-  return oldest_file_path;
+  for (auto it = writer_ranks_.begin(); it != writer_ranks_.end();) {
+    if (!indexed_writers.contains(it->first)) {
+      writer_ranks_.erase(it++);
+    } else {
+      it++;
+    }
+  }
+  return absl::OkStatus();
+}
+
+FsSpoolSegmentWriter::FsSpoolSegmentWriter(absl::string_view base_dir,
+                                           size_t max_spool_size,
+                                           size_t max_segment_size)
+    : base_dir_(base_dir),
+      segment_dir_(SegmentDirectory(base_dir)),
+      max_spool_size_(max_spool_size),
+      max_segment_size_(max_segment_size),
+      // As with FsSpoolWriter, force the spool size to be computed on the
+      // first write.
+      spool_size_estimate_(max_spool_size + 1) {}
+
+FsSpoolSegmentWriter::~FsSpoolSegmentWriter() {
+  if (fd_ >= 0) {
+    Close(fd_);
+  }
+}
+
+absl::Status FsSpoolSegmentWriter::BuildDirectoryStructureIfNeeded() {
+  if (!IsDirectory(segment_dir_)) {
+    if (!IsDirectory(base_dir_)) {
+      if (absl::Status status = MkDir(base_dir_); !status.ok()) {
+        return status;  // failed to create base directory
+      }
+    }
+    if (absl::Status status = MkDir(segment_dir_); !status.ok()) {
+      return status;  // failed to create segment directory
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> FsSpoolSegmentWriter::EstimateSpoolDirSize() {
+  // Appending to a segment doesn't change the directory's mtime, but starting
+  // one or the reader removing one does. Appends are accounted for in the
+  // estimate as they are written.
+  struct stat stats;
+  if (stat(segment_dir_.c_str(), &stats) < 0) {
+    return absl::ErrnoToStatus(errno, "failed to stat segment directory");
+  }
+  if (stats.st_mtimespec != segment_dir_last_mtime_) {
+    segment_dir_last_mtime_ = stats.st_mtimespec;
+    return EstimateDirSize(segment_dir_);
+  }
+  return spool_size_estimate_;
+}
+
+absl::Status FsSpoolSegmentWriter::OpenNextSegment() {
+  if (fd_ >= 0) {
+    Close(fd_);
+    fd_ = -1;
+  }
+  if (segment_ == 0) {
+    // Continue after both the newest segment on disk and the reader's
+    // checkpoint, so that segment numbers are never reused even once the
+    // reader has removed every segment.
+    absl::StatusOr<std::vector<uint64_t>> segments = ListSegments(segment_dir_);
+    if (!segments.ok()) {
+      return segments.status();
+    }
+    uint64_t checkpoint_segment, checkpoint_offset;
+    if (absl::Status status = ReadCheckpoint(
+            CheckpointPath(base_dir_), &checkpoint_segment, &checkpoint_offset);
+        !status.ok()) {
+      return status;
+    }
+    segment_ = checkpoint_segment;
+    if (!segments->empty()) {
+      segment_ = std::max(segment_, segments->back());
+    }
+  }
+  segment_++;
+
+  const std::string path = SegmentPath(segment_dir_, segment_);
+  fd_ = Open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0400);
+  if (fd_ < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to create ", path));
+  }
+  segment_size_ = 0;
+  return absl::OkStatus();
+}
+
+absl::Status FsSpoolSegmentWriter::WriteMessage(absl::string_view msg) {
+  if (msg.size() > kMaxRecordSize) {
+    return absl::InvalidArgumentError("Message too large for a segment record");
+  }
+  if (absl::Status status = BuildDirectoryStructureIfNeeded(); !status.ok()) {
+    return status;  // can't create directory structure for writer
+  }
+  if (spool_size_estimate_ > max_spool_size_) {
+    absl::StatusOr<size_t> estimate = EstimateSpoolDirSize();
+    if (!estimate.ok()) {
+      return estimate.status();  // failed to recompute spool size
+    }
+    spool_size_estimate_ = *estimate;
+    if (spool_size_estimate_ > max_spool_size_) {
+      // Still over the limit: avoid writing.
+      return absl::UnavailableError(
+          "Spool size estimate greater than max allowed");
+    }
+  }
+  if (fd_ < 0 || segment_size_ >= max_segment_size_) {
+    if (absl::Status status = OpenNextSegment(); !status.ok()) {
+      return status;
+    }
+  }
+
+  // Write the header and payload with a single call, so that a record is
+  // only ever torn by a crash or a full disk.
+  record_.resize(kRecordHeaderSize + msg.size());
+  EncodeFixed32(record_.data(), static_cast<uint32_t>(msg.size()));
+  EncodeFixed32(record_.data() + 4, Checksum(msg));
+  std::copy(msg.begin(), msg.end(), record_.begin() + kRecordHeaderSize);
+  if (absl::Status status = WriteBuffer(fd_, record_); !status.ok()) {
+    // The segment may now end with a partial record. Start a new segment on
+    // the next write so the reader can skip past it.
+    Close(fd_);
+    fd_ = -1;
+    return status;
+  }
+  segment_size_ += record_.size();
+  spool_size_estimate_ += record_.size();
+  return absl::OkStatus();
+}
+
+FsSpoolSegmentReader::FsSpoolSegmentReader(absl::string_view base_dir)
+    : base_dir_(base_dir),
+      segment_dir_(SegmentDirectory(base_dir)),
+      checkpoint_path_(CheckpointPath(base_dir)) {}
+
+FsSpoolSegmentReader::~FsSpoolSegmentReader() {
+  if (fd_ >= 0) {
+    Close(fd_);
+  }
+}
+
+void FsSpoolSegmentReader::SkipSegment() {
+  if (fd_ >= 0) {
+    Close(fd_);
+    fd_ = -1;
+  }
+  segment_++;
+  offset_ = 0;
+}
+
+absl::StatusOr<std::string> FsSpoolSegmentReader::NextMessage() {
+  if (!checkpoint_loaded_) {
+    if (absl::Status status =
+            ReadCheckpoint(checkpoint_path_, &segment_, &offset_);
+        !status.ok()) {
+      return status;
+    }
+    checkpoint_loaded_ = true;
+  }
+
+  // Set once the writer is known to have moved past the current segment.
+  bool segment_complete = false;
+  while (true) {
+    if (fd_ < 0) {
+      if (!IsDirectory(segment_dir_)) {
+        return absl::NotFoundError("Segment directory doesn't exist.");
+      }
+      absl::StatusOr<std::vector<uint64_t>> segments =
+          ListSegments(segment_dir_);
+      if (!segments.ok()) {
+        return segments.status();
+      }
+      auto it = std::lower_bound(segments->begin(), segments->end(), segment_);
+      if (it == segments->end()) {
+        return absl::NotFoundError("No spooled segments.");
+      }
+      if (*it != segment_) {
+        segment_ = *it;
+        offset_ = 0;
+      }
+      const std::string path = SegmentPath(segment_dir_, segment_);
+      fd_ = Open(path.c_str(), O_RDONLY, 0);
+      if (fd_ < 0) {
+        return absl::ErrnoToStatus(errno,
+                                   absl::StrCat("failed to open ", path));
+      }
+      segment_complete = false;
+    }
+
+    char header[kRecordHeaderSize];
+    const int n = PRead(fd_, header, sizeof(header), offset_);
+    if (n < 0) {
+      return absl::ErrnoToStatus(errno, "pread() failed");
+    }
+    if (n == static_cast<int>(sizeof(header))) {
+      const uint32_t size = DecodeFixed32(header);
+      const uint32_t checksum = DecodeFixed32(header + 4);
+      if (size > kMaxRecordSize) {
+        SkipSegment();
+        return absl::DataLossError("Corrupt segment record length");
+      }
+      std::string payload(size, '\0');
+      const int m = size == 0 ? 0
+                              : PRead(fd_, payload.data(), size,
+                                      offset_ + kRecordHeaderSize);
+      if (m < 0) {
+        return absl::ErrnoToStatus(errno, "pread() failed");
+      }
+      if (static_cast<uint32_t>(m) == size) {
+        // The length was plausible, so only this record's payload is bad and
+        // the next record still starts right after it.
+        offset_ += kRecordHeaderSize + size;
+        if (Checksum(payload) != checksum) {
+          return absl::DataLossError("Segment record checksum mismatch");
+        }
+        return payload;
+      }
+    }
+
+    // Reached the end of what has been written to this segment. If it's still
+    // the newest one, the writer may yet append to it. Otherwise read once
+    // more, to pick up anything appended just before the writer moved on,
+    // before advancing. Writers number segments sequentially, so only the
+    // next one needs to be checked.
+    if (!segment_complete) {
+      struct stat stats;
+      if (stat(SegmentPath(segment_dir_, segment_ + 1).c_str(), &stats) < 0) {
+        return absl::NotFoundError("Caught up with the writer.");
+      }
+      segment_complete = true;
+      continue;
+    }
+    const bool torn = n > 0;
+    SkipSegment();
+    if (torn) {
+      return absl::DataLossError("Truncated segment record");
+    }
+  }
+}
+
+absl::Status FsSpoolSegmentReader::Checkpoint() {
+  if (!checkpoint_loaded_) {
+    return absl::OkStatus();  // nothing has been read yet
+  }
+  const std::string tmp_path = absl::StrCat(checkpoint_path_, ".tmp");
+  if (absl::Status status = WriteTmpFile(
+          tmp_path, absl::StrFormat("%d %d\n", segment_, offset_));
+      !status.ok()) {
+    return status;
+  }
+  if (absl::Status status = RenameFile(tmp_path, checkpoint_path_);
+      !status.ok()) {
+    return status;
+  }
+
+  // Only remove segments once the checkpoint no longer refers to them.
+  absl::StatusOr<std::vector<uint64_t>> segments = ListSegments(segment_dir_);
+  if (!segments.ok()) {
+    return segments.status();
+  }
+  for (uint64_t segment : *segments) {
+    if (segment >= segment_) {
+      break;
+    }
+    const std::string path = SegmentPath(segment_dir_, segment);
+    if (Unlink(path.c_str()) < 0 && errno != ENOENT) {
+      return absl::ErrnoToStatus(errno,
+                                 absl::StrCat("failed to remove ", path));
+    }
+  }
+  return absl::OkStatus();
 }
 
 }  // namespace fsspool
@@ -18,34 +18,120 @@
 // Namespace ::fsspool::fsspool implements a filesystem-backed message spool, to
 // use as a lock-free IPC mechanism.
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 
 // Forward declarations
 namespace fsspool {
+class FsSpoolReaderPeer;
 class FsSpoolWriterPeer;
 }
 
 namespace fsspool {
 
-// Enqueues messages into the spool. Multiple concurrent writers can
-// write to the same directory. (Note that this class is only thread-compatible
-// and not thread-safe though!)
-class FsSpoolWriter {
+// Retention classes of spooled messages, in increasing order of importance.
+// Spool layouts which support them evict lower classes first once full.
+enum class Priority : uint8_t {
+  kLow = 0,
+  kNormal = 1,
+  kHigh = 2,
+};
+constexpr size_t kNumPriorities = 3;
+
+// A running estimate of the disk space used by a spool, in total and by each
+// retention class, shared by its writers and reader through a small
+// memory-mapped counter file in the base directory. Writers add to it as they
+// spool messages and the reader subtracts from it as it acks them, so checking
+// the spool size or a class budget doesn't need a directory walk. Updates are
+// lost if a process dies mid-write, so writers periodically reconcile the
+// counter with a full scan.
+//
+// This class is thread-safe.
+class SpoolSizeCounter {
+ public:
+  explicit SpoolSizeCounter(absl::string_view base_dir);
+  ~SpoolSizeCounter();
+
+  SpoolSizeCounter(const SpoolSizeCounter&) = delete;
+  SpoolSizeCounter& operator=(const SpoolSizeCounter&) = delete;
+
+  // Map the counter file. If create is set, the file is created if needed, in
+  // which case the counter starts at zero. Otherwise a missing file is
+  // absl::NotFoundError. Must be called before any other method.
+  absl::Status Open(bool create);
+
+  // The size of the whole spool, and of the given class.
+  size_t Get() const;
+  size_t Get(Priority priority) const;
+  // Adds to the size of the given class, and to the total.
+  void Add(Priority priority, int64_t delta);
+  void Set(const std::array<size_t, kNumPriorities>& class_sizes);
+
+ private:
+  // The total, followed by the size of each class. Counter files written
+  // before there were classes only hold the total, and are extended with
+  // zeroed class sizes until the next reconciliation.
+  static constexpr size_t kNumCounters = 1 + kNumPriorities;
+
+  const std::string path_;
+  std::atomic<int64_t>* counters_ = nullptr;
+};
+
+// Enqueues messages into a spool. Implemented by each of the spool layouts.
+class SpoolWriter {
+ public:
+  virtual ~SpoolWriter() = default;
+
+  // Pushes the given byte array to the spool. If the spool gets full, returns
+  // the UNAVAILABLE canonical code (which is retryable).
+  virtual absl::Status WriteMessage(absl::string_view msg) = 0;
+
+  // As WriteMessage(), for a message of the given retention class. Layouts
+  // without retention classes spool every message alike.
+  virtual absl::Status WritePrioritizedMessage(absl::string_view msg,
+                                               Priority priority) {
+    return WriteMessage(msg);
+  }
+};
+
+// Enqueues messages into the spool, one file per message, maildir style.
+// Multiple concurrent writers can write to the same directory. (Note that this
+// class is only thread-compatible and not thread-safe though!)
+class FsSpoolWriter : public SpoolWriter {
  public:
   // The base, spool, and temporary directory will be created as needed on the
   // first call to Write() - however the base directory can be created into an
   // existing path (i.e. this class will not do an `mkdir -p`).
-  FsSpoolWriter(absl::string_view base_dir, size_t max_spool_size);
+  //
+  // Each retention class may occupy at most its entry of class_budgets, where
+  // zero leaves it only bounded by max_spool_size. Once the spool is full, the
+  // oldest messages of lower classes are evicted to make room for higher ones.
+  FsSpoolWriter(absl::string_view base_dir, size_t max_spool_size,
+                std::array<size_t, kNumPriorities> class_budgets = {});
 
   // Pushes the given byte array to the spool. The given maximum
   // spool size will be enforced. Returns an error code. If the spool gets full,
   // returns the UNAVAILABLE canonical code (which is retryable).
-  absl::Status WriteMessage(absl::string_view msg);
+  absl::Status WriteMessage(absl::string_view msg) override;
+
+  // As WriteMessage(). Also returns UNAVAILABLE if the class is over its
+  // budget, or if evicting lower classes can't make room for the message.
+  absl::Status WritePrioritizedMessage(absl::string_view msg,
+                                       Priority priority) override;
 
   friend class fsspool::FsSpoolWriterPeer;
 
@@ -53,7 +139,7 @@ class FsSpoolWriter {
   const std::string base_dir_;
   const std::string spool_dir_;
   const std::string tmp_dir_;
-  struct timespec spool_dir_last_mtime_;
+  struct timespec spool_dir_last_mtime_ = {};
 
   // Approximate maximum size of the spooling area, in bytes. If a message is
   // being written to a spooling area which already contains more than
@@ -63,6 +149,9 @@ class FsSpoolWriter {
   // final estimate is likely to still include the size of that file).
   const size_t max_spool_size_;
 
+  // Budget of each retention class, or zero for none.
+  const std::array<size_t, kNumPriorities> class_budgets_;
+
   // 64bit hex ID for this writer. Used in combination with the sequence
   // number to generate unique names for files. This is generated through
   // util::random::NewGlobalID(), hence has only 52 bits of randomness.
@@ -86,30 +175,205 @@ class FsSpoolWriter {
   // filesystem.
   absl::Status BuildDirectoryStructureIfNeeded();
 
+  // As spool_size_estimate_, for each retention class with a budget. Only
+  // used without the shared counter.
+  std::array<size_t, kNumPriorities> class_size_estimates_;
+
   // Generates a unique filename by combining the random ID of
-  // this writer with a sequence number.
-  std::string UniqueFilename();
+  // this writer with a sequence number. Classes other than kNormal are
+  // marked by a suffix.
+  std::string UniqueFilename(Priority priority);
 
   // Estimate the size of the spool directory. However, only recompute a new
   // estimate if the spool directory has has a change to its modification time.
   absl::StatusOr<size_t> EstimateSpoolDirSize();
+
+  // The spool size shared with other writers and the reader. Only used once
+  // it has been opened. Until then, and if opening it fails, the spool size
+  // is estimated as above.
+  SpoolSizeCounter size_counter_;
+  bool size_counter_open_ = false;
+  // When the shared counter was last reconciled with a scan of the spool.
+  absl::Time size_counter_reconciled_ = absl::InfinitePast();
+
+  // The spool directory's modification time when class_size_estimates_ was
+  // last recomputed. Only used without the shared counter.
+  struct timespec class_sizes_last_mtime_ = {};
+
+  // Returns the spool size from the shared counter, reconciling it first if
+  // it hasn't been recently. Claiming that the spool, or a message of the
+  // given class and occupation, doesn't fit may reconcile it early.
+  absl::StatusOr<size_t> SharedSpoolSize(Priority priority, size_t occupation);
+
+  // Returns the spool size, from the shared counter when there is one and
+  // from the local estimate otherwise.
+  absl::StatusOr<size_t> SpoolSize(Priority priority, size_t occupation);
+
+  // Returns the size of the given class, as SpoolSize(). The local estimate
+  // is only recomputed if it is over the class budget and the spool has
+  // changed since it last was.
+  absl::StatusOr<size_t> ClassSize(Priority priority, size_t occupation);
+
+  // Whether a message of the given class and occupation would take the class
+  // over its budget, if it has one, given the size of the class.
+  bool OverClassBudget(Priority priority, size_t class_size,
+                       size_t occupation) const;
+
+  // Removes the oldest messages of classes below the given one, lowest class
+  // first, until at least the given number of bytes has been freed. Nothing
+  // is removed, and UNAVAILABLE returned, if that many can't be freed. The
+  // spool is only scanned if the lower classes hold that many bytes.
+  absl::Status EvictBelow(Priority priority, size_t needed);
 };
 
+// Dequeues messages from the spool, oldest first.
+//
+// Spooled files are kept in an in-memory index keyed by the writer ID and
+// sequence number in their names, so each writer's messages are dequeued in
+// the order they were written. Writers are ordered by the modification time of
+// the first of their files the reader came across, which is the only file of
+// each writer that is stat'd. The spool directory is only rescanned when its
+// modification time changes, or when the index runs dry, so a dequeue is
+// O(log n) in the number of spooled files.
+//
 // This class is thread-unsafe.
 class FsSpoolReader {
  public:
   explicit FsSpoolReader(absl::string_view base_directory);
+  // Removes the message, and subtracts it from the spool's shared size
+  // counter if there is one.
   absl::Status AckMessage(const std::string& message_path);
+  // As AckMessage(), for each of the given messages.
+  absl::Status AckMessages(absl::Span<const std::string> message_paths);
   // Returns absl::NotFoundError in case the FsSpool is empty.
   absl::StatusOr<std::string> NextMessagePath();
+  // Returns up to max_messages paths, oldest first. Returns
+  // absl::NotFoundError in case the FsSpool is empty.
+  absl::StatusOr<std::vector<std::string>> NextMessagePaths(
+      size_t max_messages);
   int NumberOfUnackedMessages() const;
 
+  friend class fsspool::FsSpoolReaderPeer;
+
  private:
+  // The writer's rank, the writer's ID, and the file's sequence number.
+  using IndexKey = std::tuple<absl::Time, std::string, uint64_t>;
+
+  struct IndexedFile {
+    IndexKey key;
+    // The rescan which last saw this file in the spool directory.
+    uint64_t scan;
+  };
+
   const std::string base_dir_;
   const std::string spool_dir_;
   absl::flat_hash_set<std::string> unacked_messages_;
+  SpoolSizeCounter size_counter_;
+  bool size_counter_open_ = false;
+
+  // Spooled files which have not been handed out yet, oldest first, by name.
+  std::map<IndexKey, std::string> index_;
+  // The same files as index_, keyed by file name.
+  absl::flat_hash_map<std::string, IndexedFile> indexed_files_;
+  // The rank of each writer with files in the index.
+  absl::flat_hash_map<std::string, absl::Time> writer_ranks_;
+  // Modification time of the spool directory as of the last rescan.
+  struct timespec spool_dir_last_mtime_ = {};
+  uint64_t scan_ = 0;
 
   absl::StatusOr<std::string> OldestSpooledFile();
+
+  // Add new files in the spool directory to the index, and drop those which
+  // are no longer there.
+  absl::Status RescanSpoolDirectory();
+};
+
+// The segmented spool layout. Rather than a file per message, messages are
+// appended as records to rolling, append-only segment files:
+//
+//   <base_dir>/segments/00000000000000000001.seg
+//   <base_dir>/segments/00000000000000000002.seg
+//   <base_dir>/checkpoint
+//
+// Each record is the little-endian 32-bit payload length, the little-endian
+// CRC-32C of the payload, then the payload itself. The checkpoint holds the
+// reader's position, and segments are removed once the reader checkpoints
+// past them. Writing a message is a single append instead of creating,
+// writing and renaming a file, and the reader consumes segments sequentially.
+
+// Appends messages to a segmented spool. Only one writer may write to a
+// segmented spool at a time. This class is thread-compatible.
+class FsSpoolSegmentWriter : public SpoolWriter {
+ public:
+  static constexpr size_t kDefaultMaxSegmentSize = 8 * 1024 * 1024;
+
+  // The base and segment directories will be created as needed on the first
+  // call to WriteMessage(). A new segment is started once the current one
+  // reaches max_segment_size.
+  FsSpoolSegmentWriter(absl::string_view base_dir, size_t max_spool_size,
+                       size_t max_segment_size = kDefaultMaxSegmentSize);
+  ~FsSpoolSegmentWriter();
+
+  absl::Status WriteMessage(absl::string_view msg) override;
+
+ private:
+  const std::string base_dir_;
+  const std::string segment_dir_;
+  const size_t max_spool_size_;
+  const size_t max_segment_size_;
+
+  // The segment being appended to, or -1 before the first write and after a
+  // failed one.
+  int fd_ = -1;
+  uint64_t segment_ = 0;
+  size_t segment_size_ = 0;
+
+  // As for FsSpoolWriter, only recomputed when it exceeds max_spool_size_ and
+  // the segment directory has changed.
+  size_t spool_size_estimate_;
+  struct timespec segment_dir_last_mtime_ = {};
+
+  // Reused buffer holding the record being written.
+  std::string record_;
+
+  absl::Status BuildDirectoryStructureIfNeeded();
+  absl::StatusOr<size_t> EstimateSpoolDirSize();
+
+  // Close the current segment, if any, and start the next one.
+  absl::Status OpenNextSegment();
+};
+
+// Reads messages from a segmented spool, in the order they were written.
+// This class is thread-unsafe.
+class FsSpoolSegmentReader {
+ public:
+  explicit FsSpoolSegmentReader(absl::string_view base_dir);
+  ~FsSpoolSegmentReader();
+
+  // Returns the next message, or absl::NotFoundError once the reader has
+  // caught up with the writer. Returns absl::DataLossError if a corrupt or
+  // truncated record was found. Only that record is skipped if just its
+  // payload fails the checksum, but the rest of its segment is skipped if its
+  // length can't be trusted.
+  absl::StatusOr<std::string> NextMessage();
+
+  // Persist that every message returned so far has been processed, and remove
+  // the segments which are no longer needed. Messages returned after the last
+  // checkpoint are returned again by a new reader.
+  absl::Status Checkpoint();
+
+ private:
+  const std::string base_dir_;
+  const std::string segment_dir_;
+  const std::string checkpoint_path_;
+
+  bool checkpoint_loaded_ = false;
+  uint64_t segment_ = 0;
+  uint64_t offset_ = 0;
+  int fd_ = -1;
+
+  // Close the current segment and move on to the one after it.
+  void SkipSegment();
 };
 
 }  // namespace fsspool
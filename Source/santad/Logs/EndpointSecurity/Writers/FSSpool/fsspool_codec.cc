@@ -0,0 +1,242 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_codec.h"
+
+#include <zlib.h>
+
+#include <string>
+
+#include "absl/crc/crc32c.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace fsspool {
+
+namespace {
+
+constexpr absl::string_view kCodecMagic("\0SPB", 4);
+constexpr size_t kCodecHeaderSize = kCodecMagic.size() + 1 + 4;
+// Decoded sizes past this are assumed to be corruption.
+constexpr uint32_t kMaxDecodedSize = 256 * 1024 * 1024;
+
+// Starts each framed record. Readers search for it to resync after damage, so
+// it is long enough not to turn up by chance.
+constexpr absl::string_view kFrameMarker("\xf3\x9a\x5c\x2e\x81\xd7\x46\xbb", 8);
+constexpr size_t kFrameHeaderSize = kFrameMarker.size() + 4 + 4;
+
+// Field number and wire type of LogBatch.records.
+constexpr char kLogBatchRecordsTag = (1 << 3) | 2;
+
+void EncodeFixed32(char* buf, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+uint32_t DecodeFixed32(const char* buf) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(buf[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+void AppendFixed32(std::string* out, uint32_t value) {
+  char buf[4];
+  EncodeFixed32(buf, value);
+  out->append(buf, sizeof(buf));
+}
+
+bool ReadVarint(absl::string_view* data, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && !data->empty(); shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(data->front());
+    data->remove_prefix(1);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AppendVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+uint32_t Crc32c(absl::string_view data) {
+  return static_cast<uint32_t>(absl::ComputeCrc32c(data));
+}
+
+// Sizes the string for the codec header and the given payload size, and
+// writes the header.
+void InitEncoded(std::string* encoded, Codec codec, size_t decoded_size,
+                 size_t payload_size) {
+  encoded->assign(kCodecHeaderSize + payload_size, '\0');
+  encoded->replace(0, kCodecMagic.size(), kCodecMagic.data(),
+                   kCodecMagic.size());
+  (*encoded)[kCodecMagic.size()] = static_cast<char>(codec);
+  EncodeFixed32(encoded->data() + kCodecMagic.size() + 1,
+                static_cast<uint32_t>(decoded_size));
+}
+
+// Frames each record of a serialized LogBatch.
+absl::StatusOr<std::string> FrameRecords(absl::string_view batch) {
+  std::string framed;
+  InitEncoded(&framed, Codec::kFramed, batch.size(), 0);
+  while (!batch.empty()) {
+    uint64_t size;
+    if (batch.front() != kLogBatchRecordsTag) {
+      return absl::InvalidArgumentError("Batch isn't a LogBatch");
+    }
+    batch.remove_prefix(1);
+    if (!ReadVarint(&batch, &size) || size > batch.size()) {
+      return absl::InvalidArgumentError("Truncated LogBatch record");
+    }
+    absl::string_view record = batch.substr(0, size);
+    batch.remove_prefix(size);
+
+    framed.append(kFrameMarker.data(), kFrameMarker.size());
+    AppendFixed32(&framed, static_cast<uint32_t>(record.size()));
+    AppendFixed32(&framed, Crc32c(record));
+    framed.append(record.data(), record.size());
+  }
+  return framed;
+}
+
+// Rebuilds a serialized LogBatch from the intact framed records.
+std::string UnframeRecords(absl::string_view data, size_t* damaged_records) {
+  std::string batch;
+  size_t damaged = 0;
+  while (!data.empty()) {
+    if (data.size() >= kFrameHeaderSize &&
+        data.substr(0, kFrameMarker.size()) == kFrameMarker) {
+      const uint32_t size = DecodeFixed32(data.data() + kFrameMarker.size());
+      const uint32_t crc = DecodeFixed32(data.data() + kFrameMarker.size() + 4);
+      if (size <= data.size() - kFrameHeaderSize) {
+        absl::string_view record = data.substr(kFrameHeaderSize, size);
+        if (Crc32c(record) == crc) {
+          batch.push_back(kLogBatchRecordsTag);
+          AppendVarint(&batch, record.size());
+          batch.append(record.data(), record.size());
+          data.remove_prefix(kFrameHeaderSize + size);
+          continue;
+        }
+      }
+    }
+    // Skip to the next record which may be intact.
+    damaged++;
+    size_t next = data.find(kFrameMarker, 1);
+    if (next == absl::string_view::npos) {
+      break;
+    }
+    data.remove_prefix(next);
+  }
+  if (damaged_records) {
+    *damaged_records = damaged;
+  }
+  return batch;
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> EncodeBatch(absl::string_view batch,
+                                        Codec codec) {
+  switch (codec) {
+    case Codec::kNone:
+      return std::string(batch);
+    case Codec::kZlib:
+      break;
+    case Codec::kFramed:
+      if (batch.size() > kMaxDecodedSize) {
+        return absl::InvalidArgumentError("Batch too large to encode");
+      }
+      return FrameRecords(batch);
+    default:
+      return absl::InvalidArgumentError("Unknown codec");
+  }
+  if (batch.size() > kMaxDecodedSize) {
+    return absl::InvalidArgumentError("Batch too large to encode");
+  }
+
+  uLongf compressed_size = compressBound(batch.size());
+  std::string encoded;
+  InitEncoded(&encoded, codec, batch.size(), compressed_size);
+
+  int ret = compress2(
+      reinterpret_cast<Bytef*>(encoded.data() + kCodecHeaderSize),
+      &compressed_size, reinterpret_cast<const Bytef*>(batch.data()),
+      batch.size(), Z_BEST_SPEED);
+  if (ret != Z_OK) {
+    return absl::InternalError(absl::StrCat("compress2() failed: ", ret));
+  }
+  encoded.resize(kCodecHeaderSize + compressed_size);
+  return encoded;
+}
+
+bool HasCodecHeader(absl::string_view data) {
+  return data.substr(0, kCodecMagic.size()) == kCodecMagic;
+}
+
+absl::StatusOr<std::string> DecodeBatch(absl::string_view data,
+                                        size_t* damaged_records) {
+  if (damaged_records) {
+    *damaged_records = 0;
+  }
+  if (!HasCodecHeader(data)) {
+    return std::string(data);
+  }
+  if (data.size() < kCodecHeaderSize) {
+    return absl::DataLossError("Truncated codec header");
+  }
+  const Codec codec = static_cast<Codec>(data[kCodecMagic.size()]);
+  const uint32_t decoded_size =
+      DecodeFixed32(data.data() + kCodecMagic.size() + 1);
+  data.remove_prefix(kCodecHeaderSize);
+
+  switch (codec) {
+    case Codec::kNone:
+      return std::string(data);
+    case Codec::kZlib:
+      break;
+    case Codec::kFramed:
+      return UnframeRecords(data, damaged_records);
+    default:
+      return absl::UnimplementedError(
+          absl::StrCat("Unknown codec: ", static_cast<int>(codec)));
+  }
+  if (decoded_size > kMaxDecodedSize) {
+    return absl::DataLossError("Decoded batch size too large");
+  }
+
+  std::string decoded(decoded_size, '\0');
+  uLongf size = decoded_size;
+  int ret = uncompress(reinterpret_cast<Bytef*>(decoded.data()), &size,
+                       reinterpret_cast<const Bytef*>(data.data()),
+                       data.size());
+  if (ret != Z_OK || size != decoded_size) {
+    return absl::DataLossError(absl::StrCat("uncompress() failed: ", ret));
+  }
+  return decoded;
+}
+
+}  // namespace fsspool
@@ -0,0 +1,61 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLCODEC_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLCODEC_H
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace fsspool {
+
+// Compression or framing applied to spooled batches.
+//
+// Encoded batches start with a codec header: the 4 bytes "\0SPB", the codec,
+// and the little-endian 32-bit size of the decoded batch. No serialized
+// protobuf message starts with a zero byte, so readers can tell encoded and
+// raw batches apart.
+enum class Codec : uint8_t {
+  // Batches are written as is, without a codec header. Readable by readers
+  // which predate codecs.
+  kNone = 0,
+  // zlib (deflate) at its fastest level.
+  kZlib = 1,
+  // Each record of the batch is framed by a sync marker, its little-endian
+  // 32-bit length and the little-endian CRC-32C of the record. A damaged or
+  // torn record is skipped by searching for the next marker, rather than
+  // making the whole batch unreadable.
+  kFramed = 2,
+};
+
+// Encodes a serialized batch with the given codec.
+absl::StatusOr<std::string> EncodeBatch(absl::string_view batch, Codec codec);
+
+// Returns whether the data starts with a codec header, i.e. whether it needs to
+// be passed through DecodeBatch() to be parsed.
+bool HasCodecHeader(absl::string_view data);
+
+// Decodes a batch written by EncodeBatch. Batches without a codec header are
+// returned unchanged. Damaged records of kFramed batches are left out of the
+// decoded batch, and if damaged_records is non-null, the number of damaged
+// stretches of the batch which were skipped is stored in it.
+absl::StatusOr<std::string> DecodeBatch(absl::string_view data,
+                                        size_t* damaged_records = nullptr);
+
+}  // namespace fsspool
+
+#endif  // SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLCODEC_H
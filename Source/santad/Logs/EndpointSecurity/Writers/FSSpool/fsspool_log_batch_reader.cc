@@ -0,0 +1,182 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_log_batch_reader.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_codec.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_platform_specific.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace fsspool {
+
+namespace {
+
+// Protobuf wire types.
+constexpr uint32_t kWireTypeVarint = 0;
+constexpr uint32_t kWireTypeFixed64 = 1;
+constexpr uint32_t kWireTypeLengthDelimited = 2;
+constexpr uint32_t kWireTypeFixed32 = 5;
+
+// LogBatch.records, and google.protobuf.Any's type_url and value.
+constexpr uint32_t kLogBatchRecordsField = 1;
+constexpr uint32_t kAnyTypeUrlField = 1;
+constexpr uint32_t kAnyValueField = 2;
+
+bool ReadVarint(absl::string_view* data, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64 && !data->empty(); shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(data->front());
+    data->remove_prefix(1);
+    *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads the next field. Length-delimited fields are returned in *value, and
+// other fields are skipped.
+bool ReadField(absl::string_view* data, uint32_t* field, uint32_t* wire_type,
+               absl::string_view* value) {
+  uint64_t tag;
+  if (!ReadVarint(data, &tag)) {
+    return false;
+  }
+  *field = static_cast<uint32_t>(tag >> 3);
+  *wire_type = static_cast<uint32_t>(tag & 7);
+
+  uint64_t size;
+  switch (*wire_type) {
+    case kWireTypeVarint:
+      return ReadVarint(data, &size);
+    case kWireTypeFixed64:
+      size = 8;
+      break;
+    case kWireTypeLengthDelimited:
+      if (!ReadVarint(data, &size)) {
+        return false;
+      }
+      break;
+    case kWireTypeFixed32:
+      size = 4;
+      break;
+    default:
+      return false;
+  }
+  if (size > data->size()) {
+    return false;
+  }
+  *value = data->substr(0, size);
+  data->remove_prefix(size);
+  return true;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<MappedLogBatch>> MappedLogBatch::Open(
+    const std::string& path) {
+  const int fd = fsspool::Open(path.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to open ", path));
+  }
+  struct stat stats;
+  if (fstat(fd, &stats) < 0) {
+    absl::Status status =
+        absl::ErrnoToStatus(errno, absl::StrCat("failed to stat ", path));
+    Close(fd);
+    return status;
+  }
+
+  // Empty files can't be mapped, but are empty batches.
+  void* mapping = nullptr;
+  const size_t size = stats.st_size;
+  if (size > 0) {
+    mapping = MapReadOnly(fd, size);
+  }
+  Close(fd);
+  if (size > 0 && mapping == nullptr) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("failed to map ", path));
+  }
+
+  auto batch = std::make_unique<MappedLogBatch>(mapping, size);
+  if (HasCodecHeader(batch->data_)) {
+    absl::StatusOr<std::string> decoded = DecodeBatch(batch->data_);
+    if (!decoded.ok()) {
+      return decoded.status();
+    }
+    batch->decoded_ = *std::move(decoded);
+    batch->data_ = batch->decoded_;
+  }
+  return batch;
+}
+
+MappedLogBatch::MappedLogBatch(void* mapping, size_t mapping_size)
+    : mapping_(mapping),
+      mapping_size_(mapping_size),
+      data_(static_cast<const char*>(mapping), mapping_size) {}
+
+MappedLogBatch::~MappedLogBatch() {
+  if (mapping_) {
+    Unmap(mapping_, mapping_size_);
+  }
+}
+
+absl::Status MappedLogBatch::ForEachRecord(
+    const std::function<void(absl::string_view type_url,
+                             absl::string_view value)>& callback) const {
+  absl::string_view data = data_;
+  while (!data.empty()) {
+    uint32_t field, wire_type;
+    absl::string_view record;
+    if (!ReadField(&data, &field, &wire_type, &record)) {
+      return absl::DataLossError("Malformed LogBatch");
+    }
+    if (field != kLogBatchRecordsField ||
+        wire_type != kWireTypeLengthDelimited) {
+      continue;  // unknown field
+    }
+
+    absl::string_view type_url, value;
+    while (!record.empty()) {
+      absl::string_view field_value;
+      if (!ReadField(&record, &field, &wire_type, &field_value)) {
+        return absl::DataLossError("Malformed LogBatch record");
+      }
+      if (wire_type != kWireTypeLengthDelimited) {
+        continue;  // unknown field
+      }
+      if (field == kAnyTypeUrlField) {
+        type_url = field_value;
+      } else if (field == kAnyValueField) {
+        value = field_value;
+      }
+    }
+    callback(type_url, value);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace fsspool
@@ -0,0 +1,70 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLLOGBATCHREADER_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLLOGBATCHREADER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace fsspool {
+
+// A spooled LogBatch, mapped into memory instead of being read into a buffer.
+// Records are parsed straight out of the mapping, without building LogBatch or
+// Any messages, so the values handed out point into the file itself.
+// Compressed batches are decoded into memory first.
+//
+// Example:
+//   absl::StatusOr<std::unique_ptr<MappedLogBatch>> batch =
+//       MappedLogBatch::Open(path);
+//   (*batch)->ForEachRecord([](absl::string_view type_url,
+//                              absl::string_view value) { ... });
+//
+// This class is thread-compatible.
+class MappedLogBatch {
+ public:
+  static absl::StatusOr<std::unique_ptr<MappedLogBatch>> Open(
+      const std::string& path);
+
+  MappedLogBatch(void* mapping, size_t mapping_size);
+  ~MappedLogBatch();
+
+  MappedLogBatch(const MappedLogBatch&) = delete;
+  MappedLogBatch& operator=(const MappedLogBatch&) = delete;
+
+  // Calls the callback with the type URL and serialized value of each record,
+  // in order. The views are valid for the lifetime of this object. Returns
+  // absl::DataLossError if the batch is malformed, after calling the callback
+  // for the records preceding the malformed one.
+  absl::Status ForEachRecord(
+      const std::function<void(absl::string_view type_url,
+                               absl::string_view value)>& callback) const;
+
+ private:
+  void* mapping_;
+  size_t mapping_size_;
+  // Holds the batch if it had to be decoded.
+  std::string decoded_;
+  // The serialized LogBatch, in either the mapping or decoded_.
+  absl::string_view data_;
+};
+
+}  // namespace fsspool
+
+#endif  // SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLLOGBATCHREADER_H
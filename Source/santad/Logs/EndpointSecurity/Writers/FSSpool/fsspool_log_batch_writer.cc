@@ -16,65 +16,263 @@
 
 #include <os/log.h>
 
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
 
 namespace fsspool {
 
-FsSpoolLogBatchWriter::FsSpoolLogBatchWriter(FsSpoolWriter* fs_spool_writer,
-                                             size_t max_batch_size)
-    : writer_(fs_spool_writer), max_batch_size_(max_batch_size) {
-  cache_.mutable_records()->Reserve(max_batch_size_);
+namespace {
+
+// Field numbers and wire types of LogBatch.records, and of
+// google.protobuf.Any's type_url and value, which are all length-delimited.
+constexpr uint8_t kLogBatchRecordsTag = (1 << 3) | 2;
+constexpr uint8_t kAnyTypeUrlTag = (1 << 3) | 2;
+constexpr uint8_t kAnyValueTag = (2 << 3) | 2;
+
+size_t VarintSize(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+void AppendVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Size of a length-delimited field. As in proto3, empty fields are omitted.
+size_t FieldSize(absl::string_view value) {
+  return value.empty() ? 0 : 1 + VarintSize(value.size()) + value.size();
+}
+
+void AppendField(std::string* out, uint8_t tag, absl::string_view value) {
+  if (value.empty()) {
+    return;
+  }
+  out->push_back(static_cast<char>(tag));
+  AppendVarint(out, value.size());
+  out->append(value.data(), value.size());
+}
+
+}  // namespace
+
+FsSpoolLogBatchWriter::FsSpoolLogBatchWriter(SpoolWriter* fs_spool_writer,
+                                             size_t max_batch_size,
+                                             Codec codec,
+                                             size_t max_in_flight_batches)
+    : writer_(fs_spool_writer),
+      max_batch_size_(max_batch_size),
+      codec_(codec),
+      max_in_flight_batches_(max_in_flight_batches) {
+  if (max_in_flight_batches_ > 0) {
+    flusher_ = std::thread(&FsSpoolLogBatchWriter::FlusherLoop, this);
+  }
 }
 
 FsSpoolLogBatchWriter::~FsSpoolLogBatchWriter() {
-  absl::Status s = FlushNoLock();
+  absl::Status s = Flush();
   if (!s.ok()) {
     os_log(OS_LOG_DEFAULT, "Flush() failed with %s",
            s.ToString(absl::StatusToStringMode::kWithEverything).c_str());
   }
+  if (flusher_.joinable()) {
+    {
+      absl::MutexLock lock(&flush_mutex_);
+      stopping_ = true;
+    }
+    flusher_.join();
+  }
 }
 
 absl::Status FsSpoolLogBatchWriter::Flush() {
-  absl::MutexLock lock(&cache_mutex_);
-  return FlushNoLock();
+  cache_mutex_.Lock();
+  return DispatchAndUnlock(TakeAllBatches(), /*wait=*/true);
 }
 
-absl::Status FsSpoolLogBatchWriter::FlushNoLock() {
-  if (cache_.mutable_records()->empty()) {
-    return absl::OkStatus();
+absl::Status FsSpoolLogBatchWriter::FlushAsync() {
+  cache_mutex_.Lock();
+  return DispatchAndUnlock(TakeAllBatches(), /*wait=*/false);
+}
+
+FsSpoolLogBatchWriter::Batch FsSpoolLogBatchWriter::TakeBatch(
+    Priority priority) {
+  Batch batch = std::exchange(cache_[static_cast<size_t>(priority)], Batch());
+  batch.priority = priority;
+  return batch;
+}
+
+std::vector<FsSpoolLogBatchWriter::Batch>
+FsSpoolLogBatchWriter::TakeAllBatches() {
+  std::vector<Batch> batches;
+  batches.reserve(kNumPriorities);
+  // Write the most important records first.
+  for (size_t i = kNumPriorities; i > 0; i--) {
+    batches.push_back(TakeBatch(static_cast<Priority>(i - 1)));
   }
-  std::string msg;
-  if (!cache_.SerializeToString(&msg)) {
-    return absl::InternalError("Failed to serialize internal LogBatch cache.");
+  return batches;
+}
+
+absl::Status FsSpoolLogBatchWriter::DispatchAndUnlock(
+    std::vector<Batch> batches, bool wait) {
+  if (max_in_flight_batches_ == 0) {
+    // Take the writer lock before releasing the cache, so that batches are
+    // written in the order they were taken from it.
+    writer_mutex_.Lock();
+    cache_mutex_.Unlock();
+    std::deque<Batch> pending;
+    {
+      absl::MutexLock lock(&flush_mutex_);
+      pending = TakeRetainedBatches();
+    }
+    for (Batch& batch : batches) {
+      if (batch.records > 0) {
+        pending.push_back(std::move(batch));
+      }
+    }
+    // A failure to spool one class doesn't stop the others, which the spool
+    // may still have room for.
+    absl::Status status = absl::OkStatus();
+    std::vector<Batch> failed;
+    for (Batch& batch : pending) {
+      if (absl::Status s = WriteBatch(batch); !s.ok()) {
+        status.Update(s);
+        failed.push_back(std::move(batch));
+      }
+    }
+    absl::MutexLock lock(&flush_mutex_);
+    writer_mutex_.Unlock();
+    for (Batch& batch : failed) {
+      RetainBatch(std::move(batch));
+    }
+    return status;
   }
-  {
-    absl::MutexLock lock(&writer_mutex_);
-    if (absl::Status status = writer_->WriteMessage(msg); !status.ok()) {
-      return status;
+
+  // Enqueue before releasing the cache, for the same reason. Retried batches
+  // go ahead of the new ones.
+  absl::MutexLock lock(&flush_mutex_);
+  std::deque<Batch> retried = TakeRetainedBatches();
+  for (Batch& batch : retried) {
+    in_flight_.push_back(std::move(batch));
+  }
+  for (Batch& batch : batches) {
+    if (batch.records > 0) {
+      in_flight_.push_back(std::move(batch));
+    }
+  }
+  cache_mutex_.Unlock();
+
+  // Only wait for the flusher once the cache is released, so that other
+  // producers can keep caching records meanwhile.
+  flush_mutex_.Await(
+      absl::Condition(this, &FsSpoolLogBatchWriter::IsWithinInFlightLimit));
+  if (wait) {
+    flush_mutex_.Await(absl::Condition(this, &FsSpoolLogBatchWriter::IsIdle));
+  }
+  return std::exchange(flush_error_, absl::OkStatus());
+}
+
+absl::Status FsSpoolLogBatchWriter::WriteBatch(const Batch& batch) {
+  if (codec_ == Codec::kNone) {
+    return writer_->WritePrioritizedMessage(batch.data, batch.priority);
+  }
+  absl::StatusOr<std::string> encoded = EncodeBatch(batch.data, codec_);
+  if (!encoded.ok()) {
+    return encoded.status();
+  }
+  return writer_->WritePrioritizedMessage(*encoded, batch.priority);
+}
+
+void FsSpoolLogBatchWriter::RetainBatch(Batch batch) {
+  retained_bytes_ += batch.data.size();
+  retained_.push_back(std::move(batch));
+}
+
+std::deque<FsSpoolLogBatchWriter::Batch>
+FsSpoolLogBatchWriter::TakeRetainedBatches() {
+  retained_bytes_ = 0;
+  return std::exchange(retained_, std::deque<Batch>());
+}
+
+size_t FsSpoolLogBatchWriter::RetainedBytes() {
+  absl::MutexLock lock(&flush_mutex_);
+  return retained_bytes_;
+}
+
+void FsSpoolLogBatchWriter::FlusherLoop() {
+  while (true) {
+    Batch batch;
+    {
+      absl::MutexLock lock(&flush_mutex_);
+      flush_mutex_.Await(
+          absl::Condition(this, &FsSpoolLogBatchWriter::HasWorkOrStopping));
+      if (in_flight_.empty()) {
+        return;  // stopping
+      }
+      batch = std::move(in_flight_.front());
+      in_flight_.pop_front();
+      flushing_ = true;
+    }
+
+    absl::Status status;
+    {
+      absl::MutexLock lock(&writer_mutex_);
+      status = WriteBatch(batch);
+    }
+
+    absl::MutexLock lock(&flush_mutex_);
+    flushing_ = false;
+    if (!status.ok()) {
+      RetainBatch(std::move(batch));
+      if (flush_error_.ok()) {
+        flush_error_ = status;
+      }
     }
   }
-  // We assign a new LogBatch() object here instead of calling Clear() method to
-  // make sure the memory used by the cache_ is actually freed. It seems that
-  // internal implementation of protobuf has some very generous way of managing
-  // memory allocations and in certain scenarios it keeps objects for a very
-  // long time (forever?).
-  cache_ = santa::fsspool::binaryproto::LogBatch();
-  cache_.mutable_records()->Reserve(max_batch_size_);
-  return absl::OkStatus();
 }
 
 absl::Status FsSpoolLogBatchWriter::WriteMessage(
     const ::google::protobuf::Any& msg) {
-  absl::MutexLock lock(&cache_mutex_);
-  if (cache_.records_size() >= max_batch_size_) {
-    if (absl::Status status = FlushNoLock(); !status.ok()) {
-      return status;
-    }
+  return WriteRecord(msg.type_url(), msg.value());
+}
+
+absl::Status FsSpoolLogBatchWriter::WriteRecord(absl::string_view type_url,
+                                                absl::string_view value,
+                                                Priority priority) {
+  cache_mutex_.Lock();
+  std::vector<Batch> full;
+  if (cache_[static_cast<size_t>(priority)].records >= max_batch_size_) {
+    full.push_back(TakeBatch(priority));
+  }
+
+  // Append the record as a LogBatch.records field holding an Any. A LogBatch
+  // is just the concatenation of its records.
+  Batch& cache = cache_[static_cast<size_t>(priority)];
+  const size_t any_size = FieldSize(type_url) + FieldSize(value);
+  cache.data.push_back(static_cast<char>(kLogBatchRecordsTag));
+  AppendVarint(&cache.data, any_size);
+  AppendField(&cache.data, kAnyTypeUrlTag, type_url);
+  AppendField(&cache.data, kAnyValueTag, value);
+  cache.records++;
+
+  if (full.empty()) {
+    cache_mutex_.Unlock();
+    return absl::OkStatus();
   }
-  *cache_.mutable_records()->Add() = msg;
-  return absl::OkStatus();
+  return DispatchAndUnlock(std::move(full), /*wait=*/false);
 }
 
 }  // namespace fsspool
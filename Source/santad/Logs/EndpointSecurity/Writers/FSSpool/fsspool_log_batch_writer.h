@@ -15,12 +15,17 @@
 #ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLLOGBATCHWRITER_H
 #define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FSSPOOL_FSSPOOLLOGBATCHWRITER_H
 
+#include <array>
+#include <deque>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/binaryproto.pb.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_codec.h"
 #include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "google/protobuf/any.pb.h"
 
@@ -38,10 +43,31 @@ namespace fsspool {
 // Flush() method is provided, so the users of this class can implement periodic
 // flushes. It is not necessary to call Flush() manually otherwise.
 //
+// Batches are encoded with the given codec before being written. Readers
+// should pass what they read through DecodeBatch() before parsing it.
+//
+// Records are appended to the cache already in the LogBatch wire format, so a
+// batch is written without being re-serialized.
+//
+// A full batch is swapped out for an empty one before it is written, so
+// producers don't wait on disk I/O while holding the cache. If
+// max_in_flight_batches is non-zero, batches are written by a dedicated
+// flusher thread, and producers block, without holding the cache, once more
+// than that many batches are waiting to be written. Otherwise the thread which
+// filled the batch writes it. Batches which fail to be written are retained
+// as they are, and retried ahead of newer batches on the next flush. Callers
+// should bound what they write while RetainedBytes() is high.
+//
+// Records of each retention class are batched separately, so that the spool
+// can evict them separately. max_batch_size applies to each class' batch, and
+// records of different classes may be spooled out of order.
+//
 // The class is thread-safe.
 class FsSpoolLogBatchWriter {
  public:
-  FsSpoolLogBatchWriter(FsSpoolWriter* fs_spool_writer, size_t max_batch_size);
+  FsSpoolLogBatchWriter(SpoolWriter* fs_spool_writer, size_t max_batch_size,
+                        Codec codec = Codec::kNone,
+                        size_t max_in_flight_batches = 0);
   ~FsSpoolLogBatchWriter();
 
   // Writes Any proto message to the FsSpool. The write is cached according to
@@ -50,19 +76,81 @@ class FsSpoolLogBatchWriter {
   // This may return an error if flushing is unsuccessful.
   absl::Status WriteMessage(const ::google::protobuf::Any& msg);
 
+  // As WriteMessage(), with an Any holding the given type URL and serialized
+  // value, but without building one. The value is only copied into the cache.
+  absl::Status WriteRecord(absl::string_view type_url, absl::string_view value,
+                           Priority priority = Priority::kNormal);
+
   // Flush internal FsSpoolLogBatchWriter cache to disk. Calling this method is
   // not necessary as the cache is flushed after max_batch_size limit is reached
   // or when the objects is destroyed.
+  //
+  // Waits for every in-flight batch to be written, and returns the first error
+  // encountered since the last call to Flush() or FlushAsync().
   absl::Status Flush();
 
+  // As Flush(), but doesn't wait for the batch to be written when there is a
+  // flusher thread. Errors from writing it are returned by a later call.
+  absl::Status FlushAsync();
+
+  // Size of the batches which failed to be written and are awaiting a retry.
+  size_t RetainedBytes();
+
  private:
+  // A serialized LogBatch, the number of records in it, and their class.
+  struct Batch {
+    std::string data;
+    size_t records = 0;
+    Priority priority = Priority::kNormal;
+  };
+
   absl::Mutex writer_mutex_ ABSL_ACQUIRED_AFTER(cache_mutex_);
-  FsSpoolWriter* writer_ ABSL_PT_GUARDED_BY(writer_mutex_);
+  SpoolWriter* writer_ ABSL_PT_GUARDED_BY(writer_mutex_);
   size_t max_batch_size_;
+  const Codec codec_;
+  const size_t max_in_flight_batches_;
   absl::Mutex cache_mutex_;
-  santa::fsspool::binaryproto::LogBatch cache_ ABSL_GUARDED_BY(cache_mutex_);
+  std::array<Batch, kNumPriorities> cache_ ABSL_GUARDED_BY(cache_mutex_);
+
+  absl::Mutex flush_mutex_ ABSL_ACQUIRED_AFTER(cache_mutex_, writer_mutex_);
+  std::deque<Batch> in_flight_ ABSL_GUARDED_BY(flush_mutex_);
+  // Batches which failed to be written, oldest first.
+  std::deque<Batch> retained_ ABSL_GUARDED_BY(flush_mutex_);
+  size_t retained_bytes_ ABSL_GUARDED_BY(flush_mutex_) = 0;
+  // Whether the flusher thread is writing a batch it took from in_flight_.
+  bool flushing_ ABSL_GUARDED_BY(flush_mutex_) = false;
+  bool stopping_ ABSL_GUARDED_BY(flush_mutex_) = false;
+  absl::Status flush_error_ ABSL_GUARDED_BY(flush_mutex_);
+  std::thread flusher_;
+
+  // Swap the cached batch of the given class out for an empty one.
+  Batch TakeBatch(Priority priority)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(cache_mutex_);
+  std::vector<Batch> TakeAllBatches()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(cache_mutex_);
+  // Write or enqueue batches taken from the cache.
+  absl::Status DispatchAndUnlock(std::vector<Batch> batches, bool wait)
+      ABSL_UNLOCK_FUNCTION(cache_mutex_);
+  absl::Status WriteBatch(const Batch& batch)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(writer_mutex_);
+  // Keep a batch which failed to be written for the next flush. This never
+  // takes the cache lock, which a producer may hold while waiting on the
+  // flusher thread.
+  void RetainBatch(Batch batch) ABSL_EXCLUSIVE_LOCKS_REQUIRED(flush_mutex_);
+  std::deque<Batch> TakeRetainedBatches()
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(flush_mutex_);
+  void FlusherLoop();
 
-  absl::Status FlushNoLock() ABSL_EXCLUSIVE_LOCKS_REQUIRED(cache_mutex_);
+  bool IsWithinInFlightLimit() const
+      ABSL_SHARED_LOCKS_REQUIRED(flush_mutex_) {
+    return in_flight_.size() <= max_in_flight_batches_;
+  }
+  bool HasWorkOrStopping() const ABSL_SHARED_LOCKS_REQUIRED(flush_mutex_) {
+    return !in_flight_.empty() || stopping_;
+  }
+  bool IsIdle() const ABSL_SHARED_LOCKS_REQUIRED(flush_mutex_) {
+    return in_flight_.empty() && !flushing_;
+  }
 };
 
 }  // namespace fsspool
@@ -14,6 +14,7 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -38,6 +39,25 @@ int Write(int fd, absl::string_view buf) {
   return ::write(fd, buf.data(), buf.size());
 }
 
+int PRead(int fd, char* buf, size_t count, off_t offset) {
+  return ::pread(fd, buf, count, offset);
+}
+
+int Truncate(int fd, off_t length) { return ftruncate(fd, length); }
+
+void* MapShared(int fd, size_t length) {
+  void* addr =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return addr == MAP_FAILED ? nullptr : addr;
+}
+
+void* MapReadOnly(int fd, size_t length) {
+  void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  return addr == MAP_FAILED ? nullptr : addr;
+}
+
+int Unmap(void* addr, size_t length) { return munmap(addr, length); }
+
 int Unlink(const char* pathname) { return unlink(pathname); }
 
 int MkDir(const char* path, mode_t mode) { return mkdir(path, mode); }
@@ -33,6 +33,15 @@ bool StatIsDir(mode_t mode);
 bool StatIsReg(mode_t mode);
 int Unlink(const char* pathname);
 int Write(int fd, absl::string_view buf);
+int PRead(int fd, char* buf, size_t count, off_t offset);
+int Truncate(int fd, off_t length);
+// Maps length bytes of the file into memory, shared with other processes
+// mapping it. Returns nullptr on failure.
+void* MapShared(int fd, size_t length);
+// Maps length bytes of the file into memory, read only. Returns nullptr on
+// failure.
+void* MapReadOnly(int fd, size_t length);
+int Unmap(void* addr, size_t length);
 
 absl::Status IterateDirectory(const std::string& dir,
                               std::function<void(const std::string&)> callback);
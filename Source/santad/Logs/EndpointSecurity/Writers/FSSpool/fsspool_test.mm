@@ -16,11 +16,23 @@
 #import <OCMock/OCMock.h>
 #import <XCTest/XCTest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "Source/common/TestUtils.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/binaryproto.pb.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_codec.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_log_batch_reader.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_log_batch_writer.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "google/protobuf/any.pb.h"
 #include "google/protobuf/timestamp.pb.h"
 
@@ -39,9 +51,22 @@ class FsSpoolWriterPeer : public FsSpoolWriter {
   using FsSpoolWriter::spool_size_estimate_;
 };
 
+class FsSpoolReaderPeer : public FsSpoolReader {
+ public:
+  // Constructors
+  using FsSpoolReader::FsSpoolReader;
+
+  // Private member variables
+  using FsSpoolReader::index_;
+  using FsSpoolReader::scan_;
+};
+
 }  // namespace fsspool
 
 using fsspool::FsSpoolLogBatchWriter;
+using fsspool::FsSpoolReaderPeer;
+using fsspool::FsSpoolSegmentReader;
+using fsspool::FsSpoolSegmentWriter;
 using fsspool::FsSpoolWriterPeer;
 
 static constexpr size_t kSpoolSize = 1048576;
@@ -195,6 +220,369 @@ google::protobuf::Any TestAnyTimestamp(int64_t s, int32_t n) {
   XCTAssertNil(err);
 }
 
+- (void)testSharedSizeCounter {
+  std::string baseDir = [self.baseDir UTF8String];
+  static const size_t kMessageSize = 100;
+  // Each message occupies a 4KiB cluster, so the spool fits 10 of them.
+  auto writer = std::make_unique<FsSpoolWriterPeer>(baseDir, 10 * 4096 - 1);
+  auto reader = std::make_unique<FsSpoolReaderPeer>(baseDir);
+
+  int written = 0;
+  while (writer->WriteMessage(std::string(kMessageSize, 'A')).ok()) {
+    written++;
+    XCTAssertLessThan(written, 100);
+  }
+  XCTAssertEqual(written, 10);
+
+  // A second writer shares the size, rather than starting from an empty spool.
+  fsspool::SpoolSizeCounter counter(baseDir);
+  XCTAssertStatusOk(counter.Open(/*create=*/false));
+  XCTAssertEqual(counter.Get(), 10 * 4096);
+
+  // Acking a message frees its space for the writers.
+  absl::StatusOr<std::string> path = reader->NextMessagePath();
+  XCTAssertStatusOk(path.status());
+  XCTAssertStatusOk(reader->AckMessage(*path));
+  XCTAssertEqual(counter.Get(), 9 * 4096);
+  XCTAssertStatusOk(writer->WriteMessage(std::string(kMessageSize, 'A')));
+  XCTAssertStatusNotOk(writer->WriteMessage(std::string(kMessageSize, 'A')));
+}
+
+- (void)testRetentionClasses {
+  std::string baseDir = [self.baseDir UTF8String];
+  // The spool fits 10 messages, of which at most 4 may be low priority.
+  auto writer =
+    std::make_unique<FsSpoolWriterPeer>(baseDir, 10 * 4096 - 1, std::array<size_t, 3>{4 * 4096});
+
+  int written = 0;
+  while (writer->WritePrioritizedMessage("low", fsspool::Priority::kLow).ok()) {
+    written++;
+    XCTAssertLessThan(written, 100);
+  }
+  XCTAssertEqual(written, 4);
+
+  for (int i = 0; i < 6; i++) {
+    XCTAssertStatusOk(writer->WriteMessage("normal"));
+  }
+  // The spool is full, so higher classes evict the oldest of lower ones, lowest first.
+  for (int i = 0; i < 5; i++) {
+    XCTAssertStatusOk(writer->WritePrioritizedMessage("high", fsspool::Priority::kHigh));
+  }
+  XCTAssertStatusNotOk(writer->WritePrioritizedMessage("low", fsspool::Priority::kLow));
+
+  std::vector<std::string> remaining;
+  FsSpoolReaderPeer reader(baseDir);
+  absl::StatusOr<std::vector<std::string>> paths = reader.NextMessagePaths(100);
+  XCTAssertStatusOk(paths.status());
+  for (const std::string &path : *paths) {
+    remaining.push_back([self contentsOfFile:path]);
+  }
+  std::sort(remaining.begin(), remaining.end());
+  std::vector<std::string> want(5, "high");
+  want.insert(want.end(), 5, "normal");
+  XCTAssertEqual(remaining, want);
+
+  // Once everything is high priority, nothing more can be evicted.
+  for (int i = 0; i < 5; i++) {
+    XCTAssertStatusOk(writer->WritePrioritizedMessage("high", fsspool::Priority::kHigh));
+  }
+  XCTAssertStatusNotOk(writer->WritePrioritizedMessage("high", fsspool::Priority::kHigh));
+}
+
+- (void)testSharedClassSizes {
+  std::string baseDir = [self.baseDir UTF8String];
+  // The spool fits 10 messages, of which at most 4 may be low priority.
+  auto writer =
+    std::make_unique<FsSpoolWriterPeer>(baseDir, 10 * 4096 - 1, std::array<size_t, 3>{4 * 4096});
+  for (int i = 0; i < 4; i++) {
+    XCTAssertStatusOk(writer->WritePrioritizedMessage("low", fsspool::Priority::kLow));
+  }
+  for (int i = 0; i < 6; i++) {
+    XCTAssertStatusOk(writer->WriteMessage("normal"));
+  }
+
+  fsspool::SpoolSizeCounter counter(baseDir);
+  XCTAssertStatusOk(counter.Open(/*create=*/false));
+  XCTAssertEqual(counter.Get(), 10 * 4096);
+  XCTAssertEqual(counter.Get(fsspool::Priority::kLow), 4 * 4096);
+  XCTAssertEqual(counter.Get(fsspool::Priority::kNormal), 6 * 4096);
+  XCTAssertTrue(
+    absl::IsUnavailable(writer->WritePrioritizedMessage("low", fsspool::Priority::kLow)));
+
+  // Acking a low priority message makes room in its class.
+  FsSpoolReaderPeer reader(baseDir);
+  absl::StatusOr<std::vector<std::string>> paths = reader.NextMessagePaths(100);
+  XCTAssertStatusOk(paths.status());
+  for (const std::string &path : *paths) {
+    if ([self contentsOfFile:path] == "low") {
+      XCTAssertStatusOk(reader.AckMessage(path));
+      break;
+    }
+  }
+  XCTAssertEqual(counter.Get(fsspool::Priority::kLow), 3 * 4096);
+  XCTAssertStatusOk(writer->WritePrioritizedMessage("low", fsspool::Priority::kLow));
+
+  // Evictions are taken from the evicted class.
+  XCTAssertStatusOk(writer->WritePrioritizedMessage("high", fsspool::Priority::kHigh));
+  XCTAssertEqual(counter.Get(fsspool::Priority::kLow), 3 * 4096);
+  XCTAssertEqual(counter.Get(fsspool::Priority::kHigh), 4096);
+  XCTAssertEqual(counter.Get(), 10 * 4096);
+}
+
+- (std::string)contentsOfFile:(const std::string &)path {
+  NSData *data = [NSData dataWithContentsOfFile:@(path.c_str())];
+  return std::string((const char *)data.bytes, data.length);
+}
+
+- (void)testReaderDrainsInOrder {
+  auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+  auto reader = std::make_unique<FsSpoolReaderPeer>([self.baseDir UTF8String]);
+
+  XCTAssertEqual(reader->NextMessagePath().status().code(), absl::StatusCode::kNotFound);
+
+  for (int i = 0; i < 5; i++) {
+    XCTAssertStatusOk(writer->WriteMessage(std::to_string(i)));
+  }
+
+  // Files written within the same second are ordered by sequence number.
+  for (int i = 0; i < 3; i++) {
+    auto path = reader->NextMessagePath();
+    XCTAssertStatusOk(path);
+    XCTAssertCppStringEqual([self contentsOfFile:*path], std::to_string(i));
+    XCTAssertStatusOk(reader->AckMessage(*path));
+  }
+
+  // Acking doesn't cause a rescan, but new messages do.
+  uint64_t scans = reader->scan_;
+  XCTAssertEqual(reader->index_.size(), 2);
+  auto path = reader->NextMessagePath();
+  XCTAssertCppStringEqual([self contentsOfFile:*path], std::string("3"));
+  XCTAssertEqual(reader->scan_, scans);
+
+  XCTAssertStatusOk(writer->WriteMessage("5"));
+  for (int i = 4; i <= 5; i++) {
+    path = reader->NextMessagePath();
+    XCTAssertStatusOk(path);
+    XCTAssertEqual([self contentsOfFile:*path], std::to_string(i));
+  }
+  XCTAssertGreaterThan(reader->scan_, scans);
+
+  // Handed out messages are not returned again until acked.
+  XCTAssertEqual(reader->NumberOfUnackedMessages(), 3);
+  XCTAssertEqual(reader->NextMessagePath().status().code(), absl::StatusCode::kNotFound);
+}
+
+- (void)testReaderOrdersByWriterAndSequence {
+  std::string baseDir = [self.baseDir UTF8String];
+  auto first = std::make_unique<FsSpoolWriterPeer>(baseDir, kSpoolSize);
+  XCTAssertStatusOk(first->WriteMessage("0"));
+  XCTAssertStatusOk(first->WriteMessage("1"));
+  XCTAssertStatusOk(first->WriteMessage("2"));
+
+  // Each writer's messages are dequeued in sequence, whatever their mtimes. Writers are ordered by
+  // the mtime of their files.
+  NSArray<NSString *> *files = [[self.fileMgr contentsOfDirectoryAtPath:self.spoolDir
+                                                                  error:nil]
+    sortedArrayUsingSelector:@selector(compare:)];
+  XCTAssertEqual(files.count, 3);
+  for (NSUInteger i = 0; i < files.count; i++) {
+    NSString *path = [self.spoolDir stringByAppendingPathComponent:files[i]];
+    NSDate *mtime = [NSDate dateWithTimeIntervalSinceNow:-60.0 * (i + 1)];
+    XCTAssertTrue([self.fileMgr setAttributes:@{NSFileModificationDate : mtime}
+                                 ofItemAtPath:path
+                                        error:nil]);
+  }
+  auto second = std::make_unique<FsSpoolWriterPeer>(baseDir, kSpoolSize);
+  XCTAssertStatusOk(second->WriteMessage("3"));
+
+  auto reader = std::make_unique<FsSpoolReaderPeer>(baseDir);
+  absl::StatusOr<std::vector<std::string>> paths = reader->NextMessagePaths(10);
+  XCTAssertStatusOk(paths.status());
+  XCTAssertEqual(paths->size(), 4);
+  for (int i = 0; i < 4; i++) {
+    XCTAssertCppStringEqual([self contentsOfFile:(*paths)[i]], std::to_string(i));
+  }
+}
+
+- (void)testReaderForgetsRemovedFiles {
+  auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+  auto reader = std::make_unique<FsSpoolReaderPeer>([self.baseDir UTF8String]);
+
+  XCTAssertStatusOk(writer->WriteMessage("0"));
+  XCTAssertStatusOk(writer->WriteMessage("1"));
+  auto path = reader->NextMessagePath();
+  XCTAssertStatusOk(path);
+  XCTAssertEqual(reader->index_.size(), 1);
+
+  // Something else empties the spool.
+  for (NSString *file in [self.fileMgr contentsOfDirectoryAtPath:self.spoolDir error:nil]) {
+    XCTAssertTrue([self.fileMgr
+      removeItemAtPath:[self.spoolDir stringByAppendingPathComponent:file]
+                 error:nil]);
+  }
+
+  XCTAssertEqual(reader->NextMessagePath().status().code(), absl::StatusCode::kNotFound);
+  XCTAssertEqual(reader->index_.size(), 0);
+}
+
+- (void)testReaderBatchDequeue {
+  std::string baseDir = [self.baseDir UTF8String];
+  auto writer = std::make_unique<FsSpoolWriterPeer>(baseDir, kSpoolSize);
+  auto reader = std::make_unique<FsSpoolReaderPeer>(baseDir);
+
+  XCTAssertEqual(reader->NextMessagePaths(10).status().code(), absl::StatusCode::kNotFound);
+
+  for (int i = 0; i < 5; i++) {
+    XCTAssertStatusOk(writer->WriteMessage(std::to_string(i)));
+  }
+
+  // Batches are capped and returned in order.
+  absl::StatusOr<std::vector<std::string>> paths = reader->NextMessagePaths(3);
+  XCTAssertStatusOk(paths.status());
+  XCTAssertEqual(paths->size(), 3);
+  for (int i = 0; i < 3; i++) {
+    XCTAssertCppStringEqual([self contentsOfFile:(*paths)[i]], std::to_string(i));
+  }
+
+  // A short batch is returned rather than waiting for more messages.
+  absl::StatusOr<std::vector<std::string>> rest = reader->NextMessagePaths(3);
+  XCTAssertStatusOk(rest.status());
+  XCTAssertEqual(rest->size(), 2);
+  XCTAssertEqual(reader->NumberOfUnackedMessages(), 5);
+
+  fsspool::SpoolSizeCounter counter(baseDir);
+  XCTAssertStatusOk(counter.Open(/*create=*/false));
+  size_t size = counter.Get();
+  XCTAssertStatusOk(reader->AckMessages(*paths));
+  XCTAssertEqual(reader->NumberOfUnackedMessages(), 2);
+  XCTAssertLessThan(counter.Get(), size);
+  for (const std::string &path : *paths) {
+    XCTAssertFalse([self.fileMgr fileExistsAtPath:@(path.c_str())]);
+  }
+}
+
+- (void)testSegmentsRoundTrip {
+  std::string baseDir = [self.baseDir UTF8String];
+  // Small segments, so that the messages span several of them.
+  FsSpoolSegmentWriter writer(baseDir, kSpoolSize, 64);
+  FsSpoolSegmentReader reader(baseDir);
+
+  XCTAssertTrue(absl::IsNotFound(reader.NextMessage().status()));
+
+  for (int i = 0; i < 20; i++) {
+    XCTAssertStatusOk(writer.WriteMessage(absl::StrCat("message ", i)));
+  }
+  for (int i = 0; i < 20; i++) {
+    absl::StatusOr<std::string> msg = reader.NextMessage();
+    XCTAssertStatusOk(msg.status());
+    XCTAssertCppStringEqual(*msg, absl::StrCat("message ", i));
+  }
+  XCTAssertTrue(absl::IsNotFound(reader.NextMessage().status()));
+
+  // Messages appended after the reader caught up are still seen.
+  XCTAssertStatusOk(writer.WriteMessage("late"));
+  XCTAssertCppStringEqual(reader.NextMessage().value_or(""), std::string("late"));
+}
+
+- (void)testSegmentsResumeFromCheckpoint {
+  std::string baseDir = [self.baseDir UTF8String];
+  NSString *segmentDir = [self.baseDir stringByAppendingPathComponent:@"segments"];
+
+  {
+    FsSpoolSegmentWriter writer(baseDir, kSpoolSize, 64);
+    for (int i = 0; i < 10; i++) {
+      XCTAssertStatusOk(writer.WriteMessage(absl::StrCat("message ", i)));
+    }
+  }
+
+  {
+    FsSpoolSegmentReader reader(baseDir);
+    for (int i = 0; i < 6; i++) {
+      XCTAssertStatusOk(reader.NextMessage().status());
+    }
+    XCTAssertStatusOk(reader.Checkpoint());
+    // Not checkpointed, so should be read again
+    XCTAssertStatusOk(reader.NextMessage().status());
+  }
+
+  // Fully consumed segments were removed.
+  NSError *err = nil;
+  XCTAssertLessThan([[self.fileMgr contentsOfDirectoryAtPath:segmentDir error:&err] count], 4);
+  XCTAssertNil(err);
+
+  FsSpoolSegmentReader reader(baseDir);
+  for (int i = 6; i < 10; i++) {
+    XCTAssertCppStringEqual(reader.NextMessage().value_or(""), absl::StrCat("message ", i));
+  }
+  XCTAssertStatusOk(reader.Checkpoint());
+  XCTAssertEqual([[self.fileMgr contentsOfDirectoryAtPath:segmentDir error:&err] count], 1);
+
+  // A new writer must not reuse the numbers of segments which were removed.
+  FsSpoolSegmentWriter writer(baseDir, kSpoolSize, 64);
+  XCTAssertStatusOk(writer.WriteMessage("after restart"));
+  XCTAssertCppStringEqual(reader.NextMessage().value_or(""), std::string("after restart"));
+}
+
+// Writes "first" and "second" to one segment and "third" to the next, after flipping the byte of
+// the first segment at offset.
+- (void)writeSegmentsCorruptingOffset:(NSUInteger)offset {
+  std::string baseDir = [self.baseDir UTF8String];
+  NSString *segmentDir = [self.baseDir stringByAppendingPathComponent:@"segments"];
+
+  {
+    FsSpoolSegmentWriter writer(baseDir, kSpoolSize);
+    XCTAssertStatusOk(writer.WriteMessage("first"));
+    XCTAssertStatusOk(writer.WriteMessage("second"));
+  }
+
+  NSString *segment =
+    [segmentDir stringByAppendingPathComponent:[[self.fileMgr contentsOfDirectoryAtPath:segmentDir
+                                                                                  error:nil]
+                                                 firstObject]];
+  NSMutableData *data = [NSMutableData dataWithContentsOfFile:segment];
+  ((char *)data.mutableBytes)[offset] ^= 0xff;
+  XCTAssertTrue([self.fileMgr removeItemAtPath:segment error:nil]);
+  XCTAssertTrue([data writeToFile:segment atomically:YES]);
+
+  FsSpoolSegmentWriter writer(baseDir, kSpoolSize);
+  XCTAssertStatusOk(writer.WriteMessage("third"));
+}
+
+- (void)testSegmentsSkipRecordWithBadChecksum {
+  // Flip a byte of the first record's payload.
+  [self writeSegmentsCorruptingOffset:8];
+
+  // Only the corrupt record is lost.
+  FsSpoolSegmentReader reader([self.baseDir UTF8String]);
+  XCTAssertTrue(absl::IsDataLoss(reader.NextMessage().status()));
+  XCTAssertCppStringEqual(reader.NextMessage().value_or(""), std::string("second"));
+  XCTAssertCppStringEqual(reader.NextMessage().value_or(""), std::string("third"));
+}
+
+- (void)testSegmentsSkipSegmentWithBadLength {
+  // Flip the high byte of the first record's length.
+  [self writeSegmentsCorruptingOffset:3];
+
+  // Where the next record starts is unknown, so the rest of the segment is skipped.
+  FsSpoolSegmentReader reader([self.baseDir UTF8String]);
+  XCTAssertTrue(absl::IsDataLoss(reader.NextMessage().status()));
+  XCTAssertCppStringEqual(reader.NextMessage().value_or(""), std::string("third"));
+}
+
+- (void)testSegmentsSpoolFull {
+  FsSpoolSegmentWriter writer([self.baseDir UTF8String], 10000, 1000);
+  std::string msg(500, 'A');
+
+  absl::Status status;
+  int written = 0;
+  while ((status = writer.WriteMessage(msg)).ok()) {
+    written++;
+    XCTAssertLessThan(written, 100);
+  }
+  XCTAssertTrue(absl::IsUnavailable(status));
+  XCTAssertGreaterThan(written, 0);
+}
+
 - (void)testWriteMessageNoFlush {
   auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
   FsSpoolLogBatchWriter batch_writer(writer.get(), 10);
@@ -271,4 +659,309 @@ google::protobuf::Any TestAnyTimestamp(int64_t s, int32_t n) {
   XCTAssertNil(err);
 }
 
+- (void)testWriteMessageFlusherThread {
+  static const int kCapacity = 5;
+  static const int kExpectedFlushes = 3;
+
+  auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+  FsSpoolLogBatchWriter batch_writer(writer.get(), kCapacity, fsspool::Codec::kNone, 2);
+
+  for (int i = 0; i < kExpectedFlushes * kCapacity + 1; i++) {
+    XCTAssertStatusOk(batch_writer.WriteMessage(TestAnyTimestamp(123, 456)));
+  }
+
+  // Flush waits for the batches written by the flusher thread, plus the partial one.
+  XCTAssertStatusOk(batch_writer.Flush());
+
+  NSError *err = nil;
+  XCTAssertEqual([[self.fileMgr contentsOfDirectoryAtPath:self.spoolDir error:&err] count],
+                 kExpectedFlushes + 1);
+  XCTAssertNil(err);
+}
+
+- (void)testWriteMessageRetriesFailedBatches {
+  static const int kCapacity = 5;
+
+  // Fails the first write, then counts the records in each batch.
+  class FlakyWriter : public fsspool::SpoolWriter {
+   public:
+    absl::Status WriteMessage(absl::string_view msg) override {
+      if (fail_next_) {
+        fail_next_ = false;
+        return absl::UnavailableError("flaky");
+      }
+      santa::fsspool::binaryproto::LogBatch batch;
+      batch.ParseFromString(std::string(msg));
+      records_ += batch.records_size();
+      return absl::OkStatus();
+    }
+    bool fail_next_ = true;
+    int records_ = 0;
+  };
+
+  for (size_t maxInFlight : {0, 2}) {
+    FlakyWriter writer;
+    FsSpoolLogBatchWriter batch_writer(&writer, kCapacity, fsspool::Codec::kNone, maxInFlight);
+    for (int i = 0; i < kCapacity; i++) {
+      XCTAssertStatusOk(batch_writer.WriteMessage(TestAnyTimestamp(123, 456)));
+    }
+
+    XCTAssertStatusNotOk(batch_writer.Flush());
+    XCTAssertEqual(writer.records_, 0);
+
+    // The failed batch was kept, and is written along with newer records.
+    XCTAssertStatusOk(batch_writer.WriteMessage(TestAnyTimestamp(123, 456)));
+    XCTAssertStatusOk(batch_writer.Flush());
+    XCTAssertEqual(writer.records_, kCapacity + 1);
+  }
+}
+
+- (void)testWriteMessageWhileSpoolFull {
+  static const size_t kFlushThreshold = 1000;
+  static const size_t kLeniency = 1200;
+
+  // Fails every write until the spool has room, recording the largest batch attempted.
+  class FullWriter : public fsspool::SpoolWriter {
+   public:
+    absl::Status WriteMessage(absl::string_view msg) override {
+      largest_ = std::max(largest_.load(), msg.size());
+      if (full_) {
+        return absl::UnavailableError("spool full");
+      }
+      santa::fsspool::binaryproto::LogBatch batch;
+      batch.ParseFromString(std::string(msg));
+      records_ += batch.records_size();
+      return absl::OkStatus();
+    }
+    std::atomic<bool> full_ = true;
+    std::atomic<size_t> largest_ = 0;
+    std::atomic<int> records_ = 0;
+  };
+
+  for (size_t maxInFlight : {0, 2}) {
+    FullWriter writer;
+    FsSpoolLogBatchWriter batch_writer(&writer, SIZE_T_MAX, fsspool::Codec::kNone, maxInFlight);
+
+    // Drive the writer as santa::Spool does, with a periodic flush racing it.
+    std::atomic<bool> done = false;
+    std::thread flusher([&] {
+      while (!done) {
+        (void)batch_writer.FlushAsync();
+      }
+    });
+    std::string value(100, 'A');
+    size_t accumulated = 0;
+    int written = 0;
+    for (int i = 0; i < 10000; i++) {
+      if (accumulated >= kFlushThreshold) {
+        (void)batch_writer.FlushAsync();
+        accumulated = 0;
+      }
+      if (accumulated + batch_writer.RetainedBytes() < kLeniency) {
+        XCTAssertStatusOk(batch_writer.WriteRecord("", value));
+        accumulated += value.size();
+        written++;
+      }
+    }
+    done = true;
+    flusher.join();
+
+    // Failed batches are retried as they were, rather than growing with each attempt.
+    XCTAssertGreaterThan(batch_writer.RetainedBytes(), 0);
+    XCTAssertLessThan(writer.largest_, kLeniency);
+
+    // Nothing was lost once the spool has room again.
+    writer.full_ = false;
+    XCTAssertStatusOk(batch_writer.Flush());
+    XCTAssertEqual(batch_writer.RetainedBytes(), 0);
+    XCTAssertEqual(writer.records_, written);
+  }
+}
+
+- (void)testWriteRecordMatchesLogBatch {
+  // Keeps the batches written to it.
+  class CapturingWriter : public fsspool::SpoolWriter {
+   public:
+    absl::Status WriteMessage(absl::string_view msg) override {
+      batches_.emplace_back(msg);
+      return absl::OkStatus();
+    }
+    std::vector<std::string> batches_;
+  };
+
+  CapturingWriter writer;
+  santa::fsspool::binaryproto::LogBatch want;
+  {
+    FsSpoolLogBatchWriter batch_writer(&writer, 100);
+    for (int i = 0; i < 50; i++) {
+      google::protobuf::Any *any = want.add_records();
+      // Vary the value's size so that lengths take more than one byte, and leave some fields
+      // empty, which serialization omits.
+      any->set_type_url(i % 10 == 0 ? "" : "type.googleapis.com/santa.pb.v1.SantaMessage");
+      any->set_value(std::string(i * 5, 'A' + i % 26));
+      XCTAssertStatusOk(batch_writer.WriteRecord(any->type_url(), any->value()));
+    }
+  }
+
+  XCTAssertEqual(writer.batches_.size(), 1);
+  XCTAssertCppStringEqual(writer.batches_[0], want.SerializeAsString());
+}
+
+- (void)testWriteRecordBatchesEachClass {
+  // Keeps the batches written to it, along with their class.
+  class CapturingWriter : public fsspool::SpoolWriter {
+   public:
+    absl::Status WriteMessage(absl::string_view msg) override {
+      return WritePrioritizedMessage(msg, fsspool::Priority::kNormal);
+    }
+    absl::Status WritePrioritizedMessage(absl::string_view msg,
+                                         fsspool::Priority priority) override {
+      santa::fsspool::binaryproto::LogBatch batch;
+      if (!batch.ParseFromArray(msg.data(), static_cast<int>(msg.size()))) {
+        return absl::DataLossError("malformed batch");
+      }
+      for (const google::protobuf::Any &any : batch.records()) {
+        if (any.value() != std::to_string(static_cast<int>(priority))) {
+          return absl::InternalError("record batched with the wrong class");
+        }
+      }
+      records_[static_cast<int>(priority)] += batch.records_size();
+      batches_++;
+      return absl::OkStatus();
+    }
+    int records_[3] = {};
+    int batches_ = 0;
+  };
+
+  CapturingWriter writer;
+  FsSpoolLogBatchWriter batch_writer(&writer, 4);
+  for (int i = 0; i < 15; i++) {
+    auto priority = static_cast<fsspool::Priority>(i % 3);
+    XCTAssertStatusOk(batch_writer.WriteRecord("", std::to_string(i % 3), priority));
+  }
+  // No class has filled a batch yet.
+  XCTAssertEqual(writer.batches_, 0);
+
+  XCTAssertStatusOk(batch_writer.Flush());
+  XCTAssertEqual(writer.batches_, 3);
+  for (int i = 0; i < 3; i++) {
+    XCTAssertEqual(writer.records_[i], 5);
+  }
+}
+
+- (void)testWriteMessageCompressed {
+  static const int kCapacity = 100;
+
+  auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+  FsSpoolLogBatchWriter batch_writer(writer.get(), kCapacity, fsspool::Codec::kZlib);
+  for (int i = 0; i < kCapacity; i++) {
+    XCTAssertStatusOk(batch_writer.WriteMessage(TestAnyTimestamp(123, 456)));
+  }
+  XCTAssertStatusOk(batch_writer.Flush());
+
+  FsSpoolReaderPeer reader([self.baseDir UTF8String]);
+  absl::StatusOr<std::string> path = reader.NextMessagePath();
+  XCTAssertStatusOk(path.status());
+  std::string contents = [self contentsOfFile:*path];
+
+  santa::fsspool::binaryproto::LogBatch batch;
+  XCTAssertFalse(batch.ParseFromString(contents));
+
+  absl::StatusOr<std::string> decoded = fsspool::DecodeBatch(contents);
+  XCTAssertStatusOk(decoded.status());
+  XCTAssertLessThan(contents.size(), decoded->size());
+  XCTAssertTrue(batch.ParseFromString(*decoded));
+  XCTAssertEqual(batch.records_size(), kCapacity);
+
+  // Uncompressed batches are passed through unchanged.
+  XCTAssertCppStringEqual(fsspool::DecodeBatch(*decoded).value_or(""), *decoded);
+}
+
+- (void)testWriteMessageFramed {
+  static const int kCapacity = 10;
+
+  auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+  FsSpoolLogBatchWriter batch_writer(writer.get(), kCapacity, fsspool::Codec::kFramed);
+  for (int i = 0; i < kCapacity; i++) {
+    XCTAssertStatusOk(batch_writer.WriteRecord("", std::string(100, 'A' + i)));
+  }
+  XCTAssertStatusOk(batch_writer.Flush());
+
+  FsSpoolReaderPeer reader([self.baseDir UTF8String]);
+  absl::StatusOr<std::string> path = reader.NextMessagePath();
+  XCTAssertStatusOk(path.status());
+  std::string contents = [self contentsOfFile:*path];
+
+  size_t damaged = 1;
+  absl::StatusOr<std::string> decoded = fsspool::DecodeBatch(contents, &damaged);
+  XCTAssertStatusOk(decoded.status());
+  XCTAssertEqual(damaged, 0);
+  santa::fsspool::binaryproto::LogBatch batch;
+  XCTAssertTrue(batch.ParseFromString(*decoded));
+  XCTAssertEqual(batch.records_size(), kCapacity);
+
+  // Corrupting a record only loses that record.
+  contents[contents.find(std::string(100, 'D')) + 50] = 'X';
+  decoded = fsspool::DecodeBatch(contents, &damaged);
+  XCTAssertStatusOk(decoded.status());
+  XCTAssertEqual(damaged, 1);
+  XCTAssertTrue(batch.ParseFromString(*decoded));
+  XCTAssertEqual(batch.records_size(), kCapacity - 1);
+  for (const google::protobuf::Any &any : batch.records()) {
+    XCTAssertNotEqual(any.value()[0], 'D');
+  }
+
+  // As does a torn write.
+  decoded = fsspool::DecodeBatch(contents.substr(0, contents.size() - 10), &damaged);
+  XCTAssertStatusOk(decoded.status());
+  XCTAssertEqual(damaged, 2);
+  XCTAssertTrue(batch.ParseFromString(*decoded));
+  XCTAssertEqual(batch.records_size(), kCapacity - 2);
+}
+
+- (void)testMappedLogBatch {
+  for (fsspool::Codec codec : {fsspool::Codec::kNone, fsspool::Codec::kZlib}) {
+    auto writer = std::make_unique<FsSpoolWriterPeer>([self.baseDir UTF8String], kSpoolSize);
+    santa::fsspool::binaryproto::LogBatch want;
+    {
+      FsSpoolLogBatchWriter batch_writer(writer.get(), 100, codec);
+      for (int i = 0; i < 20; i++) {
+        google::protobuf::Any *any = want.add_records();
+        any->set_type_url(i % 5 == 0 ? "" : "type.googleapis.com/santa.pb.v1.SantaMessage");
+        any->set_value(std::string(i * 10, 'A' + i));
+        XCTAssertStatusOk(batch_writer.WriteRecord(any->type_url(), any->value()));
+      }
+    }
+
+    FsSpoolReaderPeer reader([self.baseDir UTF8String]);
+    absl::StatusOr<std::string> path = reader.NextMessagePath();
+    XCTAssertStatusOk(path.status());
+    absl::StatusOr<std::unique_ptr<fsspool::MappedLogBatch>> batch =
+        fsspool::MappedLogBatch::Open(*path);
+    XCTAssertStatusOk(batch.status());
+
+    int i = 0;
+    XCTAssertStatusOk((*batch)->ForEachRecord([&](absl::string_view type_url,
+                                                  absl::string_view value) {
+      XCTAssertCppStringEqual(std::string(type_url), want.records(i).type_url());
+      XCTAssertCppStringEqual(std::string(value), want.records(i).value());
+      i++;
+    }));
+    XCTAssertEqual(i, want.records_size());
+    XCTAssertStatusOk(reader.AckMessage(*path));
+  }
+
+  // Truncated records are reported rather than read past the end of the file.
+  NSString *truncated = [self.testDir stringByAppendingPathComponent:@"truncated"];
+  XCTAssertTrue([self.fileMgr createFileAtPath:truncated
+                                      contents:[NSData dataWithBytes:"\x0a\x7f\x01" length:3]
+                                    attributes:nil]);
+  absl::StatusOr<std::unique_ptr<fsspool::MappedLogBatch>> batch =
+      fsspool::MappedLogBatch::Open([truncated UTF8String]);
+  XCTAssertStatusOk(batch.status());
+  XCTAssertEqual(
+      (*batch)->ForEachRecord([](absl::string_view, absl::string_view) {}).code(),
+      absl::StatusCode::kDataLoss);
+}
+
 @end
@@ -0,0 +1,74 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FANOUT_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_FANOUT_H
+
+#include <dispatch/dispatch.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
+
+// Forward declarations
+namespace santa {
+class FanOutPeer;
+}
+
+namespace santa {
+
+// Writes everything it's given to each of several writers. Each writer is fed from its own
+// bounded queue, so a writer that falls behind drops its own writes rather than holding up the
+// others, or the caller. A write counts against the bound until the writer has finished it,
+// including any time spent on the writer's own queue (see Writer::PendingWrites).
+class FanOut : public Writer {
+ public:
+  // Writes which may be unfinished by each writer before further writes to it are dropped.
+  static constexpr size_t kDefaultMaxPendingWrites = 8192;
+
+  // Factory
+  static std::shared_ptr<FanOut> Create(std::vector<std::shared_ptr<Writer>> writers,
+                                        size_t max_pending_writes = kDefaultMaxPendingWrites);
+
+  FanOut(std::vector<std::shared_ptr<Writer>> writers, size_t max_pending_writes);
+
+  void Write(std::vector<uint8_t> &&bytes) override;
+  void WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) override;
+  // Waits for pending writes, then flushes each writer.
+  void Flush() override;
+
+  friend class santa::FanOutPeer;
+
+ private:
+  struct Sink {
+    std::shared_ptr<Writer> writer;
+    dispatch_queue_t q;
+    std::atomic<size_t> pending = 0;
+    // Writes dropped since the sink last caught up. The first drop is logged, and the total once
+    // a write is accepted again.
+    std::atomic<size_t> unreported_dropped = 0;
+  };
+
+  void WriteToSink(const std::shared_ptr<Sink> &sink, std::vector<uint8_t> &&bytes,
+                   Priority priority);
+
+  std::vector<std::shared_ptr<Sink>> sinks_;
+  const size_t max_pending_writes_;
+};
+
+}  // namespace santa
+
+#endif
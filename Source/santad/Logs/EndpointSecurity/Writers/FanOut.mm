@@ -0,0 +1,89 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/FanOut.h"
+
+#include <utility>
+
+#include "Source/common/BranchPrediction.h"
+#import "Source/common/SNTLogging.h"
+
+namespace santa {
+
+std::shared_ptr<FanOut> FanOut::Create(std::vector<std::shared_ptr<Writer>> writers,
+                                       size_t max_pending_writes) {
+  return std::make_shared<FanOut>(std::move(writers), max_pending_writes);
+}
+
+FanOut::FanOut(std::vector<std::shared_ptr<Writer>> writers, size_t max_pending_writes)
+    : max_pending_writes_(max_pending_writes) {
+  for (std::shared_ptr<Writer> &writer : writers) {
+    auto sink = std::make_shared<Sink>();
+    sink->writer = std::move(writer);
+    sink->q = dispatch_queue_create("com.google.santa.daemon.fan_out", DISPATCH_QUEUE_SERIAL);
+    sinks_.push_back(std::move(sink));
+  }
+}
+
+void FanOut::Write(std::vector<uint8_t> &&bytes) {
+  WritePrioritized(std::move(bytes), Priority::kNormal);
+}
+
+void FanOut::WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) {
+  if (sinks_.empty()) {
+    return;
+  }
+  // Every sink but the last gets a copy.
+  for (size_t i = 0; i + 1 < sinks_.size(); i++) {
+    WriteToSink(sinks_[i], std::vector<uint8_t>(bytes), priority);
+  }
+  WriteToSink(sinks_.back(), std::move(bytes), priority);
+}
+
+void FanOut::WriteToSink(const std::shared_ptr<Sink> &sink, std::vector<uint8_t> &&bytes,
+                         Priority priority) {
+  if (sink->pending.fetch_add(1) + sink->writer->PendingWrites() >= max_pending_writes_) {
+    sink->pending--;
+    if (sink->unreported_dropped++ == 0) {
+      LOGE(@"Event log writer is falling behind, dropping events");
+    }
+    return;
+  }
+  if (unlikely(sink->unreported_dropped.load(std::memory_order_relaxed) > 0)) {
+    if (size_t dropped = sink->unreported_dropped.exchange(0); dropped > 0) {
+      LOGE(@"Event log writer caught up after dropping %zu events", dropped);
+    }
+  }
+
+  std::shared_ptr<Sink> shared_sink = sink;
+
+  // Workaround to move `bytes` into the block without a copy
+  __block std::vector<uint8_t> temp_bytes = std::move(bytes);
+
+  dispatch_async(sink->q, ^{
+    shared_sink->writer->WritePrioritized(std::move(temp_bytes), priority);
+    shared_sink->pending--;
+  });
+}
+
+void FanOut::Flush() {
+  for (const std::shared_ptr<Sink> &sink : sinks_) {
+    std::shared_ptr<Writer> writer = sink->writer;
+    dispatch_sync(sink->q, ^{
+      writer->Flush();
+    });
+  }
+}
+
+}  // namespace santa
@@ -0,0 +1,189 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#include <dispatch/dispatch.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Source/common/TestUtils.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/FanOut.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
+
+namespace santa {
+
+class FanOutPeer : public FanOut {
+ public:
+  using FanOut::FanOut;
+
+  size_t Pending(size_t i) { return sinks_[i]->pending; }
+  size_t UnreportedDropped(size_t i) { return sinks_[i]->unreported_dropped; }
+};
+
+}  // namespace santa
+
+using santa::FanOut;
+using santa::FanOutPeer;
+using santa::Writer;
+
+// Records everything written to it, optionally waiting on a semaphore before each write.
+class RecordingWriter : public Writer {
+ public:
+  explicit RecordingWriter(dispatch_semaphore_t gate = nil) : gate_(gate) {}
+
+  void Write(std::vector<uint8_t> &&bytes) override {
+    WritePrioritized(std::move(bytes), Priority::kNormal);
+  }
+
+  void WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) override {
+    if (gate_) {
+      dispatch_semaphore_wait(gate_, DISPATCH_TIME_FOREVER);
+    }
+    writes_.emplace_back(bytes.begin(), bytes.end());
+    priorities_.push_back(priority);
+  }
+
+  void Flush() override { flushes_++; }
+
+  std::vector<std::string> writes_;
+  std::vector<Priority> priorities_;
+  int flushes_ = 0;
+
+ private:
+  dispatch_semaphore_t gate_;
+};
+
+// Finishes writes asynchronously on its own queue, which starts out suspended.
+class QueueingWriter : public Writer {
+ public:
+  QueueingWriter() : q_(dispatch_queue_create("QueueingWriter", DISPATCH_QUEUE_SERIAL)) {
+    dispatch_suspend(q_);
+  }
+
+  void Write(std::vector<uint8_t> &&bytes) override {
+    pending_++;
+    dispatch_async(q_, ^{
+      written_++;
+      pending_--;
+    });
+  }
+
+  void Flush() override {
+    dispatch_sync(q_, ^{
+      flushes_++;
+    });
+  }
+
+  size_t PendingWrites() const override { return pending_; }
+
+  void Resume() { dispatch_resume(q_); }
+
+  std::atomic<size_t> written_ = 0;
+  int flushes_ = 0;
+
+ private:
+  dispatch_queue_t q_;
+  std::atomic<size_t> pending_ = 0;
+};
+
+@interface FanOutTest : XCTestCase
+@end
+
+@implementation FanOutTest
+
+- (void)testWritesToEveryWriter {
+  auto first = std::make_shared<RecordingWriter>();
+  auto second = std::make_shared<RecordingWriter>();
+  auto fanOut = FanOut::Create({first, second});
+
+  fanOut->Write({'a'});
+  fanOut->WritePrioritized({'b', 'c'}, Writer::Priority::kHigh);
+  fanOut->Flush();
+
+  for (const auto &writer : {first, second}) {
+    XCTAssertEqual(writer->writes_.size(), 2);
+    XCTAssertCppStringEqual(writer->writes_[0], std::string("a"));
+    XCTAssertCppStringEqual(writer->writes_[1], std::string("bc"));
+    XCTAssertTrue(writer->priorities_[1] == Writer::Priority::kHigh);
+    XCTAssertEqual(writer->flushes_, 1);
+  }
+}
+
+- (void)testSlowWriterDoesNotStallOthers {
+  dispatch_semaphore_t gate = dispatch_semaphore_create(0);
+  auto slow = std::make_shared<RecordingWriter>(gate);
+  auto fast = std::make_shared<RecordingWriter>();
+  const size_t maxPending = 4;
+  auto fanOut = std::make_shared<FanOutPeer>(
+    std::vector<std::shared_ptr<Writer>>{slow, fast}, maxPending);
+
+  // The slow writer is blocked on its first write, so only maxPending writes can be queued for it.
+  // The fast writer keeps up, and none of this waits on the slow writer.
+  const size_t numWrites = 10;
+  for (size_t i = 0; i < numWrites; i++) {
+    fanOut->Write({'x'});
+    for (int attempts = 0; fanOut->Pending(1) > 0 && attempts < 1000; attempts++) {
+      SleepMS(1);
+    }
+  }
+  XCTAssertEqual(fanOut->UnreportedDropped(0), numWrites - maxPending);
+  XCTAssertEqual(fanOut->UnreportedDropped(1), 0);
+
+  // Let the slow writer finish.
+  for (size_t i = 0; i < maxPending; i++) {
+    dispatch_semaphore_signal(gate);
+  }
+  fanOut->Flush();
+
+  XCTAssertEqual(slow->writes_.size(), maxPending);
+  XCTAssertEqual(fast->writes_.size(), numWrites);
+
+  // The next write accepted by the slow writer reports what it dropped.
+  dispatch_semaphore_signal(gate);
+  fanOut->Write({'y'});
+  fanOut->Flush();
+  XCTAssertEqual(fanOut->UnreportedDropped(0), 0);
+  XCTAssertEqual(slow->writes_.size(), maxPending + 1);
+}
+
+- (void)testWriterBacklogCountsAgainstLimit {
+  auto writer = std::make_shared<QueueingWriter>();
+  const size_t maxPending = 4;
+  auto fanOut =
+    std::make_shared<FanOutPeer>(std::vector<std::shared_ptr<Writer>>{writer}, maxPending);
+
+  // The writer accepts each write straight away, but doesn't finish any of them, so writes are
+  // dropped once maxPending are waiting on its queue.
+  const size_t numWrites = 10;
+  for (size_t i = 0; i < numWrites; i++) {
+    fanOut->Write({'x'});
+    for (int attempts = 0; fanOut->Pending(0) > 0 && attempts < 1000; attempts++) {
+      SleepMS(1);
+    }
+  }
+  XCTAssertEqual(writer->PendingWrites(), maxPending);
+  XCTAssertEqual(fanOut->UnreportedDropped(0), numWrites - maxPending);
+
+  writer->Resume();
+  fanOut->Flush();
+  XCTAssertEqual(writer->flushes_, 1);
+  XCTAssertEqual(writer->written_, maxPending);
+  XCTAssertEqual(writer->PendingWrites(), 0);
+}
+
+@end
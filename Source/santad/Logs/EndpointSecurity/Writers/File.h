@@ -20,9 +20,12 @@
 #include <Foundation/Foundation.h>
 #include <dispatch/dispatch.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/ring_drainer.h"
+
 // Forward declarations
 namespace santa {
 class FilePeer;
@@ -33,29 +36,61 @@ namespace santa {
 class File : public Writer, public std::enable_shared_from_this<File> {
  public:
   // Factory
+  // When use_writer_thread is set, writes are handed to the queue in batches by a dedicated thread,
+  // rather than with a block each. See santa::RingDrainer.
   static std::shared_ptr<File> Create(NSString *path, uint64_t flush_timeout_ms,
                                       size_t batch_size_bytes,
-                                      size_t max_expected_write_size_bytes);
-
+                                      size_t max_expected_write_size_bytes,
+                                      bool use_writer_thread = false,
+                                      size_t rotate_size_bytes = 0, uint64_t rotate_age_sec = 0,
+                                      size_t retain_count = 0);
+
+  // The log file is rotated once it reaches rotate_size_bytes, or is older than rotate_age_sec.
+  // Either is ignored when 0. Rotated files are compressed in the background, and only the newest
+  // retain_count are kept, or all of them when 0.
   File(NSString *path, size_t batch_size_bytes, size_t max_expected_write_size_bytes,
-       dispatch_queue_t q, dispatch_source_t timer_source);
+       dispatch_queue_t q, dispatch_source_t timer_source, size_t rotate_size_bytes = 0,
+       uint64_t rotate_age_sec = 0, size_t retain_count = 0);
   ~File();
 
   void Write(std::vector<uint8_t> &&bytes) override;
   void Flush() override;
+  size_t PendingWrites() const override;
 
   friend class santa::FilePeer;
 
  private:
+  // Writes which may be waiting on q_ before further writes are dropped. The queue only falls this
+  // far behind while writes to the log file are blocked.
+  static constexpr size_t kMaxPendingWrites = 4096;
+
   void OpenFileHandleLocked();
   void WatchLogFile();
+  void StartWriterThread();
   void FlushLocked();
   bool ShouldFlush();
-
-  void EnsureCapacityLocked(size_t additional_bytes);
-  void CopyDataLocked(const std::vector<uint8_t> &bytes);
-
-  std::vector<uint8_t> buffer_;
+  void MaybeRotateLocked();
+  void RotateLocked();
+
+  // Returns false, dropping the record, if there isn't room for it even after flushing.
+  bool CopyDataLocked(const std::vector<uint8_t> &bytes);
+  size_t FreeSpaceLocked();
+  void DropRecord();
+
+  // Data is buffered in a fixed ring of these, so memory use stays bounded
+  // even when writes to the log file stall or fail.
+  struct IOBuffer {
+    std::vector<uint8_t> data;
+    // Bytes in [begin, end) have yet to be written.
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  std::vector<IOBuffer> buffers_;
+  // The oldest buffer with unwritten data, and the buffer being filled. Every
+  // buffer from head_ to tail_ is in use.
+  size_t head_ = 0;
+  size_t tail_ = 0;
   size_t batch_size_bytes_;
   dispatch_queue_t q_;
   dispatch_source_t timer_source_;
@@ -63,11 +98,34 @@ class File : public Writer, public std::enable_shared_from_this<File> {
   NSString *path_;
   NSFileHandle *file_handle_;
 
-  // Used to manually track the size of valid data in the `buffer_`.
+  const size_t rotate_size_bytes_;
+  const uint64_t rotate_age_sec_;
+  const size_t retain_count_;
+  // Rotated files are compressed and pruned on this low priority queue.
+  dispatch_queue_t rotation_q_;
+  // The size and creation time of the current log file.
+  size_t file_size_ = 0;
+  time_t file_created_ = 0;
+
+  // Used to manually track the amount of unwritten data in `buffers_`.
   // Benchmarking showed a large amount of time clearing the buffer after
   // flushes, but that isn't very necessary. Instead we can manually track the
-  // `end` of the buffer and skip clearing the data.
-  size_t buffer_offset_ = 0;
+  // `begin` and `end` of each buffer and skip clearing the data.
+  size_t buffered_bytes_ = 0;
+  // Records dropped, because either too many writes were pending or the ring
+  // was full, which have yet to be logged.
+  std::atomic<size_t> unreported_dropped_records_ = 0;
+  // Flushes which have failed since the last successful write. Only the first
+  // of them is logged.
+  size_t failed_flushes_ = 0;
+
+  // Writes dispatched to q_ which it has yet to run. Writes handed to the drainer instead wait for
+  // room in its ring, so aren't counted.
+  std::atomic<size_t> pending_writes_ = 0;
+
+  std::unique_ptr<RingDrainer<std::vector<uint8_t>>> drainer_;
+  // Set once the destructor has started stopping the drainer.
+  std::atomic<bool> stopping_drainer_ = false;
 };
 
 }  // namespace santa
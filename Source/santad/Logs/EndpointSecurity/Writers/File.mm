@@ -14,14 +14,137 @@
 
 #include "Source/santad/Logs/EndpointSecurity/Writers/File.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <algorithm>
 #include <memory>
 
 #include "Source/common/BranchPrediction.h"
+#import "Source/common/SNTLogging.h"
+
+// Batches which may be buffered while writes to the log file are stalled or failing. Records
+// are dropped once they're all full.
+static const size_t kNumIOBuffers = 4;
+static NSString *const kCompressedExtension = @"gz";
+
+// Rotated logs are named "<log name>.<UTC rotation time>", e.g. santa.log.20240102T030405Z, with
+// a ".<n>" suffix if there's more than one rotation in a second.
+static NSString *RotatedLogPath(NSString *path) {
+  char timestamp[sizeof("YYYYmmddTHHMMSSZ")];
+  time_t now = time(nullptr);
+  struct tm tm;
+  strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", gmtime_r(&now, &tm));
+
+  NSFileManager *fm = [NSFileManager defaultManager];
+  NSString *rotated = [NSString stringWithFormat:@"%@.%s", path, timestamp];
+  int i = 0;
+  while ([fm fileExistsAtPath:rotated] ||
+         [fm fileExistsAtPath:[rotated stringByAppendingPathExtension:kCompressedExtension]]) {
+    rotated = [NSString stringWithFormat:@"%@.%s.%d", path, timestamp, ++i];
+  }
+  return rotated;
+}
+
+// Returns the rotation time and counter of a rotated log, or nil if name isn't one of path's.
+static NSString *RotatedLogSuffix(NSString *path, NSString *name) {
+  NSString *prefix = [path.lastPathComponent stringByAppendingString:@"."];
+  if (![name hasPrefix:prefix]) {
+    return nil;
+  }
+  NSString *suffix = [name substringFromIndex:prefix.length];
+  if ([suffix.pathExtension isEqualToString:@"tmp"]) {
+    return nil;
+  } else if ([suffix.pathExtension isEqualToString:kCompressedExtension]) {
+    suffix = [suffix stringByDeletingPathExtension];
+  }
+  // Skip anything not named by RotatedLogPath, such as logs rotated by newsyslog.
+  if (suffix.length < strlen("YYYYmmddTHHMMSSZ") || [suffix characterAtIndex:8] != 'T') {
+    return nil;
+  }
+  return suffix;
+}
+
+static bool CompressFile(NSString *path, NSString *compressed_path) {
+  NSString *tmp_path = [compressed_path stringByAppendingString:@".tmp"];
+  int in = open(path.fileSystemRepresentation, O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  gzFile out = gzopen(tmp_path.fileSystemRepresentation, "wb");
+  if (!out) {
+    close(in);
+    return false;
+  }
+
+  bool ok = true;
+  char buf[64 * 1024];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ok = false;
+      break;
+    }
+    if (gzwrite(out, buf, (unsigned)n) != n) {
+      ok = false;
+      break;
+    }
+  }
+  close(in);
+  ok = (gzclose(out) == Z_OK) && ok;
+
+  // Only replace the rotated log once it has been completely compressed.
+  if (ok &&
+      rename(tmp_path.fileSystemRepresentation, compressed_path.fileSystemRepresentation) == 0) {
+    unlink(path.fileSystemRepresentation);
+    return true;
+  }
+  unlink(tmp_path.fileSystemRepresentation);
+  return false;
+}
+
+// Removes all but the newest retain_count rotated logs.
+static void PruneRotatedLogs(NSString *path, size_t retain_count) {
+  NSString *dir = [path stringByDeletingLastPathComponent];
+  NSArray<NSString *> *names = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:dir
+                                                                                   error:nil];
+  NSMutableArray<NSString *> *rotated = [NSMutableArray array];
+  NSMutableDictionary<NSString *, NSString *> *suffixes = [NSMutableDictionary dictionary];
+  for (NSString *name in names) {
+    NSString *suffix = RotatedLogSuffix(path, name);
+    if (suffix) {
+      [rotated addObject:name];
+      suffixes[name] = suffix;
+    }
+  }
+  if (rotated.count <= retain_count) {
+    return;
+  }
+
+  // Sort oldest first. Rotation times sort lexically, and a rotation's counter only ever follows
+  // the first rotation in that second.
+  [rotated sortUsingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+    return [suffixes[a] compare:suffixes[b] options:NSNumericSearch];
+  }];
+  for (NSUInteger i = 0; i < rotated.count - retain_count; i++) {
+    unlink([dir stringByAppendingPathComponent:rotated[i]].fileSystemRepresentation);
+  }
+}
 
 namespace santa {
 
 std::shared_ptr<File> File::Create(NSString *path, uint64_t flush_timeout_ms,
-                                   size_t batch_size_bytes, size_t max_expected_write_size_bytes) {
+                                   size_t batch_size_bytes, size_t max_expected_write_size_bytes,
+                                   bool use_writer_thread, size_t rotate_size_bytes,
+                                   uint64_t rotate_age_sec, size_t retain_count) {
   dispatch_queue_t q = dispatch_queue_create("com.google.santa.daemon.file_event_log",
                                              DISPATCH_QUEUE_SERIAL_WITH_AUTORELEASE_POOL);
   dispatch_source_t timer_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, q);
@@ -30,8 +153,12 @@ std::shared_ptr<File> File::Create(NSString *path, uint64_t flush_timeout_ms,
                             NSEC_PER_MSEC * flush_timeout_ms, 0);
 
   auto ret_writer =
-    std::make_shared<File>(path, batch_size_bytes, max_expected_write_size_bytes, q, timer_source);
+    std::make_shared<File>(path, batch_size_bytes, max_expected_write_size_bytes, q, timer_source,
+                           rotate_size_bytes, rotate_age_sec, retain_count);
   ret_writer->WatchLogFile();
+  if (use_writer_thread) {
+    ret_writer->StartWriterThread();
+  }
 
   std::weak_ptr<File> weak_writer(ret_writer);
   dispatch_source_set_event_handler(ret_writer->timer_source_, ^{
@@ -48,12 +175,22 @@ std::shared_ptr<File> File::Create(NSString *path, uint64_t flush_timeout_ms,
 }
 
 File::File(NSString *path, size_t batch_size_bytes, size_t max_expected_write_size_bytes,
-           dispatch_queue_t q, dispatch_source_t timer_source)
-    : buffer_(batch_size_bytes + max_expected_write_size_bytes),
+           dispatch_queue_t q, dispatch_source_t timer_source, size_t rotate_size_bytes,
+           uint64_t rotate_age_sec, size_t retain_count)
+    : buffers_(kNumIOBuffers),
       batch_size_bytes_(batch_size_bytes),
       q_(q),
       timer_source_(timer_source),
-      watch_source_(nullptr) {
+      watch_source_(nullptr),
+      rotate_size_bytes_(rotate_size_bytes),
+      rotate_age_sec_(rotate_age_sec),
+      retain_count_(retain_count) {
+  rotation_q_ = dispatch_queue_create(
+    "com.google.santa.daemon.file_event_log_rotation",
+    dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_BACKGROUND, 0));
+  for (IOBuffer &buffer : buffers_) {
+    buffer.data.resize(batch_size_bytes + max_expected_write_size_bytes);
+  }
   path_ = path;
   OpenFileHandleLocked();
 }
@@ -76,7 +213,34 @@ void File::WatchLogFile() {
   dispatch_resume(watch_source_);
 }
 
+void File::StartWriterThread() {
+  // The drainer is stopped by the destructor, before anything it uses is destroyed.
+  drainer_ = std::make_unique<RingDrainer<std::vector<uint8_t>>>(
+    [this](std::vector<std::vector<uint8_t>> &batch) {
+      std::vector<std::vector<uint8_t>> *records = &batch;
+      void (^write_records)(void) = ^{
+        for (const std::vector<uint8_t> &record : *records) {
+          CopyDataLocked(record);
+          if (ShouldFlush()) {
+            FlushLocked();
+          }
+        }
+      };
+      // Nothing else can be using the writer once it is being destroyed, and the destructor may
+      // itself be running on the queue.
+      if (stopping_drainer_) {
+        write_records();
+      } else {
+        dispatch_sync(q_, write_records);
+      }
+    });
+}
+
 File::~File() {
+  if (drainer_) {
+    stopping_drainer_ = true;
+    drainer_.reset();
+  }
   if (timer_source_) {
     dispatch_source_cancel(timer_source_);
   }
@@ -84,15 +248,78 @@ File::~File() {
 
 // IMPORTANT: Not thread safe.
 void File::OpenFileHandleLocked() {
-  NSFileManager *fm = [NSFileManager defaultManager];
-  if (![fm fileExistsAtPath:path_]) {
-    [fm createFileAtPath:path_ contents:nil attributes:nil];
+  // O_APPEND keeps writes at the end of the file, even if something else appends to it too.
+  int fd = open(path_.fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOGE(@"Unable to open log file %@: %s", path_, strerror(errno));
+    file_handle_ = nil;
+    return;
+  }
+  file_handle_ = [[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+
+  struct stat sb;
+  if (fstat(fd, &sb) == 0) {
+    file_size_ = sb.st_size;
+    file_created_ = sb.st_birthtimespec.tv_sec;
+  } else {
+    file_size_ = 0;
+    file_created_ = time(nullptr);
+  }
+}
+
+// IMPORTANT: Not thread safe.
+void File::MaybeRotateLocked() {
+  if (file_size_ == 0) {
+    return;
+  }
+  if ((rotate_size_bytes_ > 0 && file_size_ >= rotate_size_bytes_) ||
+      (rotate_age_sec_ > 0 && (uint64_t)(time(nullptr) - file_created_) >= rotate_age_sec_)) {
+    RotateLocked();
+  }
+}
+
+// IMPORTANT: Not thread safe.
+void File::RotateLocked() {
+  // Everything buffered has been written by the time this is called. Moving the log aside and
+  // opening its replacement both happen on the queue, so no writes land in between.
+  NSString *rotated_path = RotatedLogPath(path_);
+  if (rename(path_.fileSystemRepresentation, rotated_path.fileSystemRepresentation) != 0) {
+    LOGE(@"Unable to rotate log file %@: %s", path_, strerror(errno));
+    return;
+  }
+
+  [file_handle_ closeFile];
+  OpenFileHandleLocked();
+  if (watch_source_) {
+    // Watch the new file, rather than reopening it again for the rename above.
+    WatchLogFile();
   }
-  file_handle_ = [NSFileHandle fileHandleForWritingAtPath:path_];
-  [file_handle_ seekToEndOfFile];
+
+  NSString *path = path_;
+  size_t retain_count = retain_count_;
+  dispatch_async(rotation_q_, ^{
+    NSString *compressed_path = [rotated_path stringByAppendingPathExtension:kCompressedExtension];
+    if (!CompressFile(rotated_path, compressed_path)) {
+      LOGW(@"Unable to compress rotated log file %@", rotated_path);
+    }
+    if (retain_count > 0) {
+      PruneRotatedLogs(path, retain_count);
+    }
+  });
 }
 
 void File::Write(std::vector<uint8_t> &&bytes) {
+  if (drainer_) {
+    drainer_->Push(std::move(bytes));
+    return;
+  }
+
+  if (unlikely(pending_writes_.fetch_add(1) >= kMaxPendingWrites)) {
+    pending_writes_--;
+    DropRecord();
+    return;
+  }
+
   auto shared_this = shared_from_this();
 
   // Workaround to move `bytes` into the block without a copy
@@ -106,41 +333,131 @@ void File::Write(std::vector<uint8_t> &&bytes) {
     if (shared_this->ShouldFlush()) {
       shared_this->FlushLocked();
     }
+    shared_this->pending_writes_--;
   });
 }
 
+size_t File::PendingWrites() const {
+  return pending_writes_;
+}
+
 bool File::ShouldFlush() {
-  return buffer_offset_ >= batch_size_bytes_;
+  return buffered_bytes_ >= batch_size_bytes_;
 }
 
 void File::Flush() {
+  if (drainer_) {
+    drainer_->WaitDrained();
+  }
   dispatch_sync(q_, ^{
     FlushLocked();
   });
 }
 
 // IMPORTANT: Not thread safe.
-void File::EnsureCapacityLocked(size_t additional_bytes) {
-  if ((buffer_offset_ + additional_bytes) > buffer_.capacity()) {
-    buffer_.resize(buffer_.capacity() * 2);
+size_t File::FreeSpaceLocked() {
+  size_t buffers_in_use = (tail_ + kNumIOBuffers - head_) % kNumIOBuffers + 1;
+  size_t capacity = buffers_[tail_].data.size();
+  return (capacity - buffers_[tail_].end) + (kNumIOBuffers - buffers_in_use) * capacity;
+}
+
+// Drops are logged when the first happens, and summarized by the next successful flush.
+void File::DropRecord() {
+  if (unreported_dropped_records_++ == 0) {
+    LOGE(@"Log file writes are backed up, dropping records until they succeed");
   }
 }
 
 // IMPORTANT: Not thread safe.
-void File::CopyDataLocked(const std::vector<uint8_t> &bytes) {
-  EnsureCapacityLocked(bytes.size());
-  std::copy(bytes.begin(), bytes.end(), buffer_.begin() + buffer_offset_);
-  buffer_offset_ += bytes.size();
+bool File::CopyDataLocked(const std::vector<uint8_t> &bytes) {
+  if (unlikely(FreeSpaceLocked() < bytes.size())) {
+    FlushLocked();
+    if (FreeSpaceLocked() < bytes.size()) {
+      DropRecord();
+      return false;
+    }
+  }
+
+  // Records larger than a single buffer are split across buffers. They're written in order, so
+  // the record is still contiguous in the file.
+  size_t copied = 0;
+  while (copied < bytes.size()) {
+    IOBuffer *buffer = &buffers_[tail_];
+    if (buffer->end == buffer->data.size()) {
+      tail_ = (tail_ + 1) % kNumIOBuffers;
+      continue;
+    }
+    size_t n = std::min(bytes.size() - copied, buffer->data.size() - buffer->end);
+    std::copy_n(bytes.begin() + copied, n, buffer->data.begin() + buffer->end);
+    buffer->end += n;
+    copied += n;
+  }
+  buffered_bytes_ += bytes.size();
+  return true;
 }
 
 // IMPORTANT: Not thread safe.
 void File::FlushLocked() {
-  if (likely(buffer_offset_ > 0)) {
-    write(file_handle_.fileDescriptor, buffer_.data(), buffer_offset_);
+  if (unlikely(!file_handle_)) {
+    return;
+  }
 
-    // After flushing, reset the offset back to 0
-    buffer_offset_ = 0;
+  int fd = file_handle_.fileDescriptor;
+  while (buffered_bytes_ > 0) {
+    struct iovec iov[kNumIOBuffers];
+    int iovcnt = 0;
+    for (size_t i = head_;; i = (i + 1) % kNumIOBuffers) {
+      IOBuffer &buffer = buffers_[i];
+      if (buffer.end > buffer.begin) {
+        iov[iovcnt].iov_base = buffer.data.data() + buffer.begin;
+        iov[iovcnt].iov_len = buffer.end - buffer.begin;
+        iovcnt++;
+      }
+      if (i == tail_) {
+        break;
+      }
+    }
+
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      // Leave the data buffered so that it's retried by the next flush. While the buffer is full
+      // that's once per record, so only the first failure is logged.
+      if (failed_flushes_++ == 0) {
+        LOGE(@"Failed to write to log file %@: %s", path_, strerror(errno));
+      }
+      return;
+    }
+    if (unlikely(failed_flushes_ > 0)) {
+      LOGI(@"Writes to log file %@ succeeded again after %zu failed attempts", path_,
+           failed_flushes_);
+      failed_flushes_ = 0;
+    }
+
+    // Consume what was written, which may have ended partway through a buffer.
+    buffered_bytes_ -= written;
+    file_size_ += written;
+    size_t remaining = written;
+    while (remaining > 0) {
+      IOBuffer &buffer = buffers_[head_];
+      size_t n = std::min(remaining, buffer.end - buffer.begin);
+      buffer.begin += n;
+      remaining -= n;
+      if (buffer.begin == buffer.end) {
+        buffer.begin = buffer.end = 0;
+        if (head_ != tail_) {
+          head_ = (head_ + 1) % kNumIOBuffers;
+        }
+      }
+    }
   }
+
+  if (size_t dropped = unreported_dropped_records_.exchange(0); unlikely(dropped > 0)) {
+    LOGE(@"Dropped %zu records while log file writes were backed up", dropped);
+  }
+
+  MaybeRotateLocked();
 }
 
 }  // namespace santa
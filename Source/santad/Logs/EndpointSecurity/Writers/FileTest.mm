@@ -14,9 +14,12 @@
 
 #import <Foundation/Foundation.h>
 #include <dispatch/dispatch.h>
+#include <fcntl.h>
 #include <gtest/gtest.h>
 #include <sys/stat.h>
+#include <zlib.h>
 
+#include <string>
 #include <vector>
 
 #include "Source/common/TestUtils.h"
@@ -30,7 +33,7 @@ class FilePeer : public File {
   using File::File;
 
   using File::CopyDataLocked;
-  using File::EnsureCapacityLocked;
+  using File::FlushLocked;
   using File::ShouldFlush;
   using File::WatchLogFile;
 
@@ -43,20 +46,37 @@ class FilePeer : public File {
     return h;
   }
 
+  void SetFileHandle(NSFileHandle *h) {
+    dispatch_sync(q_, ^{
+      file_handle_ = h;
+    });
+  }
+
   size_t InternalBufferSize() {
     __block size_t s = 0;
     dispatch_sync(q_, ^{
-      s = buffer_offset_;
+      s = buffered_bytes_;
     });
     return s;
   }
   size_t InternalBufferCapacity() {
     __block size_t s = 0;
     dispatch_sync(q_, ^{
-      s = buffer_.capacity();
+      for (const IOBuffer &buffer : buffers_) {
+        s += buffer.data.size();
+      }
     });
     return s;
   }
+  // Waits for rotated files to be compressed and pruned.
+  void WaitForRotation() {
+    dispatch_sync(rotation_q_, ^{
+    });
+  }
+
+  size_t UnreportedDroppedRecords() { return unreported_dropped_records_; }
+
+  using File::kMaxPendingWrites;
 };
 
 }  // namespace santa
@@ -199,35 +219,132 @@ bool WaitForBufferSize(std::shared_ptr<FilePeer> file, size_t expectedSize) {
   XCTAssertEqual(0, file->InternalBufferSize());
 }
 
-- (void)testEnsureCapacity {
+- (void)testAppendsToExistingFile {
+  XCTAssertTrue([@"existing\n" writeToFile:self.logPath
+                                atomically:NO
+                                  encoding:NSUTF8StringEncoding
+                                     error:nil]);
+
+  auto file = std::make_shared<FilePeer>(self.logPath, 100, 200, self.q, self.timer);
+  file->Write(std::vector<uint8_t>{'n', 'e', 'w', '\n'});
+  file->Flush();
+
+  NSString *got = [NSString stringWithContentsOfFile:self.logPath
+                                            encoding:NSUTF8StringEncoding
+                                               error:nil];
+  XCTAssertEqualObjects(got, @"existing\nnew\n");
+}
+
+- (NSArray<NSString *> *)rotatedLogs {
+  NSArray<NSString *> *names = [self.fileManager contentsOfDirectoryAtPath:self.path error:nil];
+  return [[names filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"SELF BEGINSWITH %@",
+                                                                              @"log.out."]]
+    sortedArrayUsingSelector:@selector(compare:)];
+}
+
+- (void)testRotateBySize {
   const size_t batchSize = 100;
-  auto file =
-    std::make_shared<FilePeer>(self.logPath, batchSize, batchSize * 2, self.q, self.timer);
+  auto file = std::make_shared<FilePeer>(self.logPath, batchSize, batchSize, self.q, self.timer,
+                                         150, 0, 1);
 
-  // Initial capacity == (batch_size + max_expected_write_size)
-  const size_t initialCapacity = batchSize + (batchSize * 2);
+  // Below the rotation size, nothing is rotated.
+  file->Write(std::vector<uint8_t>(batchSize, 'A'));
+  file->Flush();
+  file->WaitForRotation();
+  XCTAssertEqual([self rotatedLogs].count, 0);
 
-  // Buffer size should initially be 0 and capacity match initial expectations
-  XCTAssertEqual(file->InternalBufferSize(), 0);
-  XCTAssertEqual(file->InternalBufferCapacity(), initialCapacity);
+  // Once the log reaches the rotation size, it's moved aside, compressed and replaced.
+  file->Write(std::vector<uint8_t>(batchSize, 'B'));
+  file->Flush();
+  file->WaitForRotation();
 
-  file->EnsureCapacityLocked(batchSize);
+  NSArray<NSString *> *rotated = [self rotatedLogs];
+  XCTAssertEqual(rotated.count, 1);
+  XCTAssertEqualObjects(rotated[0].pathExtension, @"gz");
 
-  // No data was written, so size is still 0
-  XCTAssertEqual(file->InternalBufferSize(), 0);
+  struct stat gotSB;
+  XCTAssertEqual(fstat(file->FileHandle().fileDescriptor, &gotSB), 0);
+  XCTAssertEqual(gotSB.st_size, 0);
+  XCTAssertEqual(stat([self.logPath UTF8String], &gotSB), 0);
+  XCTAssertEqual(gotSB.st_size, 0);
+
+  NSString *rotatedPath = [self.path stringByAppendingPathComponent:rotated[0]];
+  gzFile gz = gzopen([rotatedPath UTF8String], "rb");
+  XCTAssertTrue(gz != NULL);
+  char buf[512];
+  int n = gzread(gz, buf, sizeof(buf));
+  gzclose(gz);
+  XCTAssertCppStringEqual(std::string(buf, n),
+                          std::string(batchSize, 'A') + std::string(batchSize, 'B'));
+
+  // Only the newest rotated log is retained.
+  file->Write(std::vector<uint8_t>(batchSize * 2, 'C'));
+  file->Flush();
+  file->WaitForRotation();
+
+  NSArray<NSString *> *rotatedAgain = [self rotatedLogs];
+  XCTAssertEqual(rotatedAgain.count, 1);
+  XCTAssertNotEqualObjects(rotatedAgain[0], rotated[0]);
+}
+
+- (void)testDropsWhenBufferFull {
+  const size_t batchSize = 100;
+  auto file = std::make_shared<FilePeer>(self.logPath, batchSize, batchSize, self.q, self.timer);
+  const size_t capacity = file->InternalBufferCapacity();
+
+  // Make every write fail, so that nothing leaves the buffer.
+  int fd = open([self.logPath UTF8String], O_RDONLY);
+  XCTAssertGreaterThanOrEqual(fd, 0);
+  file->SetFileHandle([[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES]);
 
-  // Capacity should be unchanged because the amount ensured didn't exceed
-  // the initial amount
-  XCTAssertEqual(file->InternalBufferCapacity(), initialCapacity);
+  std::vector<uint8_t> bytes(batchSize, 'A');
+  for (size_t i = 0; i < capacity / batchSize; i++) {
+    XCTAssertTrue(file->CopyDataLocked(bytes));
+  }
+  XCTAssertEqual(file->InternalBufferSize(), capacity);
 
-  file->EnsureCapacityLocked(initialCapacity + 100);
+  // The buffer is full and flushing fails, so the record is dropped rather than growing it.
+  XCTAssertFalse(file->CopyDataLocked(bytes));
+  XCTAssertEqual(file->UnreportedDroppedRecords(), 1);
+  XCTAssertEqual(file->InternalBufferSize(), capacity);
+  XCTAssertEqual(file->InternalBufferCapacity(), capacity);
 
-  // No data was written, so size is still 0
+  // Once writes succeed again, everything that was buffered is written and the drop is reported.
+  file->SetFileHandle([NSFileHandle fileHandleForWritingAtPath:self.logPath]);
+  file->Flush();
   XCTAssertEqual(file->InternalBufferSize(), 0);
+  XCTAssertEqual(file->UnreportedDroppedRecords(), 0);
 
-  // Capacity should be doubled since the amount ensured was greater than
-  // the previous capacity
-  XCTAssertEqual(file->InternalBufferCapacity(), initialCapacity * 2);
+  struct stat gotSB;
+  XCTAssertEqual(stat([self.logPath UTF8String], &gotSB), 0);
+  XCTAssertEqual(gotSB.st_size, (off_t)capacity);
+}
+
+- (void)testDropsWhenTooManyWritesPending {
+  const size_t batchSize = 100;
+  auto file = std::make_shared<FilePeer>(self.logPath, batchSize, batchSize, self.q, self.timer);
+
+  // Stall the queue, as a blocked write to the log file would.
+  dispatch_suspend(self.q);
+  for (size_t i = 0; i < FilePeer::kMaxPendingWrites; i++) {
+    file->Write(std::vector<uint8_t>(1, 'A'));
+  }
+  XCTAssertEqual(file->PendingWrites(), FilePeer::kMaxPendingWrites);
+  XCTAssertEqual(file->UnreportedDroppedRecords(), 0);
+
+  // Further writes are dropped rather than queued.
+  file->Write(std::vector<uint8_t>(1, 'B'));
+  XCTAssertEqual(file->PendingWrites(), FilePeer::kMaxPendingWrites);
+  XCTAssertEqual(file->UnreportedDroppedRecords(), 1);
+
+  dispatch_resume(self.q);
+  file->Flush();
+  XCTAssertEqual(file->PendingWrites(), 0);
+  XCTAssertEqual(file->UnreportedDroppedRecords(), 0);
+
+  struct stat gotSB;
+  XCTAssertEqual(stat([self.logPath UTF8String], &gotSB), 0);
+  XCTAssertEqual(gotSB.st_size, (off_t)FilePeer::kMaxPendingWrites);
 }
 
 - (void)testCopyData {
@@ -237,24 +354,24 @@ bool WaitForBufferSize(std::shared_ptr<FilePeer> file, size_t expectedSize) {
   auto file =
     std::make_shared<FilePeer>(self.logPath, batchSize, batchSize * 2, self.q, self.timer);
 
-  // Initial capacity == (batch_size + max_expected_write_size)
-  const size_t initialCapacity = batchSize + (batchSize * 2);
+  // Capacity is fixed at a few buffers of (batch_size + max_expected_write_size)
+  const size_t capacity = file->InternalBufferCapacity();
+  XCTAssertEqual(capacity % (batchSize + (batchSize * 2)), 0);
 
-  // Buffer size should initially be 0 and capacity match initial expectations
+  // Buffer size should initially be 0
   XCTAssertEqual(file->InternalBufferSize(), 0);
-  XCTAssertEqual(file->InternalBufferCapacity(), initialCapacity);
 
-  file->CopyDataLocked(bytes);
+  XCTAssertTrue(file->CopyDataLocked(bytes));
 
   // After a copy, buffer size should match copied data size
   XCTAssertEqual(file->InternalBufferSize(), bytes.size());
 
-  // Do a couple more copies that should require the buffer to grow and then
+  // Do a couple more copies that spill into the next buffer and then
   // confirm the size/capacity still matches expectations
-  file->CopyDataLocked(bytes);
-  file->CopyDataLocked(bytes);
+  XCTAssertTrue(file->CopyDataLocked(bytes));
+  XCTAssertTrue(file->CopyDataLocked(bytes));
   XCTAssertEqual(file->InternalBufferSize(), bytes.size() * 3);
-  XCTAssertEqual(file->InternalBufferCapacity(), initialCapacity * 2);
+  XCTAssertEqual(file->InternalBufferCapacity(), capacity);
 }
 
 - (void)testShouldFlush {
@@ -0,0 +1,132 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_MPSCRING_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_MPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace santa {
+
+// A bounded, lock-free queue for any number of producers and a single
+// consumer.
+//
+// Each slot carries a sequence number which says whose turn it is: a
+// producer claims a slot by advancing the shared enqueue position with a
+// CAS, moves its value in, then publishes it by bumping the slot's sequence.
+// The consumer takes published slots in order and hands them back to the
+// producers a lap later. Producers never wait on one another beyond a
+// contended CAS, and the consumer never writes to the enqueue position.
+//
+// Example:
+//   MpscRing<std::string> ring(1024);
+//   if (!ring.TryPush(std::move(value))) { /* full */ }
+//   std::string out;
+//   while (ring.TryPop(&out)) { ... }
+template <typename T>
+class MpscRing {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit MpscRing(size_t capacity)
+      : mask_(RoundUpToPowerOfTwo(capacity) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Moves the value into the ring. Returns false, leaving the value alone, if
+  // the ring is full. Safe to call from any thread.
+  bool TryPush(T &&value) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The slot still holds the value from the previous lap.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = std::move(value);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves the oldest value out of the ring. Returns false if there is none,
+  // or if the producer which claimed the next slot hasn't published it yet.
+  // Only the consumer may call this.
+  bool TryPop(T *value) {
+    Slot &slot = slots_[dequeue_pos_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+      return false;
+    }
+    *value = std::move(slot.value);
+    slot.sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    dequeue_pos_++;
+    return true;
+  }
+
+  // Whether TryPop() would fail. Only the consumer may call this.
+  bool Empty() const {
+    return slots_[dequeue_pos_ & mask_].sequence.load(
+               std::memory_order_acquire) != dequeue_pos_ + 1;
+  }
+
+  // The number of values pushed, or being pushed, so far.
+  size_t Pushed() const { return enqueue_pos_.load(std::memory_order_acquire); }
+
+ private:
+  // Slots are padded to a cache line, so that producers filling neighbouring
+  // slots don't contend for the same line.
+  struct alignas(64) Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) size_t dequeue_pos_ = 0;
+};
+
+}  // namespace santa
+
+#endif  // SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_MPSCRING_H
@@ -0,0 +1,172 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_RINGDRAINER_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_RINGDRAINER_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/mpsc_ring.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace santa {
+
+// Hands records pushed from any thread to a callback running on a single,
+// dedicated thread. Records are buffered in an MpscRing, and the thread takes
+// them out in batches of up to max_batch_size, so a burst of records costs one
+// callback rather than one per record.
+//
+// Pushing a record doesn't allocate or take a lock, unless the thread is idle
+// and has to be woken up. Records are never dropped: when the ring is full,
+// Push() waits for room.
+//
+// This class is thread-safe.
+template <typename T>
+class RingDrainer {
+ public:
+  // Called on the drainer's thread with each batch, oldest record first. The
+  // batch is cleared, but its storage kept, once the callback returns.
+  using BatchCallback = std::function<void(std::vector<T> &batch)>;
+
+  static constexpr size_t kDefaultCapacity = 8192;
+  static constexpr size_t kDefaultMaxBatchSize = 256;
+
+  explicit RingDrainer(BatchCallback callback,
+                       size_t capacity = kDefaultCapacity,
+                       size_t max_batch_size = kDefaultMaxBatchSize)
+      : ring_(capacity),
+        max_batch_size_(max_batch_size),
+        callback_(std::move(callback)),
+        thread_(&RingDrainer::Run, this) {}
+
+  // Waits for every pushed record to be handed to the callback.
+  ~RingDrainer() {
+    {
+      absl::MutexLock lock(&mu_);
+      stopping_ = true;
+      wake_.Signal();
+    }
+    thread_.join();
+  }
+
+  RingDrainer(const RingDrainer &) = delete;
+  RingDrainer &operator=(const RingDrainer &) = delete;
+
+  void Push(T value) {
+    if (!ring_.TryPush(std::move(value))) {
+      PushSlow(std::move(value));
+    }
+    // Only wake the drainer if it went to sleep. Pairs with the fence in
+    // Run(), so that either the drainer sees the record or this sees it
+    // sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+      absl::MutexLock lock(&mu_);
+      wake_.Signal();
+    }
+  }
+
+  // Waits until every record pushed before the call has been handed to the
+  // callback, and the callback has returned.
+  void WaitDrained() {
+    const size_t target = ring_.Pushed();
+    if (drained_.load() >= target) {
+      return;
+    }
+    waiters_++;
+    {
+      absl::MutexLock lock(&mu_);
+      while (drained_.load() < target) {
+        progress_.Wait(&mu_);
+      }
+    }
+    waiters_--;
+  }
+
+ private:
+  void PushSlow(T value) {
+    waiters_++;
+    {
+      absl::MutexLock lock(&mu_);
+      while (!ring_.TryPush(std::move(value))) {
+        wake_.Signal();
+        progress_.Wait(&mu_);
+      }
+    }
+    waiters_--;
+  }
+
+  void Run() {
+    std::vector<T> batch;
+    batch.reserve(max_batch_size_);
+    T value;
+    while (true) {
+      while (batch.size() < max_batch_size_ && ring_.TryPop(&value)) {
+        batch.push_back(std::move(value));
+      }
+      if (!batch.empty()) {
+        callback_(batch);
+        drained_ += batch.size();
+        batch.clear();
+        if (waiters_.load() > 0) {
+          absl::MutexLock lock(&mu_);
+          progress_.SignalAll();
+        }
+        continue;
+      }
+
+      absl::MutexLock lock(&mu_);
+      sleeping_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ring_.Empty()) {
+        if (stopping_) {
+          return;
+        }
+        wake_.Wait(&mu_);
+      }
+      sleeping_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing<T> ring_;
+  const size_t max_batch_size_;
+  const BatchCallback callback_;
+
+  // Whether the drainer is, or is about to go, waiting for records.
+  std::atomic<bool> sleeping_{false};
+  // The number of records handed to the callback so far.
+  std::atomic<size_t> drained_{0};
+  // Threads waiting in WaitDrained() or for room in the ring.
+  std::atomic<int> waiters_{0};
+
+  absl::Mutex mu_;
+  // Signalled to wake the drainer.
+  absl::CondVar wake_;
+  // Signalled when the drainer has handed a batch to the callback.
+  absl::CondVar progress_;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Started last, once everything it uses is initialized.
+  std::thread thread_;
+};
+
+}  // namespace santa
+
+#endif  // SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_RINGBUFFER_RINGDRAINER_H
@@ -0,0 +1,259 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+// Compares RingDrainer against a serial queue which, like dispatch_async,
+// allocates a closure holding a strong reference to the writer for every
+// record it is handed.
+//
+// Usage: ring_drainer_benchmark [events_per_producer] [max_producers]
+//                               [record_size]
+//
+// For 1, 2, 4, ... up to max_producers (default one per core) producer
+// threads, each writes events_per_producer (default 1000000) records of
+// record_size (default 512) bytes. Both designs batch the records into 128KiB
+// writes to /dev/null, as the File writer does. Reports throughput, from the
+// first write until every record has been written, and the latency of the
+// write calls themselves.
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/ring_drainer.h"
+#include "absl/strings/numbers.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kBatchSizeBytes = 128 * 1024;
+
+// Copies records into a buffer, writing it out once it fills up.
+class Sink {
+ public:
+  Sink() : fd_(open("/dev/null", O_WRONLY)) {
+    buffer_.reserve(kBatchSizeBytes);
+  }
+  ~Sink() { close(fd_); }
+
+  void Append(const std::vector<uint8_t> &record) {
+    buffer_.insert(buffer_.end(), record.begin(), record.end());
+    if (buffer_.size() >= kBatchSizeBytes) {
+      Flush();
+    }
+  }
+
+  void Flush() {
+    if (!buffer_.empty() && write(fd_, buffer_.data(), buffer_.size()) < 0) {
+      perror("write");
+    }
+    buffer_.clear();
+  }
+
+ private:
+  int fd_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Stands in for a serial dispatch queue on platforms without libdispatch.
+class SerialQueue {
+ public:
+  SerialQueue() : thread_(&SerialQueue::Run, this) {}
+  ~SerialQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  void Async(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  void Sync(std::function<void()> task) {
+    std::mutex done_mu;
+    std::condition_variable done_cv;
+    bool done = false;
+    Async([&] {
+      task();
+      std::lock_guard<std::mutex> lock(done_mu);
+      done = true;
+      done_cv.notify_one();
+    });
+    std::unique_lock<std::mutex> lock(done_mu);
+    done_cv.wait(lock, [&] { return done; });
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true) {
+      cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      std::function<void()> task = std::move(tasks_.front());
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// The current File and Spool writers' design: one queue hop per record.
+class QueueWriter : public std::enable_shared_from_this<QueueWriter> {
+ public:
+  void Write(std::vector<uint8_t> &&bytes) {
+    auto shared_this = shared_from_this();
+    auto record = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+    queue_.Async([shared_this, record] { shared_this->sink_.Append(*record); });
+  }
+
+  void Flush() {
+    queue_.Sync([this] { sink_.Flush(); });
+  }
+
+ private:
+  Sink sink_;
+  SerialQueue queue_;
+};
+
+class RingWriter {
+ public:
+  RingWriter()
+      : drainer_([this](std::vector<std::vector<uint8_t>> &batch) {
+          for (const std::vector<uint8_t> &record : batch) {
+            sink_.Append(record);
+          }
+        }) {}
+
+  void Write(std::vector<uint8_t> &&bytes) { drainer_.Push(std::move(bytes)); }
+
+  void Flush() {
+    drainer_.WaitDrained();
+    sink_.Flush();
+  }
+
+ private:
+  Sink sink_;
+  santa::RingDrainer<std::vector<uint8_t>> drainer_;
+};
+
+struct Result {
+  double events_per_sec;
+  int64_t p50_ns;
+  int64_t p99_ns;
+};
+
+template <typename Writer>
+Result Run(Writer &writer, size_t producers, size_t events,
+           size_t record_size) {
+  std::vector<std::vector<int64_t>> latencies(producers);
+  std::vector<std::thread> threads;
+  Clock::time_point start = Clock::now();
+  for (size_t p = 0; p < producers; p++) {
+    threads.emplace_back([&, p] {
+      std::vector<int64_t> &latency = latencies[p];
+      latency.reserve(events);
+      for (size_t i = 0; i < events; i++) {
+        // Serializers hand each writer a freshly allocated record.
+        std::vector<uint8_t> record(record_size, static_cast<uint8_t>(i));
+        Clock::time_point before = Clock::now();
+        writer.Write(std::move(record));
+        latency.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                 before)
+                .count());
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  writer.Flush();
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<int64_t> all;
+  all.reserve(producers * events);
+  for (const std::vector<int64_t> &latency : latencies) {
+    all.insert(all.end(), latency.begin(), latency.end());
+  }
+  auto percentile = [&all](double q) {
+    auto it = all.begin() + static_cast<size_t>(q * (all.size() - 1));
+    std::nth_element(all.begin(), it, all.end());
+    return *it;
+  };
+  return {producers * events / seconds, percentile(0.5), percentile(0.99)};
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  size_t events = 1000000;
+  size_t max_producers = std::max(1u, std::thread::hardware_concurrency());
+  size_t record_size = 512;
+  if ((argc > 1 && !absl::SimpleAtoi(argv[1], &events)) ||
+      (argc > 2 && !absl::SimpleAtoi(argv[2], &max_producers)) ||
+      (argc > 3 && !absl::SimpleAtoi(argv[3], &record_size)) || events == 0) {
+    fprintf(stderr,
+            "usage: %s [events_per_producer] [max_producers] [record_size]\n",
+            argv[0]);
+    return 1;
+  }
+
+  printf("%9s  %-6s %14s %10s %10s\n", "producers", "design", "events/s",
+         "p50 (ns)", "p99 (ns)");
+  for (size_t producers = 1; producers <= max_producers; producers *= 2) {
+    Result queue, ring;
+    {
+      auto writer = std::make_shared<QueueWriter>();
+      queue = Run(*writer, producers, events, record_size);
+    }
+    {
+      RingWriter writer;
+      ring = Run(writer, producers, events, record_size);
+    }
+    printf("%9zu  %-6s %14.0f %10lld %10lld\n", producers, "queue",
+           queue.events_per_sec, static_cast<long long>(queue.p50_ns),
+           static_cast<long long>(queue.p99_ns));
+    printf("%9zu  %-6s %14.0f %10lld %10lld\n", producers, "ring",
+           ring.events_per_sec, static_cast<long long>(ring.p50_ns),
+           static_cast<long long>(ring.p99_ns));
+  }
+  return 0;
+}
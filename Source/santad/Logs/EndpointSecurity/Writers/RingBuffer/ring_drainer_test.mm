@@ -0,0 +1,128 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Source/common/TestUtils.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/mpsc_ring.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/ring_drainer.h"
+
+using santa::MpscRing;
+using santa::RingDrainer;
+
+@interface RingDrainerTest : XCTestCase
+@end
+
+@implementation RingDrainerTest
+
+- (void)testRingPushPop {
+  MpscRing<std::string> ring(3);
+  XCTAssertEqual(ring.capacity(), 4u);
+  XCTAssertTrue(ring.Empty());
+
+  for (int i = 0; i < 4; i++) {
+    XCTAssertTrue(ring.TryPush(std::to_string(i)));
+  }
+
+  // A failed push must leave the value alone.
+  std::string extra = "extra";
+  XCTAssertFalse(ring.TryPush(std::move(extra)));
+  XCTAssertCppStringEqual(extra, std::string("extra"));
+  XCTAssertEqual(ring.Pushed(), 4u);
+
+  std::string out;
+  for (int i = 0; i < 4; i++) {
+    XCTAssertTrue(ring.TryPop(&out));
+    XCTAssertCppStringEqual(out, std::to_string(i));
+  }
+  XCTAssertFalse(ring.TryPop(&out));
+  XCTAssertTrue(ring.Empty());
+
+  // Slots are reused once the ring wraps around.
+  XCTAssertTrue(ring.TryPush(std::move(extra)));
+  XCTAssertTrue(ring.TryPop(&out));
+  XCTAssertCppStringEqual(out, std::string("extra"));
+}
+
+- (void)testDrainerPreservesOrderPerProducer {
+  const int kProducers = 4;
+  const int kPerProducer = 20000;
+  std::vector<int> next(kProducers, 0);
+  std::atomic<bool> in_order = true;
+  std::atomic<size_t> max_batch = 0;
+
+  {
+    // A small ring makes producers wait for room.
+    RingDrainer<std::pair<int, int>> drainer(
+      [&](std::vector<std::pair<int, int>> &batch) {
+        max_batch = std::max(max_batch.load(), batch.size());
+        for (const auto &[producer, seq] : batch) {
+          if (seq != next[producer]++) {
+            in_order = false;
+          }
+        }
+      },
+      64, 16);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < kProducers; p++) {
+      threads.emplace_back([&drainer, p] {
+        for (int i = 0; i < kPerProducer; i++) {
+          drainer.Push({p, i});
+        }
+      });
+    }
+    for (std::thread &t : threads) {
+      t.join();
+    }
+  }
+
+  XCTAssertTrue(in_order);
+  XCTAssertLessThanOrEqual(max_batch.load(), 16u);
+  for (int p = 0; p < kProducers; p++) {
+    XCTAssertEqual(next[p], kPerProducer);
+  }
+}
+
+- (void)testWaitDrained {
+  std::atomic<int> handled = 0;
+  RingDrainer<int> drainer([&](std::vector<int> &batch) {
+    // Slow the drainer down so that WaitDrained has something to wait for.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    handled += static_cast<int>(batch.size());
+  });
+
+  for (int i = 0; i < 1000; i++) {
+    drainer.Push(i);
+    if (i % 250 == 249) {
+      drainer.WaitDrained();
+      XCTAssertEqual(handled.load(), i + 1);
+    }
+  }
+
+  // Nothing pushed, nothing to wait for.
+  drainer.WaitDrained();
+  XCTAssertEqual(handled.load(), 1000);
+}
+
+@end
@@ -18,6 +18,7 @@
 #import <Foundation/Foundation.h>
 #include <dispatch/dispatch.h>
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -25,6 +26,7 @@
 
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/FSSpool/fsspool_log_batch_writer.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/RingBuffer/ring_drainer.h"
 #include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
 
 // Forward declarations
@@ -37,16 +39,30 @@ class Spool : public Writer, public std::enable_shared_from_this<Spool> {
  public:
   // Factory
   static std::shared_ptr<Spool> Create(std::string_view base_dir, size_t max_spool_disk_size,
-                                       size_t max_spool_file_size, uint64_t flush_timeout_ms);
-
+                                       size_t max_spool_file_size, uint64_t flush_timeout_ms,
+                                       bool use_segments = false, bool compress = false,
+                                       bool frame_records = false,
+                                       bool use_writer_thread = false);
+
+  // When use_segments is set, batches are appended to rolling segment files rather than each
+  // being written to its own file. See fsspool::FsSpoolSegmentWriter. When compress is set,
+  // batches are compressed before being written. When frame_records is set, each record is
+  // checksummed so that readers can skip damaged records, and batches aren't compressed. See
+  // fsspool::Codec. When use_writer_thread is passed to Create, writes are handed to the queue in
+  // batches by a dedicated thread, rather than with a block each. See santa::RingDrainer.
   Spool(dispatch_queue_t q, dispatch_source_t timer_source, std::string_view base_dir,
         size_t max_spool_disk_size, size_t max_spool_file_size,
-        void (^write_complete_f)(void) = nullptr, void (^flush_task_complete_f)(void) = nullptr);
+        void (^write_complete_f)(void) = nullptr, void (^flush_task_complete_f)(void) = nullptr,
+        bool use_segments = false, bool compress = false, bool frame_records = false);
 
   ~Spool();
 
   void Write(std::vector<uint8_t> &&bytes) override;
   void Flush() override;
+  // Events of each class are spooled in their own batches. Once the spool is full, batches of
+  // lower classes are evicted to make room for higher ones.
+  void WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) override;
+  size_t PendingWrites() const override;
 
   void BeginFlushTask();
 
@@ -54,11 +70,20 @@ class Spool : public Writer, public std::enable_shared_from_this<Spool> {
   friend class santa::SpoolPeer;
 
  private:
+  struct QueuedRecord {
+    std::vector<uint8_t> bytes;
+    Priority priority;
+  };
+
   bool FlushLocked();
+  // Bytes cached since the last flush, plus those which failed to be written.
+  size_t UnwrittenBytesLocked();
+  void WriteLocked(const std::vector<uint8_t> &bytes, Priority priority);
+  void StartWriterThread();
 
   dispatch_queue_t q_ = NULL;
   dispatch_source_t timer_source_ = NULL;
-  ::fsspool::FsSpoolWriter spool_writer_;
+  std::unique_ptr<::fsspool::SpoolWriter> spool_writer_;
   ::fsspool::FsSpoolLogBatchWriter log_batch_writer_;
   const size_t spool_file_size_threshold_;
   // Make a "leniency factor" of 20%. This will be used to allow some more
@@ -71,6 +96,14 @@ class Spool : public Writer, public std::enable_shared_from_this<Spool> {
   void (^flush_task_complete_f_)(void);
 
   size_t accumulated_bytes_ = 0;
+
+  // Writes dispatched to q_ which it has yet to run. Writes handed to the drainer instead wait for
+  // room in its ring, so aren't counted.
+  std::atomic<size_t> pending_writes_ = 0;
+
+  std::unique_ptr<RingDrainer<QueuedRecord>> drainer_;
+  // Set once the destructor has started stopping the drainer.
+  std::atomic<bool> stopping_drainer_ = false;
 };
 
 }  // namespace santa
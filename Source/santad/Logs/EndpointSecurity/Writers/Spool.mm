@@ -19,21 +19,61 @@
 #include "absl/strings/string_view.h"
 
 static const char *kTypeGoogleApisComPrefix = "type.googleapis.com/";
+// Batches which may be waiting to be written before writes block.
+static const size_t kMaxInFlightBatches = 2;
+// Low priority events may fill at most half of the spool, so that a flood of them doesn't churn
+// through evictions every time something more important is written.
+static const double kLowPrioritySpoolFraction = 0.5;
 
 namespace santa {
 
+static std::unique_ptr<::fsspool::SpoolWriter> CreateSpoolWriter(std::string_view base_dir,
+                                                                  size_t max_spool_disk_size,
+                                                                  bool use_segments) {
+  absl::string_view dir(base_dir.data(), base_dir.length());
+  if (use_segments) {
+    return std::make_unique<::fsspool::FsSpoolSegmentWriter>(dir, max_spool_disk_size);
+  }
+  std::array<size_t, ::fsspool::kNumPriorities> class_budgets = {};
+  class_budgets[static_cast<size_t>(::fsspool::Priority::kLow)] =
+    max_spool_disk_size * kLowPrioritySpoolFraction;
+  return std::make_unique<::fsspool::FsSpoolWriter>(dir, max_spool_disk_size, class_budgets);
+}
+
+// Compressing a whole batch would defeat skipping its damaged records, so framing wins.
+static ::fsspool::Codec SpoolCodec(bool compress, bool frame_records) {
+  if (frame_records) {
+    return ::fsspool::Codec::kFramed;
+  }
+  return compress ? ::fsspool::Codec::kZlib : ::fsspool::Codec::kNone;
+}
+
+static ::fsspool::Priority SpoolPriority(Writer::Priority priority) {
+  switch (priority) {
+    case Writer::Priority::kLow: return ::fsspool::Priority::kLow;
+    case Writer::Priority::kHigh: return ::fsspool::Priority::kHigh;
+    default: return ::fsspool::Priority::kNormal;
+  }
+}
+
 std::shared_ptr<Spool> Spool::Create(std::string_view base_dir, size_t max_spool_disk_size,
-                                     size_t max_spool_batch_size, uint64_t flush_timeout_ms) {
+                                     size_t max_spool_batch_size, uint64_t flush_timeout_ms,
+                                     bool use_segments, bool compress, bool frame_records,
+                                     bool use_writer_thread) {
   dispatch_queue_t q = dispatch_queue_create("com.google.santa.daemon.file_base_q",
                                              DISPATCH_QUEUE_SERIAL_WITH_AUTORELEASE_POOL);
   dispatch_source_t timer_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, q);
   dispatch_source_set_timer(timer_source, dispatch_time(DISPATCH_TIME_NOW, 0),
                             NSEC_PER_MSEC * flush_timeout_ms, 0);
 
-  auto spool_writer =
-    std::make_shared<Spool>(q, timer_source, base_dir, max_spool_disk_size, max_spool_batch_size);
+  auto spool_writer = std::make_shared<Spool>(q, timer_source, base_dir, max_spool_disk_size,
+                                              max_spool_batch_size, nullptr, nullptr, use_segments,
+                                              compress, frame_records);
 
   spool_writer->BeginFlushTask();
+  if (use_writer_thread) {
+    spool_writer->StartWriterThread();
+  }
 
   return spool_writer;
 }
@@ -42,14 +82,17 @@ std::shared_ptr<Spool> Spool::Create(std::string_view base_dir, size_t max_spool
 // the decision on whether or not to flush is controlled by the Spool class here based
 // on a "size of bytes" threshold, not "count of records" threshold used by the
 // FsSpoolLogBatchWriter. As such, calling `FsSpoolLogBatchWriter::WriteMessage`
-// should never flush.
+// should never flush. Batches are written on the log batch writer's own flusher thread, so that
+// the queue isn't held up by disk I/O.
 Spool::Spool(dispatch_queue_t q, dispatch_source_t timer_source, std::string_view base_dir,
              size_t max_spool_disk_size, size_t max_spool_file_size, void (^write_complete_f)(void),
-             void (^flush_task_complete_f)(void))
+             void (^flush_task_complete_f)(void), bool use_segments, bool compress,
+             bool frame_records)
     : q_(q),
       timer_source_(timer_source),
-      spool_writer_(absl::string_view(base_dir.data(), base_dir.length()), max_spool_disk_size),
-      log_batch_writer_(&spool_writer_, SIZE_T_MAX),
+      spool_writer_(CreateSpoolWriter(base_dir, max_spool_disk_size, use_segments)),
+      log_batch_writer_(spool_writer_.get(), SIZE_T_MAX, SpoolCodec(compress, frame_records),
+                        kMaxInFlightBatches),
       spool_file_size_threshold_(max_spool_file_size),
       spool_file_size_threshold_leniency_(spool_file_size_threshold_ *
                                           spool_file_size_threshold_leniency_factor_),
@@ -59,6 +102,10 @@ Spool::Spool(dispatch_queue_t q, dispatch_source_t timer_source, std::string_vie
 }
 
 Spool::~Spool() {
+  if (drainer_) {
+    stopping_drainer_ = true;
+    drainer_.reset();
+  }
   // Note: `log_batch_writer_` is automatically flushed when destroyed
   if (!flush_task_started_) {
     // The timer_source_ must be resumed to ensure it has a proper retain count before being
@@ -94,59 +141,104 @@ void Spool::BeginFlushTask() {
   flush_task_started_ = true;
 }
 
+void Spool::StartWriterThread() {
+  // The drainer is stopped by the destructor, before anything it uses is destroyed.
+  drainer_ = std::make_unique<RingDrainer<QueuedRecord>>([this](std::vector<QueuedRecord> &batch) {
+    std::vector<QueuedRecord> *records = &batch;
+    void (^write_records)(void) = ^{
+      for (const QueuedRecord &record : *records) {
+        WriteLocked(record.bytes, record.priority);
+      }
+    };
+    // Nothing else can be using the writer once it is being destroyed, and the destructor may
+    // itself be running on the queue.
+    if (stopping_drainer_) {
+      write_records();
+    } else {
+      dispatch_sync(q_, write_records);
+    }
+  });
+}
+
 void Spool::Flush() {
+  if (drainer_) {
+    drainer_->WaitDrained();
+  }
   dispatch_sync(q_, ^{
     FlushLocked();
   });
 }
 
 bool Spool::FlushLocked() {
-  if (log_batch_writer_.Flush().ok()) {
-    accumulated_bytes_ = 0;
-    return true;
-  } else {
-    return false;
-  }
+  // The cache is handed off either way. Anything that fails to be written is retained by the log
+  // batch writer, and counted by UnwrittenBytesLocked.
+  bool ok = log_batch_writer_.Flush().ok();
+  accumulated_bytes_ = 0;
+  return ok;
+}
+
+// IMPORTANT: Not thread safe.
+size_t Spool::UnwrittenBytesLocked() {
+  return accumulated_bytes_ + log_batch_writer_.RetainedBytes();
 }
 
 void Spool::Write(std::vector<uint8_t> &&bytes) {
+  WritePrioritized(std::move(bytes), Priority::kNormal);
+}
+
+void Spool::WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) {
+  if (drainer_) {
+    drainer_->Push({std::move(bytes), priority});
+    return;
+  }
+
   auto shared_this = shared_from_this();
 
   // Workaround to move `bytes` into the block without a copy
   __block std::vector<uint8_t> temp_bytes = std::move(bytes);
 
+  pending_writes_++;
   dispatch_async(q_, ^{
     std::vector<uint8_t> moved_bytes = std::move(temp_bytes);
+    shared_this->WriteLocked(moved_bytes, priority);
+    shared_this->pending_writes_--;
+  });
+}
 
-    // Manually pack an `Any` with a pre-serialized SantaMessage
-    google::protobuf::Any any;
-#if SANTA_OPEN_SOURCE
-    any.set_value(moved_bytes.data(), moved_bytes.size());
-#else
-    any.set_value(absl::string_view((const char*)moved_bytes.data(), moved_bytes.size()));
-#endif
-    any.set_type_url(type_url_);
-
-    if (shared_this->accumulated_bytes_ >= shared_this->spool_file_size_threshold_) {
-      shared_this->FlushLocked();
-    }
-
-    // Only write the new message if we have room left.
-    // This will account for Flush failing above.
-    // Use the more lenient threshold here in case the Flush failures are transitory.
-    if (shared_this->accumulated_bytes_ < shared_this->spool_file_size_threshold_leniency_) {
-      auto status = shared_this->log_batch_writer_.WriteMessage(any);
-      if (!status.ok()) {
-        LOGE(@"ProtoEventLogger::LogProto failed with: %s", status.ToString().c_str());
-      }
+size_t Spool::PendingWrites() const {
+  return pending_writes_;
+}
 
-      shared_this->accumulated_bytes_ += moved_bytes.size();
+// IMPORTANT: Not thread safe.
+void Spool::WriteLocked(const std::vector<uint8_t> &bytes, Priority priority) {
+  if (accumulated_bytes_ >= spool_file_size_threshold_) {
+    // Don't wait for the batch to be written. Errors writing earlier batches are reported here
+    // instead, and their batches are retained to be retried.
+    if (!log_batch_writer_.FlushAsync().ok()) {
+      LOGE(@"Spool writer: failed to write batch, will retry");
     }
+    accumulated_bytes_ = 0;
+  }
 
-    if (shared_this->write_complete_f_) {
-      shared_this->write_complete_f_();
+  // Only write the new message if we have room left.
+  // This will account for Flush failing above, as batches which failed to be written count until
+  // they are retried successfully.
+  // Use the more lenient threshold here in case the Flush failures are transitory.
+  if (UnwrittenBytesLocked() < spool_file_size_threshold_leniency_) {
+    // Append the pre-serialized SantaMessage as an `Any` record, without building one
+    auto status = log_batch_writer_.WriteRecord(
+      type_url_, absl::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size()),
+      SpoolPriority(priority));
+    if (!status.ok()) {
+      LOGE(@"ProtoEventLogger::LogProto failed with: %s", status.ToString().c_str());
     }
-  });
+
+    accumulated_bytes_ += bytes.size();
+  }
+
+  if (write_complete_f_) {
+    write_complete_f_();
+  }
 }
 
 }  // namespace santa
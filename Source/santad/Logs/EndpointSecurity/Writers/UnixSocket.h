@@ -0,0 +1,104 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_UNIXSOCKET_H
+#define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_UNIXSOCKET_H
+
+#import <Foundation/Foundation.h>
+#include <dispatch/dispatch.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
+
+// Forward declarations
+namespace santa {
+class UnixSocketPeer;
+}
+
+namespace santa {
+
+// Streams records to a local consumer listening on a SOCK_STREAM Unix domain socket. Each record
+// is preceded by its length as a base 128 varint, as with protobuf's delimited message format.
+//
+// Records written while a send is pending are sent together. If the consumer isn't reading, or
+// isn't listening, records are buffered up to max_buffered_bytes. Beyond that, the oldest are
+// handed to spill_writer, or dropped if there isn't one. Reconnection is attempted every
+// reconnect_interval_ms.
+class UnixSocket : public Writer, public std::enable_shared_from_this<UnixSocket> {
+ public:
+  // Factory
+  static std::shared_ptr<UnixSocket> Create(NSString *socket_path, uint64_t reconnect_interval_ms,
+                                            size_t max_buffered_bytes,
+                                            std::shared_ptr<Writer> spill_writer);
+
+  UnixSocket(NSString *socket_path, size_t max_buffered_bytes,
+             std::shared_ptr<Writer> spill_writer, dispatch_queue_t q,
+             dispatch_source_t timer_source);
+  ~UnixSocket();
+
+  void Write(std::vector<uint8_t> &&bytes) override;
+  void WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) override;
+  void Flush() override;
+  // Includes writes pending in the spill writer.
+  size_t PendingWrites() const override;
+
+  friend class santa::UnixSocketPeer;
+
+ private:
+  static constexpr size_t kMaxVarintLength = 10;
+
+  struct Record {
+    uint8_t header[kMaxVarintLength];
+    size_t header_length;
+    std::vector<uint8_t> bytes;
+    Priority priority;
+
+    size_t size() const { return header_length + bytes.size(); }
+  };
+
+  bool ConnectLocked();
+  void DisconnectLocked();
+  void SendLocked();
+  void SpillLocked();
+  void ScheduleSendLocked();
+
+  dispatch_queue_t q_;
+  dispatch_source_t timer_source_;
+  // Fires when the socket can be written to again after it filled up.
+  dispatch_source_t write_source_ = nullptr;
+  bool write_source_suspended_ = true;
+  bool send_scheduled_ = false;
+
+  NSString *socket_path_;
+  int fd_ = -1;
+  const size_t max_buffered_bytes_;
+  std::shared_ptr<Writer> spill_writer_;
+
+  std::deque<Record> records_;
+  // Bytes of the front record already sent.
+  size_t front_sent_ = 0;
+  size_t buffered_bytes_ = 0;
+  size_t spilled_records_ = 0;
+  size_t dropped_records_ = 0;
+  // Writes dispatched to q_ which it has yet to run.
+  std::atomic<size_t> pending_writes_ = 0;
+};
+
+}  // namespace santa
+
+#endif
@@ -0,0 +1,311 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Source/santad/Logs/EndpointSecurity/Writers/UnixSocket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <memory>
+#include <utility>
+
+#include "Source/common/BranchPrediction.h"
+#import "Source/common/SNTLogging.h"
+
+// Records sent by a single writev, as a header and payload iovec apiece.
+static const size_t kMaxRecordsPerSend = 256;
+
+static size_t EncodeVarint(uint64_t value, uint8_t *out) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+namespace santa {
+
+std::shared_ptr<UnixSocket> UnixSocket::Create(NSString *socket_path,
+                                               uint64_t reconnect_interval_ms,
+                                               size_t max_buffered_bytes,
+                                               std::shared_ptr<Writer> spill_writer) {
+  dispatch_queue_t q = dispatch_queue_create("com.google.santa.daemon.unix_socket_event_log",
+                                             DISPATCH_QUEUE_SERIAL_WITH_AUTORELEASE_POOL);
+  dispatch_source_t timer_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, q);
+
+  dispatch_source_set_timer(timer_source, dispatch_time(DISPATCH_TIME_NOW, 0),
+                            NSEC_PER_MSEC * reconnect_interval_ms, 0);
+
+  auto ret_writer = std::make_shared<UnixSocket>(socket_path, max_buffered_bytes,
+                                                 std::move(spill_writer), q, timer_source);
+
+  std::weak_ptr<UnixSocket> weak_writer(ret_writer);
+  dispatch_source_set_event_handler(ret_writer->timer_source_, ^{
+    std::shared_ptr<UnixSocket> shared_writer = weak_writer.lock();
+    if (!shared_writer) {
+      return;
+    }
+    if (shared_writer->fd_ < 0 && shared_writer->ConnectLocked()) {
+      shared_writer->SendLocked();
+    }
+  });
+
+  dispatch_resume(ret_writer->timer_source_);
+
+  return ret_writer;
+}
+
+UnixSocket::UnixSocket(NSString *socket_path, size_t max_buffered_bytes,
+                       std::shared_ptr<Writer> spill_writer, dispatch_queue_t q,
+                       dispatch_source_t timer_source)
+    : q_(q),
+      timer_source_(timer_source),
+      socket_path_(socket_path),
+      max_buffered_bytes_(max_buffered_bytes),
+      spill_writer_(std::move(spill_writer)) {}
+
+UnixSocket::~UnixSocket() {
+  if (timer_source_) {
+    dispatch_source_cancel(timer_source_);
+  }
+  DisconnectLocked();
+}
+
+// IMPORTANT: Not thread safe.
+bool UnixSocket::ConnectLocked() {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlcpy(addr.sun_path, socket_path_.fileSystemRepresentation, sizeof(addr.sun_path)) >=
+      sizeof(addr.sun_path)) {
+    LOGE(@"Event log socket path is too long: %@", socket_path_);
+    return false;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    LOGE(@"Failed to create event log socket: %s", strerror(errno));
+    return false;
+  }
+
+  // Failing to connect just means the consumer isn't listening yet. It's retried by the timer.
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return false;
+  }
+
+  // Sends must never block the queue, nor raise SIGPIPE if the consumer goes away.
+  int on = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on)) != 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0 ||
+      fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+    LOGE(@"Failed to configure event log socket: %s", strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  fd_ = fd;
+  write_source_ = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, fd, 0, q_);
+  write_source_suspended_ = true;
+
+  std::weak_ptr<UnixSocket> weak_writer = weak_from_this();
+  dispatch_source_set_event_handler(write_source_, ^{
+    std::shared_ptr<UnixSocket> shared_writer = weak_writer.lock();
+    if (!shared_writer) {
+      return;
+    }
+    shared_writer->SendLocked();
+  });
+  dispatch_source_set_cancel_handler(write_source_, ^{
+    close(fd);
+  });
+
+  LOGI(@"Connected to event log socket %@", socket_path_);
+  return true;
+}
+
+// IMPORTANT: Not thread safe.
+void UnixSocket::DisconnectLocked() {
+  if (fd_ < 0) {
+    return;
+  }
+
+  // The socket is closed by the cancel handler, which only runs once the source is resumed.
+  dispatch_source_cancel(write_source_);
+  if (write_source_suspended_) {
+    dispatch_resume(write_source_);
+  }
+  write_source_ = nullptr;
+  write_source_suspended_ = true;
+  fd_ = -1;
+
+  // The consumer discards a partial record along with the connection, so send it again in full.
+  front_sent_ = 0;
+}
+
+// IMPORTANT: Not thread safe.
+void UnixSocket::ScheduleSendLocked() {
+  // While the socket is full the write source sends once it drains, and records written in the
+  // meantime are picked up by the send that is already scheduled.
+  if (fd_ < 0 || send_scheduled_ || !write_source_suspended_) {
+    return;
+  }
+
+  send_scheduled_ = true;
+  auto shared_this = shared_from_this();
+  dispatch_async(q_, ^{
+    shared_this->send_scheduled_ = false;
+    shared_this->SendLocked();
+  });
+}
+
+// IMPORTANT: Not thread safe.
+void UnixSocket::SendLocked() {
+  if (unlikely(fd_ < 0)) {
+    return;
+  }
+
+  while (!records_.empty()) {
+    struct iovec iov[kMaxRecordsPerSend * 2];
+    int iovcnt = 0;
+    size_t skip = front_sent_;
+    for (size_t i = 0; i < records_.size() && i < kMaxRecordsPerSend; i++) {
+      Record &record = records_[i];
+      if (skip < record.header_length) {
+        iov[iovcnt].iov_base = record.header + skip;
+        iov[iovcnt].iov_len = record.header_length - skip;
+        iovcnt++;
+        skip = 0;
+      } else {
+        skip -= record.header_length;
+      }
+      if (skip < record.bytes.size()) {
+        iov[iovcnt].iov_base = record.bytes.data() + skip;
+        iov[iovcnt].iov_len = record.bytes.size() - skip;
+        iovcnt++;
+      }
+      skip = 0;
+    }
+
+    ssize_t written = writev(fd_, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if (errno == EAGAIN) {
+        // The consumer is behind. Resume sending once it has read enough to make room.
+        if (write_source_suspended_) {
+          dispatch_resume(write_source_);
+          write_source_suspended_ = false;
+        }
+        return;
+      }
+      LOGW(@"Lost connection to event log socket %@: %s", socket_path_, strerror(errno));
+      DisconnectLocked();
+      return;
+    }
+
+    // Consume what was sent, which may have ended partway through a record.
+    size_t remaining = written;
+    while (remaining > 0) {
+      Record &front = records_.front();
+      size_t unsent = front.size() - front_sent_;
+      if (remaining < unsent) {
+        front_sent_ += remaining;
+        break;
+      }
+      remaining -= unsent;
+      buffered_bytes_ -= front.size();
+      records_.pop_front();
+      front_sent_ = 0;
+    }
+  }
+
+  if (!write_source_suspended_) {
+    dispatch_suspend(write_source_);
+    write_source_suspended_ = true;
+  }
+}
+
+// IMPORTANT: Not thread safe.
+void UnixSocket::SpillLocked() {
+  while (buffered_bytes_ > max_buffered_bytes_) {
+    // Once part of the front record has been sent, the rest of it must follow.
+    auto it = records_.begin() + (front_sent_ > 0 ? 1 : 0);
+    if (it == records_.end()) {
+      return;
+    }
+
+    buffered_bytes_ -= it->size();
+    if (spill_writer_) {
+      if (spilled_records_++ == 0) {
+        LOGW(@"Event log socket consumer is falling behind, spilling records");
+      }
+      spill_writer_->WritePrioritized(std::move(it->bytes), it->priority);
+    } else {
+      if (dropped_records_++ == 0) {
+        LOGE(@"Event log socket consumer is falling behind, dropping records");
+      }
+    }
+    records_.erase(it);
+  }
+}
+
+void UnixSocket::Write(std::vector<uint8_t> &&bytes) {
+  WritePrioritized(std::move(bytes), Priority::kNormal);
+}
+
+void UnixSocket::WritePrioritized(std::vector<uint8_t> &&bytes, Priority priority) {
+  auto shared_this = shared_from_this();
+
+  // Workaround to move `bytes` into the block without a copy
+  __block std::vector<uint8_t> temp_bytes = std::move(bytes);
+
+  pending_writes_++;
+  dispatch_async(q_, ^{
+    Record record;
+    record.header_length = EncodeVarint(temp_bytes.size(), record.header);
+    record.bytes = std::move(temp_bytes);
+    record.priority = priority;
+
+    shared_this->buffered_bytes_ += record.size();
+    shared_this->records_.push_back(std::move(record));
+    shared_this->SpillLocked();
+    shared_this->ScheduleSendLocked();
+    shared_this->pending_writes_--;
+  });
+}
+
+size_t UnixSocket::PendingWrites() const {
+  return pending_writes_ + (spill_writer_ ? spill_writer_->PendingWrites() : 0);
+}
+
+void UnixSocket::Flush() {
+  dispatch_sync(q_, ^{
+    if (fd_ < 0) {
+      ConnectLocked();
+    }
+    SendLocked();
+  });
+  if (spill_writer_) {
+    spill_writer_->Flush();
+  }
+}
+
+}  // namespace santa
@@ -0,0 +1,325 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Source/common/TestUtils.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/UnixSocket.h"
+#include "Source/santad/Logs/EndpointSecurity/Writers/Writer.h"
+
+namespace santa {
+
+class UnixSocketPeer : public UnixSocket {
+ public:
+  using UnixSocket::UnixSocket;
+
+  bool Connect() {
+    __block bool connected;
+    dispatch_sync(q_, ^{
+      connected = ConnectLocked();
+    });
+    return connected;
+  }
+
+  bool Connected() {
+    __block bool connected;
+    dispatch_sync(q_, ^{
+      connected = fd_ >= 0;
+    });
+    return connected;
+  }
+
+  size_t SpilledRecords() {
+    __block size_t spilled;
+    dispatch_sync(q_, ^{
+      spilled = spilled_records_;
+    });
+    return spilled;
+  }
+
+  size_t DroppedRecords() {
+    __block size_t dropped;
+    dispatch_sync(q_, ^{
+      dropped = dropped_records_;
+    });
+    return dropped;
+  }
+
+  // Whether a send found the socket full, and is waiting for it to drain.
+  bool WaitingForSocket() {
+    __block bool waiting;
+    dispatch_sync(q_, ^{
+      waiting = !write_source_suspended_;
+    });
+    return waiting;
+  }
+
+  size_t FrontSent() {
+    __block size_t sent;
+    dispatch_sync(q_, ^{
+      sent = front_sent_;
+    });
+    return sent;
+  }
+};
+
+}  // namespace santa
+
+using santa::UnixSocketPeer;
+using santa::Writer;
+
+class RecordingWriter : public Writer {
+ public:
+  void Write(std::vector<uint8_t> &&bytes) override {
+    writes_.emplace_back(bytes.begin(), bytes.end());
+  }
+  void Flush() override {}
+
+  std::vector<std::string> writes_;
+};
+
+// A record of varying length, which identifies its position in the stream.
+static std::string NumberedRecord(size_t i) {
+  std::string record = std::to_string(i) + ":";
+  record.resize(record.size() + (i * 131) % 4096, 'a' + i % 26);
+  return record;
+}
+
+// Don't let a writer that stops sending hang the test.
+static int SetReadTimeout(int fd) {
+  struct timeval timeout = {.tv_sec = 5};
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+// Reads length-delimited records from fd until count have been received.
+static std::vector<std::string> ReadRecords(int fd, size_t count) {
+  std::vector<std::string> records;
+  std::string buffer;
+  while (records.size() < count) {
+    char chunk[256];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+      break;
+    }
+    buffer.append(chunk, n);
+
+    while (true) {
+      uint64_t length = 0;
+      size_t pos = 0;
+      int shift = 0;
+      bool complete = false;
+      while (pos < buffer.size()) {
+        uint8_t b = buffer[pos++];
+        length |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete || buffer.size() - pos < length) {
+        break;
+      }
+      records.push_back(buffer.substr(pos, length));
+      buffer.erase(0, pos + length);
+    }
+  }
+  return records;
+}
+
+@interface UnixSocketTest : XCTestCase
+@property NSString *path;
+@property int listenFd;
+@property dispatch_queue_t q;
+@property dispatch_source_t timer;
+@end
+
+@implementation UnixSocketTest
+
+- (void)setUp {
+  // Socket paths are limited to 104 bytes, so keep the path short.
+  self.path = [NSString stringWithFormat:@"/tmp/santa-%d.sock", getpid()];
+  unlink(self.path.fileSystemRepresentation);
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strlcpy(addr.sun_path, self.path.fileSystemRepresentation, sizeof(addr.sun_path));
+  self.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  XCTAssertGreaterThanOrEqual(self.listenFd, 0);
+  XCTAssertEqual(bind(self.listenFd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+
+  self.q = dispatch_queue_create(NULL, DISPATCH_QUEUE_SERIAL);
+  XCTAssertNotNil(self.q);
+  self.timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.q);
+  XCTAssertNotNil(self.timer);
+
+  // Resume the timer to ensure its not inadvertently cancelled first
+  dispatch_resume(self.timer);
+}
+
+- (std::shared_ptr<UnixSocketPeer>)writerWithMaxBufferedBytes:(size_t)maxBufferedBytes
+                                                  spillWriter:(std::shared_ptr<Writer>)spillWriter {
+  return std::make_shared<UnixSocketPeer>(self.path, maxBufferedBytes, spillWriter, self.q,
+                                          self.timer);
+}
+
+- (void)tearDown {
+  close(self.listenFd);
+  unlink(self.path.fileSystemRepresentation);
+}
+
+- (void)testStreamsDelimitedRecords {
+  XCTAssertEqual(listen(self.listenFd, 1), 0);
+  auto writer = [self writerWithMaxBufferedBytes:1024 * 1024 spillWriter:nullptr];
+  XCTAssertTrue(writer->Connect());
+
+  int conn = accept(self.listenFd, NULL, NULL);
+  XCTAssertGreaterThanOrEqual(conn, 0);
+
+  std::string large(300, 'x');
+  writer->Write({'a', 'b', 'c'});
+  writer->Write({});
+  writer->Write(std::vector<uint8_t>(large.begin(), large.end()));
+  writer->Flush();
+
+  std::vector<std::string> records = ReadRecords(conn, 3);
+  XCTAssertEqual(records.size(), 3);
+  XCTAssertCppStringEqual(records[0], std::string("abc"));
+  XCTAssertCppStringEqual(records[1], std::string(""));
+  XCTAssertCppStringEqual(records[2], large);
+
+  close(conn);
+}
+
+- (void)testResumesOnceConsumerDrainsSocket {
+  XCTAssertEqual(listen(self.listenFd, 1), 0);
+  auto writer = [self writerWithMaxBufferedBytes:16 * 1024 * 1024 spillWriter:nullptr];
+  XCTAssertTrue(writer->Connect());
+
+  int conn = accept(self.listenFd, NULL, NULL);
+  XCTAssertGreaterThanOrEqual(conn, 0);
+  XCTAssertEqual(SetReadTimeout(conn), 0);
+
+  // Write far more than the socket buffers while the consumer isn't reading, so sends stop with
+  // EAGAIN, most likely partway through a record.
+  const size_t numRecords = 512;
+  for (size_t i = 0; i < numRecords; i++) {
+    std::string record = NumberedRecord(i);
+    writer->Write(std::vector<uint8_t>(record.begin(), record.end()));
+  }
+  writer->Flush();
+  XCTAssertTrue(writer->WaitingForSocket());
+
+  // Sending resumes as the consumer drains the socket, and every record arrives exactly once, in
+  // order and intact.
+  std::vector<std::string> records = ReadRecords(conn, numRecords);
+  XCTAssertEqual(records.size(), numRecords);
+  for (size_t i = 0; i < records.size(); i++) {
+    XCTAssertCppStringEqual(records[i], NumberedRecord(i));
+  }
+  XCTAssertEqual(writer->SpilledRecords(), 0);
+  XCTAssertEqual(writer->DroppedRecords(), 0);
+
+  close(conn);
+}
+
+- (void)testResendsPartialRecordAfterReconnect {
+  XCTAssertEqual(listen(self.listenFd, 2), 0);
+  auto writer = [self writerWithMaxBufferedBytes:16 * 1024 * 1024 spillWriter:nullptr];
+  XCTAssertTrue(writer->Connect());
+
+  int conn = accept(self.listenFd, NULL, NULL);
+  XCTAssertGreaterThanOrEqual(conn, 0);
+
+  // A record larger than the socket buffer is only partly sent.
+  std::string large(1024 * 1024, 'x');
+  writer->Write(std::vector<uint8_t>(large.begin(), large.end()));
+  writer->Flush();
+  XCTAssertGreaterThan(writer->FrontSent(), 0);
+
+  // The consumer goes away mid-record. The first flush notices, unless the write source already
+  // has, and the second reconnects.
+  close(conn);
+  writer->Write({'a', 'f', 't', 'e', 'r'});
+  writer->Flush();
+  writer->Flush();
+  XCTAssertTrue(writer->Connected());
+
+  conn = accept(self.listenFd, NULL, NULL);
+  XCTAssertGreaterThanOrEqual(conn, 0);
+  XCTAssertEqual(SetReadTimeout(conn), 0);
+
+  // The new connection gets the interrupted record from its start.
+  std::vector<std::string> records = ReadRecords(conn, 2);
+  XCTAssertEqual(records.size(), 2);
+  XCTAssertTrue(records[0] == large);
+  XCTAssertCppStringEqual(records[1], std::string("after"));
+
+  close(conn);
+}
+
+- (void)testSpillsWhenConsumerIsNotListening {
+  // The socket is bound but not listening, so connecting fails.
+  auto spill = std::make_shared<RecordingWriter>();
+  auto writer = [self writerWithMaxBufferedBytes:8 spillWriter:spill];
+  XCTAssertFalse(writer->Connect());
+
+  writer->Write({'a', 'a', 'a'});
+  writer->Write({'b', 'b', 'b'});
+  writer->Write({'c', 'c', 'c'});
+  writer->Flush();
+
+  // Each record is 4 bytes with its length, so only the newest two stay buffered.
+  XCTAssertEqual(writer->SpilledRecords(), 1);
+  XCTAssertEqual(spill->writes_.size(), 1);
+  XCTAssertCppStringEqual(spill->writes_[0], std::string("aaa"));
+
+  // Once the consumer listens, what's left is sent on reconnect.
+  XCTAssertEqual(listen(self.listenFd, 1), 0);
+  writer->Flush();
+  XCTAssertTrue(writer->Connected());
+  int conn = accept(self.listenFd, NULL, NULL);
+  XCTAssertGreaterThanOrEqual(conn, 0);
+
+  std::vector<std::string> records = ReadRecords(conn, 2);
+  XCTAssertEqual(records.size(), 2);
+  XCTAssertCppStringEqual(records[0], std::string("bbb"));
+  XCTAssertCppStringEqual(records[1], std::string("ccc"));
+
+  close(conn);
+}
+
+- (void)testDropsWithoutSpillWriter {
+  auto writer = [self writerWithMaxBufferedBytes:8 spillWriter:nullptr];
+
+  writer->Write({'a', 'a', 'a'});
+  writer->Write({'b', 'b', 'b'});
+  writer->Write({'c', 'c', 'c'});
+  writer->Write({'d', 'd', 'd'});
+  writer->Flush();
+
+  XCTAssertEqual(writer->DroppedRecords(), 2);
+  XCTAssertEqual(writer->SpilledRecords(), 0);
+}
+
+@end
@@ -15,16 +15,36 @@
 #ifndef SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_WRITER_H
 #define SANTA__SANTAD__LOGS_ENDPOINTSECURITY_WRITERS_WRITER_H
 
+#include <utility>
 #include <vector>
 
 namespace santa {
 
 class Writer {
  public:
+  // Retention classes of written events, in increasing order of importance.
+  // Writers which can't keep everything drop lower classes first.
+  enum class Priority {
+    kLow,
+    kNormal,
+    kHigh,
+  };
+
   virtual ~Writer() = default;
 
   virtual void Write(std::vector<uint8_t>&& bytes) = 0;
   virtual void Flush() = 0;
+
+  // As Write(), for an event of the given retention class. Writers without
+  // retention classes write every event alike.
+  virtual void WritePrioritized(std::vector<uint8_t>&& bytes, Priority priority) {
+    Write(std::move(bytes));
+  }
+
+  // Writes which have been accepted but not yet finished, by writers which finish them
+  // asynchronously on their own queue. Callers which queue up writes for a writer use this to
+  // bound its backlog.
+  virtual size_t PendingWrites() const { return 0; }
 };
 
 }  // namespace santa
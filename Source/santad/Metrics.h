@@ -22,6 +22,7 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 
 #import "Source/common/SNTCommonEnums.h"
@@ -64,6 +65,14 @@ using FileAccessEventCountTuple =
 
 NSString *const EventTypeToString(es_event_type_t eventType);
 
+struct ProcessTreeMetrics {
+  int64_t processes;
+  int64_t tombstoned;
+  // See ProcessTree::Stats for how these differ.
+  int64_t oldest_retained_age_secs;
+  int64_t oldest_tombstone_age_secs;
+};
+
 class Metrics : public std::enable_shared_from_this<Metrics> {
  public:
   static std::shared_ptr<Metrics> Create(SNTMetricSet *metric_set, uint64_t interval);
@@ -72,7 +81,9 @@ class Metrics : public std::enable_shared_from_this<Metrics> {
           SNTMetricInt64Gauge *event_processing_times, SNTMetricCounter *event_counts,
           SNTMetricCounter *rate_limit_counts, SNTMetricCounter *drop_counts,
           SNTMetricCounter *faa_event_counts, SNTMetricCounter *stat_change_counts,
-          SNTMetricSet *metric_set, void (^run_on_first_start)(Metrics *));
+          SNTMetricInt64Gauge *process_tree_sizes,
+          SNTMetricInt64Gauge *process_tree_oldest_exited_ages, SNTMetricSet *metric_set,
+          void (^run_on_first_start)(Metrics *));
 
   ~Metrics();
 
@@ -96,6 +107,10 @@ class Metrics : public std::enable_shared_from_this<Metrics> {
                                  FileAccessMetricStatus status, es_event_type_t event_type,
                                  FileAccessPolicyDecision decision);
 
+  // Record the latest size of the process tree. Only the most recent values
+  // are exported.
+  void SetProcessTreeMetrics(ProcessTreeMetrics process_tree_metrics);
+
   friend class santa::MetricsPeer;
 
  private:
@@ -117,6 +132,8 @@ class Metrics : public std::enable_shared_from_this<Metrics> {
   SNTMetricCounter *faa_event_counts_;
   SNTMetricCounter *drop_counts_;
   SNTMetricCounter *stat_change_counts_;
+  SNTMetricInt64Gauge *process_tree_sizes_;
+  SNTMetricInt64Gauge *process_tree_oldest_exited_ages_;
   SNTMetricSet *metric_set_;
   // Tracks whether or not the timer_source should be running.
   // This helps manage dispatch source state to ensure the source is not
@@ -135,6 +152,7 @@ class Metrics : public std::enable_shared_from_this<Metrics> {
   std::map<FileAccessEventCountTuple, int64_t> faa_event_counts_cache_;
   std::map<EventStatsTuple, SequenceStats> drop_cache_;
   std::map<EventStatChangeTuple, int64_t> stat_change_cache_;
+  std::optional<ProcessTreeMetrics> process_tree_cache_;
 };
 
 }  // namespace santa
@@ -246,9 +246,22 @@ std::shared_ptr<Metrics> Metrics::Create(SNTMetricSet *metric_set, uint64_t inte
                      fieldNames:@[ @"step", @"error" ]
                        helpText:@"Count of times a stat info changed for a binary being evalauted"];
 
+  SNTMetricInt64Gauge *process_tree_sizes =
+    [metric_set int64GaugeWithName:@"/santa/process_tree/size"
+                        fieldNames:@[ @"state" ]
+                          helpText:@"Number of processes in the process tree"];
+
+  SNTMetricInt64Gauge *process_tree_oldest_exited_ages =
+    [metric_set int64GaugeWithName:@"/santa/process_tree/oldest_exited_age"
+                        fieldNames:@[ @"state" ]
+                          helpText:@"Seconds the oldest exited process has been retained in the "
+                                   @"process tree, of all exited processes (retained) or only "
+                                   @"those kept by a reference (tombstoned)"];
+
   std::shared_ptr<Metrics> metrics = std::make_shared<Metrics>(
     q, timer_source, interval, event_processing_times, event_counts, rate_limit_counts,
-    faa_event_counts, drop_counts, stat_change_counts, metric_set, ^(Metrics *metrics) {
+    faa_event_counts, drop_counts, stat_change_counts, process_tree_sizes,
+    process_tree_oldest_exited_ages, metric_set, ^(Metrics *metrics) {
       SNTRegisterCoreMetrics();
       metrics->EstablishConnection();
     });
@@ -270,6 +283,8 @@ Metrics::Metrics(dispatch_queue_t q, dispatch_source_t timer_source, uint64_t in
                  SNTMetricInt64Gauge *event_processing_times, SNTMetricCounter *event_counts,
                  SNTMetricCounter *rate_limit_counts, SNTMetricCounter *faa_event_counts,
                  SNTMetricCounter *drop_counts, SNTMetricCounter *stat_change_counts,
+                 SNTMetricInt64Gauge *process_tree_sizes,
+                 SNTMetricInt64Gauge *process_tree_oldest_exited_ages,
                  SNTMetricSet *metric_set, void (^run_on_first_start)(Metrics *))
     : q_(q),
       timer_source_(timer_source),
@@ -280,6 +295,8 @@ Metrics::Metrics(dispatch_queue_t q, dispatch_source_t timer_source, uint64_t in
       faa_event_counts_(faa_event_counts),
       drop_counts_(drop_counts),
       stat_change_counts_(stat_change_counts),
+      process_tree_sizes_(process_tree_sizes),
+      process_tree_oldest_exited_ages_(process_tree_oldest_exited_ages),
       metric_set_(metric_set),
       run_on_first_start_(run_on_first_start) {
   SetInterval(interval_);
@@ -382,6 +399,15 @@ void Metrics::FlushMetrics() {
       }
     }
 
+    if (process_tree_cache_) {
+      [process_tree_sizes_ set:process_tree_cache_->processes forFieldValues:@[ @"total" ]];
+      [process_tree_sizes_ set:process_tree_cache_->tombstoned forFieldValues:@[ @"tombstoned" ]];
+      [process_tree_oldest_exited_ages_ set:process_tree_cache_->oldest_retained_age_secs
+                             forFieldValues:@[ @"retained" ]];
+      [process_tree_oldest_exited_ages_ set:process_tree_cache_->oldest_tombstone_age_secs
+                             forFieldValues:@[ @"tombstoned" ]];
+    }
+
     // Reset the maps so the next cycle begins with a clean state
     // IMPORTANT: Do not reset drop_cache_, the sequence numbers must persist
     // for accurate accounting
@@ -390,6 +416,7 @@ void Metrics::FlushMetrics() {
     rate_limit_counts_cache_ = {};
     faa_event_counts_cache_ = {};
     stat_change_cache_ = {};
+    process_tree_cache_ = std::nullopt;
   });
 }
 
@@ -494,4 +521,10 @@ void Metrics::SetFileAccessEventMetrics(std::string policy_version, std::string
   });
 }
 
+void Metrics::SetProcessTreeMetrics(ProcessTreeMetrics process_tree_metrics) {
+  dispatch_sync(events_q_, ^{
+    process_tree_cache_ = process_tree_metrics;
+  });
+}
+
 }  // namespace santa
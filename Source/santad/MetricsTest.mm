@@ -61,6 +61,7 @@ class MetricsPeer : public Metrics {
   using Metrics::event_times_cache_;
   using Metrics::faa_event_counts_cache_;
   using Metrics::interval_;
+  using Metrics::process_tree_cache_;
   using Metrics::rate_limit_counts_cache_;
   using Metrics::running_;
   using Metrics::stat_change_cache_;
@@ -98,7 +99,8 @@ using santa::StatResultToString;
 
 std::shared_ptr<MetricsPeer> CreateBasicMetricsPeer(dispatch_queue_t q, void (^block)(Metrics *)) {
   dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, q);
-  return std::make_shared<MetricsPeer>(q, timer, 100, nil, nil, nil, nil, nil, nil, nil, block);
+  return std::make_shared<MetricsPeer>(q, timer, 100, nil, nil, nil, nil, nil, nil, nil, nil, nil,
+                                       block);
 }
 
 @interface MetricsTest : XCTestCase
@@ -363,6 +365,33 @@ std::shared_ptr<MetricsPeer> CreateBasicMetricsPeer(dispatch_queue_t q, void (^b
   XCTAssertEqual(metrics->rate_limit_counts_cache_[Processor::kAuthorizer], 789);
 }
 
+- (void)testSetProcessTreeMetrics {
+  std::shared_ptr<MetricsPeer> metrics = CreateBasicMetricsPeer(self.q, ^(Metrics *){
+                                                                });
+
+  XCTAssertFalse(metrics->process_tree_cache_.has_value());
+
+  metrics->SetProcessTreeMetrics({.processes = 100,
+                                  .tombstoned = 2,
+                                  .oldest_retained_age_secs = 30,
+                                  .oldest_tombstone_age_secs = 30});
+  metrics->SetProcessTreeMetrics({.processes = 120,
+                                  .tombstoned = 1,
+                                  .oldest_retained_age_secs = 120,
+                                  .oldest_tombstone_age_secs = 90});
+
+  // Only the latest values are kept
+  XCTAssertTrue(metrics->process_tree_cache_.has_value());
+  XCTAssertEqual(metrics->process_tree_cache_->processes, 120);
+  XCTAssertEqual(metrics->process_tree_cache_->tombstoned, 1);
+  XCTAssertEqual(metrics->process_tree_cache_->oldest_retained_age_secs, 120);
+  XCTAssertEqual(metrics->process_tree_cache_->oldest_tombstone_age_secs, 90);
+
+  metrics->FlushMetrics();
+
+  XCTAssertFalse(metrics->process_tree_cache_.has_value());
+}
+
 - (void)testSetFileAccessEventMetrics {
   std::shared_ptr<MetricsPeer> metrics = CreateBasicMetricsPeer(self.q, ^(Metrics *){
                                                                 });
@@ -477,7 +506,7 @@ std::shared_ptr<MetricsPeer> CreateBasicMetricsPeer(dispatch_queue_t q, void (^b
   dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.q);
   auto metrics = std::make_shared<MetricsPeer>(self.q, timer, 100, mockEventProcessingTimes,
                                                mockEventCounts, mockEventCounts, mockEventCounts,
-                                               mockEventCounts, mockEventCounts, nil,
+                                               mockEventCounts, mockEventCounts, nil, nil, nil,
                                                ^(santa::Metrics *m){
                                                  // This block intentionally left blank
                                                });
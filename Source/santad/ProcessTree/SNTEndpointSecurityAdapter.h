@@ -16,14 +16,22 @@
 
 #include <EndpointSecurity/EndpointSecurity.h>
 
+#include <optional>
+
 #include "Source/santad/EventProviders/EndpointSecurity/Message.h"
 #include "Source/santad/ProcessTree/process_tree.h"
 
 namespace santa::santad::process_tree {
 
+// Convert the ES event in msg to its ProcessTree form, or nullopt if the tree
+// is not interested in the event type.
+std::optional<Event> EventFromESEvent(const santa::Message &msg);
+
 // Inform the tree of the ES event in msg.
 // This is idempotent on the tree, so can be called from multiple places with
-// the same msg.
+// the same msg. The event is applied before returning, as a batch of one:
+// clients retain the processes it touches straight afterwards, so events
+// can't be held back to be applied together.
 void InformFromESEvent(ProcessTree &tree, const santa::Message &msg);
 
 }  // namespace santa::santad::process_tree
@@ -17,6 +17,11 @@
 #include <Foundation/Foundation.h>
 #include <bsm/libbsm.h>
 
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "Source/santad/EventProviders/EndpointSecurity/EndpointSecurityAPI.h"
 #include "Source/santad/EventProviders/EndpointSecurity/Message.h"
 #include "Source/santad/ProcessTree/process_tree.h"
@@ -28,19 +33,13 @@ using santa::Message;
 
 namespace santa::santad::process_tree {
 
-void InformFromESEvent(ProcessTree &tree, const Message &msg) {
+std::optional<Event> EventFromESEvent(const Message &msg) {
   struct Pid event_pid = PidFromAuditToken(msg->process->audit_token);
-  auto proc = tree.Get(event_pid);
-
-  if (!proc) {
-    return;
-  }
-
-  std::shared_ptr<EndpointSecurityAPI> esapi = msg.ESAPI();
 
   switch (msg->event_type) {
     case ES_EVENT_TYPE_AUTH_EXEC:
     case ES_EVENT_TYPE_NOTIFY_EXEC: {
+      std::shared_ptr<EndpointSecurityAPI> esapi = msg.ESAPI();
       std::vector<std::string> args;
       args.reserve(esapi->ExecArgCount(&msg->event.exec));
       for (int i = 0; i < esapi->ExecArgCount(&msg->event.exec); i++) {
@@ -49,24 +48,43 @@ void InformFromESEvent(ProcessTree &tree, const Message &msg) {
       }
 
       es_string_token_t executable = msg->event.exec.target->executable->path;
-      tree.HandleExec(
-        msg->mach_time, **proc, PidFromAuditToken(msg->event.exec.target->audit_token),
-        (struct Program){.executable = std::string(executable.data, executable.length),
-                         .arguments = args},
-        (struct Cred){
-          .uid = audit_token_to_euid(msg->event.exec.target->audit_token),
-          .gid = audit_token_to_egid(msg->event.exec.target->audit_token),
-        });
-
-      break;
+      return Event{
+        .type = Event::Type::kExec,
+        .timestamp = msg->mach_time,
+        .pid = event_pid,
+        .new_pid = PidFromAuditToken(msg->event.exec.target->audit_token),
+        .program = {.executable = std::string(executable.data, executable.length),
+                    .arguments = std::move(args)},
+        .cred =
+          {
+            .uid = audit_token_to_euid(msg->event.exec.target->audit_token),
+            .gid = audit_token_to_egid(msg->event.exec.target->audit_token),
+          },
+      };
     }
-    case ES_EVENT_TYPE_NOTIFY_FORK: {
-      tree.HandleFork(msg->mach_time, **proc,
-                      PidFromAuditToken(msg->event.fork.child->audit_token));
-      break;
-    }
-    case ES_EVENT_TYPE_NOTIFY_EXIT: tree.HandleExit(msg->mach_time, **proc); break;
-    default: return;
+    case ES_EVENT_TYPE_NOTIFY_FORK:
+      return Event{
+        .type = Event::Type::kFork,
+        .timestamp = msg->mach_time,
+        .pid = event_pid,
+        .new_pid = PidFromAuditToken(msg->event.fork.child->audit_token),
+      };
+    case ES_EVENT_TYPE_NOTIFY_EXIT:
+      return Event{
+        .type = Event::Type::kExit,
+        .timestamp = msg->mach_time,
+        .pid = event_pid,
+      };
+    default: return std::nullopt;
+  }
+}
+
+void InformFromESEvent(ProcessTree &tree, const Message &msg) {
+  // Looking up the process and applying the event happens under a single
+  // acquisition of the tree lock. Only replaying recorded events batches more
+  // than one.
+  if (std::optional<Event> event = EventFromESEvent(msg); event) {
+    tree.HandleEvents({*event});
   }
 }
 
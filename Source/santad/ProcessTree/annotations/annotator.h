@@ -14,6 +14,9 @@
 #ifndef SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_BASE_H
 #define SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_BASE_H
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
 #include <optional>
 
 #include "Source/santad/ProcessTree/process_tree.pb.h"
@@ -23,16 +26,46 @@ namespace santa::santad::process_tree {
 class ProcessTree;
 class Process;
 
+// Each annotator type is assigned a dense slot the first time it is seen, and
+// a Process stores its annotations in a fixed array indexed by slot. This
+// bounds the number of distinct annotator types in the daemon.
+inline constexpr size_t kMaxAnnotatorSlots = 8;
+
+namespace internal {
+inline size_t NextAnnotatorSlot() {
+  static std::atomic<size_t> next_slot{0};
+  return next_slot++;
+}
+}  // namespace internal
+
+// Get the slot assigned to annotator type T.
+template <typename T>
+size_t AnnotatorSlot() {
+  static const size_t slot = internal::NextAnnotatorSlot();
+  return slot;
+}
+
 class Annotator {
  public:
   virtual ~Annotator() = default;
 
+  // The slot of this annotator's type, i.e. AnnotatorSlot<Derived>().
+  virtual size_t Slot() const = 0;
+
   virtual void AnnotateFork(ProcessTree &tree, const Process &parent,
                             const Process &child) = 0;
   virtual void AnnotateExec(ProcessTree &tree, const Process &orig_process,
                             const Process &new_process) = 0;
   virtual std::optional<::santa::pb::v1::process_tree::Annotations> Proto()
       const = 0;
+
+  // Reconstruct this annotator's state from a previously exported proto, e.g.
+  // when restoring a tree snapshot. Returns nullptr if the proto carries no
+  // state for this annotator, in which case the annotation is re-derived.
+  virtual std::shared_ptr<const Annotator> FromProto(
+      const ::santa::pb::v1::process_tree::Annotations &proto) const {
+    return nullptr;
+  }
 };
 
 }  // namespace santa::santad::process_tree
@@ -0,0 +1,141 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#include "Source/santad/ProcessTree/annotations/lineage.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.h"
+#include "Source/santad/ProcessTree/process_tree.pb.h"
+#include "absl/types/span.h"
+
+namespace ptpb = ::santa::pb::v1::process_tree;
+
+namespace santa::santad::process_tree {
+
+namespace {
+
+// Fingerprints are compared against values computed ahead of time, e.g. in
+// detection rules, so both hashes must be stable across runs and hosts.
+constexpr uint64_t kBase = 0x9e3779b97f4a7c15;
+
+// 64-bit FNV-1a.
+uint64_t HashExecutable(std::string_view executable) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : executable) {
+    hash ^= c;
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+uint64_t OldestWeight(size_t depth) {
+  uint64_t weight = 1;
+  for (size_t i = 1; i < depth; i++) {
+    weight *= kBase;
+  }
+  return weight;
+}
+
+}  // namespace
+
+LineageAnnotator::LineageAnnotator(size_t depth)
+    : LineageAnnotator(depth, {}, 0) {}
+
+LineageAnnotator::LineageAnnotator(size_t depth, std::vector<uint64_t> hashes,
+                                   uint64_t fingerprint)
+    : depth_(std::max<size_t>(depth, 1)),
+      oldest_weight_(OldestWeight(depth_)),
+      hashes_(std::move(hashes)),
+      fingerprint_(fingerprint) {}
+
+uint64_t LineageAnnotator::Fingerprint(
+    absl::Span<const std::string_view> executables, size_t depth) {
+  depth = std::max<size_t>(depth, 1);
+  if (executables.size() > depth) {
+    executables.remove_prefix(executables.size() - depth);
+  }
+  uint64_t fingerprint = 0;
+  for (std::string_view executable : executables) {
+    fingerprint = fingerprint * kBase + HashExecutable(executable);
+  }
+  return fingerprint;
+}
+
+std::shared_ptr<const LineageAnnotator> LineageAnnotator::Seed(
+    const Process &p) const {
+  uint64_t hash = HashExecutable(p.program_->executable);
+  return std::shared_ptr<const LineageAnnotator>(
+      new LineageAnnotator(depth_, {hash}, hash));
+}
+
+std::shared_ptr<const LineageAnnotator> LineageAnnotator::Extend(
+    std::string_view executable) const {
+  uint64_t hash = HashExecutable(executable);
+  uint64_t fingerprint = fingerprint_;
+  std::vector<uint64_t> hashes;
+  hashes.reserve(depth_);
+  if (hashes_.size() < depth_) {
+    hashes.assign(hashes_.begin(), hashes_.end());
+  } else {
+    // Roll the oldest executable out of the window.
+    fingerprint -= hashes_.front() * oldest_weight_;
+    hashes.assign(hashes_.begin() + 1, hashes_.end());
+  }
+  hashes.push_back(hash);
+  fingerprint = fingerprint * kBase + hash;
+  return std::shared_ptr<const LineageAnnotator>(
+      new LineageAnnotator(depth_, std::move(hashes), fingerprint));
+}
+
+void LineageAnnotator::AnnotateFork(ProcessTree &tree, const Process &parent,
+                                    const Process &child) {
+  if (auto annotation = tree.GetAnnotation<LineageAnnotator>(parent)) {
+    tree.AnnotateProcess(child, std::move(*annotation));
+    return;
+  }
+  std::shared_ptr<const LineageAnnotator> seed = Seed(parent);
+  tree.AnnotateProcess(parent, seed);
+  tree.AnnotateProcess(child, std::move(seed));
+}
+
+void LineageAnnotator::AnnotateExec(ProcessTree &tree,
+                                    const Process &orig_process,
+                                    const Process &new_process) {
+  std::shared_ptr<const LineageAnnotator> base;
+  if (auto annotation = tree.GetAnnotation<LineageAnnotator>(orig_process)) {
+    base = std::move(*annotation);
+  } else {
+    // As in AnnotateFork. When backfilling, orig_process is the parent.
+    base = Seed(orig_process);
+    tree.AnnotateProcess(orig_process, base);
+  }
+  tree.AnnotateProcess(new_process,
+                       base->Extend(new_process.program_->executable));
+}
+
+std::optional<ptpb::Annotations> LineageAnnotator::Proto() const {
+  auto annotation = ptpb::Annotations();
+  annotation.set_lineage_fingerprint(fingerprint_);
+  return annotation;
+}
+
+}  // namespace santa::santad::process_tree
@@ -0,0 +1,87 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#ifndef SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_LINEAGE_H
+#define SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_LINEAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "Source/santad/ProcessTree/annotations/annotator.h"
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.pb.h"
+#include "absl/types/span.h"
+
+namespace santa::santad::process_tree {
+
+// Annotates each process with a fingerprint of its exec lineage: the
+// executable of the process itself and those of the depth - 1 execs which
+// most recently preceded it among its ancestors. Forks share their parent's
+// annotation, and an exec rolls the new executable into the fingerprint of
+// the process performing it, so keeping fingerprints current costs the same
+// per event regardless of how deep the tree is.
+//
+// Checking whether a process was spawned under a given chain of programs is
+// then a single integer compare against Fingerprint() of that chain.
+class LineageAnnotator : public Annotator {
+ public:
+  static constexpr size_t kDefaultDepth = 4;
+
+  explicit LineageAnnotator(size_t depth = kDefaultDepth);
+
+  // The fingerprint of the given chain of executables, ordered from the
+  // furthest ancestor to the process itself. Chains longer than depth are
+  // truncated to their last depth executables.
+  static uint64_t Fingerprint(absl::Span<const std::string_view> executables,
+                              size_t depth = kDefaultDepth);
+
+  uint64_t fingerprint() const { return fingerprint_; }
+
+  size_t Slot() const override { return AnnotatorSlot<LineageAnnotator>(); }
+  void AnnotateFork(ProcessTree &tree, const Process &parent,
+                    const Process &child) override;
+  void AnnotateExec(ProcessTree &tree, const Process &orig_process,
+                    const Process &new_process) override;
+
+  std::optional<::santa::pb::v1::process_tree::Annotations> Proto()
+      const override;
+
+ private:
+  LineageAnnotator(size_t depth, std::vector<uint64_t> hashes,
+                   uint64_t fingerprint);
+
+  // The lineage of a process with no annotation of its own, e.g. a root
+  // process added during backfill, consisting of only its own executable.
+  std::shared_ptr<const LineageAnnotator> Seed(const Process &p) const;
+
+  // The lineage of a process which exec'd the given executable from a
+  // process with this lineage.
+  std::shared_ptr<const LineageAnnotator> Extend(
+      std::string_view executable) const;
+
+  size_t depth_;
+  // depth_ - 1 powers of the hash base, used to drop the oldest executable
+  // from fingerprint_ once the window is full.
+  uint64_t oldest_weight_;
+  // Hashes of the executables in the window, oldest first.
+  std::vector<uint64_t> hashes_;
+  uint64_t fingerprint_;
+};
+
+}  // namespace santa::santad::process_tree
+
+#endif
@@ -0,0 +1,134 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#import <Foundation/Foundation.h>
+#import <XCTest/XCTest.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "Source/santad/ProcessTree/annotations/lineage.h"
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.pb.h"
+#include "Source/santad/ProcessTree/process_tree_test_helpers.h"
+#include "absl/container/flat_hash_map.h"
+
+using namespace santa::santad::process_tree;
+
+@interface LineageAnnotatorTest : XCTestCase
+@property std::shared_ptr<ProcessTreeTestPeer> tree;
+@property std::shared_ptr<const Process> initProc;
+@end
+
+@implementation LineageAnnotatorTest
+
+- (void)setUp {
+  std::vector<std::unique_ptr<Annotator>> annotators;
+  annotators.emplace_back(std::make_unique<LineageAnnotator>(3));
+  self.tree = std::make_shared<ProcessTreeTestPeer>(std::move(annotators));
+  self.initProc = self.tree->InsertInit();
+}
+
+- (uint64_t)fingerprintOf:(struct Pid)pid {
+  auto annotation = self.tree->GetAnnotation<LineageAnnotator>(**self.tree->Get(pid));
+  XCTAssertTrue(annotation.has_value());
+  return (*annotation)->fingerprint();
+}
+
+- (void)testFingerprint {
+  uint64_t event_id = 1;
+  const struct Cred cred = {.uid = 0, .gid = 0};
+
+  // PID 1.1: fork() -> PID 2.2 -> exec("/usr/sbin/sshd") -> PID 2.3
+  const struct Pid sshd_pid = {.pid = 2, .pidversion = 2};
+  const struct Pid sshd_exec_pid = {.pid = 2, .pidversion = 3};
+  self.tree->HandleFork(event_id++, *self.initProc, sshd_pid);
+  self.tree->HandleExec(event_id++, **self.tree->Get(sshd_pid), sshd_exec_pid,
+                        {.executable = "/usr/sbin/sshd", .arguments = {}}, cred);
+
+  // PID 2.3: fork() -> PID 3.3 -> exec("/bin/bash") -> PID 3.4
+  const struct Pid bash_pid = {.pid = 3, .pidversion = 3};
+  const struct Pid bash_exec_pid = {.pid = 3, .pidversion = 4};
+  self.tree->HandleFork(event_id++, **self.tree->Get(sshd_exec_pid), bash_pid);
+  self.tree->HandleExec(event_id++, **self.tree->Get(bash_pid), bash_exec_pid,
+                        {.executable = "/bin/bash", .arguments = {}}, cred);
+
+  // PID 3.4: fork() -> PID 4.4 -> exec("/bin/ls") -> PID 4.5
+  const struct Pid ls_pid = {.pid = 4, .pidversion = 4};
+  const struct Pid ls_exec_pid = {.pid = 4, .pidversion = 5};
+  self.tree->HandleFork(event_id++, **self.tree->Get(bash_exec_pid), ls_pid);
+  self.tree->HandleExec(event_id++, **self.tree->Get(ls_pid), ls_exec_pid,
+                        {.executable = "/bin/ls", .arguments = {}}, cred);
+
+  // Forks share the lineage of their parent.
+  XCTAssertEqual([self fingerprintOf:sshd_pid], LineageAnnotator::Fingerprint({"/init"}, 3));
+  XCTAssertEqual([self fingerprintOf:ls_pid], [self fingerprintOf:bash_exec_pid]);
+
+  XCTAssertEqual([self fingerprintOf:bash_exec_pid],
+                 LineageAnnotator::Fingerprint({"/init", "/usr/sbin/sshd", "/bin/bash"}, 3));
+
+  // Once the lineage is deeper than the window, the furthest ancestor is
+  // rolled out.
+  XCTAssertEqual([self fingerprintOf:ls_exec_pid],
+                 LineageAnnotator::Fingerprint({"/usr/sbin/sshd", "/bin/bash", "/bin/ls"}, 3));
+  XCTAssertEqual(
+    [self fingerprintOf:ls_exec_pid],
+    LineageAnnotator::Fingerprint({"/init", "/usr/sbin/sshd", "/bin/bash", "/bin/ls"}, 3));
+  XCTAssertNotEqual([self fingerprintOf:ls_exec_pid],
+                    LineageAnnotator::Fingerprint({"/bin/bash", "/usr/sbin/sshd", "/bin/ls"}, 3));
+
+  // The fingerprint is carried in the exported annotations.
+  auto exported = self.tree->ExportAnnotations(ls_exec_pid);
+  XCTAssertTrue(exported.has_value());
+  XCTAssertEqual(exported->lineage_fingerprint(), [self fingerprintOf:ls_exec_pid]);
+}
+
+- (void)testBackfill {
+  const struct Cred cred = {.uid = 0, .gid = 0};
+  auto sshd_prog = std::make_shared<const Program>(
+    (Program){.executable = "/usr/sbin/sshd", .arguments = {"/usr/sbin/sshd"}});
+  auto bash_prog =
+    std::make_shared<const Program>((Program){.executable = "/bin/bash", .arguments = {"bash"}});
+  const struct Pid sshd_pid = {.pid = 2, .pidversion = 2};
+  const struct Pid bash_pid = {.pid = 3, .pidversion = 3};
+  const struct Pid subshell_pid = {.pid = 4, .pidversion = 4};
+
+  // Live processes only show the program each is running now, so a child
+  // running another program than its parent must have exec'd.
+  std::vector<std::unique_ptr<Annotator>> annotators;
+  annotators.emplace_back(std::make_unique<LineageAnnotator>(3));
+  auto tree = std::make_shared<ProcessTreeTestPeer>(std::move(annotators));
+  absl::flat_hash_map<pid_t, std::vector<Process>> parent_map;
+  parent_map[0].push_back(Process(self.initProc->pid_, cred, self.initProc->program_, nullptr));
+  parent_map[1].push_back(Process(sshd_pid, cred, sshd_prog, nullptr));
+  parent_map[2].push_back(Process(bash_pid, cred, bash_prog, nullptr));
+  parent_map[3].push_back(Process(subshell_pid, cred, bash_prog, nullptr));
+  tree->BackfillFromProcesses(parent_map);
+
+  auto fingerprint = [&](struct Pid pid) -> uint64_t {
+    auto annotation = tree->GetAnnotation<LineageAnnotator>(**tree->Get(pid));
+    XCTAssertTrue(annotation.has_value());
+    return annotation.has_value() ? (*annotation)->fingerprint() : 0;
+  };
+
+  XCTAssertEqual(fingerprint(self.initProc->pid_), LineageAnnotator::Fingerprint({"/init"}, 3));
+  XCTAssertEqual(fingerprint(sshd_pid),
+                 LineageAnnotator::Fingerprint({"/init", "/usr/sbin/sshd"}, 3));
+  XCTAssertEqual(fingerprint(bash_pid),
+                 LineageAnnotator::Fingerprint({"/init", "/usr/sbin/sshd", "/bin/bash"}, 3));
+  // A child running the same program as its parent is a fork.
+  XCTAssertEqual(fingerprint(subshell_pid), fingerprint(bash_pid));
+}
+
+@end
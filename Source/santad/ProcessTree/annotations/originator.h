@@ -14,6 +14,8 @@
 #ifndef SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_ORIGINATOR_H
 #define SANTA__SANTAD_PROCESSTREE_ANNOTATIONS_ORIGINATOR_H
 
+#include <cstddef>
+#include <memory>
 #include <optional>
 
 #include "Source/santad/ProcessTree/annotations/annotator.h"
@@ -34,6 +36,7 @@ class OriginatorAnnotator : public Annotator {
       : originator_(originator) {};
   // clang-format on
 
+  size_t Slot() const override { return AnnotatorSlot<OriginatorAnnotator>(); }
   void AnnotateFork(ProcessTree &tree, const Process &parent,
                     const Process &child) override;
   void AnnotateExec(ProcessTree &tree, const Process &orig_process,
@@ -41,6 +44,8 @@ class OriginatorAnnotator : public Annotator {
 
   std::optional<::santa::pb::v1::process_tree::Annotations> Proto()
       const override;
+  std::shared_ptr<const Annotator> FromProto(
+      const ::santa::pb::v1::process_tree::Annotations &proto) const override;
 
  private:
   ::santa::pb::v1::process_tree::Annotations::Originator originator_;
@@ -18,6 +18,7 @@
 #include "Source/santad/ProcessTree/process.h"
 #include "Source/santad/ProcessTree/process_tree.pb.h"
 #include "Source/santad/ProcessTree/process_tree_test_helpers.h"
+#include "absl/status/status.h"
 
 using namespace santa::santad::process_tree;
 namespace ptpb = ::santa::pb::v1::process_tree;
@@ -75,4 +76,126 @@ namespace ptpb = ::santa::pb::v1::process_tree;
   XCTAssertEqual(*descendant_annotation_opt, *annotation_opt);
 }
 
+- (void)testExportAnnotations {
+  uint64_t event_id = 1;
+
+  // PID 1.1: fork() -> PID 2.2
+  const struct Pid child_pid = {.pid = 2, .pidversion = 2};
+  self.tree->HandleFork(event_id++, *self.initProc, child_pid);
+  XCTAssertFalse(self.tree->ExportAnnotations(child_pid).has_value());
+
+  // Annotating the process invalidates any previously exported form...
+  auto child = *self.tree->Get(child_pid);
+  self.tree->AnnotateProcess(
+    *child, std::make_shared<OriginatorAnnotator>(
+              ptpb::Annotations::Originator::Annotations_Originator_CRON));
+  auto exported = self.tree->ExportAnnotations(child_pid);
+  XCTAssertTrue(exported.has_value());
+  XCTAssertEqual(exported->originator(),
+                 ptpb::Annotations::Originator::Annotations_Originator_CRON);
+
+  // ... and repeated exports return the same merged proto.
+  auto reexported = self.tree->ExportAnnotations(child_pid);
+  XCTAssertTrue(reexported.has_value());
+  XCTAssertEqual(reexported->SerializeAsString(), exported->SerializeAsString());
+}
+
+- (void)testSnapshotRestore {
+  uint64_t event_id = 1;
+  const struct Cred cred = {.uid = 0, .gid = 0};
+
+  // PID 1.1: fork() -> PID 2.2 -> exec("/usr/bin/login") -> PID 2.3
+  const struct Pid login_pid = {.pid = 2, .pidversion = 2};
+  self.tree->HandleFork(event_id++, *self.initProc, login_pid);
+  const struct Pid login_exec_pid = {.pid = 2, .pidversion = 3};
+  const struct Program login_prog = {.executable = "/usr/bin/login", .arguments = {}};
+  self.tree->HandleExec(event_id++, **self.tree->Get(login_pid), login_exec_pid, login_prog, cred);
+
+  // Only the annotated process is recorded.
+  ptpb::Snapshot snapshot = self.tree->ExportSnapshot();
+  XCTAssertEqual(snapshot.entries_size(), 1);
+  XCTAssertEqual(snapshot.entries(0).pid(), login_exec_pid.pid);
+  XCTAssertEqual(snapshot.entries(0).pidversion(), login_exec_pid.pidversion);
+  XCTAssertEqual(snapshot.entries(0).annotations().originator(),
+                 ptpb::Annotations::Originator::Annotations_Originator_LOGIN);
+
+  NSString *path = [NSTemporaryDirectory()
+    stringByAppendingPathComponent:[NSString stringWithFormat:@"process_tree_snapshot-%d",
+                                                              getpid()]];
+  XCTAssertTrue(self.tree->SaveSnapshot([path UTF8String]).ok());
+  auto loaded = LoadSnapshot([path UTF8String]);
+  XCTAssertTrue(loaded.ok());
+  XCTAssertEqual(loaded->entries_size(), 1);
+  [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+
+  // Record a process whose pid has since been reused.
+  ptpb::Snapshot::Entry *stale = loaded->add_entries();
+  stale->set_pid(4);
+  stale->set_pidversion(4);
+  stale->mutable_annotations()->set_originator(
+    ptpb::Annotations::Originator::Annotations_Originator_CRON);
+
+  // Rebuild a tree from "live" processes that no longer expose how they were
+  // started, so the annotation can only come from the snapshot.
+  std::vector<std::unique_ptr<Annotator>> annotators;
+  annotators.emplace_back(std::make_unique<OriginatorAnnotator>());
+  auto restored_tree = std::make_shared<ProcessTreeTestPeer>(std::move(annotators));
+
+  auto shell_prog = std::make_shared<const Program>(
+    (Program){.executable = "/bin/zsh", .arguments = {"/bin/zsh"}});
+  const struct Pid shell_pid = {.pid = 3, .pidversion = 3};
+  const struct Pid reused_pid = {.pid = 4, .pidversion = 5};
+  Process init(self.initProc->pid_, cred, self.initProc->program_, nullptr);
+  absl::flat_hash_map<pid_t, std::vector<Process>> parent_map;
+  parent_map[1].push_back(Process(login_exec_pid, cred, shell_prog, nullptr));
+  parent_map[1].push_back(Process(reused_pid, cred, shell_prog, nullptr));
+  parent_map[2].push_back(Process(shell_pid, cred, shell_prog, nullptr));
+
+  std::optional<ptpb::Snapshot> restored_snapshot = std::move(*loaded);
+  restored_tree->BackfillInsertChildren(parent_map, nullptr, init,
+                                        ProcessTreeTestPeer::IndexSnapshot(restored_snapshot));
+
+  // The snapshot entry matches pid and pidversion, so it is restored...
+  auto login = restored_tree->GetAnnotation<OriginatorAnnotator>(
+    **restored_tree->Get(login_exec_pid));
+  XCTAssertTrue(login.has_value());
+  XCTAssertEqual((*login)->Proto()->originator(),
+                 ptpb::Annotations::Originator::Annotations_Originator_LOGIN);
+
+  // ... and descendants derive from the restored state ...
+  auto shell =
+    restored_tree->GetAnnotation<OriginatorAnnotator>(**restored_tree->Get(shell_pid));
+  XCTAssertTrue(shell.has_value());
+  XCTAssertEqual((*shell)->Proto()->originator(),
+                 ptpb::Annotations::Originator::Annotations_Originator_LOGIN);
+
+  // ... but an entry for a different pidversion is ignored.
+  XCTAssertFalse(
+    restored_tree->GetAnnotation<OriginatorAnnotator>(**restored_tree->Get(reused_pid))
+      .has_value());
+}
+
+- (void)testSnapshotFromPreviousBootIsDiscarded {
+  const struct Pid login_pid = {.pid = 2, .pidversion = 2};
+  self.tree->HandleFork(1, *self.initProc, login_pid);
+  const struct Pid login_exec_pid = {.pid = 2, .pidversion = 3};
+  const struct Program login_prog = {.executable = "/usr/bin/login", .arguments = {}};
+  self.tree->HandleExec(2, **self.tree->Get(login_pid), login_exec_pid, login_prog,
+                        (struct Cred){.uid = 0, .gid = 0});
+
+  auto boot_session = CurrentBootSession();
+  XCTAssertTrue(boot_session.ok());
+  XCTAssertEqual(self.tree->ExportSnapshot().boot_session(), *boot_session);
+
+  NSString *path = [NSTemporaryDirectory()
+    stringByAppendingPathComponent:[NSString stringWithFormat:@"process_tree_snapshot_boot-%d",
+                                                              getpid()]];
+  XCTAssertTrue(self.tree->SaveSnapshot([path UTF8String]).ok());
+
+  // After a reboot, pid 2 with pidversion 3 may be any process at all.
+  auto loaded = LoadSnapshot([path UTF8String], *boot_session + "-rebooted");
+  XCTAssertTrue(absl::IsFailedPrecondition(loaded.status()));
+  XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path]);
+}
+
 @end
@@ -16,14 +16,14 @@
 
 #include <sys/types.h>
 
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <string>
-#include <typeindex>
 #include <vector>
 
 #include "Source/santad/ProcessTree/annotations/annotator.h"
-#include "absl/container/flat_hash_map.h"
 
 namespace santa::santad::process_tree {
 
@@ -70,6 +70,7 @@ struct Program {
 
 // Fwd decls
 class ProcessTree;
+class ProcessToken;
 
 class Process {
  public:
@@ -80,12 +81,22 @@ class Process {
         effective_cred_(cred),
         program_(program),
         annotations_(),
+        exported_annotations_(),
         parent_(parent),
         refcnt_(0),
         tombstoned_(false) {}
-  Process(const Process &) = default;
+  // Copies (e.g. of the unlinked processes gathered during backfill) are not
+  // in any tree, so do not carry over retention state.
+  Process(const Process &other)
+      : pid_(other.pid_),
+        effective_cred_(other.effective_cred_),
+        program_(other.program_),
+        annotations_(other.annotations_),
+        exported_annotations_(other.exported_annotations_),
+        parent_(other.parent_),
+        refcnt_(0),
+        tombstoned_(false) {}
   Process &operator=(const Process &) = delete;
-  Process(Process &&) = default;
   Process &operator=(Process &&) = delete;
 
   // Const "attributes" are public
@@ -99,13 +110,22 @@ class Process {
   // annotation storage and the parent relation in memory on the process right
   // now.
   friend class ProcessTree;
-  absl::flat_hash_map<std::type_index, std::shared_ptr<const Annotator>>
+  friend class ProcessToken;
+  // Indexed by AnnotatorSlot of the annotation's type.
+  std::array<std::shared_ptr<const Annotator>, kMaxAnnotatorSlots>
       annotations_;
+  // Merged proto form of annotations_, built on first export and reset
+  // whenever annotations_ changes. Guarded by the owning tree's lock.
+  std::shared_ptr<const ::santa::pb::v1::process_tree::Annotations>
+      exported_annotations_;
   std::shared_ptr<const Process> parent_;
-  // TODO(nickmg): atomic here breaks the build.
-  int refcnt_;
+  // Number of live ProcessTokens holding this process. Tokens update it
+  // without taking the tree lock.
+  mutable std::atomic<int> refcnt_;
   // If the process is tombstoned, the event removing it from the tree has been
-  // processed, but refcnt>0 keeps it alive.
+  // processed, but refcnt>0 keeps it alive. Once refcnt drops to 0 it is no
+  // longer visible through the tree, and is erased by the next Step.
+  // Guarded by the owning tree's lock.
   bool tombstoned_;
 };
 
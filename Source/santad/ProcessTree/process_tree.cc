@@ -17,11 +17,14 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <functional>
 #include <memory>
 #include <optional>
-#include <typeindex>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -33,12 +36,64 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace ptpb = ::santa::pb::v1::process_tree;
 
 namespace santa::santad::process_tree {
 
+ProcessTree::SnapshotIndex ProcessTree::IndexSnapshot(
+    const std::optional<ptpb::Snapshot> &snapshot) {
+  SnapshotIndex index;
+  if (!snapshot) {
+    return index;
+  }
+  index.reserve(snapshot->entries_size());
+  for (const ptpb::Snapshot::Entry &entry : snapshot->entries()) {
+    index.emplace(Pid{entry.pid(), entry.pidversion()}, &entry.annotations());
+  }
+  return index;
+}
+
+void ProcessTree::BackfillFromProcesses(
+    const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+    const std::optional<ptpb::Snapshot> &snapshot) {
+  SnapshotIndex snapshot_index = IndexSnapshot(snapshot);
+  auto roots = parent_map.find(0);
+  if (roots == parent_map.end()) {
+    return;
+  }
+  for (const Process &p : roots->second) {
+    BackfillInsertChildren(parent_map, std::shared_ptr<Process>(), p,
+                           snapshot_index);
+  }
+}
+
+size_t ProcessTree::CountDescendants(
+    const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+    pid_t pid) {
+  size_t count = 0;
+  std::vector<pid_t> stack = {pid};
+  while (!stack.empty()) {
+    auto children = parent_map.find(stack.back());
+    stack.pop_back();
+    if (children == parent_map.end()) {
+      continue;
+    }
+    for (const Process &child : children->second) {
+      count++;
+      stack.push_back(child.pid_.pid);
+    }
+  }
+  return count;
+}
+
 void ProcessTree::BackfillInsertChildren(
-    absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
-    std::shared_ptr<Process> parent, const Process &unlinked_proc) {
+    const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+    std::shared_ptr<Process> parent, const Process &unlinked_proc,
+    const SnapshotIndex &snapshot) {
   auto proc = std::make_shared<Process>(
       unlinked_proc.pid_, unlinked_proc.effective_cred_,
       // Re-use shared pointers from parent if value equivalent
@@ -48,71 +103,236 @@ void ProcessTree::BackfillInsertChildren(
       parent);
   {
     absl::MutexLock lock(&mtx_);
-    map_.emplace(unlinked_proc.pid_, proc);
+    if (!InsertLocked(proc)) {
+      // Descendants can't be linked without their parent, so they are
+      // rejected along with it.
+      rejected_ += CountDescendants(parent_map, unlinked_proc.pid_.pid);
+      return;
+    }
   }
 
+  std::vector<Annotator *> pending = RestoreAnnotations(*proc, snapshot);
+
   // The only case where we should not have a parent is the root processes
   // (e.g. init, kthreadd).
   if (parent) {
-    for (auto &annotator : annotators_) {
-      annotator->AnnotateFork(*this, *(proc->parent_), *proc);
-      if (proc->program_ != proc->parent_->program_) {
+    // A child running a different program than its parent is replayed as an
+    // exec from the parent alone. Only the first annotation set on a process
+    // is kept, so a fork would leave the parent's copy in place of the exec's.
+    bool execed = proc->program_ != proc->parent_->program_;
+    for (Annotator *annotator : pending) {
+      if (execed) {
         annotator->AnnotateExec(*this, *(proc->parent_), *proc);
+      } else {
+        annotator->AnnotateFork(*this, *(proc->parent_), *proc);
       }
     }
   }
 
-  for (const Process &child : parent_map[unlinked_proc.pid_.pid]) {
-    BackfillInsertChildren(parent_map, proc, child);
+  // Only look up (never insert into) parent_map while recursing: inserting
+  // may rehash and invalidate the vectors being iterated further up the stack.
+  auto children = parent_map.find(unlinked_proc.pid_.pid);
+  if (children == parent_map.end()) {
+    return;
+  }
+  for (const Process &child : children->second) {
+    BackfillInsertChildren(parent_map, proc, child, snapshot);
   }
 }
 
+std::vector<Annotator *> ProcessTree::RestoreAnnotations(
+    const Process &p, const SnapshotIndex &snapshot) {
+  std::vector<Annotator *> pending;
+  auto it = snapshot.find(p.pid_);
+  for (auto &annotator : annotators_) {
+    std::shared_ptr<const Annotator> restored;
+    if (it != snapshot.end()) {
+      restored = annotator->FromProto(*it->second);
+    }
+    if (restored) {
+      AnnotateProcessSlot(p, annotator->Slot(), std::move(restored));
+    } else {
+      pending.push_back(annotator.get());
+    }
+  }
+  return pending;
+}
+
 void ProcessTree::HandleFork(uint64_t timestamp, const Process &parent,
                              const Pid new_pid) {
-  if (Step(timestamp)) {
-    std::shared_ptr<Process> child;
-    {
-      absl::MutexLock lock(&mtx_);
-      child = std::make_shared<Process>(new_pid, parent.effective_cred_,
-                                        parent.program_, map_[parent.pid_]);
-      map_.emplace(new_pid, child);
-    }
-    for (const auto &annotator : annotators_) {
-      annotator->AnnotateFork(*this, parent, *child);
+  std::shared_ptr<Process> child;
+  {
+    absl::MutexLock lock(&mtx_);
+    if (!StepLocked(timestamp)) {
+      return;
     }
+    child = ForkLocked(parent, new_pid);
+  }
+  for (const auto &annotator : annotators_) {
+    annotator->AnnotateFork(*this, parent, *child);
   }
 }
 
 void ProcessTree::HandleExec(uint64_t timestamp, const Process &p,
                              const Pid new_pid, const Program prog,
                              const Cred c) {
-  if (Step(timestamp)) {
-    // TODO(nickmg): should struct pid be reworked and only pid_version be
-    // passed?
-    assert(new_pid.pid == p.pid_.pid);
+  // TODO(nickmg): should struct pid be reworked and only pid_version be
+  // passed?
+  assert(new_pid.pid == p.pid_.pid);
+
+  std::shared_ptr<Process> new_proc;
+  {
+    absl::MutexLock lock(&mtx_);
+    if (!StepLocked(timestamp)) {
+      return;
+    }
+    new_proc = ExecLocked(timestamp, p, new_pid, prog, c);
+  }
+  for (const auto &annotator : annotators_) {
+    annotator->AnnotateExec(*this, p, *new_proc);
+  }
+}
 
-    auto new_proc = std::make_shared<Process>(
-        new_pid, c, std::make_shared<const Program>(prog), p.parent_);
+void ProcessTree::HandleExit(uint64_t timestamp, const Process &p) {
+  absl::MutexLock lock(&mtx_);
+  if (StepLocked(timestamp)) {
+    ExitLocked(timestamp, p);
+  }
+}
+
+void ProcessTree::HandleEvents(absl::Span<const Event> events) {
+  std::vector<const Event *> sorted;
+  sorted.reserve(events.size());
+  for (const Event &event : events) {
+    sorted.push_back(&event);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Event *a, const Event *b) {
+                     return a->timestamp < b->timestamp;
+                   });
+  // Duplicates within the batch are dropped here, and those already
+  // processed by the tree are dropped by StepLocked.
+  sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                           [](const Event *a, const Event *b) {
+                             return a->timestamp == b->timestamp;
+                           }),
+               sorted.end());
+
+  // A Process is only erased once kSeenTimestamps newer events have been
+  // stepped past. Applying at most that many events per lock acquisition
+  // guarantees every process touched by a chunk is still in the tree when its
+  // annotators run.
+  struct Applied {
+    const Event *event;
+    std::shared_ptr<const Process> proc;
+    std::shared_ptr<const Process> new_proc;
+  };
+  std::vector<Applied> applied;
+  for (size_t chunk = 0; chunk < sorted.size(); chunk += kSeenTimestamps) {
+    size_t chunk_end = std::min(sorted.size(), chunk + kSeenTimestamps);
+    applied.clear();
     {
       absl::MutexLock lock(&mtx_);
-      remove_at_.push_back({timestamp, p.pid_});
-      map_.emplace(new_proc->pid_, new_proc);
+      for (size_t i = chunk; i < chunk_end; i++) {
+        const Event &event = *sorted[i];
+        auto proc = GetLocked(event.pid);
+        if (!proc || !StepLocked(event.timestamp)) {
+          continue;
+        }
+        switch (event.type) {
+          case Event::Type::kFork:
+            applied.push_back(
+                {&event, *proc, ForkLocked(**proc, event.new_pid)});
+            break;
+          case Event::Type::kExec:
+            assert(event.new_pid.pid == event.pid.pid);
+            applied.push_back(
+                {&event, *proc,
+                 ExecLocked(event.timestamp, **proc, event.new_pid,
+                            event.program, event.cred)});
+            break;
+          case Event::Type::kExit:
+            ExitLocked(event.timestamp, **proc);
+            break;
+        }
+      }
     }
-    for (const auto &annotator : annotators_) {
-      annotator->AnnotateExec(*this, p, *new_proc);
+
+    for (const Applied &a : applied) {
+      for (const auto &annotator : annotators_) {
+        if (a.event->type == Event::Type::kFork) {
+          annotator->AnnotateFork(*this, *a.proc, *a.new_proc);
+        } else {
+          annotator->AnnotateExec(*this, *a.proc, *a.new_proc);
+        }
+      }
     }
   }
 }
 
-void ProcessTree::HandleExit(uint64_t timestamp, const Process &p) {
-  if (Step(timestamp)) {
-    absl::MutexLock lock(&mtx_);
-    remove_at_.push_back({timestamp, p.pid_});
+bool ProcessTree::InsertLocked(std::shared_ptr<Process> proc) {
+  if (map_.size() >= max_processes_ && !map_.contains(proc->pid_)) {
+    rejected_++;
+    return false;
   }
+  map_.emplace(proc->pid_, std::move(proc));
+  return true;
 }
 
-bool ProcessTree::Step(uint64_t timestamp) {
-  absl::MutexLock lock(&mtx_);
+void ProcessTree::RemoveLocked(const Pid pid, absl::Time exited) {
+  auto target = GetLocked(pid);
+  if (target && (*target)->tombstoned_) {
+    // Already in tombstones_, e.g. reclaimed by Reconcile before its exit
+    // event was processed.
+    return;
+  }
+  if (target && (*target)->refcnt_ > 0) {
+    (*target)->tombstoned_ = true;
+    tombstones_.push_back({exited, pid});
+  } else {
+    map_.erase(pid);
+  }
+}
+
+void ProcessTree::ReclaimTombstonesLocked() {
+  for (auto it = tombstones_.begin(); it != tombstones_.end();) {
+    auto target = map_.find(it->second);
+    if (target == map_.end() || Released(*target->second)) {
+      map_.erase(it->second);
+      it = tombstones_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+// A new process is still returned when the tree is full, so that annotators
+// can run on it, but it is not added to the tree.
+std::shared_ptr<Process> ProcessTree::ForkLocked(const Process &parent,
+                                                 const Pid new_pid) {
+  auto child = std::make_shared<Process>(new_pid, parent.effective_cred_,
+                                         parent.program_, map_[parent.pid_]);
+  InsertLocked(child);
+  return child;
+}
+
+std::shared_ptr<Process> ProcessTree::ExecLocked(uint64_t timestamp,
+                                                 const Process &p,
+                                                 const Pid new_pid,
+                                                 const Program &prog,
+                                                 const Cred c) {
+  auto new_proc = std::make_shared<Process>(
+      new_pid, c, std::make_shared<const Program>(prog), p.parent_);
+  remove_at_.push_back({timestamp, p.pid_, absl::Now()});
+  InsertLocked(new_proc);
+  return new_proc;
+}
+
+void ProcessTree::ExitLocked(uint64_t timestamp, const Process &p) {
+  remove_at_.push_back({timestamp, p.pid_, absl::Now()});
+}
+
+bool ProcessTree::StepLocked(uint64_t timestamp) {
   uint64_t new_cutoff = seen_timestamps_.front();
   if (timestamp < new_cutoff) {
     // Event timestamp is before the rolling list of seen events.
@@ -141,13 +361,8 @@ bool ProcessTree::Step(uint64_t timestamp) {
   *insert_point = timestamp;
 
   for (auto it = remove_at_.begin(); it != remove_at_.end();) {
-    if (it->first < new_cutoff) {
-      if (auto target = GetLocked(it->second);
-          target && (*target)->refcnt_ > 0) {
-        (*target)->tombstoned_ = true;
-      } else {
-        map_.erase(it->second);
-      }
+    if (it->timestamp < new_cutoff) {
+      RemoveLocked(it->pid, it->exited);
       it = remove_at_.erase(it);
     } else {
       it++;
@@ -157,28 +372,73 @@ bool ProcessTree::Step(uint64_t timestamp) {
   return true;
 }
 
-void ProcessTree::RetainProcess(std::vector<struct Pid> &pids) {
+size_t ProcessTree::ReconcileWithLivePids(absl::Span<const pid_t> live_pids) {
+  absl::flat_hash_set<pid_t> live(live_pids.begin(), live_pids.end());
   absl::MutexLock lock(&mtx_);
+  ReclaimTombstonesLocked();
+
+  absl::flat_hash_map<pid_t, uint64_t> newest;
+  for (const auto &[pid, _] : map_) {
+    uint64_t &version = newest[pid.pid];
+    version = std::max(version, pid.pidversion);
+  }
+
+  // Tombstones are already on their way out, and are only kept by tokens.
+  absl::flat_hash_set<Pid> suspects;
+  for (const auto &[pid, proc] : map_) {
+    if (!proc->tombstoned_ &&
+        (!live.contains(pid.pid) || pid.pidversion < newest[pid.pid])) {
+      suspects.insert(pid);
+    }
+  }
+
+  size_t reclaimed = 0;
+  const absl::Time now = absl::Now();
+  for (auto it = suspects.begin(); it != suspects.end();) {
+    if (reconcile_suspects_.contains(*it)) {
+      RemoveLocked(*it, now);
+      reclaimed++;
+      suspects.erase(it++);
+    } else {
+      it++;
+    }
+  }
+  reconcile_suspects_ = std::move(suspects);
+  reconciled_ += reclaimed;
+  return reclaimed;
+}
+
+std::vector<std::shared_ptr<const Process>> ProcessTree::RetainProcess(
+    std::vector<struct Pid> &pids) {
+  std::vector<std::shared_ptr<const Process>> retained;
+  retained.reserve(pids.size());
+  // Step only compares refcounts under the exclusive lock, so holding the
+  // shared lock here is enough to not race a process being erased.
+  absl::ReaderMutexLock lock(&mtx_);
   for (const struct Pid &p : pids) {
     auto proc = GetLocked(p);
     if (proc) {
       (*proc)->refcnt_++;
+      retained.push_back(*std::move(proc));
     }
   }
+  return retained;
 }
 
 void ProcessTree::ReleaseProcess(std::vector<struct Pid> &pids) {
-  absl::MutexLock lock(&mtx_);
+  absl::ReaderMutexLock lock(&mtx_);
   for (const struct Pid &p : pids) {
     auto proc = GetLocked(p);
     if (proc) {
-      if (--(*proc)->refcnt_ == 0 && (*proc)->tombstoned_) {
-        map_.erase(p);
-      }
+      (*proc)->refcnt_--;
     }
   }
 }
 
+bool ProcessTree::Released(const Process &p) {
+  return p.tombstoned_ && p.refcnt_ == 0;
+}
+
 /*
 ---
 Annotation get/set
@@ -187,22 +447,155 @@ Annotation get/set
 
 void ProcessTree::AnnotateProcess(const Process &p,
                                   std::shared_ptr<const Annotator> a) {
+  if (!a) {
+    return;
+  }
+  size_t slot = a->Slot();
+  AnnotateProcessSlot(p, slot, std::move(a));
+}
+
+void ProcessTree::AnnotateProcessSlot(const Process &p, size_t slot,
+                                      std::shared_ptr<const Annotator> a) {
+  // CreateTree rejects annotators whose slot is out of range, so this is only
+  // reachable with an annotator type the tree was not created with.
+  if (slot >= kMaxAnnotatorSlots) {
+    return;
+  }
   absl::MutexLock lock(&mtx_);
-  const Annotator &x = *a;
-  map_[p.pid_]->annotations_.emplace(std::type_index(typeid(x)), std::move(a));
+  // The process may not be in the tree if it was full when it was created.
+  auto it = map_.find(p.pid_);
+  if (it == map_.end()) {
+    return;
+  }
+  std::shared_ptr<const Annotator> &annotation = it->second->annotations_[slot];
+  if (!annotation) {
+    annotation = std::move(a);
+    it->second->exported_annotations_.reset();
+  }
 }
 
-std::optional<::santa::pb::v1::process_tree::Annotations>
-ProcessTree::ExportAnnotations(const Pid p) {
-  auto proc = Get(p);
-  if (!proc || (*proc)->annotations_.empty()) {
-    return std::nullopt;
+std::optional<ptpb::Annotations> ProcessTree::ExportAnnotations(const Pid p) {
+  // Most exports are for processes whose annotations have not changed since
+  // the last export, so first try the cached merge under the shared lock.
+  std::shared_ptr<Process> proc;
+  {
+    absl::ReaderMutexLock lock(&mtx_);
+    auto found = GetLocked(p);
+    if (!found) {
+      return std::nullopt;
+    }
+    proc = *found;
+    if (proc->exported_annotations_) {
+      return *proc->exported_annotations_;
+    }
+    if (std::none_of(
+            proc->annotations_.begin(), proc->annotations_.end(),
+            [](const auto &annotation) { return annotation != nullptr; })) {
+      return std::nullopt;
+    }
+  }
+
+  absl::MutexLock lock(&mtx_);
+  if (!proc->exported_annotations_) {
+    auto merged = std::make_shared<ptpb::Annotations>();
+    for (const auto &annotation : proc->annotations_) {
+      if (!annotation) {
+        continue;
+      }
+      if (auto x = annotation->Proto(); x) merged->MergeFrom(*x);
+    }
+    proc->exported_annotations_ = std::move(merged);
+  }
+  return *proc->exported_annotations_;
+}
+
+/*
+---
+Snapshots
+---
+*/
+
+ptpb::Snapshot ProcessTree::ExportSnapshot() const {
+  ptpb::Snapshot snapshot;
+  // A snapshot without a boot session is never restored.
+  if (absl::StatusOr<std::string> boot_session = CurrentBootSession();
+      boot_session.ok()) {
+    snapshot.set_boot_session(*std::move(boot_session));
   }
-  ::santa::pb::v1::process_tree::Annotations a;
-  for (const auto &[_, annotation] : (*proc)->annotations_) {
-    if (auto x = annotation->Proto(); x) a.MergeFrom(*x);
+  absl::ReaderMutexLock lock(&mtx_);
+  for (const auto &[pid, proc] : map_) {
+    ptpb::Snapshot::Entry *entry = nullptr;
+    for (const auto &annotation : proc->annotations_) {
+      if (!annotation) {
+        continue;
+      }
+      if (!entry) {
+        entry = snapshot.add_entries();
+        entry->set_pid(pid.pid);
+        entry->set_pidversion(pid.pidversion);
+        if (proc->exported_annotations_) {
+          *entry->mutable_annotations() = *proc->exported_annotations_;
+          break;
+        }
+      }
+      if (auto x = annotation->Proto(); x) {
+        entry->mutable_annotations()->MergeFrom(*x);
+      }
+    }
   }
-  return a;
+  return snapshot;
+}
+
+absl::Status ProcessTree::SaveSnapshot(const std::string &path) const {
+  // Write to a temporary file first so a crash mid-write can never leave a
+  // truncated snapshot behind for the next start to trip over.
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      return absl::ErrnoToStatus(errno, "Failed to open snapshot for writing");
+    }
+    if (!ExportSnapshot().SerializeToOstream(&out)) {
+      return absl::InternalError("Failed to serialize snapshot");
+    }
+    out.close();
+    if (!out) {
+      return absl::ErrnoToStatus(errno, "Failed to write snapshot");
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    return absl::ErrnoToStatus(errno, "Failed to move snapshot into place");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<ptpb::Snapshot> LoadSnapshot(const std::string &path,
+                                            const std::string &boot_session) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return absl::ErrnoToStatus(errno, "Failed to open snapshot");
+  }
+  ptpb::Snapshot snapshot;
+  if (!snapshot.ParseFromIstream(&in)) {
+    return absl::DataLossError("Failed to parse snapshot");
+  }
+  if (snapshot.boot_session() != boot_session) {
+    // Its pids may already have been reused by unrelated processes, so it
+    // can never be restored.
+    std::remove(path.c_str());
+    return absl::FailedPreconditionError(
+        "Snapshot was taken during a different boot");
+  }
+  return snapshot;
+}
+
+absl::StatusOr<ptpb::Snapshot> LoadSnapshot(const std::string &path) {
+  absl::StatusOr<std::string> boot_session = CurrentBootSession();
+  if (!boot_session.ok()) {
+    return boot_session.status();
+  }
+  return LoadSnapshot(path, *boot_session);
 }
 
 /*
@@ -228,7 +621,9 @@ void ProcessTree::Iterate(
     absl::ReaderMutexLock lock(&mtx_);
     procs.reserve(map_.size());
     for (auto &[_, proc] : map_) {
-      procs.push_back(proc);
+      if (!Released(*proc)) {
+        procs.push_back(proc);
+      }
     }
   }
 
@@ -246,7 +641,7 @@ std::optional<std::shared_ptr<const Process>> ProcessTree::Get(
 std::optional<std::shared_ptr<Process>> ProcessTree::GetLocked(
     const Pid target) const {
   auto it = map_.find(target);
-  if (it == map_.end()) {
+  if (it == map_.end() || Released(*it->second)) {
     return std::nullopt;
   }
   return it->second;
@@ -256,6 +651,28 @@ std::shared_ptr<const Process> ProcessTree::GetParent(const Process &p) const {
   return p.parent_;
 }
 
+struct ProcessTree::Stats ProcessTree::GetStats() const {
+  absl::ReaderMutexLock lock(&mtx_);
+  const absl::Time now = absl::Now();
+  absl::Time oldest_tombstone = now;
+  for (const auto &[exited, pid] : tombstones_) {
+    oldest_tombstone = std::min(oldest_tombstone, exited);
+  }
+  // Removals are queued in the order processes exit.
+  absl::Time oldest_retained = oldest_tombstone;
+  if (!remove_at_.empty()) {
+    oldest_retained = std::min(oldest_retained, remove_at_.front().exited);
+  }
+  return {
+      .processes = map_.size(),
+      .tombstoned = tombstones_.size(),
+      .oldest_retained_age = now - oldest_retained,
+      .oldest_tombstone_age = now - oldest_tombstone,
+      .rejected = rejected_,
+      .reconciled = reconciled_,
+  };
+}
+
 #if SANTA_PROCESS_TREE_DEBUG
 void ProcessTree::DebugDump(std::ostream &stream) const {
   absl::ReaderMutexLock lock(&mtx_);
@@ -278,22 +695,29 @@ void ProcessTree::DebugDumpLocked(std::ostream &stream, int depth,
 #endif
 
 absl::StatusOr<std::shared_ptr<ProcessTree>> CreateTree(
-    std::vector<std::unique_ptr<Annotator>> annotations) {
-  absl::flat_hash_set<std::type_index> seen;
+    std::vector<std::unique_ptr<Annotator>> annotations,
+    const std::optional<ptpb::Snapshot> &snapshot, size_t max_processes) {
+  // Registers each annotator type's slot, so the slots of the annotators in
+  // use are the densest possible.
+  absl::flat_hash_set<size_t> seen;
   for (const auto &annotator : annotations) {
-    if (seen.count(std::type_index(typeid(annotator)))) {
+    size_t slot = annotator->Slot();
+    if (slot >= kMaxAnnotatorSlots) {
+      return absl::InvalidArgumentError("Too many annotator classes");
+    }
+    if (!seen.insert(slot).second) {
       return absl::InvalidArgumentError(
           "Multiple annotators of the same class");
     }
-    seen.emplace(std::type_index(typeid(annotator)));
   }
 
   if (seen.empty()) {
     return nullptr;
   }
 
-  auto tree = std::make_shared<ProcessTree>(std::move(annotations));
-  if (auto status = tree->Backfill(); !status.ok()) {
+  auto tree =
+      std::make_shared<ProcessTree>(std::move(annotations), max_processes);
+  if (auto status = tree->Backfill(snapshot); !status.ok()) {
     return status;
   }
   return tree;
@@ -307,10 +731,21 @@ Tokens
 
 ProcessToken::ProcessToken(std::shared_ptr<ProcessTree> tree,
                            std::vector<struct Pid> pids)
-    : tree_(std::move(tree)), pids_(std::move(pids)) {
-  tree_->RetainProcess(pids);
+    : procs_(tree->RetainProcess(pids)) {}
+
+ProcessToken::ProcessToken(const ProcessToken &other) : procs_(other.procs_) {
+  for (const auto &proc : procs_) {
+    proc->refcnt_++;
+  }
 }
 
-ProcessToken::~ProcessToken() { tree_->ReleaseProcess(pids_); }
+ProcessToken::~ProcessToken() { Release(); }
+
+void ProcessToken::Release() {
+  for (const auto &proc : procs_) {
+    proc->refcnt_--;
+  }
+  procs_.clear();
+}
 
 }  // namespace santa::santad::process_tree
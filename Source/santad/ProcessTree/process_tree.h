@@ -15,33 +15,115 @@
 #define SANTA__SANTAD_PROCESSTREE_TREE_H
 
 #include <memory>
-#include <typeinfo>
+#include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.pb.h"
 #include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 
 namespace santa::santad::process_tree {
 
 absl::StatusOr<Process> LoadPID(pid_t pid);
 
+// An identifier unique to the current boot of the system.
+absl::StatusOr<std::string> CurrentBootSession();
+
+// Read a snapshot previously written by ProcessTree::SaveSnapshot. A snapshot
+// taken during a boot other than boot_session is deleted, and rejected with
+// absl::FailedPreconditionError.
+absl::StatusOr<::santa::pb::v1::process_tree::Snapshot> LoadSnapshot(
+    const std::string &path, const std::string &boot_session);
+
+// As above, for the current boot.
+absl::StatusOr<::santa::pb::v1::process_tree::Snapshot> LoadSnapshot(
+    const std::string &path);
+
+// A fork, exec or exit, as given to ProcessTree::HandleEvents.
+struct Event {
+  enum class Type { kFork, kExec, kExit };
+
+  Type type;
+  uint64_t timestamp;
+  // The process performing the event.
+  struct Pid pid;
+  // Fork: the child. Exec: the pid after the exec. Unused for exit.
+  struct Pid new_pid;
+  // Exec only: the new program and credentials.
+  struct Program program;
+  struct Cred cred;
+};
+
 // Fwd decl for test peer.
 class ProcessTreeTestPeer;
 
 class ProcessTree {
  public:
-  explicit ProcessTree(std::vector<std::unique_ptr<Annotator>> &&annotators)
-      : annotators_(std::move(annotators)), seen_timestamps_({}) {}
+  // Upper bound on the number of entries in the tree, including those waiting
+  // to be removed. A live system is expected to be well below this, so
+  // reaching it means entries are leaking faster than Reconcile reclaims them.
+  static constexpr size_t kDefaultMaxProcesses = 1 << 16;
+
+  explicit ProcessTree(std::vector<std::unique_ptr<Annotator>> &&annotators,
+                       size_t max_processes = kDefaultMaxProcesses)
+      : annotators_(std::move(annotators)),
+        max_processes_(max_processes),
+        seen_timestamps_({}) {}
   ProcessTree(const ProcessTree &) = delete;
   ProcessTree &operator=(const ProcessTree &) = delete;
   ProcessTree(ProcessTree &&) = delete;
   ProcessTree &operator=(ProcessTree &&) = delete;
 
   // Initialize the tree with the processes currently running on the system.
-  absl::Status Backfill();
+  // If a snapshot is given, annotations recorded for processes that are still
+  // running (matched by pid and pidversion) are restored from it instead of
+  // being re-derived by the annotators.
+  absl::Status Backfill(
+      const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot =
+          std::nullopt);
+
+  // Initialize the tree from an explicit list of processes, keyed by the pid
+  // of their parent. Processes with a parent pid of 0 are roots; processes
+  // whose parent is not in the list are dropped. This is the platform
+  // independent half of Backfill, and also allows seeding the tree with
+  // recorded processes, e.g. when replaying a log.
+  void BackfillFromProcesses(
+      const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+      const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot =
+          std::nullopt);
+
+#ifdef __linux__
+  // Backfill from a procfs mounted at proc_root, loading pids on num_threads
+  // worker threads. Parents are linked once all pids have been loaded.
+  // Backfill() is equivalent to backfilling from kProcRoot with one thread per
+  // core; an alternate root allows backfilling from a synthetic procfs.
+  absl::Status BackfillFromProcfs(
+      const std::string &proc_root, size_t num_threads,
+      const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot =
+          std::nullopt);
+#endif
+
+  // Erase processes which are no longer running but are still in the tree,
+  // e.g. because their exit event was dropped. This walks the whole tree, so
+  // is intended to be run periodically at a low priority.
+  // Returns the number of processes reclaimed.
+  absl::StatusOr<size_t> Reconcile();
+
+  // The platform independent half of Reconcile, given the pids currently
+  // running on the system. An entry is reclaimed if its pid is not running,
+  // or if a newer pidversion of its pid is in the tree, on two consecutive
+  // calls. Requiring two passes keeps processes which start after the live
+  // pids were listed from being mistaken for leaked ones. Reclaimed processes
+  // which are still retained by a ProcessToken are tombstoned instead.
+  size_t ReconcileWithLivePids(absl::Span<const pid_t> live_pids);
 
   // Inform the tree of a fork event, in which the parent process spawns a child
   // with the only difference between the two being the pid.
@@ -62,18 +144,29 @@ class ProcessTree {
   // Inform the tree of a process exit.
   void HandleExit(uint64_t timestamp, const Process &p);
 
+  // Inform the tree of a batch of events. Events are applied in timestamp
+  // order, taking the lock once per up to 32 events rather than several times
+  // per event, and are then annotated in the same order. An event is skipped
+  // if its process is not in the tree when it is applied; processes created
+  // by earlier events in the batch are.
+  void HandleEvents(absl::Span<const Event> events);
+
   // Mark the given pids as needing to be retained in the tree's map for future
   // access. Normally, Processes are removed once all clients process past the
   // event which would remove the Process (e.g. exit), however in cases where
   // async processing occurs, the Process may need to be accessed after the
   // exit.
-  void RetainProcess(std::vector<struct Pid> &pids);
+  // Returns the retained processes. Pids not in the tree are skipped.
+  std::vector<std::shared_ptr<const Process>> RetainProcess(
+      std::vector<struct Pid> &pids);
 
   // Release previously retained processes, signaling that the client is done
   // processing the event that retained them.
   void ReleaseProcess(std::vector<struct Pid> &pids);
 
-  // Annotate the given process with an Annotator (state).
+  // Annotate the given process with an Annotator (state). The annotation is
+  // stored in the slot of its dynamic type, as given by Annotator::Slot(), so
+  // it may be passed as a pointer to the base class.
   void AnnotateProcess(const Process &p, std::shared_ptr<const Annotator> a);
 
   // Get the given annotation on the given process if it exists, or nullopt if
@@ -85,6 +178,12 @@ class ProcessTree {
   std::optional<::santa::pb::v1::process_tree::Annotations> ExportAnnotations(
       struct Pid p);
 
+  // Capture the annotations of every annotated process in the tree.
+  ::santa::pb::v1::process_tree::Snapshot ExportSnapshot() const;
+
+  // Atomically write the current snapshot to the given path.
+  absl::Status SaveSnapshot(const std::string &path) const;
+
   // Atomically get the slice of Processes going from the given process "up"
   // to the root. The root process has no parent. N.B. There may be more than
   // one root process. E.g. on Linux, both init (PID 1) and kthread (PID 2)
@@ -102,6 +201,29 @@ class ProcessTree {
   // Traverse the tree from the given Process to its parent.
   std::shared_ptr<const Process> GetParent(const Process &p) const;
 
+  struct Stats {
+    // Number of entries in the tree's map, including tombstones.
+    size_t processes;
+    // Processes which have exited but are kept alive by a ProcessToken.
+    size_t tombstoned;
+    // How long the oldest process which has exited, or exec'd, has been
+    // retained in the tree, or zero if there are none. This covers processes
+    // waiting for events still in flight as well as tombstones, so is normally
+    // a few seconds at most. A steadily growing age points at a leaked entry.
+    absl::Duration oldest_retained_age;
+    // As above, but only for tombstones, which are retained by tokens rather
+    // than the tree. If this accounts for oldest_retained_age, a token has
+    // leaked.
+    absl::Duration oldest_tombstone_age;
+    // Processes not added because the tree was at its maximum size. When
+    // backfilling, this includes the descendants of each rejected process.
+    size_t rejected;
+    // Processes erased by Reconcile.
+    size_t reconciled;
+  };
+  // Get a point-in-time summary of the tree's size.
+  struct Stats GetStats() const;
+
 #if SANTA_PROCESS_TREE_DEBUG
   // Dump the tree in a human readable form to the given ostream.
   void DebugDump(std::ostream &stream) const;
@@ -109,79 +231,157 @@ class ProcessTree {
 
  private:
   friend class ProcessTreeTestPeer;
+  using SnapshotIndex =
+      absl::flat_hash_map<struct Pid,
+                          const ::santa::pb::v1::process_tree::Annotations *>;
+
+  static SnapshotIndex IndexSnapshot(
+      const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot);
+
   void BackfillInsertChildren(
-      absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
-      std::shared_ptr<Process> parent, const Process &unlinked_proc);
+      const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+      std::shared_ptr<Process> parent, const Process &unlinked_proc,
+      const SnapshotIndex &snapshot);
+  static size_t CountDescendants(
+      const absl::flat_hash_map<pid_t, std::vector<Process>> &parent_map,
+      pid_t pid);
+
+  // Restore the annotations recorded in a snapshot for the given process.
+  // Returns the annotators which could not restore their state and must
+  // instead annotate the process from scratch.
+  std::vector<Annotator *> RestoreAnnotations(
+      const Process &p, const SnapshotIndex &snapshot);
+
+  void AnnotateProcessSlot(const Process &p, size_t slot,
+                           std::shared_ptr<const Annotator> a);
 
   // Mark that an event with the given timestamp is being processed.
   // Returns whether the given timestamp is "novel", and the tree should be
   // updated with the results of the event.
-  bool Step(uint64_t timestamp);
+  bool StepLocked(uint64_t timestamp) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+
+  // Add the given process to map_, unless the tree is at its maximum size.
+  // Returns whether the process was added.
+  bool InsertLocked(std::shared_ptr<Process> proc)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+
+  // Remove the given process from the tree, or tombstone it if it is retained.
+  // exited is when it was found to have exited, for Stats.
+  void RemoveLocked(struct Pid pid, absl::Time exited)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+
+  // Erase tombstones which have since been released by every token. Tokens
+  // release processes without the tree lock, so this is left to Reconcile
+  // rather than being done as they are released.
+  void ReclaimTombstonesLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+
+  // Apply the mutations of the given event to map_, returning the new Process
+  // where there is one. Annotators are run by the caller, without the lock.
+  std::shared_ptr<Process> ForkLocked(const Process &parent,
+                                      struct Pid new_pid)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+  std::shared_ptr<Process> ExecLocked(uint64_t timestamp, const Process &p,
+                                      struct Pid new_pid,
+                                      const struct Program &prog,
+                                      struct Cred c)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
+  void ExitLocked(uint64_t timestamp, const Process &p)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mtx_);
 
   std::optional<std::shared_ptr<Process>> GetLocked(struct Pid target) const
       ABSL_SHARED_LOCKS_REQUIRED(mtx_);
 
+  // Whether the process was tombstoned and has since been released by every
+  // token, and so is only waiting to be erased from map_.
+  static bool Released(const Process &p);
+
   void DebugDumpLocked(std::ostream &stream, int depth, pid_t ppid) const;
 
   std::vector<std::unique_ptr<Annotator>> annotators_;
+  const size_t max_processes_;
 
   mutable absl::Mutex mtx_;
   absl::flat_hash_map<const struct Pid, std::shared_ptr<Process>> map_
       ABSL_GUARDED_BY(mtx_);
-  // List of pids which should be removed from map_, and at the timestamp at
-  // which they should be.
+  struct PendingRemoval {
+    // The event timestamp at which the process should be removed.
+    uint64_t timestamp;
+    struct Pid pid;
+    // When the removal was queued.
+    absl::Time exited;
+  };
+  // List of pids which should be removed from map_.
   // Elements are removed when the timestamp falls out of the seen_timestamps_
   // list below, signifying that all clients have synced past the timestamp.
-  std::vector<std::pair<uint64_t, struct Pid>> remove_at_ ABSL_GUARDED_BY(mtx_);
+  std::vector<PendingRemoval> remove_at_ ABSL_GUARDED_BY(mtx_);
+  // Tombstoned pids and when they exited. They are erased from map_ by the
+  // first Reconcile after they are released.
+  std::vector<std::pair<absl::Time, struct Pid>> tombstones_
+      ABSL_GUARDED_BY(mtx_);
+  // Pids found to be no longer running by the last ReconcileWithLivePids.
+  absl::flat_hash_set<struct Pid> reconcile_suspects_ ABSL_GUARDED_BY(mtx_);
+  size_t rejected_ ABSL_GUARDED_BY(mtx_) = 0;
+  size_t reconciled_ ABSL_GUARDED_BY(mtx_) = 0;
   // Rolling list of event timestamps processed by the tree.
   // This is used to ensure an event only gets processed once, even if events
   // come out of order.
-  std::array<uint64_t, 32> seen_timestamps_ ABSL_GUARDED_BY(mtx_);
+  static constexpr size_t kSeenTimestamps = 32;
+  std::array<uint64_t, kSeenTimestamps> seen_timestamps_ ABSL_GUARDED_BY(mtx_);
 };
 
 template <typename T>
 std::optional<std::shared_ptr<const T>> ProcessTree::GetAnnotation(
     const Process &p) const {
-  auto it = p.annotations_.find(std::type_index(typeid(T)));
-  if (it == p.annotations_.end()) {
+  size_t slot = AnnotatorSlot<T>();
+  if (slot >= kMaxAnnotatorSlots || !p.annotations_[slot]) {
     return std::nullopt;
   }
-  return std::dynamic_pointer_cast<const T>(it->second);
+  // Only annotations of type T are stored in T's slot.
+  return std::static_pointer_cast<const T>(p.annotations_[slot]);
 }
 
 // Create a new tree, ensuring the provided annotations are valid and that
-// backfill is successful.
+// backfill is successful. If a snapshot is given, it is reconciled against the
+// live process list during backfill. The tree holds at most max_processes
+// entries.
 absl::StatusOr<std::shared_ptr<ProcessTree>> CreateTree(
-    std::vector<std::unique_ptr<Annotator>> annotations);
+    std::vector<std::unique_ptr<Annotator>> annotations,
+    const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot =
+        std::nullopt,
+    size_t max_processes = ProcessTree::kDefaultMaxProcesses);
 
 // ProcessTokens provide a lifetime based approach to retaining processes
 // in a ProcessTree. When a token is created with a list of pids that may need
 // to be referenced during processing of a given event, the ProcessToken informs
 // the tree to retain those pids in its map so any call to ProcessTree::Get()
-// during event processing succeeds. When the token is destroyed, it signals the
-// tree to release the pids, which removes them from the tree if they would have
-// fallen out otherwise due to a destruction event (e.g. exit).
+// during event processing succeeds. When the token is destroyed, it releases
+// the pids, which removes them from the tree if they would have fallen out
+// otherwise due to a destruction event (e.g. exit).
+// Only creating a token looks up the pids in the tree. Copying and destroying
+// tokens update the processes' refcounts directly, without the tree lock.
 class ProcessToken {
  public:
   explicit ProcessToken(std::shared_ptr<ProcessTree> tree,
                         std::vector<struct Pid> pids);
   ~ProcessToken();
-  ProcessToken(const ProcessToken &other)
-      : ProcessToken(other.tree_, other.pids_) {}
+  ProcessToken(const ProcessToken &other);
   ProcessToken(ProcessToken &&other) noexcept
-      : tree_(std::move(other.tree_)), pids_(std::move(other.pids_)) {}
+      : procs_(std::move(other.procs_)) {}
   ProcessToken &operator=(const ProcessToken &other) {
-    return *this = ProcessToken(other.tree_, other.pids_);
+    return *this = ProcessToken(other);
   }
   ProcessToken &operator=(ProcessToken &&other) noexcept {
-    tree_ = std::move(other.tree_);
-    pids_ = std::move(other.pids_);
+    if (this != &other) {
+      Release();
+      procs_ = std::move(other.procs_);
+    }
     return *this;
   }
 
  private:
-  std::shared_ptr<ProcessTree> tree_;
-  std::vector<struct Pid> pids_;
+  void Release();
+
+  std::vector<std::shared_ptr<const Process>> procs_;
 };
 
 }  // namespace santa::santad::process_tree
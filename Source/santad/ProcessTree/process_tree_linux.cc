@@ -0,0 +1,283 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#include "Source/santad/ProcessTree/process_tree_linux.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+
+namespace santa::santad::process_tree {
+
+namespace {
+
+// A process loaded from procfs, along with the pid of its parent. Unlike on
+// macOS, the ppid comes from the same read as the rest of the process state.
+struct ProcfsEntry {
+  pid_t ppid;
+  Process proc;
+};
+
+absl::StatusOr<std::string> ReadProcFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", path));
+  }
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+// /proc/<pid>/stat is "pid (comm) state ppid ...". comm may itself contain
+// spaces and parentheses, so the remaining fields are located relative to the
+// last ')'.
+absl::Status ParseStat(absl::string_view stat, pid_t *ppid,
+                       uint64_t *starttime, std::string *comm) {
+  size_t open = stat.find('(');
+  size_t close = stat.rfind(')');
+  if (open == absl::string_view::npos || close == absl::string_view::npos ||
+      close < open || close + 2 > stat.size()) {
+    return absl::InvalidArgumentError("malformed stat");
+  }
+  *comm = std::string(stat.substr(open + 1, close - open - 1));
+
+  // fields[0] is field 3 (state) in proc(5), so field N is fields[N - 3].
+  std::vector<absl::string_view> fields =
+      absl::StrSplit(stat.substr(close + 2), ' ', absl::SkipEmpty());
+  if (fields.size() < 20 || !absl::SimpleAtoi(fields[1], ppid) ||
+      !absl::SimpleAtoi(fields[19], starttime)) {
+    return absl::InvalidArgumentError("malformed stat fields");
+  }
+  return absl::OkStatus();
+}
+
+// Parse the effective uid and gid from the "Uid:" and "Gid:" lines of
+// /proc/<pid>/status. Each lists the real, effective, saved and fs ids.
+absl::Status ParseStatus(absl::string_view status, struct Cred *cred) {
+  bool have_uid = false, have_gid = false;
+  for (absl::string_view line : absl::StrSplit(status, '\n')) {
+    bool is_uid = absl::StartsWith(line, "Uid:");
+    bool is_gid = absl::StartsWith(line, "Gid:");
+    if (!is_uid && !is_gid) {
+      continue;
+    }
+    std::vector<absl::string_view> ids = absl::StrSplit(
+        line.substr(4), absl::ByAnyChar(" \t"), absl::SkipEmpty());
+    if (ids.size() < 2) {
+      return absl::InvalidArgumentError("malformed status ids");
+    }
+    if (is_uid) {
+      have_uid = absl::SimpleAtoi(ids[1], &cred->uid);
+    } else {
+      have_gid = absl::SimpleAtoi(ids[1], &cred->gid);
+    }
+  }
+  if (!have_uid || !have_gid) {
+    return absl::InvalidArgumentError("missing status ids");
+  }
+  return absl::OkStatus();
+}
+
+// /proc/<pid>/cmdline is the NUL-separated argv. It is empty for kernel
+// threads and zombies.
+std::vector<std::string> ParseCmdline(absl::string_view cmdline) {
+  if (!cmdline.empty() && cmdline.back() == '\0') {
+    cmdline.remove_suffix(1);
+  }
+  if (cmdline.empty()) {
+    return {};
+  }
+  return absl::StrSplit(cmdline, '\0');
+}
+
+absl::StatusOr<ProcfsEntry> LoadProcfsEntry(const std::string &proc_root,
+                                            pid_t pid) {
+  std::string dir = absl::StrCat(proc_root, "/", pid);
+
+  auto stat = ReadProcFile(absl::StrCat(dir, "/stat"));
+  if (!stat.ok()) {
+    return stat.status();
+  }
+  pid_t ppid = 0;
+  uint64_t starttime = 0;
+  std::string comm;
+  if (absl::Status s = ParseStat(*stat, &ppid, &starttime, &comm); !s.ok()) {
+    return s;
+  }
+
+  auto status = ReadProcFile(absl::StrCat(dir, "/status"));
+  if (!status.ok()) {
+    return status.status();
+  }
+  struct Cred cred = {};
+  if (absl::Status s = ParseStatus(*status, &cred); !s.ok()) {
+    return s;
+  }
+
+  // Don't fail Process creation if args can't be recovered.
+  std::vector<std::string> args =
+      ParseCmdline(ReadProcFile(absl::StrCat(dir, "/cmdline")).value_or(""));
+
+  // exe is unreadable for kernel threads, and for other users' processes
+  // without CAP_SYS_PTRACE. Fall back to argv[0], then the comm.
+  std::string executable;
+  char path[PATH_MAX];
+  ssize_t len =
+      readlink(absl::StrCat(dir, "/exe").c_str(), path, sizeof(path));
+  if (len > 0) {
+    executable.assign(path, len);
+  } else if (!args.empty()) {
+    executable = args[0];
+  } else {
+    executable = comm;
+  }
+
+  return ProcfsEntry{
+      .ppid = ppid,
+      .proc = Process((struct Pid){.pid = pid, .pidversion = starttime}, cred,
+                      std::make_shared<struct Program>((struct Program){
+                          .executable = std::move(executable),
+                          .arguments = std::move(args),
+                      }),
+                      nullptr),
+  };
+}
+
+absl::StatusOr<std::vector<pid_t>> ListPids(const std::string &proc_root) {
+  DIR *dir = opendir(proc_root.c_str());
+  if (dir == nullptr) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("opendir ", proc_root));
+  }
+  std::vector<pid_t> pids;
+  while (struct dirent *ent = readdir(dir)) {
+    pid_t pid;
+    if (absl::SimpleAtoi(ent->d_name, &pid) && pid > 0) {
+      pids.push_back(pid);
+    }
+  }
+  closedir(dir);
+  return pids;
+}
+
+}  // namespace
+
+absl::StatusOr<Process> LoadPIDFromProcfs(const std::string &proc_root,
+                                          pid_t pid) {
+  auto entry = LoadProcfsEntry(proc_root, pid);
+  if (!entry.ok()) {
+    return entry.status();
+  }
+  return std::move(entry->proc);
+}
+
+absl::StatusOr<Process> LoadPID(pid_t pid) {
+  return LoadPIDFromProcfs(kProcRoot, pid);
+}
+
+absl::StatusOr<std::string> CurrentBootSession() {
+  absl::StatusOr<std::string> boot_id = ReadProcFile(
+      absl::StrCat(kProcRoot, "/sys/kernel/random/boot_id"));
+  if (!boot_id.ok()) {
+    return boot_id.status();
+  }
+  return std::string(absl::StripAsciiWhitespace(*boot_id));
+}
+
+absl::Status ProcessTree::Backfill(
+    const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot) {
+  return BackfillFromProcfs(kProcRoot, std::thread::hardware_concurrency(),
+                            snapshot);
+}
+
+absl::StatusOr<size_t> ProcessTree::Reconcile() {
+  auto pids = ListPids(kProcRoot);
+  if (!pids.ok()) {
+    return pids.status();
+  }
+  return ReconcileWithLivePids(*pids);
+}
+
+absl::Status ProcessTree::BackfillFromProcfs(
+    const std::string &proc_root, size_t num_threads,
+    const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot) {
+  auto pids_status = ListPids(proc_root);
+  if (!pids_status.ok()) {
+    return pids_status.status();
+  }
+  const std::vector<pid_t> &pids = *pids_status;
+  if (pids.empty()) {
+    return absl::OkStatus();
+  }
+  num_threads = std::clamp<size_t>(num_threads, 1, pids.size());
+
+  // Each worker claims the next unloaded pid and keeps its results to itself,
+  // so the only shared state during the scan is the cursor. Processes that
+  // exit mid-scan simply fail to load and are skipped.
+  std::atomic<size_t> next{0};
+  std::vector<std::vector<ProcfsEntry>> loaded(num_threads);
+  auto worker = [&](size_t id) {
+    for (size_t i = next++; i < pids.size(); i = next++) {
+      auto entry = LoadProcfsEntry(proc_root, pids[i]);
+      if (entry.ok()) {
+        loaded[id].push_back(std::move(*entry));
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t id = 1; id < num_threads; id++) {
+    threads.emplace_back(worker, id);
+  }
+  worker(0);
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  // Link parents on a single thread: annotators expect a process' parent to
+  // be in the tree before the process itself is.
+  absl::flat_hash_map<pid_t, std::vector<Process>> parent_map;
+  for (std::vector<ProcfsEntry> &entries : loaded) {
+    for (ProcfsEntry &entry : entries) {
+      parent_map[entry.ppid].push_back(std::move(entry.proc));
+    }
+  }
+
+  BackfillFromProcesses(parent_map, snapshot);
+
+  return absl::OkStatus();
+}
+
+}  // namespace santa::santad::process_tree
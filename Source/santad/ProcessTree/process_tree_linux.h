@@ -0,0 +1,37 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#ifndef SANTA__SANTAD_PROCESSTREE_TREE_LINUX_H
+#define SANTA__SANTAD_PROCESSTREE_TREE_LINUX_H
+
+#include <sys/types.h>
+
+#include <string>
+
+#include "Source/santad/ProcessTree/process.h"
+#include "absl/status/statusor.h"
+
+namespace santa::santad::process_tree {
+
+// Mount point of the procfs that LoadPID and ProcessTree::Backfill read.
+static constexpr const char *kProcRoot = "/proc";
+
+// Load the given pid from a procfs mounted at proc_root.
+// The pidversion of a Linux process is its start time (in clock ticks since
+// boot), which together with the pid identifies the process for its lifetime.
+absl::StatusOr<Process> LoadPIDFromProcfs(const std::string &proc_root,
+                                          pid_t pid);
+
+}  // namespace santa::santad::process_tree
+
+#endif
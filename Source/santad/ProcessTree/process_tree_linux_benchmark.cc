@@ -0,0 +1,99 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+// Measures ProcessTree::BackfillFromProcfs against a synthetic procfs.
+//
+// Usage: process_tree_linux_benchmark [num_procs] [max_threads] [dir]
+//
+// Writes num_procs (default 100000) processes under dir (default a fresh
+// directory in $TMPDIR) as a random tree, then backfills from it with 1, 2,
+// 4, ... up to max_threads (default one per core) worker threads.
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Source/santad/ProcessTree/process_tree.h"
+#include "Source/santad/ProcessTree/process_tree_linux_test_helpers.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+using santa::santad::process_tree::Annotator;
+using santa::santad::process_tree::FakeProcfs;
+using santa::santad::process_tree::ProcessTree;
+
+int main(int argc, char *argv[]) {
+  size_t num_procs = 100000;
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  const char *tmpdir = getenv("TMPDIR");
+  std::string root = absl::StrCat(tmpdir ? tmpdir : "/tmp",
+                                  "/process_tree_benchmark_", getpid());
+  if ((argc > 1 && !absl::SimpleAtoi(argv[1], &num_procs)) ||
+      (argc > 2 && !absl::SimpleAtoi(argv[2], &max_threads))) {
+    fprintf(stderr, "usage: %s [num_procs] [max_threads] [dir]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 3) {
+    root = argv[3];
+  }
+
+  // Each process' parent is chosen uniformly from the processes before it, so
+  // the tree is wide and shallow like a real process table. The seed is
+  // fixed so runs are comparable.
+  FakeProcfs procfs(root);
+  std::mt19937 rng(0);
+  absl::Time start = absl::Now();
+  for (size_t i = 0; i < num_procs; i++) {
+    pid_t pid = static_cast<pid_t>(i + 1);
+    pid_t ppid = i == 0 ? 0 : std::uniform_int_distribution<pid_t>(1, i)(rng);
+    absl::Status s = procfs.AddProcess(
+        {.pid = pid, .pidversion = i}, ppid, {.uid = 0, .gid = 0}, "proc",
+        {"/usr/bin/proc", "--id", absl::StrCat(i)}, "/usr/bin/proc");
+    if (!s.ok()) {
+      fprintf(stderr, "Failed to write %s: %s\n", root.c_str(),
+              s.ToString().c_str());
+      return 1;
+    }
+  }
+  printf("wrote %zu processes to %s in %s\n", num_procs, root.c_str(),
+         absl::FormatDuration(absl::Now() - start).c_str());
+
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    // Room for every process, which may be more than a live system needs.
+    ProcessTree tree{std::vector<std::unique_ptr<Annotator>>(), num_procs};
+    start = absl::Now();
+    absl::Status s = tree.BackfillFromProcfs(procfs.root(), threads);
+    absl::Duration elapsed = absl::Now() - start;
+    if (!s.ok()) {
+      fprintf(stderr, "Backfill failed: %s\n", s.ToString().c_str());
+      return 1;
+    }
+    size_t loaded = 0;
+    tree.Iterate([&loaded](auto) { loaded++; });
+    printf("threads=%zu processes=%zu rejected=%zu elapsed=%s procs/sec=%.0f\n",
+           threads, loaded, tree.GetStats().rejected,
+           absl::FormatDuration(elapsed).c_str(),
+           loaded / absl::ToDoubleSeconds(elapsed));
+  }
+
+  return 0;
+}
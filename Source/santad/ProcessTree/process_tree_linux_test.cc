@@ -0,0 +1,110 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#include "Source/santad/ProcessTree/process_tree_linux.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.h"
+#include "Source/santad/ProcessTree/process_tree_linux_test_helpers.h"
+#include "absl/strings/str_cat.h"
+
+namespace santa::santad::process_tree {
+namespace {
+
+std::string ProcRoot(const std::string &name) {
+  return absl::StrCat(testing::TempDir(), "/", name, "_", getpid());
+}
+
+TEST(ProcessTreeLinuxTest, LoadPIDFromProcfs) {
+  FakeProcfs procfs(ProcRoot("load"));
+  ASSERT_TRUE(procfs
+                  .AddProcess({.pid = 42, .pidversion = 1234}, 1,
+                              {.uid = 501, .gid = 20}, "odd (comm) name",
+                              {"/bin/sh", "-c", "true"}, "/usr/bin/dash")
+                  .ok());
+  ASSERT_TRUE(procfs
+                  .AddProcess({.pid = 2, .pidversion = 7}, 0,
+                              {.uid = 0, .gid = 0}, "kthreadd", {}, "")
+                  .ok());
+
+  auto proc = LoadPIDFromProcfs(procfs.root(), 42);
+  ASSERT_TRUE(proc.ok()) << proc.status();
+  EXPECT_EQ(proc->pid_, (Pid{.pid = 42, .pidversion = 1234}));
+  EXPECT_EQ(proc->effective_cred_, (Cred{.uid = 501, .gid = 20}));
+  EXPECT_EQ(proc->program_->executable, "/usr/bin/dash");
+  EXPECT_EQ(proc->program_->arguments,
+            (std::vector<std::string>{"/bin/sh", "-c", "true"}));
+
+  // Kernel threads have neither an exe nor a cmdline.
+  auto kthread = LoadPIDFromProcfs(procfs.root(), 2);
+  ASSERT_TRUE(kthread.ok()) << kthread.status();
+  EXPECT_EQ(kthread->program_->executable, "kthreadd");
+  EXPECT_TRUE(kthread->program_->arguments.empty());
+
+  EXPECT_FALSE(LoadPIDFromProcfs(procfs.root(), 43).ok());
+}
+
+TEST(ProcessTreeLinuxTest, LoadPIDSelf) {
+  auto self = LoadPID(getpid());
+  ASSERT_TRUE(self.ok()) << self.status();
+  EXPECT_EQ(self->pid_.pid, getpid());
+  EXPECT_EQ(self->effective_cred_.uid, geteuid());
+  EXPECT_EQ(self->effective_cred_.gid, getegid());
+  EXPECT_FALSE(self->program_->arguments.empty());
+
+  // The pidversion is stable across loads.
+  auto again = LoadPID(getpid());
+  ASSERT_TRUE(again.ok());
+  EXPECT_EQ(self->pid_, again->pid_);
+}
+
+TEST(ProcessTreeLinuxTest, BackfillLinksParents) {
+  FakeProcfs procfs(ProcRoot("backfill"));
+  // A chain 1 -> 100 -> 101 -> ... -> 199, plus a second root.
+  ASSERT_TRUE(procfs
+                  .AddProcess({.pid = 1, .pidversion = 1}, 0, {0, 0}, "init",
+                              {"/sbin/init"}, "/sbin/init")
+                  .ok());
+  ASSERT_TRUE(procfs
+                  .AddProcess({.pid = 2, .pidversion = 1}, 0, {0, 0},
+                              "kthreadd", {}, "")
+                  .ok());
+  for (pid_t pid = 100; pid < 200; pid++) {
+    pid_t ppid = pid == 100 ? 1 : pid - 1;
+    ASSERT_TRUE(procfs
+                    .AddProcess({.pid = pid, .pidversion = 10}, ppid, {0, 0},
+                                "sh", {"/bin/sh"}, "/bin/sh")
+                    .ok());
+  }
+
+  auto tree = std::make_shared<ProcessTree>(
+      std::vector<std::unique_ptr<Annotator>>());
+  ASSERT_TRUE(tree->BackfillFromProcfs(procfs.root(), 4).ok());
+
+  auto leaf = tree->Get({.pid = 199, .pidversion = 10});
+  ASSERT_TRUE(leaf.has_value());
+  auto slice = tree->RootSlice(*leaf);
+  ASSERT_EQ(slice.size(), 101);
+  EXPECT_EQ(slice.back()->pid_.pid, 1);
+  EXPECT_TRUE(tree->Get({.pid = 2, .pidversion = 1}).has_value());
+}
+
+}  // namespace
+}  // namespace santa::santad::process_tree
@@ -0,0 +1,91 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#include "Source/santad/ProcessTree/process_tree_linux_test_helpers.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace santa::santad::process_tree {
+
+namespace {
+
+absl::Status WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out.write(contents.data(), contents.size())) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("write ", path));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status FakeProcfs::AddProcess(const struct Pid &pid, pid_t ppid,
+                                    const struct Cred &cred,
+                                    const std::string &comm,
+                                    const std::vector<std::string> &args,
+                                    const std::string &exe) {
+  if (mkdir(root_.c_str(), 0755) != 0 && errno != EEXIST) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("mkdir ", root_));
+  }
+  std::string dir = absl::StrCat(root_, "/", pid.pid);
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("mkdir ", dir));
+  }
+
+  // Fields 3 through 52 of proc(5); only ppid (4) and starttime (22) are
+  // meaningful here.
+  std::string stat = absl::StrFormat("%d (%s) S %d", pid.pid, comm, ppid);
+  for (int field = 5; field <= 52; field++) {
+    absl::StrAppend(&stat, " ", field == 22 ? pid.pidversion : 0);
+  }
+  absl::StrAppend(&stat, "\n");
+  if (absl::Status s = WriteFile(dir + "/stat", stat); !s.ok()) {
+    return s;
+  }
+
+  std::string status = absl::StrFormat(
+      "Name:\t%s\nPid:\t%d\nPPid:\t%d\nUid:\t%d\t%d\t%d\t%d\n"
+      "Gid:\t%d\t%d\t%d\t%d\n",
+      comm, pid.pid, ppid, cred.uid, cred.uid, cred.uid, cred.uid, cred.gid,
+      cred.gid, cred.gid, cred.gid);
+  if (absl::Status s = WriteFile(dir + "/status", status); !s.ok()) {
+    return s;
+  }
+
+  std::string cmdline;
+  for (const std::string &arg : args) {
+    absl::StrAppend(&cmdline, arg, std::string(1, '\0'));
+  }
+  if (absl::Status s = WriteFile(dir + "/cmdline", cmdline); !s.ok()) {
+    return s;
+  }
+
+  std::string exe_link = dir + "/exe";
+  unlink(exe_link.c_str());
+  if (!exe.empty() && symlink(exe.c_str(), exe_link.c_str()) != 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("symlink ", exe_link));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace santa::santad::process_tree
@@ -0,0 +1,49 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+#ifndef SANTA__SANTAD_PROCESSTREE_TREE_LINUX_TEST_HELPERS_H
+#define SANTA__SANTAD_PROCESSTREE_TREE_LINUX_TEST_HELPERS_H
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Source/santad/ProcessTree/process.h"
+#include "absl/status/status.h"
+
+namespace santa::santad::process_tree {
+
+// Writes the subset of procfs read by LoadPIDFromProcfs under a directory, so
+// that backfill can be exercised against an arbitrary process table.
+class FakeProcfs {
+ public:
+  explicit FakeProcfs(std::string root) : root_(std::move(root)) {}
+
+  // Add the given process. An empty exe leaves /proc/<pid>/exe missing, as it
+  // is for kernel threads.
+  absl::Status AddProcess(const struct Pid &pid, pid_t ppid,
+                          const struct Cred &cred, const std::string &comm,
+                          const std::vector<std::string> &args,
+                          const std::string &exe);
+
+  const std::string &root() const { return root_; }
+
+ private:
+  std::string root_;
+};
+
+}  // namespace santa::santad::process_tree
+
+#endif
@@ -18,6 +18,10 @@
 
 namespace santa::santad::process_tree {
 
+// Location the daemon persists the tree to so that annotations survive
+// restarts.
+static constexpr const char *kSnapshotPath = "/var/db/santa/process_tree.snapshot";
+
 // Create a struct pid from the given audit token.
 struct Pid PidFromAuditToken(const audit_token_t &tok);
 
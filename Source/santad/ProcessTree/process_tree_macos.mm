@@ -20,7 +20,10 @@
 #include <string.h>
 #include <sys/sysctl.h>
 
+#include <cerrno>
 #include <memory>
+#include <optional>
+#include <string>
 #include <vector>
 
 #include "Source/santad/ProcessTree/process.h"
@@ -94,6 +97,26 @@ absl::StatusOr<std::vector<std::string>> ProcessArgumentsForPID(pid_t pid) {
   }
   return local_argv;
 }
+
+absl::StatusOr<std::vector<pid_t>> ListPids() {
+  int n_procs = proc_listpids(PROC_ALL_PIDS, 0, NULL, 0);
+  if (n_procs < 0) {
+    return absl::InternalError("proc_listpids failed");
+  }
+  n_procs /= sizeof(pid_t);
+
+  std::vector<pid_t> pids;
+  pids.resize(n_procs + 16);  // add space for a few more processes
+                              // in case some spawn in-between.
+
+  n_procs = proc_listpids(PROC_ALL_PIDS, 0, pids.data(), (int)(pids.size() * sizeof(pid_t)));
+  if (n_procs < 0) {
+    return absl::InternalError("proc_listpids failed");
+  }
+  n_procs /= sizeof(pid_t);
+  pids.resize(n_procs);
+  return pids;
+}
 }  // namespace
 
 struct Pid PidFromAuditToken(const audit_token_t &tok) {
@@ -137,26 +160,24 @@ absl::StatusOr<Process> LoadPID(pid_t pid) {
                  nullptr);
 }
 
-absl::Status ProcessTree::Backfill() {
-  int n_procs = proc_listpids(PROC_ALL_PIDS, 0, NULL, 0);
-  if (n_procs < 0) {
-    return absl::InternalError("proc_listpids failed");
+absl::StatusOr<std::string> CurrentBootSession() {
+  char uuid[64];
+  size_t len = sizeof(uuid);
+  if (sysctlbyname("kern.bootsessionuuid", uuid, &len, NULL, 0) != 0) {
+    return absl::ErrnoToStatus(errno, "sysctlbyname(kern.bootsessionuuid)");
   }
-  n_procs /= sizeof(pid_t);
-
-  std::vector<pid_t> pids;
-  pids.resize(n_procs + 16);  // add space for a few more processes
-                              // in case some spawn in-between.
+  return std::string(uuid, strnlen(uuid, len));
+}
 
-  n_procs = proc_listpids(PROC_ALL_PIDS, 0, pids.data(), (int)(pids.size() * sizeof(pid_t)));
-  if (n_procs < 0) {
-    return absl::InternalError("proc_listpids failed");
+absl::Status ProcessTree::Backfill(
+  const std::optional<::santa::pb::v1::process_tree::Snapshot> &snapshot) {
+  absl::StatusOr<std::vector<pid_t>> pids = ListPids();
+  if (!pids.ok()) {
+    return pids.status();
   }
-  n_procs /= sizeof(pid_t);
-  pids.resize(n_procs);
 
   absl::flat_hash_map<pid_t, std::vector<Process>> parent_map;
-  for (pid_t pid : pids) {
+  for (pid_t pid : *pids) {
     auto proc_status = LoadPID(pid);
     if (proc_status.ok()) {
       auto unlinked_proc = proc_status.value();
@@ -174,12 +195,17 @@ absl::Status ProcessTree::Backfill() {
     }
   }
 
-  auto &roots = parent_map[0];
-  for (const Process &p : roots) {
-    BackfillInsertChildren(parent_map, std::shared_ptr<Process>(), p);
-  }
+  BackfillFromProcesses(parent_map, snapshot);
 
   return absl::OkStatus();
 }
 
+absl::StatusOr<size_t> ProcessTree::Reconcile() {
+  absl::StatusOr<std::vector<pid_t>> pids = ListPids();
+  if (!pids.ok()) {
+    return pids.status();
+  }
+  return ReconcileWithLivePids(*pids);
+}
+
 }  // namespace santa::santad::process_tree
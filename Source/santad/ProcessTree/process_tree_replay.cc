@@ -0,0 +1,466 @@
+/// Copyright 2024 Google LLC
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     https://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+// Replays a stream of fork/exec/exit events through a ProcessTree and reports
+// throughput, lock contention, memory and tree size.
+//
+// The stream is either generated from a seed (--synthetic=N), or read from
+// recorded logs given as arguments. Each file holds newline-delimited
+// SantaMessage JSON (the "json" event log type), or a single pretty-printed
+// SantaMessage, Execution, Fork or Exit (as under santad/testdata/protobuf).
+// Processes referenced by a recorded stream before it creates them are seeded
+// into the tree up front, as Backfill would have found them.
+//
+// Both modes are deterministic: events are numbered by their position in the
+// stream rather than their recorded time, so repeated runs replay identical
+// work.
+//
+//   bazel run //Source/santad/ProcessTree:process_tree_replay --
+//       --synthetic=1000000 --readers=4 --batch=64
+#include <google/protobuf/json/json.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Source/common/santa.pb.h"
+#include "Source/santad/ProcessTree/annotations/annotator.h"
+#include "Source/santad/ProcessTree/annotations/lineage.h"
+#include "Source/santad/ProcessTree/annotations/originator.h"
+#include "Source/santad/ProcessTree/process.h"
+#include "Source/santad/ProcessTree/process_tree.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+ABSL_FLAG(uint64_t, synthetic, 0,
+          "Generate this many events instead of reading recorded logs.");
+ABSL_FLAG(uint32_t, seed, 1, "Seed for --synthetic.");
+ABSL_FLAG(uint32_t, initial_processes, 500,
+          "Number of processes backfilled before a --synthetic stream.");
+ABSL_FLAG(std::vector<std::string>, annotators, {"originator"},
+          "Annotators to create the tree with.");
+ABSL_FLAG(uint32_t, batch, 1,
+          "Events per ProcessTree::HandleEvents call. 1 replays one at a time, "
+          "as the ES adapter does.");
+ABSL_FLAG(uint64_t, max_processes, 0,
+          "Maximum size of the tree. 0 sizes it to hold every process in the "
+          "workload, so that none are rejected.");
+ABSL_FLAG(uint32_t, readers, 0,
+          "Threads concurrently looking up, exporting and retaining the "
+          "processes being replayed, as event logging does.");
+
+namespace pb = ::santa::pb::v1;
+
+using santa::santad::process_tree::Annotator;
+using santa::santad::process_tree::Cred;
+using santa::santad::process_tree::Event;
+using santa::santad::process_tree::LineageAnnotator;
+using santa::santad::process_tree::OriginatorAnnotator;
+using santa::santad::process_tree::Pid;
+using santa::santad::process_tree::Process;
+using santa::santad::process_tree::ProcessToken;
+using santa::santad::process_tree::ProcessTree;
+using santa::santad::process_tree::Program;
+
+namespace {
+
+// The processes to seed the tree with, keyed by parent pid, followed by the
+// events to replay on top of them.
+struct Workload {
+  absl::flat_hash_map<pid_t, std::vector<Process>> initial;
+  std::vector<Event> events;
+  // Recorded events which could not be replayed.
+  size_t skipped = 0;
+};
+
+absl::StatusOr<std::vector<std::unique_ptr<Annotator>>> MakeAnnotators(
+    const std::vector<std::string> &names) {
+  std::vector<std::unique_ptr<Annotator>> annotators;
+  for (const std::string &name : names) {
+    if (name == "originator") {
+      annotators.emplace_back(std::make_unique<OriginatorAnnotator>());
+    } else if (name == "lineage") {
+      annotators.emplace_back(std::make_unique<LineageAnnotator>());
+    } else {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Unknown annotator: ", name));
+    }
+  }
+  return annotators;
+}
+
+Process MakeProcess(const Pid &pid, const Cred &cred, std::string executable) {
+  return Process(pid, cred,
+                 std::make_shared<const Program>(
+                     Program{.executable = std::move(executable),
+                             .arguments = {}}),
+                 nullptr);
+}
+
+// A random tree of initial processes, then a random mix of events. Execs
+// regularly run the programs the originator annotator looks for, so
+// annotations spread through the tree as they would on a real host.
+Workload Synthesize(uint64_t num_events, uint32_t initial_processes,
+                    uint32_t seed) {
+  static const char *kPrograms[] = {
+      "/bin/zsh",      "/bin/bash",          "/usr/bin/login",
+      "/usr/bin/make", "/usr/sbin/cron",     "/usr/bin/clang",
+      "/bin/ls",       "/usr/libexec/xpcproxy",
+  };
+  std::mt19937_64 rng(seed);
+  auto pick = [&rng](size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+  };
+
+  Workload w;
+  std::vector<Pid> live;
+  pid_t next_pid = 1;
+  uint64_t next_pidversion = 1;
+  const Cred cred = {.uid = 0, .gid = 0};
+
+  for (uint32_t i = 0; i < std::max(initial_processes, 1u); i++) {
+    Pid pid = {.pid = next_pid++, .pidversion = next_pidversion++};
+    pid_t ppid = live.empty() ? 0 : live[pick(live.size())].pid;
+    w.initial[ppid].push_back(
+        MakeProcess(pid, cred, kPrograms[pick(std::size(kPrograms))]));
+    live.push_back(pid);
+  }
+
+  w.events.reserve(num_events);
+  for (uint64_t ts = 1; ts <= num_events; ts++) {
+    size_t idx = pick(live.size());
+    Pid pid = live[idx];
+    uint32_t roll = std::uniform_int_distribution<uint32_t>(0, 99)(rng);
+    if (roll < 40 || live.size() < 2) {
+      Pid child = {.pid = next_pid++, .pidversion = next_pidversion++};
+      w.events.push_back({.type = Event::Type::kFork,
+                          .timestamp = ts,
+                          .pid = pid,
+                          .new_pid = child});
+      live.push_back(child);
+    } else if (roll < 75) {
+      Pid new_pid = {.pid = pid.pid, .pidversion = next_pidversion++};
+      w.events.push_back(
+          {.type = Event::Type::kExec,
+           .timestamp = ts,
+           .pid = pid,
+           .new_pid = new_pid,
+           .program = {.executable = kPrograms[pick(std::size(kPrograms))],
+                       .arguments = {}},
+           .cred = cred});
+      live[idx] = new_pid;
+    } else {
+      w.events.push_back(
+          {.type = Event::Type::kExit, .timestamp = ts, .pid = pid});
+      live[idx] = live.back();
+      live.pop_back();
+    }
+  }
+  return w;
+}
+
+Pid PidFromProto(const pb::ProcessID &id) {
+  return {.pid = id.pid(),
+          .pidversion = static_cast<uint64_t>(id.pidversion())};
+}
+
+Cred CredFromProto(const pb::ProcessInfoLight &p) {
+  return {.uid = static_cast<uid_t>(p.effective_user().uid()),
+          .gid = static_cast<gid_t>(p.effective_group().gid())};
+}
+
+// Accumulates the events of a recorded stream, seeding any process that is
+// referenced before the stream creates it.
+class RecordedWorkload {
+ public:
+  void Add(const pb::SantaMessage &msg) {
+    if (msg.has_execution()) {
+      Add(msg.execution());
+    } else if (msg.has_fork()) {
+      Add(msg.fork());
+    } else if (msg.has_exit()) {
+      Add(msg.exit());
+    }
+  }
+
+  void Add(const pb::Execution &exec) {
+    Pid pid = Seen(exec.instigator());
+    Pid new_pid = PidFromProto(exec.target().id());
+    if (new_pid.pid != pid.pid) {
+      // Not a valid exec, e.g. hand-written test data.
+      w_.skipped++;
+      return;
+    }
+    std::vector<std::string> args;
+    for (const std::string &arg : exec.args()) {
+      args.push_back(arg);
+    }
+    created_.insert(new_pid);
+    w_.events.push_back(
+        {.type = Event::Type::kExec,
+         .timestamp = NextTimestamp(),
+         .pid = pid,
+         .new_pid = new_pid,
+         .program = {.executable = exec.target().executable().path(),
+                     .arguments = std::move(args)},
+         .cred = {.uid = static_cast<uid_t>(
+                      exec.target().effective_user().uid()),
+                  .gid = static_cast<gid_t>(
+                      exec.target().effective_group().gid())}});
+  }
+
+  void Add(const pb::Fork &fork) {
+    Pid pid = Seen(fork.instigator());
+    Pid child = PidFromProto(fork.child().id());
+    created_.insert(child);
+    w_.events.push_back({.type = Event::Type::kFork,
+                         .timestamp = NextTimestamp(),
+                         .pid = pid,
+                         .new_pid = child});
+  }
+
+  void Add(const pb::Exit &exit) {
+    w_.events.push_back({.type = Event::Type::kExit,
+                         .timestamp = NextTimestamp(),
+                         .pid = Seen(exit.instigator())});
+  }
+
+  Workload Finish() && {
+    // Seeded processes whose parent was not seen are roots.
+    for (auto &[ppid, procs] : seeded_by_ppid_) {
+      bool parent_seeded = seeded_pids_.contains(ppid);
+      auto &siblings = w_.initial[parent_seeded ? ppid : 0];
+      for (Process &p : procs) {
+        siblings.push_back(std::move(p));
+      }
+    }
+    return std::move(w_);
+  }
+
+ private:
+  Pid Seen(const pb::ProcessInfoLight &p) {
+    Pid pid = PidFromProto(p.id());
+    if (!created_.contains(pid) && seeded_.insert(pid).second) {
+      seeded_pids_.insert(pid.pid);
+      seeded_by_ppid_[p.parent_id().pid()].push_back(
+          MakeProcess(pid, CredFromProto(p), p.executable().path()));
+    }
+    return pid;
+  }
+
+  uint64_t NextTimestamp() { return w_.events.size() + 1; }
+
+  Workload w_;
+  absl::flat_hash_set<Pid> created_;
+  absl::flat_hash_set<Pid> seeded_;
+  absl::flat_hash_set<pid_t> seeded_pids_;
+  absl::flat_hash_map<pid_t, std::vector<Process>> seeded_by_ppid_;
+};
+
+// Parse json as a SantaMessage, or as one of the process events it carries.
+std::optional<pb::SantaMessage> ParseRecorded(const std::string &json) {
+  google::protobuf::json::ParseOptions options;
+  options.ignore_unknown_fields = false;
+  auto parse = [&](google::protobuf::Message *m) {
+    return google::protobuf::json::JsonStringToMessage(json, m, options).ok();
+  };
+
+  pb::SantaMessage msg;
+  if (parse(&msg)) {
+    return msg;
+  }
+  if (pb::Execution exec; parse(&exec)) {
+    *msg.mutable_execution() = std::move(exec);
+  } else if (pb::Fork fork; parse(&fork)) {
+    *msg.mutable_fork() = std::move(fork);
+  } else if (pb::Exit exit; parse(&exit)) {
+    *msg.mutable_exit() = std::move(exit);
+  } else {
+    return std::nullopt;
+  }
+  return msg;
+}
+
+absl::StatusOr<Workload> LoadRecorded(const std::vector<char *> &paths) {
+  RecordedWorkload w;
+  for (const char *path : paths) {
+    std::ifstream in(path);
+    if (!in) {
+      return absl::NotFoundError(absl::StrCat("Unable to open ", path));
+    }
+    std::stringstream contents;
+    contents << in.rdbuf();
+
+    // Newline-delimited messages, or else the whole file is one message.
+    std::vector<pb::SantaMessage> msgs;
+    for (absl::string_view line :
+         absl::StrSplit(contents.str(), '\n', absl::SkipWhitespace())) {
+      std::optional<pb::SantaMessage> msg = ParseRecorded(std::string(line));
+      if (!msg) {
+        msgs.clear();
+        break;
+      }
+      msgs.push_back(*std::move(msg));
+    }
+    if (msgs.empty()) {
+      std::optional<pb::SantaMessage> msg = ParseRecorded(contents.str());
+      if (!msg) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Unable to parse events in ", path));
+      }
+      msgs.push_back(*std::move(msg));
+    }
+
+    for (const pb::SantaMessage &msg : msgs) {
+      w.Add(msg);
+    }
+  }
+  return std::move(w).Finish();
+}
+
+std::atomic<int64_t> g_contended_locks{0};
+std::atomic<int64_t> g_lock_wait_cycles{0};
+
+void RecordLockWait(int64_t wait_cycles) {
+  g_contended_locks++;
+  g_lock_wait_cycles += wait_cycles;
+}
+
+// Peak resident set size, in bytes.
+uint64_t PeakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<char *> paths = absl::ParseCommandLine(argc, argv);
+  paths.erase(paths.begin());
+
+  absl::StatusOr<Workload> workload;
+  if (uint64_t n = absl::GetFlag(FLAGS_synthetic); n > 0) {
+    workload = Synthesize(n, absl::GetFlag(FLAGS_initial_processes),
+                          absl::GetFlag(FLAGS_seed));
+  } else if (!paths.empty()) {
+    workload = LoadRecorded(paths);
+  } else {
+    fprintf(stderr, "Pass --synthetic=N or one or more recorded logs\n");
+    return 1;
+  }
+  if (!workload.ok()) {
+    fprintf(stderr, "%s\n", workload.status().ToString().c_str());
+    return 1;
+  }
+
+  auto annotators = MakeAnnotators(absl::GetFlag(FLAGS_annotators));
+  if (!annotators.ok()) {
+    fprintf(stderr, "%s\n", annotators.status().ToString().c_str());
+    return 1;
+  }
+  // Every event adds at most one process.
+  size_t max_processes = absl::GetFlag(FLAGS_max_processes);
+  if (max_processes == 0) {
+    max_processes = workload->events.size();
+    for (const auto &[ppid, children] : workload->initial) {
+      max_processes += children.size();
+    }
+  }
+  auto tree =
+      std::make_shared<ProcessTree>(std::move(*annotators), max_processes);
+  tree->BackfillFromProcesses(workload->initial);
+  size_t initial = tree->GetStats().processes;
+
+  absl::RegisterMutexProfiler(RecordLockWait);
+
+  // Readers follow the replay, touching the most recently replayed process
+  // like the logging of an event would.
+  const std::vector<Event> &events = workload->events;
+  std::atomic<size_t> replayed{0};
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (uint32_t i = 0; i < absl::GetFlag(FLAGS_readers); i++) {
+    readers.emplace_back([&] {
+      while (!done) {
+        size_t n = replayed.load();
+        if (n == 0) {
+          std::this_thread::yield();
+          continue;
+        }
+        const Event &event = events[n - 1];
+        Pid pid = event.type == Event::Type::kExec ? event.new_pid : event.pid;
+        ProcessToken token(tree, {pid});
+        if (tree->Get(pid)) {
+          tree->ExportAnnotations(pid);
+        }
+      }
+    });
+  }
+
+  size_t batch = std::max(absl::GetFlag(FLAGS_batch), 1u);
+  absl::Time start = absl::Now();
+  for (size_t i = 0; i < events.size(); i += batch) {
+    size_t n = std::min(batch, events.size() - i);
+    tree->HandleEvents(absl::MakeConstSpan(&events[i], n));
+    replayed = i + n;
+  }
+  absl::Duration elapsed = absl::Now() - start;
+  done = true;
+  for (std::thread &t : readers) {
+    t.join();
+  }
+
+  ProcessTree::Stats stats = tree->GetStats();
+  printf("events:             %zu (%zu initial processes, %zu skipped)\n",
+         events.size(), initial, workload->skipped);
+  printf("elapsed:            %s\n", absl::FormatDuration(elapsed).c_str());
+  printf("events/sec:         %.0f\n",
+         events.size() / std::max(absl::ToDoubleSeconds(elapsed), 1e-9));
+  printf("contended locks:    %lld\n",
+         static_cast<long long>(g_contended_locks.load()));
+  printf("lock wait (cycles): %lld\n",
+         static_cast<long long>(g_lock_wait_cycles.load()));
+  printf("peak memory:        %.1f MiB\n", PeakRSS() / (1024.0 * 1024.0));
+  printf("processes:          %zu live, %zu tombstoned, %zu rejected "
+         "(max %zu)\n",
+         stats.processes - stats.tombstoned, stats.tombstoned, stats.rejected,
+         max_processes);
+  return 0;
+}
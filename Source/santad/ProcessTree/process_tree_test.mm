@@ -17,11 +17,14 @@
 #include <bsm/libbsm.h>
 
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "Source/santad/ProcessTree/annotations/annotator.h"
 #include "Source/santad/ProcessTree/process.h"
 #include "Source/santad/ProcessTree/process_tree_test_helpers.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/synchronization/mutex.h"
 
 namespace ptpb = ::santa::pb::v1::process_tree;
@@ -33,6 +36,7 @@ static constexpr std::string_view kAnnotatedExecutable = "/usr/bin/login";
 class TestAnnotator : public Annotator {
  public:
   TestAnnotator() {}
+  size_t Slot() const override { return AnnotatorSlot<TestAnnotator>(); }
   void AnnotateFork(ProcessTree &tree, const Process &parent, const Process &child) override;
   void AnnotateExec(ProcessTree &tree, const Process &orig_process,
                     const Process &new_process) override;
@@ -133,6 +137,14 @@ using namespace santa::santad::process_tree;
     }];
 }
 
+- (void)testCreateTreeRejectsDuplicateAnnotators {
+  std::vector<std::unique_ptr<Annotator>> annotators{};
+  annotators.emplace_back(std::make_unique<TestAnnotator>());
+  annotators.emplace_back(std::make_unique<TestAnnotator>());
+  auto tree = CreateTree(std::move(annotators));
+  XCTAssertEqual(tree.status().code(), absl::StatusCode::kInvalidArgument);
+}
+
 - (void)testAnnotation {
   std::vector<std::unique_ptr<Annotator>> annotators{};
   annotators.emplace_back(std::make_unique<TestAnnotator>());
@@ -173,6 +185,15 @@ using namespace santa::santad::process_tree;
   XCTAssertTrue(annotation.has_value());
 }
 
+- (void)testAnnotateThroughBaseClass {
+  // The annotation goes in the slot of its dynamic type, not that of the pointer it's passed as.
+  std::shared_ptr<const Annotator> annotation = std::make_shared<TestAnnotator>();
+  self.tree->AnnotateProcess(*self.initProc, annotation);
+  auto got = self.tree->GetAnnotation<TestAnnotator>(*self.initProc);
+  XCTAssertTrue(got.has_value());
+  XCTAssertEqual(got->get(), annotation.get());
+}
+
 - (void)testCleanup {
   uint64_t event_id = 1;
   const struct Pid child_pid = {.pid = 2, .pidversion = 2};
@@ -243,4 +264,166 @@ using namespace santa::santad::process_tree;
   }
 }
 
+- (void)testTokenRetention {
+  uint64_t event_id = 1;
+  const struct Pid child_pid = {.pid = 2, .pidversion = 2};
+  self.tree->HandleFork(event_id++, *self.initProc, child_pid);
+
+  std::optional<ProcessToken> token = ProcessToken(self.tree, {child_pid});
+  self.tree->HandleExit(event_id++, **self.tree->Get(child_pid));
+
+  // A copy keeps the process retained after the original is dropped.
+  std::optional<ProcessToken> copy = *token;
+  token.reset();
+  for (int i = 0; i < 100; i++) {
+    struct Pid churn_pid = {.pid = 100 + i, .pidversion = (uint64_t)(100 + i)};
+    self.tree->HandleFork(event_id++, *self.initProc, churn_pid);
+  }
+  XCTAssertTrue(self.tree->Get(child_pid).has_value());
+
+  // Dropping the last token makes the process unreachable straight away, even
+  // though it is only erased from the map by the next Reconcile.
+  copy.reset();
+  XCTAssertFalse(self.tree->Get(child_pid).has_value());
+  self.tree->HandleFork(event_id++, *self.initProc, {.pid = 1000, .pidversion = 1000});
+  XCTAssertFalse(self.tree->Get(child_pid).has_value());
+  XCTAssertEqual(self.tree->GetStats().tombstoned, 1);
+
+  std::vector<pid_t> live = {1};
+  self.tree->ReconcileWithLivePids(live);
+  XCTAssertFalse(self.tree->Get(child_pid).has_value());
+  XCTAssertEqual(self.tree->GetStats().tombstoned, 0);
+}
+
+- (void)testHandleEvents {
+  const struct Cred cred = {.uid = 0, .gid = 0};
+  const struct Pid child_pid = {.pid = 2, .pidversion = 2};
+  const struct Pid child_exec_pid = {.pid = 2, .pidversion = 3};
+  const struct Program child_exec_prog = {.executable = "/bin/bash", .arguments = {"/bin/bash"}};
+
+  // Out of order, with a duplicate. The exec applies to a process forked
+  // earlier in the same batch.
+  std::vector<Event> events = {
+    {.type = Event::Type::kExec,
+     .timestamp = 2,
+     .pid = child_pid,
+     .new_pid = child_exec_pid,
+     .program = child_exec_prog,
+     .cred = cred},
+    {.type = Event::Type::kFork, .timestamp = 1, .pid = self.initProc->pid_, .new_pid = child_pid},
+    {.type = Event::Type::kFork, .timestamp = 1, .pid = self.initProc->pid_, .new_pid = child_pid},
+  };
+  self.tree->HandleEvents(events);
+
+  auto child = self.tree->Get(child_exec_pid);
+  XCTAssertTrue(child.has_value());
+  XCTAssertEqual(*(*child)->program_, child_exec_prog);
+  XCTAssertEqual(self.tree->GetParent(**child), self.initProc);
+
+  // Replaying the batch is a no-op.
+  self.tree->HandleEvents(events);
+  XCTAssertEqual(*self.tree->Get(child_exec_pid), *child);
+}
+
+- (void)testReconcile {
+  uint64_t event_id = 1;
+  const struct Pid leaked_pid = {.pid = 2, .pidversion = 2};
+  const struct Pid retained_pid = {.pid = 3, .pidversion = 3};
+  const struct Pid stale_pid = {.pid = 4, .pidversion = 4};
+  const struct Pid reused_pid = {.pid = 4, .pidversion = 5};
+  self.tree->HandleFork(event_id++, *self.initProc, leaked_pid);
+  self.tree->HandleFork(event_id++, *self.initProc, retained_pid);
+  self.tree->HandleFork(event_id++, *self.initProc, stale_pid);
+  self.tree->HandleFork(event_id++, *self.initProc, reused_pid);
+  std::optional<ProcessToken> token = ProcessToken(self.tree, {retained_pid});
+
+  // None of the exits were seen. The first pass only marks the suspects.
+  std::vector<pid_t> live = {1, 4};
+  XCTAssertEqual(self.tree->ReconcileWithLivePids(live), 0);
+  XCTAssertTrue(self.tree->Get(leaked_pid).has_value());
+
+  // A process started after the first pass listed the live pids survives.
+  const struct Pid late_pid = {.pid = 5, .pidversion = 5};
+  self.tree->HandleFork(event_id++, *self.initProc, late_pid);
+  live.push_back(5);
+
+  XCTAssertEqual(self.tree->ReconcileWithLivePids(live), 3);
+  XCTAssertFalse(self.tree->Get(leaked_pid).has_value());
+  XCTAssertFalse(self.tree->Get(stale_pid).has_value());
+  XCTAssertTrue(self.tree->Get(reused_pid).has_value());
+  XCTAssertTrue(self.tree->Get(late_pid).has_value());
+
+  // The retained process stays reachable until its token goes away.
+  XCTAssertTrue(self.tree->Get(retained_pid).has_value());
+  ProcessTree::Stats stats = self.tree->GetStats();
+  XCTAssertEqual(stats.tombstoned, 1);
+  XCTAssertEqual(stats.reconciled, 3);
+  XCTAssertTrue(stats.oldest_retained_age >= stats.oldest_tombstone_age);
+
+  // Its exit event arriving late doesn't tombstone it a second time.
+  self.tree->HandleExit(event_id++, **self.tree->Get(retained_pid));
+  for (int i = 0; i < 32; i++) {
+    struct Pid churn_pid = {.pid = 100 + i, .pidversion = (uint64_t)(100 + i)};
+    self.tree->HandleFork(event_id++, *self.initProc, churn_pid);
+  }
+  XCTAssertTrue(self.tree->Get(retained_pid).has_value());
+  XCTAssertEqual(self.tree->GetStats().tombstoned, 1);
+
+  // Once released, the next pass erases it.
+  token.reset();
+  XCTAssertFalse(self.tree->Get(retained_pid).has_value());
+  self.tree->ReconcileWithLivePids(live);
+  XCTAssertEqual(self.tree->GetStats().tombstoned, 0);
+}
+
+- (void)testMaxProcesses {
+  std::vector<std::unique_ptr<Annotator>> annotators{};
+  annotators.emplace_back(std::make_unique<TestAnnotator>());
+  auto tree = std::make_shared<ProcessTreeTestPeer>(std::move(annotators), 2);
+  auto init = tree->InsertInit();
+
+  uint64_t event_id = 1;
+  const struct Pid child_pid = {.pid = 2, .pidversion = 2};
+  const struct Pid rejected_pid = {.pid = 3, .pidversion = 3};
+  tree->HandleFork(event_id++, *init, child_pid);
+  tree->HandleFork(event_id++, *init, rejected_pid);
+
+  XCTAssertTrue(tree->Get(child_pid).has_value());
+  XCTAssertFalse(tree->Get(rejected_pid).has_value());
+  ProcessTree::Stats stats = tree->GetStats();
+  XCTAssertEqual(stats.processes, 2);
+  XCTAssertEqual(stats.rejected, 1);
+
+  // Once a slot frees up, new processes are added again.
+  tree->HandleExit(event_id++, **tree->Get(child_pid));
+  for (int i = 0; i < 32; i++) {
+    tree->HandleFork(event_id++, *init, rejected_pid);
+  }
+  tree->HandleFork(event_id++, *init, rejected_pid);
+  XCTAssertTrue(tree->Get(rejected_pid).has_value());
+}
+
+- (void)testMaxProcessesBackfill {
+  auto tree = std::make_shared<ProcessTreeTestPeer>(std::vector<std::unique_ptr<Annotator>>(), 2);
+  auto prog = std::make_shared<const Program>((Program){.executable = "/bin/sh", .arguments = {}});
+  const struct Cred cred = {.uid = 0, .gid = 0};
+  auto proc = [&](pid_t pid) {
+    return Process((struct Pid){.pid = pid, .pidversion = 1}, cred, prog, nullptr);
+  };
+
+  // 1 -> {2, 3 -> {4, 5}}
+  absl::flat_hash_map<pid_t, std::vector<Process>> parent_map;
+  parent_map[0].push_back(proc(1));
+  parent_map[1].push_back(proc(2));
+  parent_map[1].push_back(proc(3));
+  parent_map[3].push_back(proc(4));
+  parent_map[3].push_back(proc(5));
+  tree->BackfillFromProcesses(parent_map);
+
+  // Once 3 is rejected, its descendants are too.
+  ProcessTree::Stats stats = tree->GetStats();
+  XCTAssertEqual(stats.processes, 2);
+  XCTAssertEqual(stats.rejected, 3);
+}
+
 @end
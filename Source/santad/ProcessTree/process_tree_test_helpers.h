@@ -22,9 +22,13 @@ namespace santa::santad::process_tree {
 class ProcessTreeTestPeer : public ProcessTree {
  public:
   explicit ProcessTreeTestPeer(
-      std::vector<std::unique_ptr<Annotator>> &&annotators)
-      : ProcessTree(std::move(annotators)) {}
+      std::vector<std::unique_ptr<Annotator>> &&annotators,
+      size_t max_processes = kDefaultMaxProcesses)
+      : ProcessTree(std::move(annotators), max_processes) {}
   std::shared_ptr<const Process> InsertInit();
+
+  using ProcessTree::BackfillInsertChildren;
+  using ProcessTree::IndexSnapshot;
 };
 
 }  // namespace santa::santad::process_tree
@@ -18,14 +18,10 @@
 
 #include "Source/santad/ProcessTree/process.h"
 #include "Source/santad/ProcessTree/process_tree.h"
+#include "Source/santad/ProcessTree/process_tree_test_helpers.h"
 
 namespace santa::santad::process_tree {
 
-class ProcessTreeTestPeer : public ProcessTree {
- public:
-  std::shared_ptr<const Process> InsertInit();
-};
-
 std::shared_ptr<const Process> ProcessTreeTestPeer::InsertInit() {
   absl::MutexLock lock(&mtx_);
   struct Pid initpid = {
@@ -62,6 +62,7 @@ static void RegisterEventLogType(SNTMetricSet *metricSet) {
       case SNTEventLogTypeSyslog: [logType set:@"syslog" forFieldValues:@[]]; break;
       case SNTEventLogTypeNull: [logType set:@"null" forFieldValues:@[]]; break;
       case SNTEventLogTypeFilelog: [logType set:@"file" forFieldValues:@[]]; break;
+      case SNTEventLogTypeSocket: [logType set:@"socket" forFieldValues:@[]]; break;
       default:
         // Should never be reached.
         [logType set:@"unknown" forFieldValues:@[]];
@@ -35,6 +35,7 @@
 #import "Source/santad/EventProviders/SNTEndpointSecurityRecorder.h"
 #import "Source/santad/EventProviders/SNTEndpointSecurityTamperResistance.h"
 #include "Source/santad/Logs/EndpointSecurity/Logger.h"
+#include "Source/santad/ProcessTree/process_tree_macos.h"
 #include "Source/santad/SNTDaemonControlController.h"
 #include "Source/santad/SNTDecisionCache.h"
 #include "Source/santad/TTYWriter.h"
@@ -51,6 +52,9 @@ using santa::TTYWriter;
 using santa::Unit;
 using santa::WatchItems;
 
+// How often the process tree is persisted to disk.
+static const uint64_t kProcessTreeSnapshotIntervalSec = 60;
+
 static void EstablishSyncServiceConnection(SNTSyncdQueue *syncd_queue) {
   // The syncBaseURL check is here to stop retrying if the sync server is removed.
   if (![[SNTConfigurator configurator] syncBaseURL]) {
@@ -441,11 +445,42 @@ void SantadMain(std::shared_ptr<EndpointSecurityAPI> esapi, std::shared_ptr<Logg
   // of the SNTKVOManager objects it contains.
   (void)kvoObservers;
 
+  // Must outlive this scope, as SantadMain does not return.
+  dispatch_source_t process_tree_maintenance_timer = nil;
   if (process_tree) {
-    if (absl::Status status = process_tree->Backfill(); !status.ok()) {
-      std::string err = status.ToString();
-      LOGE(@"Failed to backfill process tree: %@", @(err.c_str()));
-    }
+    // Periodically persist the tree so that a restarted daemon can recover the
+    // annotations of processes that are still running, and reclaim processes
+    // whose exit was never seen (e.g. due to dropped events).
+    process_tree_maintenance_timer = dispatch_source_create(
+      DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+    dispatch_source_set_timer(
+      process_tree_maintenance_timer,
+      dispatch_time(DISPATCH_TIME_NOW, kProcessTreeSnapshotIntervalSec * NSEC_PER_SEC),
+      kProcessTreeSnapshotIntervalSec * NSEC_PER_SEC, NSEC_PER_SEC);
+    dispatch_source_set_event_handler(process_tree_maintenance_timer, ^{
+      absl::StatusOr<size_t> reconciled = process_tree->Reconcile();
+      if (!reconciled.ok()) {
+        LOGW(@"Failed to reconcile process tree: %s",
+             reconciled.status().ToString().c_str());
+      } else if (*reconciled > 0) {
+        LOGD(@"Reclaimed %zu exited processes from the process tree", *reconciled);
+      }
+
+      santa::santad::process_tree::ProcessTree::Stats stats = process_tree->GetStats();
+      metrics->SetProcessTreeMetrics({
+        .processes = static_cast<int64_t>(stats.processes),
+        .tombstoned = static_cast<int64_t>(stats.tombstoned),
+        .oldest_retained_age_secs = absl::ToInt64Seconds(stats.oldest_retained_age),
+        .oldest_tombstone_age_secs = absl::ToInt64Seconds(stats.oldest_tombstone_age),
+      });
+
+      absl::Status status =
+        process_tree->SaveSnapshot(santa::santad::process_tree::kSnapshotPath);
+      if (!status.ok()) {
+        LOGW(@"Failed to save process tree snapshot: %s", status.ToString().c_str());
+      }
+    });
+    dispatch_resume(process_tree_maintenance_timer);
   }
 
   // IMPORTANT: ES will hold up third party execs until early boot clients make
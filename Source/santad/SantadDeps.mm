@@ -16,6 +16,8 @@
 
 #include <cstdlib>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #import "Source/common/SNTLogging.h"
 #import "Source/common/SNTMetricSet.h"
@@ -24,11 +26,14 @@
 #import "Source/santad/DataLayer/SNTRuleTable.h"
 #include "Source/santad/DataLayer/WatchItems.h"
 #include "Source/santad/EventProviders/EndpointSecurity/EndpointSecurityAPI.h"
+#include "Source/santad/ProcessTree/annotations/lineage.h"
 #include "Source/santad/ProcessTree/annotations/originator.h"
 #include "Source/santad/ProcessTree/process_tree.h"
+#include "Source/santad/ProcessTree/process_tree_macos.h"
 #import "Source/santad/SNTDatabaseController.h"
 #include "Source/santad/SNTDecisionCache.h"
 #include "Source/santad/TTYWriter.h"
+#include "absl/status/status.h"
 
 using santa::AuthResultCache;
 using santa::EndpointSecurityAPI;
@@ -123,10 +128,23 @@ std::unique_ptr<SantadDeps> SantadDeps::Create(SNTConfigurator *configurator,
   size_t spool_dir_threshold_bytes = [configurator spoolDirectorySizeThresholdMB] * 1024 * 1024;
   uint64_t spool_flush_timeout_ms = [configurator spoolDirectoryEventMaxFlushTimeSec] * 1000;
 
+  std::vector<SNTEventLogType> additional_log_types;
+  for (NSNumber *log_type in [configurator eventLogAdditionalTypes]) {
+    additional_log_types.push_back((SNTEventLogType)[log_type integerValue]);
+  }
+
   std::unique_ptr<::Logger> logger =
     Logger::Create(esapi, [configurator eventLogType], [SNTDecisionCache sharedCache],
                    [configurator eventLogPath], [configurator spoolDirectory],
-                   spool_dir_threshold_bytes, spool_file_threshold_bytes, spool_flush_timeout_ms);
+                   spool_dir_threshold_bytes, spool_file_threshold_bytes, spool_flush_timeout_ms,
+                   [configurator spoolDirectoryUseSegments],
+                   [configurator spoolDirectoryCompressBatches],
+                   [configurator spoolDirectoryChecksumRecords],
+                   [configurator eventLogUseWriterThread],
+                   [configurator eventLogRotationSizeMB] * 1024 * 1024,
+                   [configurator eventLogRotationIntervalSec],
+                   [configurator eventLogRotationRetainCount], additional_log_types,
+                   [configurator eventLogSocketPath]);
   if (!logger) {
     LOGE(@"Failed to create logger.");
     exit(EXIT_FAILURE);
@@ -162,12 +180,36 @@ std::unique_ptr<SantadDeps> SantadDeps::Create(SNTConfigurator *configurator,
   for (NSString *annotation in [configurator enabledProcessAnnotations]) {
     if ([[annotation lowercaseString] isEqualToString:@"originator"]) {
       annotators.emplace_back(std::make_unique<santa::santad::process_tree::OriginatorAnnotator>());
+    } else if ([[annotation lowercaseString] isEqualToString:@"lineage"]) {
+      NSUInteger depth = [configurator processAnnotationLineageDepth];
+      annotators.emplace_back(std::make_unique<santa::santad::process_tree::LineageAnnotator>(
+        depth > 0 ? depth : santa::santad::process_tree::LineageAnnotator::kDefaultDepth));
     } else {
       LOGW(@"Unrecognized process annotation %@", annotation);
     }
   }
 
-  auto tree_status = santa::santad::process_tree::CreateTree(std::move(annotators));
+  // Reuse annotations persisted by a previous instance of the daemon, if any.
+  std::optional<santa::pb::v1::process_tree::Snapshot> snapshot;
+  if (!annotators.empty()) {
+    auto snapshot_status =
+      santa::santad::process_tree::LoadSnapshot(santa::santad::process_tree::kSnapshotPath);
+    if (snapshot_status.ok()) {
+      snapshot = std::move(*snapshot_status);
+    } else if (absl::IsFailedPrecondition(snapshot_status.status())) {
+      LOGI(@"Discarded process tree snapshot: %@",
+           @(snapshot_status.status().ToString().c_str()));
+    } else if (!absl::IsNotFound(snapshot_status.status())) {
+      LOGW(@"Unable to load process tree snapshot: %@",
+           @(snapshot_status.status().ToString().c_str()));
+    }
+  }
+
+  NSUInteger max_processes = [configurator processTreeMaxProcesses];
+  auto tree_status = santa::santad::process_tree::CreateTree(
+    std::move(annotators), snapshot,
+    max_processes > 0 ? max_processes
+                      : santa::santad::process_tree::ProcessTree::kDefaultMaxProcesses);
   if (!tree_status.ok()) {
     LOGE(@"Failed to create process tree: %@", @(tree_status.status().ToString().c_str()));
     exit(EXIT_FAILURE);